@@ -28,7 +28,7 @@
 #include "ELModule.h"
 #include "ELConfig.h"
 #include "ELOutput.h"
-#include "ELRealtime.h"
+#include "ELRealTime.h"
 #include "ELString.h"
 
 struct SOutputEntry
@@ -45,7 +45,7 @@ MModuleImplementation_Finish(CModule_SysMsgCmdHandler)
 CModule_SysMsgCmdHandler::CModule_SysMsgCmdHandler(
 	)
 	:
-	CModule()
+	CModule(0, 0, NULL, eUpdateTime_SignalOnly)
 {
 	msgBufferIndex = 0;
 
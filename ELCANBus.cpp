@@ -62,7 +62,7 @@ CANIDFromComponents(
 CModule_CANBus::CModule_CANBus(
 	)
 	:
-	CModule(0, 0, NULL, 100),
+	CModule(0, 0, NULL, 100, true, eModulePriority_RealTime),	// Outgoing msgs signal the module but nothing signals it when a msg arrives so it still has to poll the receive fifo
 	canBus(0)
 {
 	gCANBusModule = this;
@@ -146,6 +146,7 @@ CModule_CANBus::SendMsg(
 		memcpy(msg.buf, inMsgData, inMsgSize);
 
 	sendFIFO[sendFIFOPendingNext++ % eCANBus_SendBufferSize] = msg;
+	Signal();
 }
 
 void
@@ -214,6 +215,8 @@ CModule_CANBus::SendString(
 		msg.len = msgLen;
 		sendFIFO[sendFIFOPendingNext++ % eCANBus_SendBufferSize] = msg;
 	}
+
+	Signal();
 }
 
 void
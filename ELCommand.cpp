@@ -42,9 +42,10 @@ MModuleImplementation_Finish(CModule_SerialCmdHandler)
 CModule_SerialCmdHandler::CModule_SerialCmdHandler(
 	)
 	:
-	CModule(0, 0, NULL, 100000)
+	CModule(0, 0, NULL, eUpdateTime_SignalOnly)
 {
 	curIndex = 0;
+	SignalOnInput(&Serial);
 }
 
 void
@@ -88,12 +89,12 @@ CModule_SerialCmdHandler::Update(
 }
 
 MModuleImplementation_Start(CModule_Command)
-MModuleImplementation_FinishGlobal(CModule_Command, gCommandModule)
+MModuleImplementation_FinishStaticGlobal(CModule_Command, gCommandModule)
 
 CModule_Command::CModule_Command(
 	)
 	:
-	CModule()
+	CModule(0, 0, NULL, eUpdateTime_SignalOnly)
 {
 	handlerCount = 0;
 	memset(commandList, 0, sizeof(commandList));
@@ -154,7 +155,9 @@ CModule_Command::ProcessCommand(
 		if(strcmp(commandList[itr].name, inArgV[0]) == 0)
 		{
 			cmdFound = true;
+			LoopMonitorHandlerStart(commandList[itr].name);
 			result = (commandList[itr].handler->*commandList[itr].method)(inOutput, inArgC, inArgV);
+			LoopMonitorHandlerEnd();
 			break;
 		}
 	}
@@ -62,6 +62,7 @@ typedef uint8_t
 	int					inArgC,
 	char const*			inArgV[]);
 
+// Commands typed into the serial port are processed on the pass of the module loop after they arrive, the module is not updated otherwise
 class CModule_SerialCmdHandler : public CModule
 {
 public:
@@ -32,12 +32,12 @@
 CModule_Config*	gConfigModule;
 
 MModuleImplementation_Start(CModule_Config)
-MModuleImplementation_FinishGlobal(CModule_Config, gConfigModule);
+MModuleImplementation_FinishStaticGlobal(CModule_Config, gConfigModule);
 
 CModule_Config::CModule_Config(
 	)
 	:
-	CModule(sizeof(configVars), 1, configVars)
+	CModule(sizeof(configVars), 1, configVars, eUpdateTime_SignalOnly)
 {
 	memset(configVars, 0, sizeof(configVars));
 	memset(configVarUsed, 0, sizeof(configVarUsed));
@@ -68,6 +68,7 @@ CModule_Config::GetVal(
 {
 	MAssert(eepromOffset > 0);
 	MAssert(inVar < eConfigVar_Max);
+	EEPROMLoadIfNeeded();
 	return configVars[inVar].value;
 }
 
@@ -78,6 +79,7 @@ CModule_Config::SetVal(
 {
 	MAssert(eepromOffset > 0);
 	MAssert(inVar < eConfigVar_Max);
+	EEPROMLoadIfNeeded();
 	configVars[inVar].value = inVal;
 	EEPROMSave();
 }
@@ -135,6 +137,7 @@ CModule_Config::RegisterConfigVar(
 {
 	MReturnOnError(strlen(inName) > eConfigVar_MaxNameLength, -1);
 	MAssert(eepromOffset > 0);
+	EEPROMLoadIfNeeded();	// Other modules register their vars from their own Setup() which may come before ours
 
 	int	targetIndex = -1;
 	for(int i = 0; i < eConfigVar_Max; ++i)
@@ -49,7 +49,7 @@ MModuleImplementation_FinishGlobal(CModule_DigitalIO, gDigitalIOModule)
 CModule_DigitalIO::CModule_DigitalIO(
 	)
 	:
-	CModule(0, 0, NULL, eUpdateTimeUS)
+	CModule(0, 0, NULL, eUpdateTimeUS, true, eModulePriority_RealTime)
 {
 	memset(pinState, 0, sizeof(pinState));
 }
@@ -863,7 +863,7 @@ MModuleImplementation_FinishGlobal(CModule_Display, gDisplayModule)
 CModule_Display::CModule_Display(
 	)
 	:
-	CModule(0, 0, NULL, 20000)
+	CModule(0, 0, NULL, 20000, true, eModulePriority_Background)
 {
 	displayDriver = NULL;
 	touchDriver = NULL;
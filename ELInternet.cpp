@@ -36,6 +36,7 @@
 #include <ELCommand.h>
 
 CModule_Internet*	gInternetModule;
+CInternetPacketPool	gInternetPacketPool;
 
 static char const*	gReplyStringPreOutput = 
 	"HTTP/1.1 200 OK\r\n"
@@ -47,6 +48,87 @@ static char const*	gReplyStringPreOutput =
 	;
 static char const*	gReplyStringPostOutput = "</code></body></html>";
 	
+CInternetPacketPool::CInternetPacketPool(
+	)
+{
+	freeList = NULL;
+	for(int i = 0; i < eInternetPacketPoolCount; ++i)
+	{
+		packetList[i].refCount = 0;
+		packetList[i].next = freeList;
+		freeList = packetList + i;
+	}
+}
+
+SInternetPacket*
+CInternetPacketPool::Allocate(
+	void)
+{
+	SInternetPacket*	result = freeList;
+
+	if(result != NULL)
+	{
+		freeList = result->next;
+		result->next = NULL;
+		result->remoteAddress = 0;
+		result->remotePort = 0;
+		result->size = 0;
+		result->refCount = 1;
+	}
+
+	return result;
+}
+
+void
+CInternetPacketPool::Retain(
+	SInternetPacket*	inPacket)
+{
+	MReturnOnError(inPacket == NULL || inPacket->refCount == 0);
+	++inPacket->refCount;
+}
+
+void
+CInternetPacketPool::Release(
+	SInternetPacket*	inPacket)
+{
+	MReturnOnError(inPacket == NULL || inPacket->refCount == 0);
+
+	if(--inPacket->refCount == 0)
+	{
+		inPacket->next = freeList;
+		freeList = inPacket;
+	}
+}
+
+SInternetPacket*
+CInternetPacketPool::FindPacket(
+	char const*	inData)
+{
+	for(int i = 0; i < eInternetPacketPoolCount; ++i)
+	{
+		if(inData >= packetList[i].data && inData < packetList[i].data + sizeof(packetList[i].data))
+		{
+			return packetList + i;
+		}
+	}
+
+	return NULL;
+}
+
+int
+CInternetPacketPool::GetFreeCount(
+	void)
+{
+	int	result = 0;
+
+	for(SInternetPacket* curPacket = freeList; curPacket != NULL; curPacket = curPacket->next)
+	{
+		++result;
+	}
+
+	return result;
+}
+
 CHTTPConnection::CHTTPConnection(
 	char const*							inServer,
 	uint16_t							inPort,
@@ -76,14 +158,14 @@ CHTTPConnection::~CHTTPConnection(
 	}
 }
 
-void
+bool
 CHTTPConnection::StartRequest(
 	char const*	inVerb,
 	char const*	inURL,
 	int			inParameterCount,
 	...)
 {
-	MReturnOnError(responseState != eResponseState_None);
+	MReturnOnError(responseState != eResponseState_None, false);
 
 	TString<256> buffer;
 
@@ -125,17 +207,17 @@ CHTTPConnection::StartRequest(
 		buffer.SetF("%s %s HTTP/1.1\r\n", inVerb, inURL);
 	}
 
-	SendData(buffer, false);
+	return SendData(buffer, false);
 }
 
-void
+bool
 CHTTPConnection::SetHeaders(
 	int	inHeaderCount,
 	...)
 {
 	TString<256> buffer;
 
-	MReturnOnError(responseState != eResponseState_None);
+	MReturnOnError(responseState != eResponseState_None, false);
 
 	va_list	valist;
 
@@ -151,52 +233,55 @@ CHTTPConnection::SetHeaders(
 
 	va_end(valist);
 
-	SendData(buffer, false);
+	return SendData(buffer, false);
 }
 
-void
+bool
 CHTTPConnection::CompleteRequest(
 	char const*	inBody)
 {
-	MReturnOnError(responseState != eResponseState_None);
+	MReturnOnError(responseState != eResponseState_None, false);
 
 	size_t	bodyLen = strlen(inBody);
 	char blBuffer[32];
+	bool	result;
 
 	// Add the Content-Length header
 	if(bodyLen > 0)
 	{
-		SetHeaders(4, "Content-Length", _itoa((int)bodyLen, blBuffer, 10), "User-Agent", "EmbeddedLibrary", "Host", (char*)serverAddress, "Accept", "*/*"); 
+		result = SetHeaders(4, "Content-Length", _itoa((int)bodyLen, blBuffer, 10), "User-Agent", "EmbeddedLibrary", "Host", (char*)serverAddress, "Accept", "*/*"); 
 	}
 	else if(isPost)
 	{
-		SetHeaders(4, "Content-Length", _itoa((int)parameterBuffer.GetLength(), blBuffer, 10), "User-Agent", "EmbeddedLibrary", "Host", (char*)serverAddress, "Accept", "*/*"); 
+		result = SetHeaders(4, "Content-Length", _itoa((int)parameterBuffer.GetLength(), blBuffer, 10), "User-Agent", "EmbeddedLibrary", "Host", (char*)serverAddress, "Accept", "*/*"); 
 	}
 	else
 	{
-		SetHeaders(3, "User-Agent", "EmbeddedLibrary", "Host", (char*)serverAddress, "Accept", "*/*"); 
+		result = SetHeaders(3, "User-Agent", "EmbeddedLibrary", "Host", (char*)serverAddress, "Accept", "*/*"); 
 	}
 		
 	// Add a blank line
-	SendData("\r\n", false);
+	result = SendData("\r\n", false) && result;
 
 	if(bodyLen > 0)
 	{
 		// Send the body
-		SendData(inBody, true);
+		result = SendData(inBody, true) && result;
 	}
 	else if(isPost)
 	{
-		SendData(parameterBuffer, true);
+		result = SendData(parameterBuffer, true) && result;
 	}
 	else
 	{
-		SendData("", true);
+		result = SendData("", true) && result;
 	}
 
 	responseContentSize = 0;
 	responseState = eResponseState_HTTP;
 	responseHTTPCode = 0;
+
+	return result;
 }
 
 void
@@ -236,18 +321,16 @@ CHTTPConnection::ResponseHandlerMethod(
 		case eConnectionResponse_Opened:
 			openInProgress = false;
 			localPort = inLocalPort;
-			if(tempBuffer.GetLength() > 0)
+			if(!SendTempBuffer())
 			{
-				if(gInternetModule->TCPSendData(localPort, tempBuffer.GetLength(), tempBuffer, flushPending))
-				{
-					tempBuffer.Clear();
-					flushPending = false;
-					dataSentTimeMS = millis();
-				}
-				else
-				{
-					ReopenConnection();
-				}
+				ReopenConnection();
+			}
+			break;
+
+		case eConnectionResponse_SendReady:
+			if(!SendTempBuffer())
+			{
+				ReopenConnection();
 			}
 			break;
 
@@ -286,33 +369,78 @@ CHTTPConnection::ResponseHandlerMethod(
 	}
 }
 
-void
+bool
 CHTTPConnection::SendData(
 	char const*	inData,
 	bool		inFlush)
 {
+	size_t	dataSize = strlen(inData);
+
 	dataSentTimeMS = millis();
-	if(localPort != eInvalidPort)
+	if(localPort != eInvalidPort && tempBuffer.GetLength() == 0)
 	{
-		if(gInternetModule->TCPSendData(localPort, strlen(inData), inData, inFlush) == false)
+		size_t	bytesSent;
+
+		if(!gInternetModule->TCPSendData(localPort, dataSize, inData, bytesSent, inFlush))
 		{
 			ReopenConnection();
-			tempBuffer = inData;
-			flushPending |= inFlush;
+			bytesSent = 0;
 		}
-	}
-	else
-	{
-		if(!openInProgress)
+
+		if(bytesSent == dataSize)
 		{
-			// Start an open request
-			MInternetOpenConnection(serverPort, serverAddress, CHTTPConnection::ResponseHandlerMethod);
-			openInProgress = true;
+			return true;
 		}
 
-		tempBuffer.Append(inData);
-		flushPending |= inFlush;
+		// The rest goes out on eConnectionResponse_SendReady or once the connection has reopened
+		inData += bytesSent;
+		dataSize -= bytesSent;
 	}
+	else if(localPort == eInvalidPort && !openInProgress)
+	{
+		// Start an open request
+		MInternetOpenConnection(serverPort, serverAddress, CHTTPConnection::ResponseHandlerMethod);
+		openInProgress = true;
+	}
+
+	// Earlier data may still be waiting on the port so this has to go after it, what does not fit is refused instead of being cut off
+	if(tempBuffer.GetLength() + dataSize >= eHTTPTempBufferSize)
+	{
+		SystemMsg("HTTP: ERROR: Temp buffer full, refusing %d bytes", (int)dataSize);
+		return false;
+	}
+
+	tempBuffer.Append(inData);
+	flushPending |= inFlush;
+
+	return true;
+}
+
+bool
+CHTTPConnection::SendTempBuffer(
+	void)
+{
+	if(tempBuffer.GetLength() == 0)
+	{
+		return true;
+	}
+
+	size_t	bytesSent;
+
+	if(!gInternetModule->TCPSendData(localPort, tempBuffer.GetLength(), tempBuffer, bytesSent, flushPending))
+	{
+		return false;
+	}
+
+	TString<eHTTPTempBufferSize>	remaining((char*)tempBuffer + bytesSent);
+	tempBuffer = remaining;
+	if(tempBuffer.GetLength() == 0)
+	{
+		flushPending = false;
+	}
+	dataSentTimeMS = millis();
+
+	return true;
 }
 
 void
@@ -472,6 +600,16 @@ CModule_Internet::CModule_Internet(
 		curUDP->localPort = eInvalidPort;
 	}
 
+	SReplyOutput*	curReply = replyOutputList;
+	for(int i = 0; i < eMaxConnectionsCount; ++i, ++curReply)
+	{
+		curReply->replyPort = eInvalidPort;
+		curReply->headOffset = 0;
+		curReply->head = NULL;
+		curReply->tail = NULL;
+		curReply->closeWhenSent = false;
+	}
+
 	CModule_RealTime::Include();
 }
 
@@ -573,6 +711,7 @@ CModule_Internet::TCPOpenConnection(
 	target->serverPort = inServerPort;
 	target->serverAddress = inServerAddress;
 	target->localPort = eInvalidPort;
+	target->sendBlocked = false;
 }
 
 bool
@@ -580,6 +719,7 @@ CModule_Internet::TCPSendData(
 	uint16_t						inLocalPort,
 	size_t							inDataSize,
 	char const*						inData,
+	size_t&							outBytesQueued,
 	bool							inFlush)
 {
 	STCPConnection*	target = NULL;
@@ -593,14 +733,17 @@ CModule_Internet::TCPSendData(
 		}
 	}
 
+	outBytesQueued = 0;
 	MReturnOnError(target == NULL || target->openRef > 0, false);
 
-	if(internetDevice->TCPSendData(inLocalPort, inDataSize, inData, inFlush) == false)
+	if(!internetDevice->TCPSendData(inLocalPort, inDataSize, inData, outBytesQueued, inFlush))
 	{
 		TCPCloseConnection(inLocalPort);
 		return false;
 	}
 
+	target->sendBlocked = outBytesQueued < inDataSize;
+
 	return true;
 }
 
@@ -845,8 +988,9 @@ CModule_Internet::Update(
 		}
 	}
 
-	size_t	bufferSize;
-	char*	buffer;
+	SInternetPacket*	packet;
+
+	UpdateReplyOutput();
 
 	// Update the current TCP connections
 	curTCPConnection = tcpConnectionList;
@@ -904,6 +1048,11 @@ CModule_Internet::Update(
 				TCPCloseConnection(curTCPConnection->localPort);
 			}
 		}
+		else if(curTCPConnection->sendBlocked && (portState & ePortState_CanSendData))
+		{
+			curTCPConnection->sendBlocked = false;
+			(curTCPConnection->handlerObject->*curTCPConnection->handlerResponseMethod)(eConnectionResponse_SendReady, curTCPConnection->localPort, 0, NULL);
+		}
 	}
 
 	// Get any incoming UDP packets
@@ -927,15 +1076,16 @@ CModule_Internet::Update(
 			continue;
 		}
 
-		uint32_t	remoteAddress;
-		uint16_t	remotePort;
-
-		if(internetDevice->UDPGetData(curUDPConnection->deviceConnection, remoteAddress, remotePort, bufferSize, buffer))
+		if(internetDevice->UDPGetData(curUDPConnection->deviceConnection, packet))
 		{
+			uint32_t	remoteAddress = packet->remoteAddress;
+
 			curUDPConnection->timeoutSecs = 0;
-			curUDPConnection->remotePort = remotePort;
+			curUDPConnection->remotePort = packet->remotePort;
 			curUDPConnection->remoteAddress.SetF("%d.%d.%d.%d", (remoteAddress >> 24) & 0xFF, (remoteAddress >> 16) & 0xFF, (remoteAddress >> 8) & 0xFF, (remoteAddress >> 0) & 0xFF);
-			(curUDPConnection->handlerObject->*curUDPConnection->handlerMethod)(eConnectionResponse_Data, curUDPConnection->localPort, remotePort, remoteAddress, bufferSize, buffer);
+			(curUDPConnection->handlerObject->*curUDPConnection->handlerMethod)(eConnectionResponse_Data, curUDPConnection->localPort, packet->remotePort, remoteAddress, packet->size, packet->data);
+			gInternetPacketPool.Release(packet);
+			Signal();	// More packets may be queued behind this one
 		}
 
 		if(curUDPConnection->timeoutSecs > 0 && (gRealTime->GetEpochTime(true) - curUDPConnection->sendStartTime) > curUDPConnection->timeoutSecs)
@@ -949,12 +1099,15 @@ CModule_Internet::Update(
 	// Check for incoming data
 	uint16_t	localPort;
 	uint16_t	replyPort;
-	internetDevice->TCPGetData(localPort, replyPort, bufferSize, buffer);
+	internetDevice->TCPGetData(localPort, replyPort, packet);
 
-	if(bufferSize == 0)
+	if(packet == NULL)
 	{
 		return;
 	}
+
+	char*	buffer = packet->data;
+	size_t	bufferSize = packet->size;
 	
 	if(webServerPort > 0 && localPort == webServerPort)
 	{
@@ -986,7 +1139,7 @@ CModule_Internet::Update(
 
 			TransformURLIntoParameters(paramCount, paramList, pageName, url, strlen(url));
 
-			internetDevice->TCPSendData(replyPort, strlen(gReplyStringPreOutput), gReplyStringPreOutput);
+			ReplySendData(replyPort, strlen(gReplyStringPreOutput), gReplyStringPreOutput);
 
 			respondingServer = true;
 			respondingServerPort = webServerPort;
@@ -1000,8 +1153,8 @@ CModule_Internet::Update(
 				}
 			}
 
-			internetDevice->TCPSendData(replyPort, strlen(gReplyStringPostOutput), gReplyStringPostOutput);
-			internetDevice->TCPCloseConnection(replyPort);
+			ReplySendData(replyPort, strlen(gReplyStringPostOutput), gReplyStringPostOutput);
+			ReplyFinish(replyPort);
 		}
 		else
 		{
@@ -1023,7 +1176,7 @@ CModule_Internet::Update(
 				respondingServerPort = curServer->port;
 				respondingReplyPort = replyPort;
 				(curServer->handlerObject->*curServer->handlerMethod)(this, (int)bufferSize, buffer);
-				internetDevice->TCPCloseConnection(replyPort);
+				ReplyFinish(replyPort);
 				dataProcessed = true;
 				break;
 			}
@@ -1043,6 +1196,9 @@ CModule_Internet::Update(
 			}
 		}
 	}
+
+	gInternetPacketPool.Release(packet);
+	Signal();	// More packets may be queued behind this one
 }
 
 void
@@ -1074,14 +1230,15 @@ CModule_Internet::write(
 				++csp;
 			}
 
+			// Page output can not wait for the port so it is coalesced until the port can take it
 			if(respondingServer)
 			{
-				if(internetDevice->TCPSendData(respondingReplyPort, lineEnd - lineStart, lineStart) == false)
+				if(!ReplySendData(respondingReplyPort, lineEnd - lineStart, lineStart))
 				{
 					return;
 				}
 
-				if(internetDevice->TCPSendData(respondingReplyPort, 5, "</br>") == false)
+				if(!ReplySendData(respondingReplyPort, 5, "</br>"))
 				{
 					return;
 				}
@@ -1095,7 +1252,7 @@ CModule_Internet::write(
 	{
 		if(respondingServer)
 		{
-			if(internetDevice->TCPSendData(respondingReplyPort, cep - lineStart, lineStart) == false)
+			if(!ReplySendData(respondingReplyPort, cep - lineStart, lineStart))
 			{
 				return;
 			}
@@ -1103,6 +1260,187 @@ CModule_Internet::write(
 	}
 }
 
+bool
+CModule_Internet::ReplySendData(
+	uint16_t	inReplyPort,
+	size_t		inDataSize,
+	char const*	inData)
+{
+	SReplyOutput*	output = FindReplyOutput(inReplyPort, false);
+
+	if(output == NULL)
+	{
+		// Nothing is held for this port so the device gets the data first
+		size_t	bytesSent;
+		if(!internetDevice->TCPSendData(inReplyPort, inDataSize, inData, bytesSent))
+		{
+			return false;
+		}
+
+		inData += bytesSent;
+		inDataSize -= bytesSent;
+
+		if(inDataSize == 0)
+		{
+			return true;
+		}
+
+		output = FindReplyOutput(inReplyPort, true);
+		MReturnOnError(output == NULL, false);
+	}
+
+	while(inDataSize > 0)
+	{
+		if(output->tail == NULL || output->tail->size >= eMaxOutgoingPacketSize)
+		{
+			// The pool is shared with the device's receive side so a long reply is cut short rather than starving it
+			SInternetPacket*	newPacket = gInternetPacketPool.GetFreeCount() > eInternetReceiveReservePackets ? gInternetPacketPool.Allocate() : NULL;
+			if(newPacket == NULL)
+			{
+				SystemMsg("Internet: ERROR: No free packet, dropping reply output on port %d", inReplyPort);
+				return false;
+			}
+
+			if(output->tail != NULL)
+			{
+				output->tail->next = newPacket;
+			}
+			else
+			{
+				output->head = newPacket;
+			}
+			output->tail = newPacket;
+		}
+
+		size_t	bytesToCopy = MMin(inDataSize, (size_t)(eMaxOutgoingPacketSize - output->tail->size));
+		memcpy(output->tail->data + output->tail->size, inData, bytesToCopy);
+		output->tail->size += (uint16_t)bytesToCopy;
+		inData += bytesToCopy;
+		inDataSize -= bytesToCopy;
+	}
+
+	return true;
+}
+
+void
+CModule_Internet::ReplyFinish(
+	uint16_t	inReplyPort)
+{
+	SReplyOutput*	output = FindReplyOutput(inReplyPort, false);
+
+	if(output == NULL)
+	{
+		internetDevice->TCPCloseConnection(inReplyPort);
+		return;
+	}
+
+	output->closeWhenSent = true;
+}
+
+void
+CModule_Internet::UpdateReplyOutput(
+	void)
+{
+	SReplyOutput*	curOutput = replyOutputList;
+	for(int i = 0; i < eMaxConnectionsCount; ++i, ++curOutput)
+	{
+		if(curOutput->replyPort == eInvalidPort)
+		{
+			continue;
+		}
+
+		uint32_t	portState = internetDevice->TCPGetPortState(curOutput->replyPort);
+		if(!(portState & ePortState_IsOpen) || (portState & ePortState_Failure))
+		{
+			// The remote end has gone away so the rest of the reply has nowhere to go
+			ReleaseReplyOutput(curOutput);
+			continue;
+		}
+
+		while(curOutput->head != NULL)
+		{
+			SInternetPacket*	curPacket = curOutput->head;
+			size_t				bytesLeft = curPacket->size - curOutput->headOffset;
+			size_t				bytesSent;
+
+			if(!internetDevice->TCPSendData(curOutput->replyPort, bytesLeft, curPacket->data + curOutput->headOffset, bytesSent))
+			{
+				break;
+			}
+
+			curOutput->headOffset += bytesSent;
+			if(bytesSent < bytesLeft)
+			{
+				break;
+			}
+
+			curOutput->head = curPacket->next;
+			if(curOutput->head == NULL)
+			{
+				curOutput->tail = NULL;
+			}
+			curOutput->headOffset = 0;
+			gInternetPacketPool.Release(curPacket);
+		}
+
+		if(curOutput->head == NULL)
+		{
+			// Everything has gone to the device so later output can go straight to it
+			if(curOutput->closeWhenSent)
+			{
+				internetDevice->TCPCloseConnection(curOutput->replyPort);
+			}
+			ReleaseReplyOutput(curOutput);
+		}
+	}
+}
+
+CModule_Internet::SReplyOutput*
+CModule_Internet::FindReplyOutput(
+	uint16_t	inReplyPort,
+	bool		inCreate)
+{
+	SReplyOutput*	freeOutput = NULL;
+	SReplyOutput*	curOutput = replyOutputList;
+	for(int i = 0; i < eMaxConnectionsCount; ++i, ++curOutput)
+	{
+		if(curOutput->replyPort == inReplyPort)
+		{
+			return curOutput;
+		}
+
+		if(freeOutput == NULL && curOutput->replyPort == eInvalidPort)
+		{
+			freeOutput = curOutput;
+		}
+	}
+
+	if(inCreate && freeOutput != NULL)
+	{
+		freeOutput->replyPort = inReplyPort;
+		return freeOutput;
+	}
+
+	return NULL;
+}
+
+void
+CModule_Internet::ReleaseReplyOutput(
+	SReplyOutput*	inOutput)
+{
+	while(inOutput->head != NULL)
+	{
+		SInternetPacket*	curPacket = inOutput->head;
+		inOutput->head = curPacket->next;
+		gInternetPacketPool.Release(curPacket);
+	}
+
+	inOutput->replyPort = eInvalidPort;
+	inOutput->headOffset = 0;
+	inOutput->tail = NULL;
+	inOutput->closeWhenSent = false;
+}
+
 uint8_t
 CModule_Internet::SerialCmd_WirelessSet(
 	IOutputDirector*	inOutput,
@@ -38,6 +38,20 @@
 #include <ELString.h>
 #include <ELRealTime.h>
 
+// The pool sizes can be changed with a compiler flag such as -DMInternetPacketPoolCount=8 so the library sources see the same value
+#ifndef MInternetPacketPoolCount
+#define MInternetPacketPoolCount 4
+#endif
+
+// One connection can queue this many incoming packets, the default leaves a packet in the pool for the other connections
+#ifndef MInternetMaxChannelPackets
+#define MInternetMaxChannelPackets (MInternetPacketPoolCount - 1)
+#endif
+
+#if MInternetMaxChannelPackets < 1 || MInternetMaxChannelPackets > MInternetPacketPoolCount
+#error MInternetMaxChannelPackets must be between 1 and MInternetPacketPoolCount
+#endif
+
 enum
 {
 	eMaxServersCount = 4,
@@ -53,6 +67,10 @@ enum
 	eMaxIncomingPacketSize = 1460,
 	eMaxOutgoingPacketSize = 1400,
 
+	eInternetPacketPoolCount = MInternetPacketPoolCount,		// The incoming packet buffers shared by every connection
+	eInternetMaxChannelPackets = MInternetMaxChannelPackets,	// The most incoming packets one connection holds before its data is dropped
+	eInternetReceiveReservePackets = 1,							// Server reply output never takes the last pool packets so incoming data always has one
+
 	eLocalPortBase = 40000,
 	eLocalPortCount = 16,
 
@@ -75,6 +93,7 @@ enum EConnectionResponse
 	eConnectionResponse_Closed,
 	eConnectionResponse_Data,
 	eConnectionResponse_Error,
+	eConnectionResponse_SendReady,	// The port can take more data after a TCPSendData() that queued less than it was given
 };
 
 // Utility macro for registering a response handler when opening a connection to a server
@@ -129,6 +148,55 @@ typedef void
 	char const*			inData);
 
 
+// An incoming packet from the shared pool, it is handed from the device to the handlers without being copied
+struct SInternetPacket
+{
+	SInternetPacket*	next;		// Links the packet into the free list or a device's incoming queue
+	uint32_t			remoteAddress;
+	uint16_t			remotePort;
+	uint16_t			size;
+	uint8_t				refCount;
+	char				data[eMaxIncomingPacketSize + 1];	// Zero terminated after size bytes for string processing
+};
+
+class CInternetPacketPool
+{
+public:
+
+	CInternetPacketPool(
+		);
+
+	// Returns NULL if every packet is in use, the caller holds the only reference to the packet
+	SInternetPacket*
+	Allocate(
+		void);
+
+	void
+	Retain(
+		SInternetPacket*	inPacket);
+
+	// The packet goes back to the pool when its last reference is released
+	void
+	Release(
+		SInternetPacket*	inPacket);
+
+	// Returns the packet holding inData or NULL if inData is not in the pool, this lets a handler keep the data it was passed by retaining its packet
+	SInternetPacket*
+	FindPacket(
+		char const*	inData);
+
+	int
+	GetFreeCount(
+		void);
+
+private:
+
+	SInternetPacket		packetList[eInternetPacketPoolCount];
+	SInternetPacket*	freeList;
+};
+
+extern CInternetPacketPool	gInternetPacketPool;
+
 class IInternetDevice
 {
 public:
@@ -169,20 +237,20 @@ public:
 		bool&		outSuccess,
 		uint16_t&	outPort) = 0;
 
-	// Do a non blocking check for data arriving on a previously opened port
+	// Do a non blocking check for data arriving on a previously opened port, the caller takes over the reference to the packet and must release it
 	virtual void
 	TCPGetData(
-		uint16_t&	outPort,			// The previously open port that data was found on
-		uint16_t&	outReplyPort,		// The port to send response data with
-		size_t&		ioBufferSize,		// The size of the provided buffer in bytes on input and the bytes received on output
-		char*&		outBuffer) = 0;		// A pointer to the buffer
+		uint16_t&			outPort,		// The previously open port that data was found on
+		uint16_t&			outReplyPort,	// The port to send response data with
+		SInternetPacket*&	outPacket) = 0;	// The packet or NULL if there is no data
 
-	// Send data on the previously opened port
+	// Queue data to send on the previously opened port without waiting, returns false if the port has failed
 	virtual bool
 	TCPSendData(
 		uint16_t	inPort,				// The open port
 		size_t		inBufferSize,		// The number of bytes on the buffer
 		char const*	inBuffer,			// The data to send
+		size_t&		outBytesQueued,		// The bytes queued, less than inBufferSize when the port's outgoing queue is full
 		bool		inFlush = false) = 0;
 	
 	// Check if the given port is ready to send data
@@ -207,14 +275,11 @@ public:
 	UDPChannelReady(
 		int			inChannel) = 0;			// The channel from UDPOpenChannel
 
-	// Check for a udp packet
+	// Check for a udp packet, the caller takes over the reference to the packet and must release it
 	virtual bool
 	UDPGetData(
-		int			inChannel,			// The channel from UDPOpenChannel
-		uint32_t&	outRemoteAddress,
-		uint16_t&	outRemotePort,
-		size_t&		ioBufferSize,		// The size of the provided buffer in bytes on input and the bytes received on output
-		char*&		outBuffer) = 0;		// A pointer to the buffer
+		int					inChannel,		// The channel from UDPOpenChannel
+		SInternetPacket*&	outPacket) = 0;
 
 	virtual bool
 	UDPSendData(
@@ -273,12 +338,13 @@ public:
 		IInternetHandler*			inHandlerObject,			// The object of the handlers
 		TTCPResponseHandlerMethod	inHandlerMethod);			// The response handler
 	
-	// The OpenConnection completion method must have been called before calling SendData
+	// The OpenConnection completion method must have been called before calling SendData, after a short outBytesQueued the handler gets eConnectionResponse_SendReady when it can send again
 	bool
 	TCPSendData(
 		uint16_t	inLocalPort,
 		size_t		inDataSize,
 		char const*	inData,
+		size_t&		outBytesQueued,
 		bool		inFlush);
 
 	void
@@ -380,6 +446,23 @@ private:
 		char const* inMsg,
 		size_t		inBytes);
 
+	// Server reply output is never made to wait, what the port can not take yet is coalesced into pool packets of up to eMaxOutgoingPacketSize bytes, the last eInternetReceiveReservePackets are left for incoming data, returns false if the output was dropped
+	bool
+	ReplySendData(
+		uint16_t	inReplyPort,
+		size_t		inDataSize,
+		char const*	inData);
+
+	// Close the reply port once all of its output has gone to the device, the close flushes the device's queue
+	void
+	ReplyFinish(
+		uint16_t	inReplyPort);
+
+	// Feed the coalesced reply output to the ports as they drain
+	void
+	UpdateReplyOutput(
+		void);
+
 	void
 	CommandHomePageHandler(
 		IOutputDirector*	inOutput,
@@ -414,6 +497,7 @@ private:
 		TString<eServerMaxAddressLength>	serverAddress;
 		IInternetHandler*					handlerObject;
 		TTCPResponseHandlerMethod			handlerResponseMethod;
+		bool								sendBlocked;	// The last send was short so the handler is waiting on eConnectionResponse_SendReady
 	};
 
 	struct SUDPConnection
@@ -429,6 +513,24 @@ private:
 		TUDPPacketHandlerMethod				handlerMethod;
 	};
 
+	struct SReplyOutput
+	{
+		uint16_t			replyPort;		// eInvalidPort if this is not in use
+		uint16_t			headOffset;		// The bytes at the start of head that have already gone to the device
+		SInternetPacket*	head;
+		SInternetPacket*	tail;
+		bool				closeWhenSent;
+	};
+
+	SReplyOutput*
+	FindReplyOutput(
+		uint16_t	inReplyPort,
+		bool		inCreate);
+
+	void
+	ReleaseReplyOutput(
+		SReplyOutput*	inOutput);
+
 	struct SWebServerPageHandler
 	{
 		char const*					pageName;
@@ -450,6 +552,7 @@ private:
 	SServer				serverList[eMaxServersCount];
 	STCPConnection		tcpConnectionList[eMaxConnectionsCount];
 	SUDPConnection		udpConnectionList[eMaxConnectionsCount];
+	SReplyOutput		replyOutputList[eMaxConnectionsCount];
 
 	SSettings	settings;
 
@@ -46,35 +46,154 @@
 #define MESPDebugMsg(inMsg, ...)
 #endif
 
+// Responses from the device
+enum
+{
+	eResponse_Unknown = 0,
+	eResponse_Ready,
+	eResponse_OK,
+	eResponse_Recv,
+	eResponse_SendOK,
+	eResponse_Connect,
+	eResponse_Closed,
+	eResponse_WifiConnected,
+	eResponse_WifiDisconnect,
+	eResponse_WifiGotIP,
+	eResponse_ConnectFail,
+	eResponse_Error,
+	eResponse_SendFail,
+	eResponse_Unlink,
+
+	eMatch_Exact = 0,	// The line is the text
+	eMatch_Prefix,		// The line starts with the text followed by more chars
+	eMatch_Link,		// The line is a link digit followed by the text
+};
+
+struct SResponseToken
+{
+	char const*	text;
+	uint8_t		length;
+	uint8_t		match;
+	uint8_t		response;
+	bool		inIPD;		// The firmware has been seen sending this in place of the tail of an ipd
+};
+
+#define MResponseToken(inText, inMatch, inResponse, inInIPD) {inText, sizeof(inText) - 1, inMatch, inResponse, inInIPD}
+
+static SResponseToken const	gResponseTable[] =
+{
+	MResponseToken("ready", eMatch_Exact, eResponse_Ready, false),
+	MResponseToken("OK", eMatch_Exact, eResponse_OK, false),
+	MResponseToken("Recv ", eMatch_Prefix, eResponse_Recv, true),
+	MResponseToken("SEND OK", eMatch_Exact, eResponse_SendOK, true),
+	MResponseToken(",CONNECT", eMatch_Link, eResponse_Connect, true),
+	MResponseToken(",CLOSED", eMatch_Link, eResponse_Closed, true),
+	MResponseToken("WIFI CONNECTED", eMatch_Exact, eResponse_WifiConnected, true),
+	MResponseToken("WIFI DISCONNECT", eMatch_Exact, eResponse_WifiDisconnect, true),
+	MResponseToken("WIFI GOT IP", eMatch_Exact, eResponse_WifiGotIP, true),
+	MResponseToken(",CONNECT FAIL", eMatch_Link, eResponse_ConnectFail, true),
+	MResponseToken("ERROR", eMatch_Exact, eResponse_Error, false),
+	MResponseToken("SEND FAIL", eMatch_Exact, eResponse_SendFail, true),
+	MResponseToken("UNLINK", eMatch_Exact, eResponse_Unlink, true),
+};
+
+enum
+{
+	eMaxResponseLength = 32,	// Longer than any line in gResponseTable
+};
+
+// Returns eResponse_Unknown if the line is not in gResponseTable, if inIPDOnly is true only the responses that can cut off an ipd are matched
+static uint8_t
+ClassifyResponse(
+	char const*	inLine,
+	size_t		inLength,
+	bool		inIPDOnly,
+	int&		outLinkIndex)
+{
+	SResponseToken const*	curToken = gResponseTable;
+
+	outLinkIndex = -1;
+
+	for(size_t i = 0; i < MStaticArrayLength(gResponseTable); ++i, ++curToken)
+	{
+		if(inIPDOnly && !curToken->inIPD)
+		{
+			continue;
+		}
+
+		switch(curToken->match)
+		{
+			case eMatch_Exact:
+				if(inLength == curToken->length && memcmp(inLine, curToken->text, inLength) == 0)
+				{
+					return curToken->response;
+				}
+				break;
+
+			case eMatch_Prefix:
+				if(inLength > curToken->length && memcmp(inLine, curToken->text, curToken->length) == 0)
+				{
+					return curToken->response;
+				}
+				break;
+
+			case eMatch_Link:
+				if(inLength == curToken->length + 1U && isdigit(inLine[0]) && memcmp(inLine + 1, curToken->text, curToken->length) == 0)
+				{
+					outLinkIndex = inLine[0] - '0';
+					return curToken->response;
+				}
+				break;
+		}
+	}
+
+	return eResponse_Unknown;
+}
+
 MModuleImplementation_Start(CModule_ESP8266,
 	HardwareSerial*	inSerialPort,
 	uint8_t			inRstPin,
 	uint8_t			inChPDPin,
 	uint8_t			inGPIO0,
-	uint8_t			inGPIO2)
-MModuleImplementation_Finish(CModule_ESP8266, inSerialPort, inRstPin, inChPDPin, inGPIO0, inGPIO2)
+	uint8_t			inGPIO2,
+	uint32_t		inBaudRate,
+	uint8_t			inRTSPin,
+	uint8_t			inCTSPin)
+MModuleImplementation_Finish(CModule_ESP8266, inSerialPort, inRstPin, inChPDPin, inGPIO0, inGPIO2, inBaudRate, inRTSPin, inCTSPin)
 
 CModule_ESP8266::CModule_ESP8266(
 	HardwareSerial*	inSerialPort,
 	uint8_t			inRstPin,
 	uint8_t			inChPDPin,
 	uint8_t			inGPIO0,
-	uint8_t			inGPIO2)
+	uint8_t			inGPIO2,
+	uint32_t		inBaudRate,
+	uint8_t			inRTSPin,
+	uint8_t			inCTSPin)
 	:
-	CModule(0, 0, NULL, 1000, true),
+	CModule(0, 0, NULL, eSendCoalesceTimeMS * 1000 / 2, true),	// Serial input signals the module so this period only needs to keep up with the send coalescing and the timeouts
 	serialPort(inSerialPort),
 	rstPin(inRstPin),
 	chPDPin(inChPDPin),
 	gpio0Pin(inGPIO0),
 	gpio2Pin(inGPIO2),
+	rtsPin(inRTSPin),
+	ctsPin(inCTSPin),
+	baudRate(inBaudRate),
 	commandHead(0),
 	commandTail(0),
 	serverPort(0),
+	serverCommandPort(0),
+	serverCommandOpen(false),
+	setupStep(eSetupStep_Done),
 	simpleCommandInProcess(false),
 	ipdInProcess(false),
 	ipdTotalBytes(0),
 	ipdCurByte(0),
 	ipdCurChannel(NULL),
+	ipdCurPacket(NULL),
+	ipdHeaderFieldIndex(0),
+	ipdScanIndex(0),
 	sendState(eSendState_None),
 	lastSerialInputTimeMS(0),
 	ssid(NULL),
@@ -87,16 +206,21 @@ CModule_ESP8266::CModule_ESP8266(
 	gotReady(false),
 	gotCR(false),
 	deviceIsHorked(false),
-	attemptingConnection(false)
+	attemptingConnection(false),
+	uartSwitchPending(false)
 {
 	//logDebugData = true;
 	memset(commandQueue, 0, sizeof(commandQueue));
+	memset(ipdHeaderFields, 0, sizeof(ipdHeaderFields));
 	for(int i = 0; i < eChannelCount; ++i)
 	{
 		channelArray[i].channelIndex = i;
 	}
 
-	MAssert(inSerialPort->availableForWrite() > 1000);	// Ensure that the serial port transmit and receive buffers are at least 1024 bytes each
+	if(inSerialPort != NULL)
+	{
+		SignalOnInput(inSerialPort);
+	}
 }
 
 void
@@ -104,7 +228,15 @@ CModule_ESP8266::Setup(
 	void)
 {
 	MReturnOnError(serialPort == NULL);
-	serialPort->begin(115200);
+	serialPort->begin(eDefaultBaudRate);
+	uartSwitchPending = false;
+
+	#if MESP8266SerialBuffers
+	serialPort->addMemoryForRead(serialRxBuffer, sizeof(serialRxBuffer));
+	serialPort->addMemoryForWrite(serialTxBuffer, sizeof(serialTxBuffer));
+	#endif
+
+	MAssert(serialPort->availableForWrite() > 1000);	// Ensure that the serial port transmit and receive buffers are at least 1024 bytes each, older cores need serial1.c patched for this
 
 	connectionStatusEvent = MRealTimeCreateEvent("ESP8266 CnctSts", CModule_ESP8266::CheckConnectionStatus, NULL);
 	gRealTime->ScheduleEvent(connectionStatusEvent, 10 * 1000000, false);
@@ -136,33 +268,10 @@ CModule_ESP8266::Setup(
 		digitalWriteFast(gpio2Pin, 1);
 	}
 
-	IssueCommand("ready", NULL, 2 * 60 * 1000);
-	IssueCommand("ATE0", NULL, eSimpleCommandTimeoutMS);
-	IssueCommand("AT+CWMODE_CUR=1", NULL, eSimpleCommandTimeoutMS);
-	IssueCommand("AT+CIPMUX=1", NULL, eSimpleCommandTimeoutMS);
-	IssueCommand("AT+CIPDINFO=1", NULL, eSimpleCommandTimeoutMS);
+	setupStep = eSetupStep_Ready;
+	IssueSetupCommands();
 
 	InitiateConnectionAttempt();
-
-	if(ipAddr != 0)
-	{
-		IssueCommand("AT+CIPSTA_CUR=\"%d.%d.%d.%d\",\"%d.%d.%d.%d\",\"%d.%d.%d.%d\"", 
-			NULL, 
-			eCommandTimeoutMS, 
-			(ipAddr >> 24) & 0xFF,
-			(ipAddr >> 16) & 0xFF,
-			(ipAddr >> 8) & 0xFF,
-			(ipAddr >> 0) & 0xFF,
-			(gatewayAddr >> 24) & 0xFF,
-			(gatewayAddr >> 16) & 0xFF,
-			(gatewayAddr >> 8) & 0xFF,
-			(gatewayAddr >> 0) & 0xFF,
-			(subnetAddr >> 24) & 0xFF,
-			(subnetAddr >> 16) & 0xFF,
-			(subnetAddr >> 8) & 0xFF,
-			(subnetAddr >> 0) & 0xFF
-			);
-	}
 }
 
 void
@@ -201,8 +310,7 @@ CModule_ESP8266::ProcessPendingCommand(
 		else
 		{
 			DumpChannelState(targetChannel, "Not issuing send data cmd", true);
-			targetChannel->outgoingTotalBytes = 0;
-			targetChannel->sendPending = false;
+			targetChannel->ClearOutgoing();
 			++commandTail;
 		}
 	}
@@ -300,68 +408,40 @@ CModule_ESP8266::ProcessSerialChar(
 
 	if(ipdInProcess)
 	{
-		// We are processing an IDP command
-		if(ipdTotalBytes > 0)
+		// We are processing the ipd header "link,length,a.b.c.d,port:" one field at a time, the data after the ':' goes through CollectIPDData()
+		if(inChar >= '0' && inChar <= '9')
+		{
+			ipdHeaderFields[ipdHeaderFieldIndex] = ipdHeaderFields[ipdHeaderFieldIndex] * 10 + (inChar - '0');
+		}
+		else if(inChar == ',' || inChar == '.')
 		{
-			// We are collecting incoming data from the IPD command
-			if(ipdCurChannel != NULL && ipdCurByte < (int)sizeof(ipdCurChannel->incomingBuffer))
+			if(ipdHeaderFieldIndex < eIPDField_Count - 1)
 			{
-				ipdCurChannel->incomingBuffer[ipdCurByte] = inChar;
-			}
-			++ipdCurByte;	// increment this here because we still need to terminate the ipd even if we did not meet the above conditions for storing the char
-
-			if(ipdCurByte >= ipdTotalBytes)
-			{
-				// we have all the ipd data now so stop collecting, hold on to the data until it is collected from the GetData() method
-
-				#if 0
-				Serial.printf("+++start+++\n");
-				for(size_t i = 0; i < (size_t)ipdTotalBytes; ++i)
-				{
-					uint8_t c = (uint8_t)ipdCurChannel->incomingBuffer[i];
-					if(c >= 32 && c < 0x7F && isprint(c))
-					{
-						Serial.write(c);
-					}
-					else
-					{
-						Serial.printf("\\x%02x", c);
-					}
-				}
-				Serial.printf("\n+++end+++\n");
-				#endif
-
-				if(ipdCurChannel != NULL)
-				{
-					ipdCurChannel->incomingTotalBytes = ipdTotalBytes;
-					DumpChannelState(ipdCurChannel, "Finished ipd", false);
-					ipdCurChannel = NULL;
-				}
-				else
-				{
-					SystemMsg("ESP8266: ERROR: Finished ipd but no channel");
-				}
-
-				ipdTotalBytes = 0;
-				ipdCurByte = 0;
-				ipdInProcess = false;
+				++ipdHeaderFieldIndex;
 			}
 		}
 		else if(inChar == ':')
 		{
 			// we are done processing the IPD command
+			int	ipdCurLinkIndex = ipdHeaderFields[eIPDField_Link];
 
-			int	ipdCurLinkIndex;
-			int	ip0, ip1, ip2, ip3;
-			int	remotePort;
-			sscanf((char*)serialInputBuffer, "%d,%d,%d.%d.%d.%d,%d", &ipdCurLinkIndex, &ipdTotalBytes, &ip0, &ip1, &ip2, &ip3, &remotePort);
-
+			ipdTotalBytes = ipdHeaderFields[eIPDField_Length];
 			ipdCurChannel = FindChannel(ipdCurLinkIndex);
 			if(ipdCurChannel != NULL)
 			{
-				MESPDebugMsg("Collecting ipd chn=%d lnk=%d totalbytes=%d ip=%d.%d.%d.%d port=%d\n", ipdCurChannel->channelIndex, ipdCurLinkIndex, ipdTotalBytes, ip0, ip1, ip2, ip3, remotePort);
-				ipdCurChannel->remoteAddress = ((ip0 & 0xFF) << 24) | ((ip1 & 0xFF) << 16) | ((ip2 & 0xFF) << 8) | ((ip3 & 0xFF) << 0);
-				ipdCurChannel->remotePort = remotePort;
+				MESPDebugMsg("Collecting ipd chn=%d lnk=%d totalbytes=%d ip=%d.%d.%d.%d port=%d\n", ipdCurChannel->channelIndex, ipdCurLinkIndex, ipdTotalBytes, ipdHeaderFields[eIPDField_IP0], ipdHeaderFields[eIPDField_IP1], ipdHeaderFields[eIPDField_IP2], ipdHeaderFields[eIPDField_IP3], ipdHeaderFields[eIPDField_Port]);
+
+				// The data goes straight into a pool packet that is later handed up to the handler, a channel that is not collecting its packets can not take the whole pool
+				ipdCurPacket = ipdCurChannel->CountIncoming() < eInternetMaxChannelPackets ? gInternetPacketPool.Allocate() : NULL;
+				if(ipdCurPacket != NULL)
+				{
+					ipdCurPacket->remoteAddress = ((ipdHeaderFields[eIPDField_IP0] & 0xFF) << 24) | ((ipdHeaderFields[eIPDField_IP1] & 0xFF) << 16) | ((ipdHeaderFields[eIPDField_IP2] & 0xFF) << 8) | ((ipdHeaderFields[eIPDField_IP3] & 0xFF) << 0);
+					ipdCurPacket->remotePort = ipdHeaderFields[eIPDField_Port];
+				}
+				else
+				{
+					SystemMsg("ESP8266: ERROR: No free packet for ipd lnk=%d inq=%d, dropping %d bytes\n", ipdCurLinkIndex, ipdCurChannel->CountIncoming(), ipdTotalBytes);
+				}
 			}
 			else
 			{
@@ -370,70 +450,151 @@ CModule_ESP8266::ProcessSerialChar(
 			}
 
 			ipdCurByte = 0;
-			serialInputBuffer.Clear();
-		}
-		else
-		{
-			// Continue collecting the ipd command chars
-			serialInputBuffer.Append(inChar);
+			ipdScanIndex = 0;
+
+			if(ipdTotalBytes == 0)
+			{
+				FinishIPD();
+			}
 		}
 	}
-	else
+	else if(sendState == eSendState_WaitingOnReady && inChar == '>')
 	{
-		if(sendState == eSendState_WaitingOnReady && inChar == '>')
+		// We are ready to send the outgoing buffer
+		SPendingCommand*	curCommand = GetCurrentCommand();
+		SChannel*			targetChannel = curCommand->targetChannel;
+		MAssert(targetChannel != NULL);
+		if(targetChannel->linkIndex >= 0)
 		{
-			// We are ready to send the outgoing buffer
-			SPendingCommand*	curCommand = GetCurrentCommand();
-			SChannel*			targetChannel = curCommand->targetChannel;
-			MAssert(targetChannel != NULL);
-			if(targetChannel->linkIndex >= 0)
-			{
-				DumpChannelState(targetChannel, "Sending data", false);
-
-				#if 0
-				Serial.printf("???start???\n");
-				Serial.write((uint8_t*)targetChannel->outgoingBuffer, targetChannel->outgoingTotalBytes);
-				Serial.printf("\n???end???\n");
-				#endif
+			DumpChannelState(targetChannel, "Sending data", false);
 
-				serialPort->write((uint8_t*)targetChannel->outgoingBuffer, targetChannel->outgoingTotalBytes);
-			}
-			else
+			// The bytes being sent may wrap around the end of the ring
+			size_t	firstBytes = MMin((size_t)targetChannel->sendingBytes, sizeof(targetChannel->outgoingBuffer) - targetChannel->outgoingHead);
+			serialPort->write((uint8_t*)targetChannel->outgoingBuffer + targetChannel->outgoingHead, firstBytes);
+			if(firstBytes < targetChannel->sendingBytes)
 			{
-				DumpChannelState(targetChannel, "Can't send data, no link", true);
-				// the connection was closed so just send a 0 to terminate the send
-				serialPort->write((uint8_t)0);
+				serialPort->write((uint8_t*)targetChannel->outgoingBuffer, targetChannel->sendingBytes - firstBytes);
 			}
-			serialPort->flush();
+		}
+		else
+		{
+			DumpChannelState(targetChannel, "Can't send data, no link", true);
+			// the connection was closed so just send a 0 to terminate the send
+			serialPort->write((uint8_t)0);
+		}
+		serialPort->flush();
 
-			// Command queue tail is advanced after SEND OK has been received
-			sendState = eSendState_WaitingOnRecv;
-			serialInputBuffer.Clear();
+		// Command queue tail is advanced after SEND OK has been received
+		sendState = eSendState_WaitingOnRecv;
+		serialInputBuffer.Clear();
+	}
+	// keep collecting input
+	else if(inChar == '\r')
+	{
+		// got a command, process it
+		if(serialInputBuffer.GetLength() > 0 && !serialInputBuffer.IsSpace())
+		{
+			ProcessInputResponse();
 		}
-		// keep collecting input
-		else if(inChar == '\r')
+		serialInputBuffer.Clear();
+
+		gotCR = true;
+	}
+	else if(inChar > 0 && isprint(inChar))
+	{
+		serialInputBuffer.Append(inChar);
+		if(serialInputBuffer.GetLength() == 5 && gotReady && memcmp((char*)serialInputBuffer, "+IPD,", 5) == 0)
 		{
-			// got a command, process it
-			if(serialInputBuffer.GetLength() > 0 && !serialInputBuffer.IsSpace())
-			{
-				ProcessInputResponse();
-			}
+			// We are receiving an IPD command so start special parsing
+			ipdInProcess = true;
+			ipdTotalBytes = 0;
+			ipdCurByte = 0;
+			ipdCurChannel = NULL;
+			ipdHeaderFieldIndex = 0;
+			memset(ipdHeaderFields, 0, sizeof(ipdHeaderFields));
 			serialInputBuffer.Clear();
+		}
+	}
+}
+
+size_t
+CModule_ESP8266::CollectIPDData(
+	char const*	inData,
+	size_t		inSize)
+{
+	// Take as much of the ipd data as this chunk holds in one go
+	size_t	dataBytes = MMin(inSize, (size_t)(ipdTotalBytes - ipdCurByte));
+
+	if(ipdCurPacket != NULL && ipdCurByte < eMaxIncomingPacketSize)
+	{
+		memcpy(ipdCurPacket->data + ipdCurByte, inData, MMin(dataBytes, (size_t)(eMaxIncomingPacketSize - ipdCurByte)));
+	}
+	ipdCurByte += dataBytes;	// increment this even if the data was not stored because we still need to terminate the ipd
 
-			gotCR = true;
+	if(ipdCurByte >= ipdTotalBytes)
+	{
+		FinishIPD();
+	}
+
+	return dataBytes;
+}
+
+void
+CModule_ESP8266::FinishIPD(
+	void)
+{
+	// we have all the ipd data now so stop collecting, queue the packet on the channel until it is collected from the GetData() method
+	if(ipdCurChannel != NULL)
+	{
+		if(ipdCurPacket != NULL)
+		{
+			ipdCurPacket->size = MMin(ipdTotalBytes, (int)eMaxIncomingPacketSize);
+			ipdCurPacket->data[ipdCurPacket->size] = 0;
+			ipdCurChannel->QueueIncoming(ipdCurPacket);
+			ipdCurPacket = NULL;
+		}
+		DumpChannelState(ipdCurChannel, "Finished ipd", false);
+	}
+	else
+	{
+		SystemMsg("ESP8266: ERROR: Finished ipd but no channel");
+	}
+
+	ResetIPD();
+}
+
+void
+CModule_ESP8266::ResetIPD(
+	void)
+{
+	ipdInProcess = false;
+	ipdTotalBytes = 0;
+	ipdCurByte = 0;
+	ipdCurChannel = NULL;
+
+	if(ipdCurPacket != NULL)
+	{
+		gInternetPacketPool.Release(ipdCurPacket);
+		ipdCurPacket = NULL;
+	}
+}
+
+void
+CModule_ESP8266::ProcessSerialData(
+	char const*	inData,
+	size_t		inSize)
+{
+	size_t	curIndex = 0;
+
+	while(curIndex < inSize)
+	{
+		if(ipdInProcess && ipdTotalBytes > 0)
+		{
+			curIndex += CollectIPDData(inData + curIndex, inSize - curIndex);
 		}
-		else if(inChar > 0 && isprint(inChar))
+		else
 		{
-			serialInputBuffer.Append(inChar);
-			if(serialInputBuffer == "+IPD," && gotReady)
-			{
-				// We are receiving an IPD command so start special parsing
-				ipdInProcess = true;
-				ipdTotalBytes = 0;
-				ipdCurByte = 0;
-				ipdCurChannel = NULL;
-				serialInputBuffer.Clear();
-			}
+			ProcessSerialChar(inData[curIndex++]);
 		}
 	}
 }
@@ -450,6 +611,12 @@ CModule_ESP8266::ProcessSerialInput(
 		return;	// no input to process
 	}
 
+	if(bytesAvailable >= sizeof(tmpBuffer))
+	{
+		// There is more input than we can take this pass so come back for the rest right away
+		Signal();
+	}
+
 	bytesAvailable = MMin(bytesAvailable, sizeof(tmpBuffer) - 1);
 	serialPort->readBytes(tmpBuffer, bytesAvailable);
 
@@ -471,10 +638,7 @@ CModule_ESP8266::ProcessSerialInput(
 	Serial.printf("\n***end***\n");
 	#endif
 
-	for(size_t i = 0; i < bytesAvailable; ++i)
-	{
-		ProcessSerialChar(tmpBuffer[i]);
-	}
+	ProcessSerialData(tmpBuffer, bytesAvailable);
 
 	lastSerialInputTimeMS = millis();
 
@@ -498,7 +662,10 @@ CModule_ESP8266::ProcessInputResponse(
 {
 	MESPDebugMsg("Received: \"%s\"\n", (char*)serialInputBuffer); 
 
-	if(serialInputBuffer == "ready")
+	int		linkIndex;
+	uint8_t	response = ClassifyResponse((char*)serialInputBuffer, serialInputBuffer.GetLength(), false, linkIndex);
+
+	if(response == eResponse_Ready)
 	{
 		// got the initial ready message
 
@@ -519,170 +686,181 @@ CModule_ESP8266::ProcessInputResponse(
 		return;
 	}
 	
-	if(serialInputBuffer == "OK")
+	switch(response)
 	{
-		// Command completed successfully
-		if(simpleCommandInProcess)
+		case eResponse_OK:
+			// Command completed successfully
+			if(simpleCommandInProcess)
+			{
+				SPendingCommand*	curCommand = GetCurrentCommand();
+				MAssert(curCommand != NULL);
+
+				if(curCommand->command.StartsWith("AT+CWJAP"))
+				{
+					attemptingConnection = false;
+				}
+				else if(curCommand->command.StartsWith("AT+UART_CUR"))
+				{
+					SwitchUART();
+				}
+				else if(uartSwitchPending)
+				{
+					MESPDebugMsg("UART confirmed at %lu baud\n", (unsigned long)baudRate);
+					uartSwitchPending = false;
+				}
+
+				++commandTail;
+				simpleCommandInProcess = false;
+			}
+			break;
+
+		case eResponse_Recv:
 		{
+			long	recvSize = strtol((char*)serialInputBuffer + 5, NULL, 10);
+
 			SPendingCommand*	curCommand = GetCurrentCommand();
-			MAssert(curCommand != NULL);
+			SChannel*			targetChannel = curCommand->targetChannel;
 
-			if(curCommand->command.StartsWith("AT+CWJAP"))
+			if(sendState == eSendState_None)
 			{
-				attemptingConnection = false;
+				SystemMsg("ESP8266: ERROR: Got Recv with no send pending");
 			}
-
-			++commandTail;
-			simpleCommandInProcess = false;
+			else if(sendState != eSendState_WaitingOnRecv)
+			{
+				SystemMsg("ESP8266: ERROR: Got Recv out of order");
+			}
+			else if(recvSize != targetChannel->sendingBytes)
+			{
+				SystemMsg("ESP8266: ERROR: Got wrong recv size got %d expecting %d", recvSize, targetChannel->sendingBytes);
+			}
+			sendState = eSendState_WaitingOnSendOK;
+			break;
 		}
-	}
-	else if(serialInputBuffer.StartsWith("Recv "))
-	{
-		long	recvSize = strtol((char*)serialInputBuffer + 5, NULL, 10);
 
-		SPendingCommand*	curCommand = GetCurrentCommand();
-		SChannel*			targetChannel = curCommand->targetChannel;
+		case eResponse_SendOK:
+			// Send completed successfully
+			ProcessSendOkAck();
+			break;
 
-		if(sendState == eSendState_None)
-		{
-			SystemMsg("ESP8266: ERROR: Got Recv with no send pending");
-		}
-		else if(sendState != eSendState_WaitingOnRecv)
-		{
-			SystemMsg("ESP8266: ERROR: Got Recv out of order");
-		}
-		else if(recvSize != targetChannel->outgoingTotalBytes)
-		{
-			SystemMsg("ESP8266: ERROR: Got wrong recv size got %d expecting %d", recvSize, targetChannel->outgoingTotalBytes);
-		}
-		sendState = eSendState_WaitingOnSendOK;
-	}
-	else if(serialInputBuffer == "SEND OK")
-	{
-		// Send completed successfully
-		ProcessSendOkAck();
-	}
-	else if(serialInputBuffer.Contains(",CONNECT"))
-	{
-		char*		startStr = strstr((char*)serialInputBuffer, ",CONNECT");
-		int			linkIndex = startStr[-1] - '0';
-		SChannel*	targetChannel = FindChannel(linkIndex);
-		
-		if(targetChannel == NULL)
+		case eResponse_Connect:
 		{
-			targetChannel = FindAvailableChannel();
-			if(targetChannel != NULL)
+			SChannel*	targetChannel = FindChannel(linkIndex);
+			
+			if(targetChannel == NULL)
 			{
-				targetChannel->ServerConnection(linkIndex);
-				DumpChannelState(targetChannel, "Incoming Server Connect", false);
+				targetChannel = FindAvailableChannel();
+				if(targetChannel != NULL)
+				{
+					targetChannel->ServerConnection(linkIndex);
+					DumpChannelState(targetChannel, "Incoming Server Connect", false);
+				}
+				else
+				{
+					// we need to close the connection immediately since there are no available channels to accept the connection request
+					// This will generated an unexpected close event but it will get ignored
+					 MESPDebugMsg("Refusing connect attempt on link %d\n", linkIndex);
+					serialPort->printf("AT+CIPCLOSE=%d", linkIndex);
+					serialPort->flush();
+				}
 			}
 			else
 			{
-				// we need to close the connection immediately since there are no available channels to accept the connection request
-				// This will generated an unexpected close event but it will get ignored
-				 MESPDebugMsg("Refusing connect attempt on link %d\n", linkIndex);
-				serialPort->printf("AT+CIPCLOSE=%d", linkIndex);
-				serialPort->flush();
-			}
-		}
-		else
-		{
-			DumpChannelState(targetChannel, "Incoming Client Connect", false);
-			switch(targetChannel->state)
-			{
-				case eChannelState_Server:
-				case eChannelState_ClientConnected:
-					// this is a duplicate connect
-					SystemMsg("ESP8266: Ignoring duplicate connect");
-					break;
-
-				case eChannelState_ClientStart:
-					targetChannel->ClientConnected(linkIndex);
-					break;
-
-				default:
-					SystemMsg("ESP8266: Invalid channel state on connect state=%d", targetChannel->state);
-					break;
+				DumpChannelState(targetChannel, "Incoming Client Connect", false);
+				switch(targetChannel->state)
+				{
+					case eChannelState_Server:
+					case eChannelState_ClientConnected:
+						// this is a duplicate connect
+						SystemMsg("ESP8266: Ignoring duplicate connect");
+						break;
+
+					case eChannelState_ClientStart:
+						targetChannel->ClientConnected(linkIndex);
+						break;
+
+					default:
+						SystemMsg("ESP8266: Invalid channel state on connect state=%d", targetChannel->state);
+						break;
+				}
 			}
+			
+			#if MESPDebug
+			if(logDebugData) DumpState("CONNECT");
+			#endif
+			break;
 		}
-		
-		#if MESPDebug
-		if(logDebugData) DumpState("CONNECT");
-		#endif
-	}
-	else if(serialInputBuffer.Contains(",CLOSED"))
-	{
-		char*		startStr = strstr((char*)serialInputBuffer, ",CLOSED");
-		int			linkIndex = startStr[-1] - '0';
-		SChannel*	targetChannel = FindChannel(linkIndex);
 
-		if(targetChannel)
+		case eResponse_Closed:
 		{
-			DumpChannelState(targetChannel, "Received Closed", false);
+			SChannel*	targetChannel = FindChannel(linkIndex);
 
-			if(targetChannel->sendPending)
+			if(targetChannel)
 			{
-				SystemMsg("ESP8266: ERROR: Received close while channel send is pending");
-				
-				// Check to see if this pending send has been submitted
-				if(sendState != eSendState_None)
+				DumpChannelState(targetChannel, "Received Closed", false);
+
+				if(targetChannel->sendPending)
 				{
-					SPendingCommand*	sendCommand = GetCurrentCommand();
-					if(sendCommand->targetChannel == targetChannel)
+					SystemMsg("ESP8266: ERROR: Received close while channel send is pending");
+					
+					// Check to see if this pending send has been submitted
+					if(sendState != eSendState_None)
 					{
-						SystemMsg("ESP8266: ERROR: Received close while actively sending");
-						sendState = eSendState_None;
-						++commandTail;
+						SPendingCommand*	sendCommand = GetCurrentCommand();
+						if(sendCommand->targetChannel == targetChannel)
+						{
+							SystemMsg("ESP8266: ERROR: Received close while actively sending");
+							sendState = eSendState_None;
+							++commandTail;
+						}
 					}
 				}
+
+				targetChannel->Reset();
+				ClearOutPendingCommandsForChannel(targetChannel);	// Since this channel is now closed clear out any pending sends
+			}
+			else
+			{
+				MESPDebugMsg("Received closed with no channel lnk=%d\n", linkIndex);
 			}
 
-			targetChannel->Reset();
-			ClearOutPendingCommandsForChannel(targetChannel);	// Since this channel is now closed clear out any pending sends
-		}
-		else
-		{
-			MESPDebugMsg("Received closed with no channel lnk=%d\n", linkIndex);
+			#if MESPDebug
+			if(logDebugData) DumpState("CLOSED");
+			#endif
+			break;
 		}
 
-		#if MESPDebug
-		if(logDebugData) DumpState("CLOSED");
-		#endif
-	}
-	else if(serialInputBuffer == "WIFI CONNECTED")
-	{
-		wifiConnected = true;
-	}
-	else if(serialInputBuffer == "WIFI DISCONNECT")
-	{
-		wifiConnected = false;
-	}
-	else if(serialInputBuffer == "WIFI GOT IP")
-	{
-		gotIP = true;
-	}
-	else if(serialInputBuffer.Contains(",CONNECT FAIL"))
-	{
-		char*	startStr = strstr((char*)serialInputBuffer, ",CONNECT FAIL");
-		int		linkIndex = startStr[-1] - '0';
-		ProcessError(eErrorType_ConnectFailed, linkIndex);
-	}
-	else if(serialInputBuffer == "ERROR")
-	{
-		ProcessError(eErrorType_ERROR);
-	}
-	else if(serialInputBuffer == "SEND FAIL")
-	{
-		ProcessError(eErrorType_SendFail);
-	}
-	else if(serialInputBuffer == "UNLINK")
-	{
-		// The device has done thermonuclear on us, return the favor
-		deviceIsHorked = true;
-	}
-	else if(serialInputBuffer.GetLength() > 0)
-	{
-		MESPDebugMsg("  COMMAND NOT RECOGNIZED\n"); 
+		case eResponse_WifiConnected:
+			wifiConnected = true;
+			break;
+
+		case eResponse_WifiDisconnect:
+			wifiConnected = false;
+			break;
+
+		case eResponse_WifiGotIP:
+			gotIP = true;
+			break;
+
+		case eResponse_ConnectFail:
+			ProcessError(eErrorType_ConnectFailed, linkIndex);
+			break;
+
+		case eResponse_Error:
+			ProcessError(eErrorType_ERROR);
+			break;
+
+		case eResponse_SendFail:
+			ProcessError(eErrorType_SendFail);
+			break;
+
+		case eResponse_Unlink:
+			// The device has done thermonuclear on us, return the favor
+			deviceIsHorked = true;
+			break;
+
+		default:
+			MESPDebugMsg("  COMMAND NOT RECOGNIZED\n"); 
+			break;
 	}
 }
 
@@ -731,7 +909,8 @@ CModule_ESP8266::ProcessTimeouts(
 				if(curChannel->linkIndex >= 0)
 				{
 					curChannel->state = eChannelState_ClosePending;
-					IssueCommand("AT+CIPCLOSE=%d", curChannel, eCommandTimeoutMS, curChannel->linkIndex);
+					curChannel->closeRequested = true;
+					IssuePendingClose(curChannel);
 				}
 				else
 				{
@@ -751,6 +930,33 @@ CModule_ESP8266::Update(
 		return;
 	}
 
+	// Retry the commands that could not get into the command queue earlier
+	if(setupStep != eSetupStep_Done)
+	{
+		IssueSetupCommands();
+	}
+
+	IssueServerCommand();
+
+	// Retry the sends and closes that could not get into the command queue earlier and send the queued bytes that nobody flushed
+	SChannel*	curChannel = channelArray;
+	for(int i = 0; i < eChannelCount; ++i, ++curChannel)
+	{
+		if(curChannel->linkIndex < 0)
+		{
+			continue;
+		}
+
+		if(!curChannel->sendPending && curChannel->outgoingTotalBytes > 0
+			&& (curChannel->state == eChannelState_Server || curChannel->state == eChannelState_ClientConnected || curChannel->state == eChannelState_ClosePending)
+			&& (curChannel->flushRequested || millis() - curChannel->queuedTimeMS >= eSendCoalesceTimeMS))
+		{
+			TCPTransmitPendingData(curChannel);
+		}
+
+		IssuePendingClose(curChannel);
+	}
+
 	ProcessPendingCommand();
 	ProcessSerialInput();
 	ProcessTimeouts();
@@ -762,6 +968,7 @@ CModule_ESP8266::DumpDebugInfo(
 {
 	inOutput->printf("wifiConnected=%d\n", wifiConnected);
 	inOutput->printf("gotIP=%d\n", gotIP);
+	inOutput->printf("freePackets=%d\n", gInternetPacketPool.GetFreeCount());
 	DumpState("DumpDebugInfo", inOutput);
 }
 
@@ -799,22 +1006,12 @@ CModule_ESP8266::SetIPAddr(
 
 	if(HasBeenSetup())
 	{
-		IssueCommand("AT+CIPSTA_CUR=\"%d.%d.%d.%d\",\"%d.%d.%d.%d\",\"%d.%d.%d.%d\"", 
-			NULL, 
-			eCommandTimeoutMS, 
-			(ipAddr >> 24) & 0xFF,
-			(ipAddr >> 16) & 0xFF,
-			(ipAddr >> 8) & 0xFF,
-			(ipAddr >> 0) & 0xFF,
-			(gatewayAddr >> 24) & 0xFF,
-			(gatewayAddr >> 16) & 0xFF,
-			(gatewayAddr >> 8) & 0xFF,
-			(gatewayAddr >> 0) & 0xFF,
-			(subnetAddr >> 24) & 0xFF,
-			(subnetAddr >> 16) & 0xFF,
-			(subnetAddr >> 8) & 0xFF,
-			(subnetAddr >> 0) & 0xFF
-			);
+		// Only the address command is left to queue once the others have been
+		if(setupStep == eSetupStep_Done)
+		{
+			setupStep = eSetupStep_IPAddr;
+		}
+		IssueSetupCommands();
 	}
 }
 
@@ -830,7 +1027,9 @@ CModule_ESP8266::Server_Open(
 	MReturnOnError(serverPort != 0, false);
 
 	serverPort = inServerPort;
-	IssueCommand("AT+CIPSERVER=1,%d", NULL, eCommandTimeoutMS, inServerPort);
+	serverCommandPort = inServerPort;
+	serverCommandOpen = true;
+	IssueServerCommand();
 	return true;
 }
 
@@ -844,7 +1043,9 @@ CModule_ESP8266::Server_Close(
 	}
 
 	serverPort = 0;
-	IssueCommand("AT+CIPSERVER=0,%d", NULL, eCommandTimeoutMS, inServerPort);
+	serverCommandPort = inServerPort;
+	serverCommandOpen = false;
+	IssueServerCommand();
 }
 
 int
@@ -865,7 +1066,13 @@ CModule_ESP8266::TCPRequestOpen(
 
 	targetChannel->ClientStart(true);
 
-	IssueCommand("AT+CIPSTART=0,\"TCP\",\"%s\",%d", targetChannel, eCommandTimeoutMS, inRemoteServerAddress, inRemoteServerPort);
+	if(!IssueCommand("AT+CIPSTART=0,\"TCP\",\"%s\",%d", targetChannel, eCommandTimeoutMS, inRemoteServerAddress, inRemoteServerPort))
+	{
+		// The caller reports the failed open rather than waiting out eClientOpenTimeoutMS on a start that was never sent
+		SystemMsg("ESP8266: ERROR: Command queue full, failing tcp open on chn=%d\n", targetChannel->channelIndex);
+		targetChannel->Reset();
+		return -1;
+	}
 
 	return targetChannel->channelIndex;
 }
@@ -924,13 +1131,11 @@ CModule_ESP8266::TCPCheckOpenCompleted(
 
 void
 CModule_ESP8266::TCPGetData(
-	uint16_t&	outPort,
-	uint16_t&	outReplyPort,	
-	size_t&		ioBufferSize,		
-	char*&		outBuffer)
+	uint16_t&			outPort,
+	uint16_t&			outReplyPort,	
+	SInternetPacket*&	outPacket)
 {
-	ioBufferSize = 0;
-	outBuffer = NULL;
+	outPacket = NULL;
 
 	if(deviceIsHorked)
 	{
@@ -940,16 +1145,13 @@ CModule_ESP8266::TCPGetData(
 	SChannel*	curChannel = channelArray;
 	for(int i = 0; i < eChannelCount; ++i, ++curChannel)
 	{
-		//MESPDebugMsg("chn=%d inuse=%d lnk=%d bytes=%d", i, curChannel->inUse, curChannel->linkIndex, curChannel->incomingTotalBytes);
-		if((curChannel->state == eChannelState_ClientConnected || curChannel->state == eChannelState_Server) && curChannel->incomingTotalBytes > 0)
+		if((curChannel->state == eChannelState_ClientConnected || curChannel->state == eChannelState_Server) && curChannel->incomingHead != NULL)
 		{
 			DumpChannelState(curChannel, "Got Data", false);
 
-			ioBufferSize = curChannel->incomingTotalBytes;
-			outBuffer = curChannel->incomingBuffer;
+			outPacket = curChannel->DequeueIncoming();
 			outReplyPort = i;
 			outPort = curChannel->state == eChannelState_Server ? serverPort : i;
-			curChannel->incomingTotalBytes = 0;
 			return;
 		}
 	}
@@ -960,8 +1162,10 @@ CModule_ESP8266::TCPSendData(
 	uint16_t	inPort,	
 	size_t		inBufferSize,
 	char const*	inBuffer,
+	size_t&		outBytesQueued,
 	bool		inFlush)
 {
+	outBytesQueued = 0;
 	MReturnOnError(inPort >= eChannelCount, false);
 
 	if(deviceIsHorked)
@@ -974,31 +1178,30 @@ CModule_ESP8266::TCPSendData(
 	MReturnOnError(targetChannel->linkIndex < 0, false);
 	MReturnOnError(targetChannel->state != eChannelState_Server && targetChannel->state != eChannelState_ClientConnected, false);
 
-	while(inBufferSize > 0)
-	{
-		// We need to wait for the last transmit to complete before putting new data in the outgoing buffer
-		MReturnOnError(WaitPendingTransmitComplete(targetChannel) == false, false);
-
-		// Now it is safe to copy new data into the outgoing buffer
-		size_t	bytesToCopy = MMin(inBufferSize, sizeof(targetChannel->outgoingBuffer) - targetChannel->outgoingTotalBytes);
-		memcpy(targetChannel->outgoingBuffer + targetChannel->outgoingTotalBytes, inBuffer, bytesToCopy);
-		targetChannel->outgoingTotalBytes += (uint16_t)bytesToCopy;
-		inBufferSize -= bytesToCopy;
-		inBuffer += bytesToCopy;
+	// Queue as much as fits behind any send in flight, the caller gets the count back instead of waiting for room
+	size_t	capacity = sizeof(targetChannel->outgoingBuffer);
+	size_t	bytesToCopy = MMin(inBufferSize, capacity - targetChannel->outgoingTotalBytes);
+	size_t	tailIndex = (targetChannel->outgoingHead + targetChannel->outgoingTotalBytes) % capacity;
+	size_t	firstBytes = MMin(bytesToCopy, capacity - tailIndex);
 
-		// If the buffer is full then transmit the pending data
-		if(targetChannel->outgoingTotalBytes >= (int)sizeof(targetChannel->outgoingBuffer))
-		{
-			TCPTransmitPendingData(targetChannel);
-		}
+	if(targetChannel->outgoingTotalBytes == targetChannel->sendingBytes)
+	{
+		// These are the first bytes waiting for a send so start the coalesce timer
+		targetChannel->queuedTimeMS = millis();
 	}
 
-	if(inFlush)
+	memcpy(targetChannel->outgoingBuffer + tailIndex, inBuffer, firstBytes);
+	memcpy(targetChannel->outgoingBuffer, inBuffer + firstBytes, bytesToCopy - firstBytes);
+	targetChannel->outgoingTotalBytes += (uint16_t)bytesToCopy;
+
+	// A full ring is sent right away, otherwise the data waits for a flush or for Update() to find it has waited eSendCoalesceTimeMS
+	if(inFlush || targetChannel->outgoingTotalBytes >= capacity)
 	{
-		// No need to wait here since we are not adding any new data to the outgoing buffer, just flushing what is there
 		TCPTransmitPendingData(targetChannel);
 	}
 
+	outBytesQueued = bytesToCopy;
+
 	return true;
 }
 
@@ -1032,12 +1235,12 @@ CModule_ESP8266::TCPGetPortState(
 		result |= ePortState_IsOpen;
 	}
 
-	if(targetChannel->incomingTotalBytes > 0)
+	if(targetChannel->incomingHead != NULL)
 	{
 		result |= ePortState_HasIncommingData;
 	}
 
-	if(targetChannel->sendPending == false)
+	if(targetChannel->outgoingTotalBytes < sizeof(targetChannel->outgoingBuffer))
 	{
 		result |= ePortState_CanSendData;
 	}
@@ -1057,15 +1260,12 @@ CModule_ESP8266::TCPCloseConnection(
 	// Sometimes the channel can be closed before the client closes it so handle that case
 	if(targetChannel->linkIndex >= 0)
 	{
-		if(!targetChannel->sendPending)
-		{
-			TCPTransmitPendingData(targetChannel);
-		}
+		TCPTransmitPendingData(targetChannel);
 
+		// The close follows the send commands for all of the queued bytes so none are cut off
 		targetChannel->state = eChannelState_ClosePending;
-
-		// inUse will be marked false when this command is processed
-		IssueCommand("AT+CIPCLOSE=%d", targetChannel, eCommandTimeoutMS, targetChannel->linkIndex);
+		targetChannel->closeRequested = true;
+		IssuePendingClose(targetChannel);
 	}
 	else
 	{
@@ -1097,13 +1297,22 @@ CModule_ESP8266::UDPOpenChannel(
 
 	targetChannel->ClientStart(false);
 
+	bool	issued;
+
 	if(inRemoteServerPort > 0 && inRemoteServerAddress != NULL && inRemoteServerAddress[0] != 0)
 	{
-		IssueCommand("AT+CIPSTART=0,\"UDP\",\"%s\",%d,%d", targetChannel, eCommandTimeoutMS, inRemoteServerAddress, inRemoteServerPort, inLocalPort);
+		issued = IssueCommand("AT+CIPSTART=0,\"UDP\",\"%s\",%d,%d", targetChannel, eCommandTimeoutMS, inRemoteServerAddress, inRemoteServerPort, inLocalPort);
 	}
 	else
 	{
-		IssueCommand("AT+CIPSTART=0,\"UDP\",%d", targetChannel, eCommandTimeoutMS, inLocalPort);
+		issued = IssueCommand("AT+CIPSTART=0,\"UDP\",%d", targetChannel, eCommandTimeoutMS, inLocalPort);
+	}
+
+	if(!issued)
+	{
+		SystemMsg("ESP8266: ERROR: Command queue full, failing udp open on chn=%d\n", targetChannel->channelIndex);
+		targetChannel->Reset();
+		return -1;
 	}
 
 	return targetChannel->channelIndex;
@@ -1120,14 +1329,10 @@ CModule_ESP8266::UDPChannelReady(
 
 bool
 CModule_ESP8266::UDPGetData(
-	int			inChannel,
-	uint32_t&	outRemoteAddress,
-	uint16_t&	outRemotePort,
-	size_t&		ioBufferSize,
-	char*&		outBuffer)
+	int					inChannel,
+	SInternetPacket*&	outPacket)
 {
-	ioBufferSize = 0;
-	outBuffer = NULL;
+	outPacket = NULL;
 
 	MReturnOnError(inChannel >= eChannelCount, false);
 
@@ -1138,20 +1343,9 @@ CModule_ESP8266::UDPGetData(
 
 	SChannel*	targetChannel = channelArray + inChannel;
 
-	if(targetChannel->incomingTotalBytes == 0)
-	{
-		return false;
-	}
-	
-	outRemoteAddress = targetChannel->remoteAddress;
-	outRemotePort = targetChannel->remotePort;
-	ioBufferSize = targetChannel->incomingTotalBytes;
-	outBuffer = targetChannel->incomingBuffer;
-	targetChannel->incomingTotalBytes = 0;
-	targetChannel->remoteAddress = 0;
-	targetChannel->remotePort = 0;
+	outPacket = targetChannel->DequeueIncoming();
 
-	return true;
+	return outPacket != NULL;
 }
 
 bool
@@ -1172,31 +1366,19 @@ CModule_ESP8266::UDPSendData(
 	SChannel*	targetChannel = channelArray + inChannel;
 
 	MReturnOnError(targetChannel->linkIndex < 0, false);
+	MReturnOnError(inBufferSize > sizeof(targetChannel->outgoingBuffer), false);
 
-	char*	cp = (char*)inBuffer;
-
-	while(inBufferSize > 0)
+	// The remote address goes in the send command so only one datagram is queued at a time, the caller retries later
+	if(targetChannel->sendPending)
 	{
-		// We need to wait for the last transmit to complete before putting new data in the outgoing buffer
-		MReturnOnError(WaitPendingTransmitComplete(targetChannel) == false, false);
-
-		// Now it is safe to copy new data into the outgoing buffer
-		size_t	bytesToCopy = MMin(inBufferSize, sizeof(targetChannel->outgoingBuffer) - targetChannel->outgoingTotalBytes);
-		memcpy(targetChannel->outgoingBuffer + targetChannel->outgoingTotalBytes, cp, bytesToCopy);
-		targetChannel->outgoingTotalBytes += (uint16_t)bytesToCopy;
-		inBufferSize -= bytesToCopy;
-		cp += bytesToCopy;
-
-		// If the buffer is full then transmit the pending data
-		if(targetChannel->outgoingTotalBytes >= (int)sizeof(targetChannel->outgoingBuffer))
-		{
-			UDPTransmitPendingData(targetChannel, inRemoteAddress, inRemotePort);
-		}
+		return false;
 	}
 
-	UDPTransmitPendingData(targetChannel, inRemoteAddress, inRemotePort);
+	targetChannel->ClearOutgoing();
+	memcpy(targetChannel->outgoingBuffer, inBuffer, inBufferSize);
+	targetChannel->outgoingTotalBytes = (uint16_t)inBufferSize;
 
-	return true;
+	return UDPTransmitPendingData(targetChannel, inRemoteAddress, inRemotePort);
 }
 	
 void
@@ -1217,9 +1399,8 @@ CModule_ESP8266::UDPCloseChannel(
 	if(targetChannel->linkIndex >= 0)
 	{
 		targetChannel->state = eChannelState_ClosePending;
-
-		// inUse will be marked false when this command is processed
-		IssueCommand("AT+CIPCLOSE=%d", targetChannel, eCommandTimeoutMS, targetChannel->linkIndex);
+		targetChannel->closeRequested = true;
+		IssuePendingClose(targetChannel);
 	}
 	else
 	{
@@ -1251,11 +1432,9 @@ CModule_ESP8266::ResetDevice(
 {
 	commandHead = commandTail = 0;
 	serverPort = 0;
+	serverCommandPort = 0;
 	simpleCommandInProcess = false;
-	ipdInProcess = false;
-	ipdTotalBytes = 0;
-	ipdCurByte = 0;
-	ipdCurChannel = 0;
+	ResetIPD();
 	sendState = eSendState_None;
 	lastSerialInputTimeMS = 0;
 	wifiConnected = false;
@@ -1275,20 +1454,38 @@ void
 CModule_ESP8266::TCPTransmitPendingData(
 	SChannel*	inChannel)
 {
-	if(inChannel->outgoingTotalBytes == 0)
+	if(inChannel->outgoingTotalBytes <= inChannel->sendingBytes)
 	{
+		// Nothing is queued beyond the send in flight so there is nothing left to flush
+		inChannel->flushRequested = false;
+		return;
+	}
+
+	if(inChannel->sendPending)
+	{
+		// The bytes queued behind the send in flight go out when its SEND OK arrives
+		inChannel->flushRequested = true;
 		return;
 	}
 
 	DumpChannelState(inChannel, "Initiating TCP Transmit", false);
 
-	MReturnOnError((inChannel->state != eChannelState_Server && inChannel->state != eChannelState_ClientConnected) || inChannel->linkIndex < 0);
+	MReturnOnError((inChannel->state != eChannelState_Server && inChannel->state != eChannelState_ClientConnected && inChannel->state != eChannelState_ClosePending) || inChannel->linkIndex < 0);
+
+	// Everything queued goes in one send so a close queued after it follows all of the data
+	if(!IssueCommand("AT+CIPSENDEX=%d,%d", inChannel, eCommandTimeoutMS, inChannel->linkIndex, inChannel->outgoingTotalBytes))
+	{
+		// Update() tries again once the command queue has room
+		inChannel->flushRequested = true;
+		return;
+	}
 
+	inChannel->sendingBytes = inChannel->outgoingTotalBytes;
 	inChannel->sendPending = true;
-	IssueCommand("AT+CIPSENDEX=%d,%d", inChannel, eCommandTimeoutMS, inChannel->linkIndex, inChannel->outgoingTotalBytes);
+	inChannel->flushRequested = false;
 }
 
-void
+bool
 CModule_ESP8266::UDPTransmitPendingData(
 	SChannel*	inChannel,
 	char const*	inRemoteAddress,
@@ -1296,70 +1493,149 @@ CModule_ESP8266::UDPTransmitPendingData(
 {
 	if(inChannel->outgoingTotalBytes == 0)
 	{
-		return;
+		return true;
 	}
 
 	DumpChannelState(inChannel, "Initiating UDP Transmit", false);
 
-	MReturnOnError(inChannel->linkIndex < 0);
+	MReturnOnError(inChannel->linkIndex < 0, false);
+
+	if(!IssueCommand("AT+CIPSENDEX=%d,%d,\"%s\",%d", inChannel, eCommandTimeoutMS, inChannel->linkIndex, inChannel->outgoingTotalBytes, inRemoteAddress, inRemotePort))
+	{
+		SystemMsg("ESP8266: ERROR: Command queue full, dropping udp send on chn=%d\n", inChannel->channelIndex);
+		inChannel->ClearOutgoing();
+		return false;
+	}
 
+	inChannel->sendingBytes = inChannel->outgoingTotalBytes;
 	inChannel->sendPending = true;
-	IssueCommand("AT+CIPSENDEX=%d,%d,\"%s\",%d", inChannel, eCommandTimeoutMS, inChannel->linkIndex, inChannel->outgoingTotalBytes, inRemoteAddress, inRemotePort);
+
+	return true;
 }
 
-// return true on success, false if there was a channel failure or a timeout
-bool
-CModule_ESP8266::WaitPendingTransmitComplete(
+void
+CModule_ESP8266::IssuePendingClose(
 	SChannel*	inChannel)
 {
-	bool		waitingOn = false;
+	if(!inChannel->closeRequested || inChannel->outgoingTotalBytes != inChannel->sendingBytes)
+	{
+		return;	// Bytes still have to go into a send command ahead of the close
+	}
 
-	while(inChannel->sendPending)
+	// inUse will be marked false when this command is processed
+	if(IssueCommand("AT+CIPCLOSE=%d", inChannel, eCommandTimeoutMS, inChannel->linkIndex))
 	{
-		MAssert(inChannel->state == eChannelState_Server || inChannel->state == eChannelState_ClientConnected);
+		inChannel->closeRequested = false;
+	}
+}
 
-		if(!waitingOn)
+void
+CModule_ESP8266::IssueSetupCommands(
+	void)
+{
+	bool	uartSwitch = baudRate != eDefaultBaudRate || rtsPin != 0xFF || ctsPin != 0xFF;
+
+	while(setupStep < eSetupStep_Done)
+	{
+		bool	issued = true;
+
+		switch(setupStep)
 		{
-			MESPDebugMsg("Waiting on transmit\n");
-			waitingOn = true;
+			case eSetupStep_Ready:
+				issued = IssueCommand("ready", NULL, 2 * 60 * 1000);
+				break;
+
+			case eSetupStep_Echo:
+				issued = IssueCommand("ATE0", NULL, eSimpleCommandTimeoutMS);
+				break;
+
+			case eSetupStep_UART:
+				if(uartSwitch)
+				{
+					// The ESP8266 flow control setting is from its side, 1 enables its RTS output which feeds our CTS and 2 enables its CTS input which is fed by our RTS
+					int	flowControl = (ctsPin != 0xFF ? 1 : 0) | (rtsPin != 0xFF ? 2 : 0);
+					issued = IssueCommand("AT+UART_CUR=%lu,8,1,0,%d", NULL, eSimpleCommandTimeoutMS, (unsigned long)baudRate, flowControl);
+				}
+				break;
+
+			case eSetupStep_UARTCheck:
+				if(uartSwitch)
+				{
+					issued = IssueCommand("AT", NULL, eSimpleCommandTimeoutMS);	// Confirms the link works with the new settings
+				}
+				break;
+
+			case eSetupStep_Mode:
+				issued = IssueCommand("AT+CWMODE_CUR=1", NULL, eSimpleCommandTimeoutMS);
+				break;
+
+			case eSetupStep_Mux:
+				issued = IssueCommand("AT+CIPMUX=1", NULL, eSimpleCommandTimeoutMS);
+				break;
+
+			case eSetupStep_DInfo:
+				issued = IssueCommand("AT+CIPDINFO=1", NULL, eSimpleCommandTimeoutMS);
+				break;
+
+			case eSetupStep_IPAddr:
+				if(ipAddr != 0)
+				{
+					issued = IssueCommand("AT+CIPSTA_CUR=\"%d.%d.%d.%d\",\"%d.%d.%d.%d\",\"%d.%d.%d.%d\"", 
+						NULL, 
+						eCommandTimeoutMS, 
+						(ipAddr >> 24) & 0xFF,
+						(ipAddr >> 16) & 0xFF,
+						(ipAddr >> 8) & 0xFF,
+						(ipAddr >> 0) & 0xFF,
+						(gatewayAddr >> 24) & 0xFF,
+						(gatewayAddr >> 16) & 0xFF,
+						(gatewayAddr >> 8) & 0xFF,
+						(gatewayAddr >> 0) & 0xFF,
+						(subnetAddr >> 24) & 0xFF,
+						(subnetAddr >> 16) & 0xFF,
+						(subnetAddr >> 8) & 0xFF,
+						(subnetAddr >> 0) & 0xFF
+						);
+				}
+				break;
 		}
 
-		// Allow time for the serial port
-		delay(1);
+		if(!issued)
+		{
+			return;	// Update() picks up from this step once the command queue has room
+		}
 
-		// Check serial input to monitor the send command
-		Update(0);
+		++setupStep;
 	}
+}
 
-	if(waitingOn)
+void
+CModule_ESP8266::IssueServerCommand(
+	void)
+{
+	if(serverCommandPort == 0)
 	{
-		MESPDebugMsg("Done waiting on transmit\n");
+		return;
 	}
 
-	return true;
+	if(IssueCommand("AT+CIPSERVER=%d,%d", NULL, eCommandTimeoutMS, serverCommandOpen ? 1 : 0, serverCommandPort))
+	{
+		serverCommandPort = 0;
+	}
 }
 
-void
+bool
 CModule_ESP8266::IssueCommand(
 	char const*	inCommand,
 	SChannel*	inChannel,
 	uint32_t	inTimeoutMS,
 	...)
 {
-	bool	waitingOn = false;
-	while((commandHead - commandTail) >= eMaxPendingCommands)
-	{
-		if(!waitingOn)
-		{
-			MESPDebugMsg("Waiting on command queue\n");
-			waitingOn = true;
-		}
-		delay(1);
-		Update(0);
-	}
-	if(waitingOn)
+	if((uint16_t)(commandHead - commandTail) >= eMaxPendingCommands)
 	{
-		MESPDebugMsg("Done waiting on command queue\n");
+		// Callers retry or report the failure themselves so this is not an error on its own
+		MESPDebugMsg("Command queue full for %s\n", inCommand);
+		return false;
 	}
 
 	SPendingCommand*	targetCommand = commandQueue + (commandHead++ % eMaxPendingCommands);
@@ -1372,6 +1648,10 @@ CModule_ESP8266::IssueCommand(
 	MESPDebugMsg("Queuing Command (%d): %s\n", commandHead - 1, (char*)targetCommand->command);
 	targetCommand->timeoutMS = inTimeoutMS;
 	targetCommand->targetChannel = inChannel;
+
+	Signal();	// Get the command going on the next pass rather than waiting out the update period
+
+	return true;
 }
 
 void
@@ -1422,12 +1702,22 @@ CModule_ESP8266::ProcessSendOkAck(
 
 		SChannel*	targetChannel = curCommand->targetChannel;
 
-		targetChannel->outgoingTotalBytes = 0;
+		targetChannel->outgoingHead = (uint16_t)((targetChannel->outgoingHead + targetChannel->sendingBytes) % sizeof(targetChannel->outgoingBuffer));
+		targetChannel->outgoingTotalBytes -= targetChannel->sendingBytes;
+		targetChannel->sendingBytes = 0;
 		targetChannel->sendPending = false;
 		sendState = eSendState_None;
 		++commandTail;
 
 		targetChannel->lastUseTimeMS = millis();
+
+		// Start on whatever was queued while this send was in flight, a close waiting on it follows
+		if(targetChannel->flushRequested)
+		{
+			TCPTransmitPendingData(targetChannel);
+		}
+
+		IssuePendingClose(targetChannel);
 	}
 }
 		
@@ -1435,93 +1725,86 @@ void
 CModule_ESP8266::CheckIPDBufferForCommands(
 	void)
 {
-	char const*	lowestPtr = NULL;
-	char const*	checkPtr;
-
-	if(ipdCurChannel == NULL)
+	if(ipdCurPacket == NULL)
 	{
 		return;
 	}
 
-	ipdCurChannel->incomingBuffer[ipdCurByte] = 0;
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, "\r\nRecv ");
-	if(checkPtr != NULL && ipdCurByte - (checkPtr - ipdCurChannel->incomingBuffer + 7) > 0 && isdigit(checkPtr[7]) && lowestPtr < checkPtr)
-	{
-		lowestPtr = checkPtr;
-	}
+	// Only the lines that start after ipdScanIndex need to be looked at, everything before it was checked on an earlier pass
+	char*	buffer = ipdCurPacket->data;
+	int		storedBytes = MMin(ipdCurByte, (int)eMaxIncomingPacketSize);
+	int		foundIndex = -1;
+	int		curIndex;
 
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, "\r\nSEND OK\r\n");
-	if(checkPtr != NULL && lowestPtr < checkPtr)
+	for(curIndex = ipdScanIndex; curIndex + 1 < storedBytes; ++curIndex)
 	{
-		lowestPtr = checkPtr;
-	}
+		if(buffer[curIndex] != '\r' || buffer[curIndex + 1] != '\n')
+		{
+			continue;
+		}
 
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, ",CONNECT\r\n");
-	if(checkPtr != NULL && checkPtr > ipdCurChannel->incomingBuffer && isdigit(checkPtr[-1]) && lowestPtr < checkPtr)
-	{
-		lowestPtr = checkPtr - 1;
-	}
+		int		lineStart = curIndex + 2;
+		char*	lineEnd = (char*)memchr(buffer + lineStart, '\r', storedBytes - lineStart);
 
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, ",CLOSED\r\n");
-	if(checkPtr != NULL && checkPtr > ipdCurChannel->incomingBuffer && isdigit(checkPtr[-1]) && lowestPtr < checkPtr)
-	{
-		lowestPtr = checkPtr - 1;
-	}
+		if(lineEnd == NULL)
+		{
+			if(storedBytes - lineStart < eMaxResponseLength)
+			{
+				// The line could still turn into a response so look at it again when more data arrives
+				break;
+			}
 
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, "\r\nWIFI CONNECTED\r\n");
-	if(checkPtr != NULL && lowestPtr < checkPtr)
-	{
-		lowestPtr = checkPtr;
-	}
+			continue;
+		}
 
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, "\r\nWIFI DISCONNECT\r\n");
-	if(checkPtr != NULL && lowestPtr < checkPtr)
-	{
-		lowestPtr = checkPtr;
-	}
+		int	linkIndex;
+		if(lineEnd - (buffer + lineStart) < eMaxResponseLength && ClassifyResponse(buffer + lineStart, lineEnd - (buffer + lineStart), true, linkIndex) != eResponse_Unknown)
+		{
+			foundIndex = curIndex;
+			break;
+		}
 
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, "\r\nWIFI GOT IP\r\n");
-	if(checkPtr != NULL && lowestPtr < checkPtr)
-	{
-		lowestPtr = checkPtr;
+		curIndex = lineEnd - buffer - 1;	// Pick up again at the CR that ends this line
 	}
 
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, ",CONNECT FAIL\r\n");
-	if(checkPtr != NULL && checkPtr > ipdCurChannel->incomingBuffer && isdigit(checkPtr[-1]) && lowestPtr < checkPtr)
-	{
-		lowestPtr = checkPtr;
-	}
+	ipdScanIndex = curIndex;
 
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, "\r\nSEND FAIL\r\n");
-	if(checkPtr != NULL && lowestPtr < checkPtr)
+	if(foundIndex >= 0)
 	{
-		lowestPtr = checkPtr;
+		// We found a command in the ipd input data this means the P.O.S. ESP8266 firmware did not send us all the ipd data it said it would
+		// cancel the ipd and feed the chars after back into the serial input processing loop, the packet is held until then since a new ipd gets a different packet
+		SInternetPacket*	truncatedPacket = ipdCurPacket;
+
+		DumpChannelState(ipdCurChannel, "Truncated ipd", true);
+
+		ipdCurPacket = NULL;
+		ResetIPD();
+		ProcessSerialData(buffer + foundIndex, storedBytes - foundIndex);
+		gInternetPacketPool.Release(truncatedPacket);
 	}
+}
 
-	checkPtr = strstr(ipdCurChannel->incomingBuffer, "\r\nUNLINK\r\n");
-	if(checkPtr != NULL && lowestPtr < checkPtr)
+void
+CModule_ESP8266::SwitchUART(
+	void)
+{
+	serialPort->flush();
+	serialPort->begin(baudRate);
+
+	#if !defined(WIN32)
+	if(rtsPin != 0xFF)
 	{
-		lowestPtr = checkPtr;
+		serialPort->attachRts(rtsPin);
 	}
 
-	if(lowestPtr != NULL)
+	if(ctsPin != 0xFF)
 	{
-		// We found a command in the ipd input data this means the P.O.S. ESP8266 firmware did not send us all the ipd data it said it would
-		// cancel the ipd and feed the chars after back into the serial input processing loop
-		size_t	startIndex = lowestPtr - ipdCurChannel->incomingBuffer;
-		size_t	endIndex = ipdCurByte;
-
-		ipdInProcess = false;
-		ipdTotalBytes = 0;
-		ipdCurByte = 0;
-		ipdCurChannel = NULL;
-
-		for(size_t	i = startIndex; i < endIndex; ++i)
-		{
-			ProcessSerialChar(ipdCurChannel->incomingBuffer[i]);
-		}
+		serialPort->attachCts(ctsPin);
 	}
+	#endif
 
+	MESPDebugMsg("UART switched to %lu baud rts=%d cts=%d\n", (unsigned long)baudRate, rtsPin, ctsPin);
+	uartSwitchPending = true;
 }
 
 void
@@ -1562,8 +1845,10 @@ CModule_ESP8266::ProcessError(
 					{
 						if(targetChannel->linkIndex >= 0)
 						{
+							// Issue a close here in case this failed because it was already open
 							targetChannel->state = eChannelState_ClosePending;
-							IssueCommand("AT+CIPCLOSE=%d", targetChannel, eCommandTimeoutMS, targetChannel->linkIndex);	// Issue a close here in case this failed because it was already open
+							targetChannel->closeRequested = true;
+							IssuePendingClose(targetChannel);
 						}
 						else
 						{
@@ -1586,7 +1871,7 @@ CModule_ESP8266::ProcessError(
 			break;
 
 		case eErrorType_IPDTimeout:
-			SystemMsg("ESP8266: ERROR: ipd timedout this probably means serial buffer overrun, increase RX_BUFFER_SIZE in serial1.c\n");
+			SystemMsg("ESP8266: ERROR: ipd timedout this probably means serial buffer overrun, use flow control or increase eSerialRxBufferSize (RX_BUFFER_SIZE in serial1.c on older cores)\n");
 			if(ipdCurChannel != NULL)
 			{
 				DumpChannelState(ipdCurChannel, "IPDTimeout", true);
@@ -1598,10 +1883,7 @@ CModule_ESP8266::ProcessError(
 				ProcessSendOkAck();
 			}
 
-			ipdInProcess = false;
-			ipdTotalBytes = 0;
-			ipdCurByte = 0;
-			ipdCurChannel = NULL;
+			ResetIPD();
 			break;
 
 		case eErrorType_SendTimeout:
@@ -1618,8 +1900,7 @@ CModule_ESP8266::ProcessError(
 
 			if(targetChannel != NULL)
 			{
-				targetChannel->sendPending = false;
-				targetChannel->outgoingTotalBytes = 0;
+				targetChannel->ClearOutgoing();
 			}
 			else
 			{
@@ -1638,6 +1919,17 @@ CModule_ESP8266::ProcessError(
 					attemptingConnection = false;
 				}
 
+				if(uartSwitchPending)
+				{
+					// Nothing came back at the new settings so the device is unreachable until it is reset, stay at the default settings after that
+					SystemMsg("ESP8266: ERROR: No response at %lu baud, using %d baud without flow control after reset\n", (unsigned long)baudRate, eDefaultBaudRate);
+					baudRate = eDefaultBaudRate;
+					rtsPin = 0xFF;
+					ctsPin = 0xFF;
+					uartSwitchPending = false;
+					deviceIsHorked = true;
+				}
+
 				if(targetChannel != NULL)
 				{
 					if(targetChannel->state == eChannelState_ClientStart)
@@ -1755,26 +2047,26 @@ CModule_ESP8266::DumpChannelState(
 	if(inError)
 	{
 		SystemMsg(
-			"ESP8266: ERROR: %s (chn=%d lnk=%d state=%d sp=%d otb=%d itb=%d)\n", 
+			"ESP8266: ERROR: %s (chn=%d lnk=%d state=%d sp=%d otb=%d inq=%d)\n", 
 			inMsg,
 			inChannel->channelIndex, 
 			inChannel->linkIndex, 
 			inChannel->state, 
 			inChannel->sendPending, 
 			inChannel->outgoingTotalBytes, 
-			inChannel->incomingTotalBytes);
+			inChannel->CountIncoming());
 	}
 	else
 	{
 		MESPDebugMsg(
-			"%s (chn=%d lnk=%d state=%d sp=%d otb=%d itb=%d)\n", 
+			"%s (chn=%d lnk=%d state=%d sp=%d otb=%d inq=%d)\n", 
 			inMsg,
 			inChannel->channelIndex, 
 			inChannel->linkIndex, 
 			inChannel->state, 
 			inChannel->sendPending, 
 			inChannel->outgoingTotalBytes, 
-			inChannel->incomingTotalBytes);
+			inChannel->CountIncoming());
 	}
 }
 
@@ -1799,13 +2091,13 @@ CModule_ESP8266::DumpState(
 	{
 		MOutputDirectorOrSerial(
 			inOutput, 
-			"    chn=%d lnk=%d state=%d sp=%d otb=%d itb=%d\n", 
+			"    chn=%d lnk=%d state=%d sp=%d otb=%d inq=%d\n", 
 			curChannel->channelIndex, 
 			curChannel->linkIndex, 
 			curChannel->state, 
 			curChannel->sendPending, 
 			curChannel->outgoingTotalBytes, 
-			curChannel->incomingTotalBytes);
+			curChannel->CountIncoming());
 	}
 }
 
@@ -1829,10 +2121,7 @@ CModule_ESP8266::InitiateConnectionAttempt(
 		return;
 	}
 
-	attemptingConnection = true;
-	if(ssid != NULL)
-	{
-		IssueCommand("AT+CWJAP=\"%s\",\"%s\"", NULL, eCommandTimeoutMS, (char*)ssid, (char*)pw);
-	}
+	// A join that does not fit in the command queue is tried again by the connection status event
+	attemptingConnection = ssid != NULL && IssueCommand("AT+CWJAP=\"%s\",\"%s\"", NULL, eCommandTimeoutMS, (char*)ssid, (char*)pw);
 }
 
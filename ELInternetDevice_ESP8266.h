@@ -32,6 +32,12 @@
 */
 #include <ELInternet.h>
 
+#if defined(TEENSYDUINO) && TEENSYDUINO >= 142
+	#define MESP8266SerialBuffers 1	// The core takes serial buffer memory from the driver so serial1.c does not need to be patched
+#else
+	#define MESP8266SerialBuffers 0
+#endif
+
 class CModule_ESP8266 : public CModule, public IInternetDevice, public IRealTimeHandler
 {
 public:
@@ -42,7 +48,10 @@ public:
 		uint8_t			inRstPin,
 		uint8_t			inChPDPin = 0xFF,
 		uint8_t			inGPIO0 = 0xFF,
-		uint8_t			inGPIO2 = 0xFF)
+		uint8_t			inGPIO2 = 0xFF,
+		uint32_t		inBaudRate = 115200,	// The ESP8266 always starts at 115200, a higher rate is switched to once it is ready
+		uint8_t			inRTSPin = 0xFF,		// Host RTS output wired to the ESP8266 CTS (GPIO13)
+		uint8_t			inCTSPin = 0xFF)		// Host CTS input wired to the ESP8266 RTS (GPIO15)
 
 private:
 
@@ -51,7 +60,10 @@ private:
 		uint8_t			inRstPin,
 		uint8_t			inChPDPin,
 		uint8_t			inGPIO0,
-		uint8_t			inGPIO2);
+		uint8_t			inGPIO2,
+		uint32_t		inBaudRate,
+		uint8_t			inRTSPin,
+		uint8_t			inCTSPin);
 
 	virtual void
 	Setup(
@@ -98,16 +110,16 @@ private:
 
 	virtual void
 	TCPGetData(
-		uint16_t&	outPort,
-		uint16_t&	outReplyPort,	
-		size_t&		ioBufferSize,		
-		char*&		outBuffer);
+		uint16_t&			outPort,
+		uint16_t&			outReplyPort,	
+		SInternetPacket*&	outPacket);
 
 	virtual bool
 	TCPSendData(
 		uint16_t	inPort,	
 		size_t		inBufferSize,
 		char const*	inBuffer,
+		size_t&		outBytesQueued,
 		bool		inFlush);
 
 	virtual uint32_t
@@ -130,11 +142,8 @@ private:
 	
 	virtual bool
 	UDPGetData(
-		int			inChannel,
-		uint32_t&	outRemoteAddress,
-		uint16_t&	outRemotePort,
-		size_t&		ioBufferSize,
-		char*&		outBuffer);
+		int					inChannel,
+		SInternetPacket*&	outPacket);
 
 	virtual bool
 	UDPSendData(
@@ -163,7 +172,7 @@ private:
 	enum
 	{
 		eMaxCommandLength = 96,
-		eMaxPendingCommands = 8,
+		eMaxPendingCommands = 24,	// Callers are never made to wait on the queue so it must cover a send and a close on every channel plus setup
 
 		eServerConnectionTimeoutMS = 25000,
 		eClientOpenTimeoutMS = 20000,
@@ -173,6 +182,11 @@ private:
 		eSimpleCommandTimeoutMS = 5000,
 		eCommandPauseTimeMS = 20,
 
+		eDefaultBaudRate = 115200,
+		eSerialRxBufferSize = 2048,	// Holds a full ipd burst with room to spare
+		eSerialTxBufferSize = 1024,
+		eSendCoalesceTimeMS = 20,	// How long queued bytes wait for more data to fill out a packet before they are sent without a flush
+
 		eChannelCount = 5,
 
 		eChannelState_Unused = 0,			// The channel is not being used 
@@ -183,11 +197,14 @@ private:
 		eChannelState_ClientStartFailed,	// The start command failed, this needs to be reported differently then a general channel failure
 		eChannelState_Failed,				// The esp8266 reported a connection failed or a timeout while trying to open a connection
 	
-		eIPDCheck_NotLooking = 0,
-		eIPDCheck_LookingRecvOrSendOK,
-		eIPDCheck_LookingNum,
-		eIPDCheck_LookingBytes,
-		eIPDCheck_LookingSendOK,
+		eIPDField_Link = 0,		// The fields of the "+IPD,link,length,a.b.c.d,port:" header
+		eIPDField_Length,
+		eIPDField_IP0,
+		eIPDField_IP1,
+		eIPDField_IP2,
+		eIPDField_IP3,
+		eIPDField_Port,
+		eIPDField_Count,
 
 		eSendState_None = 0,
 		eSendState_WaitingOnReady,
@@ -200,7 +217,17 @@ private:
 		eErrorType_SendTimeout,
 		eErrorType_SendFail,
 		eErrorType_CommandTimeout,
-		eErrorType_ConnectFailed
+		eErrorType_ConnectFailed,
+
+		eSetupStep_Ready = 0,	// The setup commands in order, see IssueSetupCommands()
+		eSetupStep_Echo,
+		eSetupStep_UART,
+		eSetupStep_UARTCheck,
+		eSetupStep_Mode,
+		eSetupStep_Mux,
+		eSetupStep_DInfo,
+		eSetupStep_IPAddr,
+		eSetupStep_Done,
 	};
 
 	struct SChannel
@@ -208,6 +235,9 @@ private:
 		SChannel(
 			)
 		{
+			incomingHead = NULL;
+			incomingTail = NULL;
+			incomingCount = 0;
 			Reset();
 		}
 
@@ -215,16 +245,81 @@ private:
 		Reset(
 			void)
 		{
-			remoteAddress = 0;
-			remotePort = 0;
-			incomingTotalBytes = 0;
-			outgoingTotalBytes = 0;
 			linkIndex = -1;
 			state = eChannelState_Unused;
-			sendPending = false;
+			closeRequested = false;
+			ClearIncoming();
+			ClearOutgoing();
 			lastUseTimeMS = millis();
 		}
 
+		void
+		ClearIncoming(
+			void)
+		{
+			while(incomingHead != NULL)
+			{
+				gInternetPacketPool.Release(DequeueIncoming());
+			}
+		}
+
+		// The channel takes over the caller's reference to the packet
+		void
+		QueueIncoming(
+			SInternetPacket*	inPacket)
+		{
+			inPacket->next = NULL;
+			if(incomingTail != NULL)
+			{
+				incomingTail->next = inPacket;
+			}
+			else
+			{
+				incomingHead = inPacket;
+			}
+			incomingTail = inPacket;
+			++incomingCount;
+		}
+
+		// Returns NULL if no packets are queued, the caller takes over the channel's reference to the packet
+		SInternetPacket*
+		DequeueIncoming(
+			void)
+		{
+			SInternetPacket*	result = incomingHead;
+
+			if(result != NULL)
+			{
+				incomingHead = result->next;
+				if(incomingHead == NULL)
+				{
+					incomingTail = NULL;
+				}
+				result->next = NULL;
+				--incomingCount;
+			}
+
+			return result;
+		}
+
+		int
+		CountIncoming(
+			void)
+		{
+			return incomingCount;
+		}
+
+		void
+		ClearOutgoing(
+			void)
+		{
+			outgoingHead = 0;
+			outgoingTotalBytes = 0;
+			sendingBytes = 0;
+			sendPending = false;
+			flushRequested = false;
+		}
+
 		void
 		ServerConnection(
 			int	inLinkIndex)
@@ -252,17 +347,21 @@ private:
 			state = eChannelState_ClientConnected;
 		}
 
-		char		incomingBuffer[eMaxIncomingPacketSize + 1];	// Add space for a zero term byte for string processing when chechking for a corrupted buffer
-		char		outgoingBuffer[eMaxOutgoingPacketSize];
-		uint32_t	remoteAddress;
-		uint16_t	remotePort;
-		uint16_t	outgoingTotalBytes;
-		uint16_t	incomingTotalBytes;
+		SInternetPacket*	incomingHead;		// Packets received but not yet collected by TCPGetData() or UDPGetData()
+		SInternetPacket*	incomingTail;
+		uint8_t				incomingCount;		// At most eInternetMaxChannelPackets
+		char		outgoingBuffer[eMaxOutgoingPacketSize];	// A ring so data can be queued while a send is in flight
+		uint16_t	outgoingHead;			// The ring index of the first byte not yet acknowledged by SEND OK
+		uint16_t	outgoingTotalBytes;		// The bytes in the ring including the ones being sent
+		uint16_t	sendingBytes;			// The bytes in the send command that is queued or in flight
+		uint32_t	queuedTimeMS;			// When the oldest byte not yet in a send was queued
 		uint32_t	lastUseTimeMS;			// For server connections, the last time this channel was used, for client the time the start command was issued
 		int			linkIndex;				// The esp8266 link number for this channel
 		uint8_t		channelIndex;			// Our index in the the channelArray list
 		uint8_t		state;					// The state of the channel
 		bool		sendPending;			// True if a send is pending
+		bool		flushRequested;			// True if the queued bytes should be sent as soon as no send is pending
+		bool		closeRequested;			// True if a close still has to be queued, it waits for the send commands of every queued byte
 		bool		tcpConnection;			// True if tcp connection, false if UDP
 	};
 
@@ -281,6 +380,25 @@ private:
 	ProcessSerialChar(
 		char	inChar);
 
+	// Returns the number of bytes taken from inData
+	size_t
+	CollectIPDData(
+		char const*	inData,
+		size_t		inSize);
+
+	void
+	FinishIPD(
+		void);
+
+	void
+	ResetIPD(
+		void);
+
+	void
+	ProcessSerialData(
+		char const*	inData,
+		size_t		inSize);
+
 	void
 	ProcessSerialInput(
 		void);
@@ -297,17 +415,30 @@ private:
 	TCPTransmitPendingData(
 		SChannel*	inChannel);
 
-	void
+	// Returns false if the send command could not be queued
+	bool
 	UDPTransmitPendingData(
 		SChannel*	inChannel,
 		char const*	inRemoteAddress,
 		uint16_t	inRemotePort);
 
-	bool
-	WaitPendingTransmitComplete(
+	// Queues the CIPCLOSE for a channel with closeRequested once its queued bytes are in send commands, Update() retries it
+	void
+	IssuePendingClose(
 		SChannel*	inChannel);
 
+	// Queues the remaining setup commands, Update() retries the ones that do not fit in the command queue
 	void
+	IssueSetupCommands(
+		void);
+
+	// Queues the CIPSERVER command for serverCommandPort, Update() retries it if the command queue is full
+	void
+	IssueServerCommand(
+		void);
+
+	// Returns false if the command queue is full, this never waits for room
+	bool
 	IssueCommand(
 		char const*	inCommand,
 		SChannel*	inChannel,
@@ -331,6 +462,11 @@ private:
 		uint8_t	inError,
 		int		inLinkIndex = -1);
 
+	// Called when the ESP8266 has acknowledged AT+UART_CUR, it switches right after the OK
+	void
+	SwitchUART(
+		void);
+
 	int
 	FindHighestAvailableLink(
 		void);
@@ -375,6 +511,14 @@ private:
 	uint8_t	chPDPin;
 	uint8_t	gpio0Pin;
 	uint8_t	gpio2Pin;
+	uint8_t	rtsPin;
+	uint8_t	ctsPin;
+	uint32_t	baudRate;
+
+	#if MESP8266SerialBuffers
+	uint8_t	serialRxBuffer[eSerialRxBufferSize];
+	uint8_t	serialTxBuffer[eSerialTxBufferSize];
+	#endif
 
 	uint16_t		commandHead;
 	uint16_t		commandTail;
@@ -383,6 +527,9 @@ private:
 	TString<128>	serialInputBuffer;
 
 	uint16_t	serverPort;
+	uint16_t	serverCommandPort;	// The port of a CIPSERVER command that still has to be queued, 0 if none
+	bool		serverCommandOpen;	// True if that command opens the server, false if it closes it
+	uint8_t		setupStep;			// The next setup command to queue, eSetupStep_Done once they all are
 
 	SChannel	channelArray[eChannelCount];
 
@@ -392,6 +539,10 @@ private:
 	int			ipdTotalBytes;
 	int			ipdCurByte;
 	SChannel*	ipdCurChannel;
+	SInternetPacket*	ipdCurPacket;	// The pool packet the ipd data is collected into, NULL if the data is being dropped
+	uint32_t	ipdHeaderFields[eIPDField_Count];
+	uint8_t		ipdHeaderFieldIndex;
+	int			ipdScanIndex;	// Where CheckIPDBufferForCommands() picks up on the next pass
 
 	uint8_t		sendState;
 
@@ -409,6 +560,7 @@ private:
 	bool	gotCR;
 	bool	deviceIsHorked;
 	bool	attemptingConnection;
+	bool	uartSwitchPending;	// The UART has been switched and the next OK confirms the new settings work
 };
 
 #endif /* _ELINTERNETDEVICE_ESP8266_H_ */
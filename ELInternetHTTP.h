@@ -41,6 +41,7 @@
 enum
 {
 	eHTTPTimeoutMS = 10000,
+	eHTTPTempBufferSize = 512,	// Holds the request data the connection can not take yet
 
 };
 
@@ -48,19 +49,20 @@ class CHTTPConnection : public IInternetHandler, public IRealTimeHandler
 {
 public:
 	
-	void
+	// The request methods return false if the connection could not hold their data, the request is then incomplete and the connection should be closed
+	bool
 	StartRequest(
 		char const*	inVerb,
 		char const*	inURL,
 		int			inParameterCount = 0,
 		...);							// Variable length string parameters param name and param value times inParameterCount
 
-	void
+	bool
 	SetHeaders(
 		int	inHeaderCount,
 		...);					// Variable length string headers header name and header value times inHeaderCount
 
-	void
+	bool
 	CompleteRequest(
 		char const*	inBody = "");
 
@@ -98,7 +100,8 @@ private:
 		int					inDataSize,
 		char const*			inData);
 
-	void
+	// Returns false if the data was refused because the temp buffer can not hold the part the connection did not take
+	bool
 	SendData(
 		char const*	inData,
 		bool		inFlush);
@@ -125,6 +128,11 @@ private:
 	ReopenConnection(
 		void);
 
+	// Send what the connection could not take earlier, returns false if the connection failed
+	bool
+	SendTempBuffer(
+		void);
+
 	IInternetHandler*					internetHandler;
 	THTTPResponseHandlerMethod			responseMethod;
 
@@ -132,7 +140,7 @@ private:
 	uint16_t	serverPort;
 	uint16_t	localPort;
 
-	TString<512>	tempBuffer;
+	TString<eHTTPTempBufferSize>	tempBuffer;
 	TString<256>	parameterBuffer;
 
 	TRealTimeEventRef	eventRef;
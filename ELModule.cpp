@@ -35,20 +35,56 @@ enum
 	eEEPROM_ModuleCountOffset = 1,
 	eEEPROM_ListStart = 2,
 
-	eEEPROM_Version = 104,
+	eEEPROM_Version = 106,
+	eEEPROM_Version105 = 105,	// The directory entries held the full uid string
+	eEEPROM_Version104 = 104,	// The directory entries held the full uid string and no crc
 
 	eEEPROM_Size = 2048,
 
 	eEEPROM_UIDLength = 32,
 
 	eMaxEEPROMModules = 16,
+
+	eEEPROM_CommitDelayMS = 1000,	// Saves made within this time of the first one are written in a single commit
+
+	eIdleSleepMinUS = 100,	// Don't bother sleeping if the next module update is due sooner than this
+
+	eProfile_HistogramBuckets = 20,	// Bucket n counts Update() calls that took less than 2^n us, the last bucket counts everything longer
+
+	eStackPaint_Pattern = 0xC5,
+	eStackPaint_GuardBytes = 64,		// This much space below the frame of the painting function is left unpainted
+	eStackPaint_ScanPeriodUS = 1000000,
 };
 
 #define MDebugModuleDelayMS 1000
 #define MDebugModules 0
 #define MDebugTargetNode 0xFF
+#define MModuleProfiling 1
+#define MBootTimeline 0	// Set to 1 to report the construct, eeprom, and per module setup times at boot
+#define MStackPainting 1
 
 struct SEEPROMEntry
+{
+	uint32_t	uidHash;	// The hash of the module uid from ComputeUIDHash()
+	uint16_t	offset;
+	uint16_t	size;
+	uint16_t	version;
+	uint16_t	crc;	// The crc of the module data as of the last commit
+};
+
+// The directory entry of eEEPROM_Version105
+struct SEEPROMEntryV105
+{
+	char		uid[eEEPROM_UIDLength];
+	uint16_t	offset;
+	uint16_t	size;
+	uint16_t	version;
+	uint16_t	crc;
+	bool		inUse;
+};
+
+// The directory entry of eEEPROM_Version104
+struct SEEPROMEntryV104
 {
 	char		uid[eEEPROM_UIDLength];
 	uint16_t	offset;
@@ -77,16 +113,74 @@ private:
 
 static uint32_t		gModuleCount;
 static CModule*		gModuleList[eMaxModuleCount];
+static uint32_t		gScheduleCount;
+static CModule*		gScheduleHeap[eMaxModuleCount];	// A min heap of modules keyed on nextUpdateUS
+static volatile uint32_t	gSignalPending[eModule_SignalWordCount];	// A bit per module index set by Signal()
+static uint32_t		gInputWatchCount;
+static Stream*		gInputWatchStreamList[eModule_MaxInputWatches];
+static CModule*		gInputWatchModuleList[eModule_MaxInputWatches];
 static SEEPROMEntry	gEEPROMEntryList[eMaxEEPROMModules];
+static bool			gEEPROMDirty;	// True if any module has eeprom data waiting for a commit
+static uint64_t		gEEPROMCommitDueMS;
+static uint32_t		gEEPROMCommitCount;
+static uint32_t		gEEPROMBytesWritten;
+
+#if MModuleProfiling
+// Update() timing for a single module, kept in a fixed size table indexed by CModule::moduleIndex
+struct SModuleProfile
+{
+	uint32_t	callCount;
+	uint32_t	minUS;
+	uint32_t	maxUS;
+	uint32_t	maxLateUS;
+	uint64_t	totalUS;
+	uint64_t	totalLateUS;	// The accumulated time beyond updateTimeUS between Update() calls
+	uint16_t	histogram[eProfile_HistogramBuckets];
+};
+
+static SModuleProfile	gModuleProfile[eMaxModuleCount];
+#endif
+
+// A single pass of LoopAll() that went over the loop budget
+struct SLoopOverrun
+{
+	char const*	moduleName;		// The module that spent the most time in the pass
+	char const*	handlerName;	// The slowest handler called within that module's update or NULL if none was reported
+	uint32_t	passUS;
+	uint32_t	moduleUS;
+	uint32_t	timeMS;
+};
+
+static uint32_t		gLoopBudgetUS;
+static bool			gLoopFeedWatchdog;
+static uint32_t		gLoopOverrunCount;	// The total count of overruns, the most recent is at (gLoopOverrunCount - 1) % eLoopMonitor_MaxOverruns
+static SLoopOverrun	gLoopOverrunList[eLoopMonitor_MaxOverruns];
+static uint32_t		gBackgroundBudgetUS;
+static uint32_t		gBackgroundDeferPassCount;	// The number of passes that deferred at least one background module
+static uint32_t		gBackgroundDeferCount[eMaxModuleCount];	// The number of times each module was deferred, indexed by CModule::moduleIndex
+static uint32_t		gHandlerDepth;
+static uint32_t		gHandlerStartUS;
+static char const*	gHandlerCurName;
+static char const*	gHandlerSlowestName;	// The slowest handler called during the current module update
+static uint32_t		gHandlerSlowestUS;
 static bool			gTooManyModules = false;
 static bool			gTearingDown = false;
 static uint32_t		gLastMillis;
 static uint32_t		gLastMicros;
 static bool			gFlashLED;
+static bool			gIdleSleep;
+#if MBootTimeline
+static bool			gBootStarted;
+static uint32_t		gBootStartUS;	// The time the first module started construction
+static uint32_t		gBootSetupDoneUS;	// The time SetupAll() finished or 0 once the first module update has been reported
+#endif
 static int			gDontBlinkLEDIndex;		// config index for blink LED config var
 static char const*	gCurrentModuleConstructingName;
 static uint32_t		gCurrentModuleClassSize;
 static bool			gSetupStarted;
+#if defined(WIN32)
+static bool			gSimulatedTime;
+#endif
 
 uint64_t	gCurLocalMS;
 uint64_t	gCurLocalUS;
@@ -95,7 +189,7 @@ char const*	gVersionStr;
 IOutputDirector*	gSerialOut;
 
 MModuleImplementation_Start(CModule_SysMsgSerialHandler)
-MModuleImplementation_FinishGlobal(CModule_SysMsgSerialHandler, gSerialOut)
+MModuleImplementation_FinishStaticGlobal(CModule_SysMsgSerialHandler, gSerialOut)
 
 #if !defined(WIN32)
 extern char _estack;	// This is a dummy variable for the top of the stack at high memory, the address of this is the highest memory value
@@ -103,8 +197,13 @@ extern char* __brkval;	// This is a real pointer variable that points to the hig
 char*	gLowestStackAddress = &_estack;
 char*	gHighestBrkVal = NULL;
 static volatile bool	gDontEnterFuncCallbacks = true;	// Start with this true so we don't enter the func callbacks until we are ready
+static uint16_t		gSetupHeapBytes[eMaxModuleCount];	// The heap growth during each module's Setup(), indexed by CModule::moduleIndex
 
-// The project must be compiled with the -finstrument-functions in order to get runtime stack corruption detection
+#if MStackPainting
+static char*		gStackPaintBottom;
+#endif
+
+// The project must be compiled with the -finstrument-functions in order to get runtime stack corruption detection on every call, MStackPainting is much cheaper but only finds the high water mark when the stack is scanned
 extern "C"
 {
 void 
@@ -119,6 +218,53 @@ __cyg_profile_func_exit(
 }
 #endif
 
+#if !defined(WIN32) && MStackPainting
+// Fill the free memory between the heap and the stack with a known pattern so ScanStackHighWater() can find how deep the stack has been
+static void __attribute__((noinline))
+PaintStack(
+	void)
+{
+	char	tos;
+	char*	paintTop = &tos - eStackPaint_GuardBytes;
+
+	// Interrupt handlers push their frames below ours so keep them out until the painting is done
+	noInterrupts();
+	gStackPaintBottom = __brkval;
+	for(char* cp = gStackPaintBottom; cp < paintTop; ++cp)
+	{
+		*cp = eStackPaint_Pattern;
+	}
+	interrupts();
+}
+
+// Walk up from the top of the heap to the first byte the stack has touched
+static void
+ScanStackHighWater(
+	void)
+{
+	static uint32_t const	paintWord = eStackPaint_Pattern * 0x01010101UL;
+
+	char*				scanStart = MMax(__brkval, gStackPaintBottom);
+	uint32_t const*		cp = (uint32_t const*)(((uintptr_t)scanStart + 3) & ~(uintptr_t)3);
+	uint32_t const*		lowestStack = (uint32_t const*)gLowestStackAddress;
+
+	while(cp < lowestStack && *cp == paintWord)
+	{
+		++cp;
+	}
+
+	if((char*)cp < gLowestStackAddress)
+	{
+		gLowestStackAddress = (char*)cp;
+	}
+
+	if(__brkval > gHighestBrkVal)
+	{
+		gHighestBrkVal = __brkval;
+	}
+}
+#endif
+
 static int32_t
 GetFreeMemory(
 	void)
@@ -136,7 +282,7 @@ GetFreeMemory(
 CModule_SysMsgSerialHandler::CModule_SysMsgSerialHandler(
 	)
 	:
-	CModule()
+	CModule(0, 0, NULL, eUpdateTime_SignalOnly)
 {
 	AddSysMsgHandler(this);
 }
@@ -149,6 +295,82 @@ CModule_SysMsgSerialHandler::write(
 	Serial.write(inMsg, (int)inBytes);
 }
 
+#if MModuleProfiling
+static void
+ProfileUpdate(
+	uint32_t	inModuleIndex,
+	uint32_t	inDurationUS,
+	uint32_t	inLateUS)
+{
+	SModuleProfile*	profile = gModuleProfile + inModuleIndex;
+
+	if(profile->callCount == 0 || inDurationUS < profile->minUS)
+	{
+		profile->minUS = inDurationUS;
+	}
+
+	if(inDurationUS > profile->maxUS)
+	{
+		profile->maxUS = inDurationUS;
+	}
+
+	if(inLateUS > profile->maxLateUS)
+	{
+		profile->maxLateUS = inLateUS;
+	}
+
+	++profile->callCount;
+	profile->totalUS += inDurationUS;
+	profile->totalLateUS += inLateUS;
+
+	uint32_t	bucket = 0;
+	while(bucket < eProfile_HistogramBuckets - 1 && (inDurationUS >> bucket) != 0)
+	{
+		++bucket;
+	}
+
+	if(profile->histogram[bucket] == 0xFFFF)
+	{
+		// Halve every bucket when one saturates, this keeps the shape of the distribution
+		for(uint32_t i = 0; i < eProfile_HistogramBuckets; ++i)
+		{
+			profile->histogram[i] >>= 1;
+		}
+	}
+	++profile->histogram[bucket];
+}
+
+// Return the upper bound in us of the bucket holding the 99th percentile Update() time
+static uint32_t
+ProfileGetP99(
+	SModuleProfile const*	inProfile)
+{
+	uint32_t	totalCount = 0;
+	for(uint32_t i = 0; i < eProfile_HistogramBuckets; ++i)
+	{
+		totalCount += inProfile->histogram[i];
+	}
+
+	if(totalCount == 0)
+	{
+		return 0;
+	}
+
+	uint32_t	targetCount = totalCount - totalCount / 100;
+	uint32_t	curCount = 0;
+	for(uint32_t i = 0; i < eProfile_HistogramBuckets - 1; ++i)
+	{
+		curCount += inProfile->histogram[i];
+		if(curCount >= targetCount)
+		{
+			return 1UL << i;
+		}
+	}
+
+	return inProfile->maxUS;
+}
+#endif
+
 class CModuleManager : public CModule, public ICmdHandler
 {
 public:
@@ -160,7 +382,7 @@ private:
 	CModuleManager(
 		)
 		:
-		CModule()
+		CModule(0, 0, NULL, eStackPaint_ScanPeriodUS)
 	{
 		CModule_Command::Include();
 		CModule_Config::Include();
@@ -175,9 +397,23 @@ private:
 		MCommandRegister("alive", CModuleManager::SerialCmdAlive, "Return the build date and version as proof of life");
 		MCommandRegister("dbg_dump", CModuleManager::DebugDump, "[modulename | all]: dump debug data for the given module");
 		MCommandRegister("dbg_module", CModuleManager::DebugModule, "[modulename | all] [on|off]: turn on or off module debug logging");
+		MCommandRegister("loop_overruns", CModuleManager::LoopOverruns, "[reset]: dump or reset the passes of the module loop that exceeded the loop budget");
+		MCommandRegister("mod_tiers", CModuleManager::ModuleTiers, "[reset]: dump or reset the priority tier and background deferral count of each module");
+		#if MModuleProfiling
+		MCommandRegister("mod_prof", CModuleManager::ModuleProfile, "[modulename | all | reset]: dump or reset the Update() timing in us for the given module");
+		#endif
 		gDontBlinkLEDIndex = gConfigModule->RegisterConfigVar("dont_blink_led");
 	}
 
+	virtual void
+	Update(
+		uint32_t	inDeltaTimeUS)
+	{
+		#if !defined(WIN32) && MStackPainting
+		ScanStackHighWater();
+		#endif
+	}
+
 	uint8_t
 	SerialCmdAlive(
 		IOutputDirector*	inOutput,
@@ -272,36 +508,163 @@ private:
 		return eCmd_Succeeded;
 	}
 
+	uint8_t
+	LoopOverruns(
+		IOutputDirector*	inOutput,
+		int					inArgC,
+		char const*			inArgV[])
+	{
+		if(inArgC == 2 && strcmp(inArgV[1], "reset") == 0)
+		{
+			gLoopOverrunCount = 0;
+			return eCmd_Succeeded;
+		}
+
+		if(inArgC != 1)
+		{
+			return eCmd_Failed;
+		}
+
+		inOutput->printf("budget=%lu us overruns=%lu\n", gLoopBudgetUS, gLoopOverrunCount);
+
+		uint32_t	listCount = MMin(gLoopOverrunCount, (uint32_t)eLoopMonitor_MaxOverruns);
+		for(uint32_t i = 0; i < listCount; ++i)
+		{
+			SLoopOverrun*	curOverrun = gLoopOverrunList + (gLoopOverrunCount - 1 - i) % eLoopMonitor_MaxOverruns;
+
+			inOutput->printf("%lu ms: pass=%lu us module=%s (%lu us) handler=%s\n",
+				curOverrun->timeMS, curOverrun->passUS, curOverrun->moduleName, curOverrun->moduleUS, curOverrun->handlerName != NULL ? curOverrun->handlerName : "(none)");
+		}
+
+		return eCmd_Succeeded;
+	}
+
+	uint8_t
+	ModuleTiers(
+		IOutputDirector*	inOutput,
+		int					inArgC,
+		char const*			inArgV[])
+	{
+		static char const*	tierNames[eModulePriority_Count] = {"realtime", "normal", "background"};
+
+		if(inArgC == 2 && strcmp(inArgV[1], "reset") == 0)
+		{
+			gBackgroundDeferPassCount = 0;
+			memset(gBackgroundDeferCount, 0, sizeof(gBackgroundDeferCount));
+			return eCmd_Succeeded;
+		}
+
+		if(inArgC != 1)
+		{
+			return eCmd_Failed;
+		}
+
+		inOutput->printf("background budget=%lu us deferred passes=%lu\n", gBackgroundBudgetUS, gBackgroundDeferPassCount);
+
+		for(uint32_t i = 0; i < gModuleCount; ++i)
+		{
+			inOutput->printf("%s: tier=%s deferred=%lu\n", gModuleList[i]->uid, tierNames[gModuleList[i]->priority], gBackgroundDeferCount[i]);
+		}
+
+		return eCmd_Succeeded;
+	}
+
+	#if MModuleProfiling
+	uint8_t
+	ModuleProfile(
+		IOutputDirector*	inOutput,
+		int					inArgC,
+		char const*			inArgV[])
+	{
+		if(inArgC > 2)
+		{
+			return eCmd_Failed;
+		}
+
+		if(inArgC == 2 && strcmp(inArgV[1], "reset") == 0)
+		{
+			memset(gModuleProfile, 0, sizeof(gModuleProfile));
+			return eCmd_Succeeded;
+		}
+
+		bool	all = inArgC == 1 || strcmp(inArgV[1], "all") == 0;
+		bool	found = false;
+		for(uint32_t i = 0; i < gModuleCount; ++i)
+		{
+			if(all || strcmp(inArgV[1], gModuleList[i]->uid) == 0)
+			{
+				SModuleProfile*	profile = gModuleProfile + i;
+				uint32_t		callCount = profile->callCount > 0 ? profile->callCount : 1;
+
+				inOutput->printf("%s: calls=%lu avg=%lu min=%lu max=%lu p99<=%lu late_avg=%lu late_max=%lu\n",
+					gModuleList[i]->uid, profile->callCount,
+					(uint32_t)(profile->totalUS / callCount), profile->minUS, profile->maxUS, ProfileGetP99(profile),
+					(uint32_t)(profile->totalLateUS / callCount), profile->maxLateUS);
+				found = true;
+			}
+		}
+
+		if(!found)
+		{
+			inOutput->printf("Module %s not found\n", inArgV[1]);
+			return eCmd_Failed;
+		}
+
+		return eCmd_Succeeded;
+	}
+	#endif
+
 	void
 	DumpDebugInfo(
 		IOutputDirector* inOutput)
 	{
 		#if !defined(WIN32)
+		#if MStackPainting
+		ScanStackHighWater();
+		inOutput->printf("Stack high water = %d\n", &_estack - gLowestStackAddress);
+		#endif
 		inOutput->printf("Smallest free memory = %d\n", gLowestStackAddress - gHighestBrkVal);
+		for(uint32_t i = 0; i < gModuleCount; ++i)
+		{
+			if(gSetupHeapBytes[i] > 0)
+			{
+				inOutput->printf("%s: setup heap = %d\n", gModuleList[i]->uid, gSetupHeapBytes[i]);
+			}
+		}
 		#endif
+		inOutput->printf("EEPROM commits = %lu bytes written = %lu pending = %d\n", gEEPROMCommitCount, gEEPROMBytesWritten, gEEPROMDirty);
 	}
 
 };
 
 MModuleImplementation_Start(CModuleManager)
-MModuleImplementation_Finish(CModuleManager)
+MModuleImplementation_FinishStatic(CModuleManager, 1)
 
 CModule::CModule(
 	uint16_t	inEEPROMSize,
 	uint16_t	inEEPROMVersion,
 	void*		inEEPROMData,
 	uint32_t	inUpdateTimeUS,
-	bool		inEnabled)
+	bool		inEnabled,
+	uint8_t		inPriority)
 	:
 	logDebugData(false),
 	eepromSize(inEEPROMSize),
 	eepromVersion(inEEPROMVersion),
 	eepromData(inEEPROMData),
 	updateTimeUS(inUpdateTimeUS),
+	lastUpdateUS(0),
+	nextUpdateUS(UINT64_MAX),
+	moduleIndex(0),
+	heapIndex(eModule_NotScheduled),
+	priority(inPriority),
 	enabled(inEnabled),
+	eepromLoadPending(false),
+	eepromDirty(false),
 	hasBeenSetup(false)
 {
 	MAssert(strlen(gCurrentModuleConstructingName) <= eEEPROM_UIDLength - 1);
+	MAssert(inPriority < eModulePriority_Count);
 	uid = gCurrentModuleConstructingName;
 	classSize = gCurrentModuleClassSize;
 }
@@ -312,12 +675,16 @@ CModule::DoneConstructing(
 {
 	if(gModuleCount >= MStaticArrayLength(gModuleList))
 	{
+		// SetupAll() asserts on this once the serial port is available
+		SystemMsg("Module %s: more than %d modules, increase eMaxModuleCount\n", uid, eMaxModuleCount);
 		gTooManyModules = true;
 		return;
 	}
+	moduleIndex = (uint16_t)gModuleCount;
 	gModuleList[gModuleCount++] = this;
 
 	SetupIfNeeded();
+	Reschedule();
 
 	#if MDebugModules
 	SystemMsg("%s DoneConstruction: free mem = %ld", uid, GetFreeMemory());
@@ -339,9 +706,16 @@ CModule::SetupIfNeeded(
 			}
 		#endif
 		// Set this module up now
+		#if !defined(WIN32)
+		char*	brkBefore = __brkval;
 		Setup();
+		gSetupHeapBytes[moduleIndex] = (uint16_t)(__brkval - brkBefore);
+		#else
+		Setup();
+		#endif
 		lastUpdateUS = gCurLocalUS;
 		hasBeenSetup = true;
+		Reschedule();
 	}
 }
 
@@ -379,6 +753,7 @@ CModule::SetEnabledState(
 {
 	enabled = inEnabled;
 	SetupIfNeeded();
+	Reschedule();
 }
 
 void
@@ -416,36 +791,171 @@ void
 CModule::EEPROMSave(
 	void)
 {
+	// Saving before the load would overwrite the stored data with whatever is in memory
+	MAssert(!eepromLoadPending);
+
 	if(eepromData != NULL && eepromSize > 0)
 	{
-		WriteDataToEEPROM(eepromData, eepromOffset, eepromSize);
+		eepromDirty = true;
+		if(!gEEPROMDirty)
+		{
+			gEEPROMDirty = true;
+			gEEPROMCommitDueMS = gCurLocalMS + eEEPROM_CommitDelayMS;
+		}
+	}
+}
+
+// FNV-1a, SetupAll() asserts that no two modules with eeprom data share a hash
+static uint32_t
+ComputeUIDHash(
+	char const*	inUID)
+{
+	uint32_t	hash = 2166136261UL;
+
+	for(uint32_t i = 0; i < eEEPROM_UIDLength && inUID[i] != 0; ++i)
+	{
+		hash = (hash ^ (uint8_t)inUID[i]) * 16777619UL;
 	}
+
+	return hash;
 }
 
 static SEEPROMEntry*
 FindEEPROMEntry(
 	char const*		inUID)
 {
+	uint32_t	uidHash = ComputeUIDHash(inUID);
+
 	for(uint32_t i = 0; i < MStaticArrayLength(gEEPROMEntryList); ++i)
 	{
-		if(strcmp(gEEPROMEntryList[i].uid, inUID) == 0)
+		if(gEEPROMEntryList[i].uidHash == uidHash)
 			return gEEPROMEntryList + i;
 	}
 
 	return NULL;
 }
 
+// Fill in gEEPROMEntryList from a directory written by an older version, the module data is left where it is
+static void
+ConvertEEPROMDirectory(
+	uint8_t	inVersion)
+{
+	SystemMsg(eMsgLevel_Basic, "EEPROM converting directory version %d\n", inVersion);
+
+	for(uint32_t i = 0; i < MStaticArrayLength(gEEPROMEntryList); ++i)
+	{
+		SEEPROMEntry*	newEntry = gEEPROMEntryList + i;
+
+		if(inVersion == eEEPROM_Version105)
+		{
+			SEEPROMEntryV105	oldEntry;
+
+			LoadDataFromEEPROM(&oldEntry, eEEPROM_ListStart + i * sizeof(oldEntry), sizeof(oldEntry));
+			newEntry->uidHash = ComputeUIDHash(oldEntry.uid);
+			newEntry->offset = oldEntry.offset;
+			newEntry->size = oldEntry.size;
+			newEntry->version = oldEntry.version;
+			newEntry->crc = oldEntry.crc;
+		}
+		else
+		{
+			SEEPROMEntryV104	oldEntry;
+
+			LoadDataFromEEPROM(&oldEntry, eEEPROM_ListStart + i * sizeof(oldEntry), sizeof(oldEntry));
+			newEntry->uidHash = ComputeUIDHash(oldEntry.uid);
+			newEntry->offset = oldEntry.offset;
+			newEntry->size = oldEntry.size;
+			newEntry->version = oldEntry.version;
+
+			// There was no crc so take it from the data as it is now
+			newEntry->crc = 0xFFFF;
+			for(uint16_t byteItr = 0; byteItr < oldEntry.size && oldEntry.offset + byteItr < eEEPROM_Size; ++byteItr)
+			{
+				uint8_t	curByte = EEPROM.read(oldEntry.offset + byteItr);
+				newEntry->crc = ComputeCRC16(&curByte, 1, newEntry->crc);
+			}
+		}
+	}
+}
+
+void
+CModule::EEPROMLoadIfNeeded(
+	void)
+{
+	if(eepromLoadPending)
+	{
+		eepromLoadPending = false;
+		LoadDataFromEEPROM(eepromData, eepromOffset, eepromSize);
+
+		// A reset part way through a commit leaves the data and its crc out of step
+		SEEPROMEntry*	target = FindEEPROMEntry(uid);
+		if(target != NULL && target->crc != ComputeCRC16(eepromData, eepromSize))
+		{
+			SystemMsg(eMsgLevel_Basic, "Module %s: eeprom crc mismatch, initializing\n", uid);
+			EEPROMInitialize();
+			EEPROMSave();
+		}
+	}
+}
+
+void
+CModule::EEPROMCommit(
+	void)
+{
+	if(!gEEPROMDirty)
+	{
+		return;
+	}
+
+	gEEPROMDirty = false;
+
+	uint32_t	bytesWritten = 0;
+	for(uint32_t i = 0; i < gModuleCount; ++i)
+	{
+		CModule*	curModule = gModuleList[i];
+		if(!curModule->eepromDirty)
+			continue;
+
+		curModule->eepromDirty = false;
+
+		// A module included after SetupAll() was never given eeprom space so its data stays in memory only
+		SEEPROMEntry*	target = FindEEPROMEntry(curModule->uid);
+		if(target == NULL)
+		{
+			SystemMsg(eMsgLevel_Basic, "Module %s: no eeprom entry, not saved\n", curModule->uid);
+			continue;
+		}
+
+		// The data goes first so a reset before the crc is written is caught at the next boot
+		bytesWritten += WriteDataToEEPROM(curModule->eepromData, curModule->eepromOffset, curModule->eepromSize);
+		target->crc = ComputeCRC16(curModule->eepromData, curModule->eepromSize);
+		bytesWritten += WriteDataToEEPROM(&target->crc, eEEPROM_ListStart + (target - gEEPROMEntryList) * sizeof(SEEPROMEntry) + offsetof(SEEPROMEntry, crc), sizeof(target->crc));
+	}
+
+	++gEEPROMCommitCount;
+	gEEPROMBytesWritten += bytesWritten;
+}
+
 void
 CModule::SetupAll(
 	char const*	inVersionStr,
-	bool		inFlashLED)
+	bool		inFlashLED,
+	bool		inIdleSleep)
 {
 	#if !defined(WIN32)
+	#if MStackPainting
+	PaintStack();
+	#endif
 	gDontEnterFuncCallbacks = false;	// Now start entering the function callbacks
 	#endif
 
+	#if MBootTimeline
+	uint32_t	setupStartUS = micros();
+	#endif
+
 	gVersionStr = inVersionStr;
 	gFlashLED = inFlashLED;
+	gIdleSleep = inIdleSleep;
 	if(inFlashLED)
 	{
 		pinMode(13, OUTPUT);
@@ -461,15 +971,38 @@ CModule::SetupAll(
 
 	MAssert(gTooManyModules == false);
 
-	bool	changes = false;
-	uint8_t	eepromVersion = EEPROM.read(eEEPROM_VersionOffset);
-	uint8_t	eepromModuleCount = EEPROM.read(eEEPROM_ModuleCountOffset);
-	if(eepromVersion == eEEPROM_Version && eepromModuleCount == MStaticArrayLength(gEEPROMEntryList))
+	#if MBootTimeline
+	uint32_t	eepromStartUS = micros();
+	#endif
+
+	bool		changes = false;
+	uint8_t		eepromVersion = EEPROM.read(eEEPROM_VersionOffset);
+	uint8_t		eepromModuleCount = EEPROM.read(eEEPROM_ModuleCountOffset);
+
+	// Only the uid hash is stored in the directory so make sure it is unique
+	for(uint32_t i = 0; i < gModuleCount; ++i)
+	{
+		if(gModuleList[i]->eepromSize == 0)
+			continue;
+
+		uint32_t	uidHash = ComputeUIDHash(gModuleList[i]->uid);
+		for(uint32_t j = 0; j < i; ++j)
+		{
+			MAssert(gModuleList[j]->eepromSize == 0 || ComputeUIDHash(gModuleList[j]->uid) != uidHash);
+		}
+	}
+
+	if(eepromModuleCount == MStaticArrayLength(gEEPROMEntryList) && (eepromVersion == eEEPROM_Version || eepromVersion == eEEPROM_Version105 || eepromVersion == eEEPROM_Version104))
 	{
-		LoadDataFromEEPROM(gEEPROMEntryList, eEEPROM_ListStart, sizeof(gEEPROMEntryList));
-		for(uint32_t i = 0; i < MStaticArrayLength(gEEPROMEntryList); ++i)
+		if(eepromVersion == eEEPROM_Version)
+		{
+			LoadDataFromEEPROM(gEEPROMEntryList, eEEPROM_ListStart, sizeof(gEEPROMEntryList));
+		}
+		else
 		{
-			gEEPROMEntryList[i].inUse = false;
+			// The old module data is kept and moved down into the space freed by the smaller directory below
+			ConvertEEPROMDirectory(eepromVersion);
+			changes = true;
 		}
 
 		int	totalEEPROMSize = eEEPROM_ListStart + sizeof(gEEPROMEntryList);
@@ -495,9 +1028,9 @@ CModule::SetupAll(
 			}
 			else
 			{
+				// Only the directory is read here, the module data is read just before the module is setup
 				curModule->eepromOffset = target->offset;
-				LoadDataFromEEPROM(curModule->eepromData, curModule->eepromOffset, curModule->eepromSize);
-				target->inUse = true;
+				curModule->eepromLoadPending = true;
 			}
 
 			totalEEPROMSize += curModule->eepromSize;
@@ -509,15 +1042,20 @@ CModule::SetupAll(
 		SystemMsg(eMsgLevel_Basic, "EEPROM version mismatch old=%d new=%d\n", eepromVersion, eEEPROM_Version);
 
 		changes = true;
-		for(uint32_t i = 0; i < MStaticArrayLength(gEEPROMEntryList); ++i)
-		{
-			gEEPROMEntryList[i].inUse = false;
-		}
 	}
 
 	if(changes)
 	{
+		// The module data is about to move so read what is still valid from the old location first
+		bool	validData[eMaxModuleCount];
+		for(uint32_t i = 0; i < gModuleCount; ++i)
+		{
+			validData[i] = gModuleList[i]->eepromLoadPending;
+			gModuleList[i]->EEPROMLoadIfNeeded();
+		}
+
 		// since changes have been made compress all module eeprom data into low eeprom space
+		memset(gEEPROMEntryList, 0, sizeof(gEEPROMEntryList));
 		uint16_t		curOffset = eEEPROM_ListStart + sizeof(gEEPROMEntryList);
 		SEEPROMEntry*	curEEPROM = gEEPROMEntryList;
 		for(uint32_t i = 0; i < gModuleCount; ++i)
@@ -528,15 +1066,17 @@ CModule::SetupAll(
 
 			MAssert(curEEPROM < gEEPROMEntryList + MStaticArrayLength(gEEPROMEntryList));
 			curModule->eepromOffset = curOffset;
-			strcpy(curEEPROM->uid, curModule->uid);
+			curEEPROM->uidHash = ComputeUIDHash(curModule->uid);
 			curEEPROM->offset = curOffset;
 			curEEPROM->size = curModule->eepromSize;
 			curEEPROM->version = curModule->eepromVersion;
-			if(!curEEPROM->inUse)
+			if(!validData[i])
 			{
 				SystemMsg(eMsgLevel_Basic, "Module %s: Initializing eeprom\n", curModule->uid);
 				curModule->EEPROMInitialize();
 			}
+			curEEPROM->crc = ComputeCRC16(curModule->eepromData, curModule->eepromSize);
+			curModule->eepromDirty = false;
 			WriteDataToEEPROM(curModule->eepromData, curOffset, curModule->eepromSize);
 			++curEEPROM;
 			curOffset += curModule->eepromSize;
@@ -547,19 +1087,37 @@ CModule::SetupAll(
 		EEPROM.write(eEEPROM_ModuleCountOffset, MStaticArrayLength(gEEPROMEntryList));
 	}
 
+	#if MBootTimeline
+	uint32_t	eepromUS = micros() - eepromStartUS;
+	#endif
+
 	gSetupStarted = true;
 
-	gCurLocalMS = millis();
-	gCurLocalUS = micros();
+	SampleLocalTime();
 
 	for(uint32_t i = 0; i < gModuleCount; ++i)
 	{
 		CModule*	curModule = gModuleList[i];
+		#if MBootTimeline
+		uint32_t	moduleStartUS = micros();
+		#endif
+
+		// Disabled modules are loaded here too so their data is valid if they are enabled later or saved
+		curModule->EEPROMLoadIfNeeded();
 		curModule->SetupIfNeeded();
+
+		#if MBootTimeline
+		SystemMsg("Boot: %s setup %lu us\n", curModule->uid, micros() - moduleStartUS);
+		#endif
 	}
 
 	gConfigModule->SetupFinished();
 
+	#if MBootTimeline
+	gBootSetupDoneUS = micros();
+	SystemMsg("Boot: construct=%lu eeprom=%lu setup=%lu us\n", setupStartUS - gBootStartUS, eepromUS, gBootSetupDoneUS - setupStartUS - eepromUS);
+	#endif
+
 	int32_t	freeMemory = GetFreeMemory();
 	SystemMsg("Free memory after setup = %d\n", freeMemory);
 	MAssert(freeMemory >= 2046);
@@ -573,6 +1131,8 @@ void
 CModule::TearDownAll(
 	void)
 {
+	EEPROMCommit();
+
 	for(uint32_t i = 0; i < gModuleCount; ++i)
 	{
 		#if MDebugModules
@@ -606,7 +1166,7 @@ CModule::ResetAllState(
 		gModuleList[i]->ResetState();
 	}
 
-	SetupAll(gVersionStr, gFlashLED);
+	SetupAll(gVersionStr, gFlashLED, gIdleSleep);
 
 	gTearingDown = true;
 
@@ -620,6 +1180,18 @@ void
 CModule::LoopAll(
 	void)
 {
+	// This is done before the clock is sampled so a signal here also stops simulated time from skipping ahead
+	for(uint32_t itr = 0; itr < gInputWatchCount; ++itr)
+	{
+		if(gInputWatchStreamList[itr]->available() > 0)
+		{
+			gInputWatchModuleList[itr]->Signal();
+		}
+	}
+
+	// Sample the clock once for the whole pass, every module due in this pass sees the same time
+	SampleLocalTime();
+
 	if(gFlashLED && gConfigModule->GetVal(gDontBlinkLEDIndex) == 0)
 	{
 		static bool	on = false;
@@ -633,64 +1205,462 @@ CModule::LoopAll(
 		}
 	}
 
-	for(uint32_t i = 0; i < gModuleCount; ++i)
+	// Any signaled module is due now
+	for(uint32_t wordItr = 0; wordItr < eModule_SignalWordCount; ++wordItr)
 	{
-		if(gTearingDown)
+		if(gSignalPending[wordItr] == 0)
 		{
-			break;
+			continue;
+		}
+
+		noInterrupts();
+		uint32_t	pending = gSignalPending[wordItr];
+		gSignalPending[wordItr] = 0;
+		interrupts();
+
+		for(uint32_t bitItr = 0; pending != 0; ++bitItr, pending >>= 1)
+		{
+			if((pending & 1) == 0)
+			{
+				continue;
+			}
+
+			CModule*	curModule = gModuleList[wordItr * 32 + bitItr];
+			if(curModule->heapIndex != eModule_NotScheduled && curModule->nextUpdateUS > gCurLocalUS)
+			{
+				curModule->nextUpdateUS = gCurLocalUS;
+				ScheduleSiftUp(curModule->heapIndex);
+			}
 		}
-		gModuleList[i]->UpdateIfNeeded();
+	}
+
+	// Pull every due module off the heap before running any of them, this ensures a module with a zero update period only runs once per pass
+	CModule*	dueList[eMaxModuleCount];
+	uint32_t	dueCount = 0;
+
+	while(gScheduleCount > 0 && gScheduleHeap[0]->nextUpdateUS <= gCurLocalUS)
+	{
+		dueList[dueCount++] = ScheduleRemoveTop();
+	}
+
+	CModule*	slowestModule = NULL;
+	char const*	slowestHandlerName = NULL;
+	uint32_t	slowestUS = 0;
+
+	uint32_t	backgroundUS = 0;
+	bool		deferred = false;
+
+	// Run the due modules tier by tier, within a tier they run in deadline order
+	for(uint8_t tier = eModulePriority_RealTime; tier < eModulePriority_Count; ++tier)
+	{
+		for(uint32_t i = 0; i < dueCount; ++i)
+		{
+			CModule*	curModule = dueList[i];
+
+			if(curModule->priority != tier)
+			{
+				continue;
+			}
+
+			if(tier == eModulePriority_Background && gBackgroundBudgetUS > 0 && backgroundUS >= gBackgroundBudgetUS && !gTearingDown)
+			{
+				// The module keeps its old deadline and is signaled so it is first in line for the next pass
+				++gBackgroundDeferCount[curModule->moduleIndex];
+				deferred = true;
+				curModule->Reschedule();
+				curModule->Signal();
+				continue;
+			}
+
+			if(!gTearingDown)
+			{
+				gHandlerSlowestName = NULL;
+				gHandlerSlowestUS = 0;
+
+				uint32_t	updateUS = curModule->UpdateIfNeeded();
+
+				#if MBootTimeline
+				if(gBootSetupDoneUS != 0)
+				{
+					uint32_t	curUS = micros();
+					SystemMsg("Boot: first update %s at %lu us, %lu us after setup\n", curModule->uid, curUS - gBootStartUS, curUS - gBootSetupDoneUS);
+					gBootSetupDoneUS = 0;
+				}
+				#endif
+
+				if(tier == eModulePriority_Background)
+				{
+					backgroundUS += updateUS;
+				}
+
+				if(slowestModule == NULL || updateUS > slowestUS)
+				{
+					slowestModule = curModule;
+					slowestHandlerName = gHandlerSlowestName;
+					slowestUS = updateUS;
+				}
+			}
+
+			// Always put the module back on the heap even when tearing down so it is not lost from the schedule
+			curModule->Reschedule();
+		}
+	}
+
+	if(deferred)
+	{
+		++gBackgroundDeferPassCount;
 	}
 
 	gTearingDown = false;
+
+	uint32_t	passUS = micros() - gLastMicros;
+
+	if(gLoopBudgetUS > 0 && passUS > gLoopBudgetUS)
+	{
+		SLoopOverrun*	newOverrun = gLoopOverrunList + gLoopOverrunCount++ % eLoopMonitor_MaxOverruns;
+
+		newOverrun->moduleName = slowestModule != NULL ? slowestModule->uid : "(none)";
+		newOverrun->handlerName = slowestHandlerName;
+		newOverrun->passUS = passUS;
+		newOverrun->moduleUS = slowestUS;
+		newOverrun->timeMS = (uint32_t)gCurLocalMS;
+	}
+	else if(gLoopFeedWatchdog)
+	{
+		#if defined(WDOG_REFRESH)
+		// A stalled module stops the refresh and lets the watchdog reset the cpu
+		noInterrupts();
+		WDOG_REFRESH = 0xA602;
+		WDOG_REFRESH = 0xB480;
+		interrupts();
+		#endif
+	}
+
+	// The commit is done outside the monitored pass so the eeprom write time is not charged to a module
+	if(gEEPROMDirty && gCurLocalMS >= gEEPROMCommitDueMS)
+	{
+		EEPROMCommit();
+	}
+
+	#if !defined(WIN32)
+	if(gIdleSleep && gScheduleCount > 0)
+	{
+		bool	signalPending = false;
+		for(uint32_t wordItr = 0; wordItr < eModule_SignalWordCount; ++wordItr)
+		{
+			signalPending |= gSignalPending[wordItr] != 0;
+		}
+
+		SampleLocalTime();
+		if(!signalPending && gScheduleHeap[0]->nextUpdateUS > gCurLocalUS + eIdleSleepMinUS)
+		{
+			// Sleep until the next interrupt, the systick interrupt wakes us at least every ms so the next deadline is never missed by more than that
+			asm volatile("wfi");
+		}
+	}
+	#endif
 }
 
-void
+uint32_t
 CModule::UpdateIfNeeded(
 	void)
+{
+	if(!enabled)
+	{
+		return 0;
+	}
+
+	uint32_t	deltaUS = (uint32_t)(gCurLocalUS - lastUpdateUS);
+	uint32_t	startUS = micros();
+
+	Update(deltaUS);
+
+	uint32_t	durationUS = micros() - startUS;
+
+	#if MModuleProfiling
+	ProfileUpdate(moduleIndex, durationUS, deltaUS > updateTimeUS ? deltaUS - updateTimeUS : 0);
+	#endif
+
+	lastUpdateUS = gCurLocalUS;
+
+	return durationUS;
+}
+
+void
+CModule::Signal(
+	void)
+{
+	uint32_t	bit = 1UL << (moduleIndex % 32);
+
+	// This is called from interrupt handlers too so the interrupt state is restored rather than turned back on
+	uint32_t	interruptState = SaveAndDisableInterrupts();
+	gSignalPending[moduleIndex / 32] |= bit;
+	RestoreInterrupts(interruptState);
+}
+
+void
+CModule::SignalOnInput(
+	Stream*	inStream)
+{
+	MReturnOnError(gInputWatchCount >= eModule_MaxInputWatches);
+
+	gInputWatchStreamList[gInputWatchCount] = inStream;
+	gInputWatchModuleList[gInputWatchCount] = this;
+	++gInputWatchCount;
+}
+
+void
+CModule::SetLoopBudget(
+	uint32_t	inBudgetUS,
+	bool		inFeedWatchdog)
+{
+	gLoopBudgetUS = inBudgetUS;
+	gLoopFeedWatchdog = inFeedWatchdog;
+}
+
+void
+CModule::SetBackgroundBudget(
+	uint32_t	inBudgetUS)
+{
+	gBackgroundBudgetUS = inBudgetUS;
+}
+
+void
+LoopMonitorHandlerStart(
+	char const*	inHandlerName)
+{
+	// Only the outermost handler is timed, nested handlers are charged to it
+	if(gHandlerDepth++ == 0)
+	{
+		gHandlerCurName = inHandlerName;
+		gHandlerStartUS = micros();
+	}
+}
+
+void
+LoopMonitorHandlerEnd(
+	void)
+{
+	if(gHandlerDepth == 0 || --gHandlerDepth > 0)
+	{
+		return;
+	}
+
+	uint32_t	durationUS = micros() - gHandlerStartUS;
+
+	if(gHandlerSlowestName == NULL || durationUS > gHandlerSlowestUS)
+	{
+		gHandlerSlowestName = gHandlerCurName;
+		gHandlerSlowestUS = durationUS;
+	}
+}
+
+void
+CModule::Reschedule(
+	void)
+{
+	if(enabled && hasBeenSetup && updateTimeUS != eUpdateTime_SignalOnly)
+	{
+		nextUpdateUS = lastUpdateUS + updateTimeUS;
+	}
+	else
+	{
+		// Park disabled and signal only modules at the bottom of the heap, SetEnabledState() or Signal() will bring them back up
+		nextUpdateUS = UINT64_MAX;
+	}
+
+	if(heapIndex == eModule_NotScheduled)
+	{
+		MAssert(gScheduleCount < MStaticArrayLength(gScheduleHeap));
+		heapIndex = (uint16_t)gScheduleCount;
+		gScheduleHeap[gScheduleCount++] = this;
+	}
+
+	ScheduleSiftUp(heapIndex);
+	ScheduleSiftDown(heapIndex);
+}
+
+bool
+CModule::ScheduleIsBefore(
+	CModule const*	inA,
+	CModule const*	inB)
+{
+	return inA->nextUpdateUS < inB->nextUpdateUS || (inA->nextUpdateUS == inB->nextUpdateUS && inA->moduleIndex < inB->moduleIndex);
+}
+
+void
+CModule::ScheduleSiftUp(
+	uint32_t	inIndex)
+{
+	CModule*	target = gScheduleHeap[inIndex];
+
+	while(inIndex > 0)
+	{
+		uint32_t	parentIndex = (inIndex - 1) / 2;
+		CModule*	parent = gScheduleHeap[parentIndex];
+
+		if(!ScheduleIsBefore(target, parent))
+		{
+			break;
+		}
+
+		gScheduleHeap[inIndex] = parent;
+		parent->heapIndex = (uint16_t)inIndex;
+		inIndex = parentIndex;
+	}
+
+	gScheduleHeap[inIndex] = target;
+	target->heapIndex = (uint16_t)inIndex;
+}
+
+void
+CModule::ScheduleSiftDown(
+	uint32_t	inIndex)
+{
+	CModule*	target = gScheduleHeap[inIndex];
+
+	for(;;)
+	{
+		uint32_t	childIndex = inIndex * 2 + 1;
+
+		if(childIndex >= gScheduleCount)
+		{
+			break;
+		}
+
+		CModule*	child = gScheduleHeap[childIndex];
+
+		if(childIndex + 1 < gScheduleCount)
+		{
+			CModule*	rightChild = gScheduleHeap[childIndex + 1];
+			if(ScheduleIsBefore(rightChild, child))
+			{
+				++childIndex;
+				child = rightChild;
+			}
+		}
+
+		if(!ScheduleIsBefore(child, target))
+		{
+			break;
+		}
+
+		gScheduleHeap[inIndex] = child;
+		child->heapIndex = (uint16_t)inIndex;
+		inIndex = childIndex;
+	}
+
+	gScheduleHeap[inIndex] = target;
+	target->heapIndex = (uint16_t)inIndex;
+}
+
+CModule*
+CModule::ScheduleRemoveTop(
+	void)
+{
+	CModule*	result = gScheduleHeap[0];
+
+	result->heapIndex = eModule_NotScheduled;
+	--gScheduleCount;
+
+	if(gScheduleCount > 0)
+	{
+		gScheduleHeap[0] = gScheduleHeap[gScheduleCount];
+		ScheduleSiftDown(0);
+	}
+
+	return result;
+}
+
+void
+CModule::SampleLocalTime(
+	void)
 {
 	uint32_t	curMillis = millis();
 	uint32_t	curMicros = micros();
 
+	#if defined(WIN32)
+	if(gSimulatedTime)
+	{
+		// The host clock is still sampled so the loop monitor measures the real time of a pass
+		gLastMillis = curMillis;
+		gLastMicros = curMicros;
+		AdvanceSimulatedTime();
+		return;
+	}
+	#endif
+
 	gCurLocalMS += curMillis - gLastMillis;
 	gCurLocalUS += curMicros - gLastMicros;
 	gLastMillis = curMillis;
 	gLastMicros = curMicros;
+}
 
-	uint64_t	updateDeltaUS = gCurLocalUS - lastUpdateUS;
-	if(updateDeltaUS >= updateTimeUS)
+#if defined(WIN32)
+void
+CModule::SetSimulatedTime(
+	bool	inEnabled)
+{
+	// Resample the host clock so no real time is added when switching either way
+	gLastMillis = millis();
+	gLastMicros = micros();
+	gSimulatedTime = inEnabled;
+}
+
+void
+CModule::AdvanceSimulatedTime(
+	void)
+{
+	for(uint32_t wordItr = 0; wordItr < eModule_SignalWordCount; ++wordItr)
 	{
-		if(enabled)
+		if(gSignalPending[wordItr] != 0)
 		{
-			//Serial.printf("%s\n", uid); Serial.flush();//delay(100);
-			#if 0
-			uint32_t startMS = millis();
-			#endif
-			Update((uint32_t)updateDeltaUS);
-			#if 0
-			uint32_t doneMS = millis();
-			uint32_t	result = doneMS - startMS;
-			if(result > 0)
-			{
-				Serial.printf("%s = %d\n", uid, result);
-			}
-			#endif
-			lastUpdateUS = gCurLocalUS;
+			return;
 		}
 	}
+
+	// Modules with a zero update period run on every pass so they can not hold back the clock, parked modules have a deadline of UINT64_MAX
+	uint64_t	nextUS = UINT64_MAX;
+	for(uint32_t itr = 0; itr < gScheduleCount; ++itr)
+	{
+		CModule*	curModule = gScheduleHeap[itr];
+		if(curModule->updateTimeUS != 0 && curModule->nextUpdateUS < nextUS)
+		{
+			nextUS = curModule->nextUpdateUS;
+		}
+	}
+
+	if(nextUS == UINT64_MAX || nextUS <= gCurLocalUS)
+	{
+		return;
+	}
+
+	// Milliseconds are carried from the microsecond clock so the two never drift apart
+	gCurLocalMS += nextUS / 1000 - gCurLocalUS / 1000;
+	gCurLocalUS = nextUS;
 }
+#endif
 
 void
 StartingModuleConstruction(
 	char const*	inClassName,
-	uint32_t	inClassSize)
+	uint32_t	inClassSize,
+	bool		inHeapAllocated)
 {
 	#if MDebugModules
 	SystemMsg("%s StartConstruction: class size = %ld, free mem = %ld", inClassName, inClassSize, GetFreeMemory());
 	#endif
-	MAssert((int32_t)inClassSize <= GetFreeMemory());
+	MAssert(!inHeapAllocated || (int32_t)inClassSize <= GetFreeMemory());
 	gCurrentModuleConstructingName = inClassName;
 	gCurrentModuleClassSize = inClassSize;
+
+	#if MBootTimeline
+	if(!gBootStarted)
+	{
+		gBootStartUS = micros();
+		gBootStarted = true;
+	}
+	#endif
 }
 
 #if !defined(WIN32)
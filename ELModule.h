@@ -34,6 +34,12 @@
 
 	A module's constructor can only initialize itself, it can not access other modules
 	A module's Setup() method may reference other modules, any module included during a constructor will itself be constructed and added to the module list
+
+	Modules are kept in a heap ordered by the deadline of their next Update() call so each pass of LoopAll() only touches the modules that are due
+	A module that is waiting on input can use a long update period (or eUpdateTime_SignalOnly) and call Signal() from an interrupt handler or another module when there is work to do,
+	or use SignalOnInput() to be signaled when a serial port has input
+
+	EEPROMSave() only marks the module's eeprom data dirty, all dirty modules are written together once per eEEPROM_CommitDelayMS and only the bytes that changed are written
 */
 #include <new>
 
@@ -44,6 +50,23 @@
 enum
 {
 	eMaxModuleCount = 32,
+
+	eModule_NotScheduled = 0xFFFF,	// The heap index of a module that is not currently in the update schedule
+
+	eLoopMonitor_MaxOverruns = 8,	// The number of loop overruns kept for the loop_overruns command
+
+	eModule_SignalWordCount = (eMaxModuleCount + 31) / 32,
+
+	eModule_MaxInputWatches = 8,	// The number of streams that can be watched with SignalOnInput()
+
+	eUpdateTime_SignalOnly = 0xFFFFFFFF,	// Pass this as the update period for a module that only wants Update() called after Signal()
+
+	// The priority tier of a module, all due modules in a tier are updated before any module in the next tier
+	eModulePriority_RealTime = 0,
+	eModulePriority_Normal,
+	eModulePriority_Background,	// Background modules are deferred to the next pass once the background budget is used
+
+	eModulePriority_Count,
 };
 
 class CModule
@@ -68,6 +91,40 @@ public:
 	HasBeenSetup(
 		void);
 
+	// Mark the module as runnable so its Update() is called on the next pass of LoopAll() regardless of its update period, this is safe to call from an interrupt handler
+	void
+	Signal(
+		void);
+
+	// Signal the module whenever the stream has input available, the streams are checked at the start of every pass of LoopAll() which costs far less than updating the module
+	// The serial RX interrupt is in the core and has no hook so this is how a module waiting on a serial port can use a long update period and still respond on the next pass
+	void
+	SignalOnInput(
+		Stream*	inStream);
+
+	// Set the time budget for a single pass of LoopAll(), a pass that exceeds it is recorded along with the module and handler that took the longest
+	static void
+	SetLoopBudget(
+		uint32_t	inBudgetUS,					// 0 disables the loop monitor
+		bool		inFeedWatchdog = false);	// If true the hardware watchdog is refreshed only after a pass that completes within the budget, the sketch must enable the watchdog itself
+
+	// Write the eeprom data of every module that has called EEPROMSave() since the last commit, call this before an intentional reset
+	static void
+	EEPROMCommit(
+		void);
+
+	// Set the time budget for background tier modules in a single pass of LoopAll(), at least one due background module is always updated per pass
+	static void
+	SetBackgroundBudget(
+		uint32_t	inBudgetUS);	// 0 means background modules are never deferred
+
+#if defined(WIN32)
+	// In simulated time the local clock no longer follows millis() and micros(), instead each pass of LoopAll() jumps it to the next module deadline so long schedules can be run in a fraction of the real time
+	static void
+	SetSimulatedTime(
+		bool	inEnabled);
+#endif
+
 	char const*		uid;	// The unique ID for the module
 
 protected:
@@ -78,7 +135,8 @@ protected:
 		uint16_t	inEEPROMVersion = 0,	// This is the version number of the eeprom (so the system can reinitialize eeprom when the version number changes)
 		void*		inEEPROMData = NULL,	// A pointer to the local eeprom data storage
 		uint32_t	inUpdateTimeUS = 0,		// The period between Update() calles
-		bool		inEnabled = true);		// This is the initial enabled state for the module
+		bool		inEnabled = true,		// This is the initial enabled state for the module
+		uint8_t		inPriority = eModulePriority_Normal);	// The priority tier for Update() calls
 	
 	// Override this to setup the initial state of the module
 	virtual void
@@ -109,11 +167,16 @@ protected:
 	DumpDebugInfo(
 		IOutputDirector*	inOutput);
 
-	// This saves the eeprom data into the eeprom
+	// This marks the eeprom data to be saved into the eeprom by the next EEPROMCommit()
 	void
 	EEPROMSave(
 		void);
 
+	// The eeprom data is loaded just before Setup(), a module whose eeprom data is read by other modules before its own Setup() must call this first
+	void
+	EEPROMLoadIfNeeded(
+		void);
+
 	uint16_t		eepromOffset;
 	bool			logDebugData;
 
@@ -125,22 +188,65 @@ private:
 	uint32_t		updateTimeUS;
 	uint32_t		classSize;
 	uint64_t		lastUpdateUS;
+	uint64_t		nextUpdateUS;	// The deadline for the next Update() call, this is the key for the schedule heap
+	uint16_t		moduleIndex;	// The index into the module list, this breaks ties between equal deadlines so modules run in include order
+	uint16_t		heapIndex;		// The index into the schedule heap or eModule_NotScheduled
+	uint8_t			priority;
 	bool			enabled;
+	bool			eepromLoadPending;	// True if eepromData has not yet been read from eepromOffset
+	bool			eepromDirty;		// True if EEPROMSave() has been called since the last commit
 	bool			hasBeenSetup;
 
 	void
 	SetupIfNeeded(
 		void);
 
-	void
+	// Returns the time in us spent in Update()
+	uint32_t
 	UpdateIfNeeded(
 		void);
 
+	// Recompute the deadline for the next Update() call and move the module to its proper place in the schedule heap
+	void
+	Reschedule(
+		void);
+
+	// Return true if inA is due before inB
+	static bool
+	ScheduleIsBefore(
+		CModule const*	inA,
+		CModule const*	inB);
+
+	static void
+	ScheduleSiftUp(
+		uint32_t	inIndex);
+
+	static void
+	ScheduleSiftDown(
+		uint32_t	inIndex);
+
+	static CModule*
+	ScheduleRemoveTop(
+		void);
+
+	// Accumulate the elapsed time into gCurLocalMS and gCurLocalUS, this is done once per pass of LoopAll()
+	static void
+	SampleLocalTime(
+		void);
+
+#if defined(WIN32)
+	// Advance the local clock to the earliest deadline of a module with an update period unless something is already due
+	static void
+	AdvanceSimulatedTime(
+		void);
+#endif
+
 	// This is called from the sketch's setup() function in the .ino file
 	static void
 	SetupAll(
 		char const*	inVersionStr,
-		bool		inFlashLED);
+		bool		inFlashLED,
+		bool		inIdleSleep = false);	// Pass in true to sleep the cpu until the next interrupt when no module is due for an update
 
 	// This is called from the sketch's loop() function in the .ino file
 	static void
@@ -169,6 +275,15 @@ private:
 	friend class CModuleManager;
 };
 
+// Call these around a callback made on behalf of a module (alarms, events, commands, etc) so a loop overrun can name the handler responsible
+void
+LoopMonitorHandlerStart(
+	char const*	inHandlerName);	// This must be a static string
+
+void
+LoopMonitorHandlerEnd(
+	void);
+
 extern uint64_t		gCurLocalMS;	// The accumulated ms since boot, its 64-bit so it will never overflow
 extern uint64_t		gCurLocalUS;	// The accumulated us since boot, its 64-bit so it will never overflow
 extern char const*	gVersionStr;
@@ -176,7 +291,8 @@ extern char const*	gVersionStr;
 void
 StartingModuleConstruction(
 	char const*	inClassName,
-	uint32_t	inClassSize);
+	uint32_t	inClassSize,
+	bool		inHeapAllocated = true);
 
 #define MModule_Declaration(inClassName, ...)	\
 	static inClassName*							\
@@ -219,4 +335,39 @@ inClassName::Include(									\
 	return result;																	\
 }
 
+// Use these in place of MModuleImplementation_Finish and MModuleImplementation_FinishGlobal to construct the module in static storage instead of the heap,
+// the module's RAM is then accounted for at link time and there is no heap fragmentation at boot
+#define MModuleImplementation_FinishStaticGlobal(inClassName, inGlobalVariable, ...)	\
+	static inClassName* currentConstruction = NULL;										\
+	if(currentConstruction != NULL)														\
+	{																					\
+		return currentConstruction;														\
+	}																					\
+	static uint64_t	moduleStorage[(sizeof(inClassName) + sizeof(uint64_t) - 1) / sizeof(uint64_t)];	\
+	StartingModuleConstruction(#inClassName, sizeof(inClassName), false);				\
+	currentConstruction = (inClassName*)moduleStorage;									\
+	inClassName*	result = new(currentConstruction) inClassName(__VA_ARGS__);			\
+	result->DoneConstructing();															\
+	inGlobalVariable = result;															\
+	return result;																		\
+}
+
+// Like MModuleImplementation_Finish each call to Include() constructs a new instance, storage is reserved for inMaxInstances of them and including more asserts
+#define MModuleImplementation_FinishStatic(inClassName, inMaxInstances, ...)			\
+	static inClassName* currentConstruction = NULL;										\
+	if(currentConstruction != NULL)														\
+	{																					\
+		return currentConstruction;														\
+	}																					\
+	static uint64_t	moduleStorage[inMaxInstances][(sizeof(inClassName) + sizeof(uint64_t) - 1) / sizeof(uint64_t)];	\
+	static uint32_t	instanceCount = 0;													\
+	MAssert(instanceCount < (inMaxInstances));											\
+	StartingModuleConstruction(#inClassName, sizeof(inClassName), false);				\
+	currentConstruction = (inClassName*)moduleStorage[instanceCount++];					\
+	inClassName*	result = new(currentConstruction) inClassName(__VA_ARGS__);			\
+	result->DoneConstructing();															\
+	currentConstruction = NULL;															\
+	return result;																		\
+}
+
 #endif /* _ELMODULE_H_ */
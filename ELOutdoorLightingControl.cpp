@@ -121,7 +121,7 @@ CModule_OutdoorLightingControl::Setup(
 	digitalWriteFast(transformerPin, false);
 
 	// Register the alarms, events, and commands
-	MRealTimeRegisterTimeChange("OutdoorLighting", CModule_OutdoorLightingControl::TimeChangeMethod);
+	MRealTimeRegisterTimeChange(timeChangeHandler, "OutdoorLighting", CModule_OutdoorLightingControl::TimeChangeMethod);
 	if(togglePin != 0xFF)
 	{
 		MDigitalIORegisterEventHandler(togglePin, false, CModule_OutdoorLightingControl::ButtonPush, NULL);
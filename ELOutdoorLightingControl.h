@@ -295,6 +295,7 @@ private:
 
 	TSunRiseAndSetEventRef	SunriseEvent;
 	TSunRiseAndSetEventRef	SunsetEvent;
+	STimeChangeHandler		timeChangeHandler;
 
 	int			toggleCount;
 	uint64_t	toggleLastTimeMS;
@@ -42,81 +42,81 @@ STimeZoneRule gTimeZone =
 	2, 1, 3, 2, -7 * 60,
 	1, 1, 11, 2, -8 * 60,
 };
+#endif
 
-class CRealTimeDataProvider_DS3234 : public IRealTimeDataProvider
+enum
 {
-public:
-
-	CRealTimeDataProvider_DS3234(
-		int		inChipSelect,
-		bool	inUseAltSPI)
-	{
-	}
-
-	virtual bool
-	SetUTCDateAndTime(
-		int			inYear,			// 20xx
-		int			inMonth,		// 1 to 12
-		int			inDayOfMonth,	// 1 to 31
-		int			inHour,			// 00 to 23
-		int			inMinute,		// 00 to 59
-		int			inSecond)		// 00 to 59
-	{
-		return true;
-	}
+	eDS3234_Seconds = 0x00,			// Seconds, minutes, hours, day, date, month and year are consecutive bcd registers
+	eDS3234_Alarm1Seconds = 0x07,	// Alarm 1 seconds, minutes, hours and date
+	eDS3234_Control = 0x0E,
+	eDS3234_Status = 0x0F,
+	eDS3234_RegisterCount = 0x14,
+	eDS3234_WriteAddress = 0x80,
+
+	eDS3234_ControlDefault = 0x60,	// Battery backed square wave, temperature conversion, alarms disabled
+	eDS3234_ControlINTCN = 0x04,	// The INT/SQW output is the alarm interrupt instead of the square wave
+	eDS3234_ControlA1IE = 0x01,
+	eDS3234_StatusA1F = 0x01,
+	eDS3234_MonthCentury = 0x80,
+};
 
-	// This requests a syncronization from the provider which must call gRealTime->SetDateAndTime() to set the time, this allows the fetching of the date and time to be asyncronous
-	virtual bool
-	RequestSync(
-		void)
-	{
-		time_t	localTime = time(NULL) /*- 33 * 60*/;
-		gRealTime->SetEpochTime((TEpochTime)localTime, true, this);
-		return true;
-	}
+enum
+{
+	eISRTimerRequest_None,
+	eISRTimerRequest_Arm,
+	eISRTimerRequest_Cancel,
 };
 
-#else
+static uint8_t
+ToBCD(
+	int	inValue)
+{
+	return (uint8_t)(((inValue / 10) << 4) | (inValue % 10));
+}
+
+static int
+FromBCD(
+	uint8_t	inValue)
+{
+	return ((inValue >> 4) & 0x07) * 10 + (inValue & 0x0F);
+}
 
+// The time registers are read and written in a single burst so they can not roll over between bytes
 class CRealTimeDataProvider_DS3234 : public IRealTimeDataProvider
 {
 public:
 	
 	CRealTimeDataProvider_DS3234(
 		int		inChipSelect,
-		bool	inUseAltSPI)
+		bool	inUseAltSPI,
+		uint8_t	inAlarmPin)
 		:
 		spiSettings(2000000, MSBFIRST, SPI_MODE3),
 		useAltSPI(inUseAltSPI)
 	{
 		chipselect = inChipSelect;
+		alarmPin = inAlarmPin;
+		control = eDS3234_ControlDefault;
 
-		pinMode(chipselect, OUTPUT);
+		#if defined(WIN32)
+			memset(registerFile, 0, sizeof(registerFile));
+			timeOffset = (int32_t)time(NULL);	// The chip starts out at the host time
+		#else
+			pinMode(chipselect, OUTPUT);
+		#endif
 
-		if(useAltSPI)
+		if(alarmPin != 0xFF)
 		{
-			SPI.setMISO(8);
-			SPI.setMOSI(7);
-			SPI.setSCK(14);
-		}
-
-		SPI.begin();
-		SPI.beginTransaction(spiSettings);
-		digitalWrite(chipselect, LOW);  
-		delayMicroseconds(1);
-		//set control register 
-		SPI.transfer(0x8E);
-		SPI.transfer(0x60); //60= disable Oscillator and Battery SQ wave @1hz, temp compensation, Alarms disabled
-		digitalWrite(chipselect, HIGH);
-		SPI.endTransaction();
-		SPI.end();
+			control |= eDS3234_ControlINTCN;
 
-		if(useAltSPI)
-		{
-			SPI.setMISO(12);
-			SPI.setMOSI(11);
-			SPI.setSCK(13);
+			#if !defined(WIN32)
+				// The alarm output is open drain and active low
+				pinMode(alarmPin, INPUT_PULLUP);
+				attachInterrupt(alarmPin, CRealTimeDataProvider_DS3234::AlarmInterrupt, FALLING);
+			#endif
 		}
+
+		WriteRegisters(eDS3234_Control, &control, 1);
 	}
 
 	virtual bool
@@ -129,7 +129,6 @@ public:
 		int			inSec)
 	{
 		int	centuryBit;
-		bool	result = true;
 
 		if(inYear >= 1970 && inYear <= 1999)
 		{
@@ -162,146 +161,303 @@ public:
 			return false;
 		}
 
-		int TimeDate [7] = {inSec, inMin, inHour, 0, inDayOfMonth, inMonth, inYear};
-		//SystemMsg("set %d %d %d %d %d %d\n", TimeDate[6], TimeDate[5], TimeDate[4], TimeDate[2], TimeDate[1], TimeDate[0]);
+		int		dayOfWeek = gRealTime->GetDayOfWeekFromEpoch(gRealTime->GetEpochTimeFromComponents(inYear + (centuryBit ? 2000 : 1900), inMonth, inDayOfMonth, 0, 0, 0));
+		uint8_t	timeData[7] = {ToBCD(inSec), ToBCD(inMin), ToBCD(inHour), (uint8_t)dayOfWeek, ToBCD(inDayOfMonth), (uint8_t)(ToBCD(inMonth) | (centuryBit ? eDS3234_MonthCentury : 0)), ToBCD(inYear)};
+		uint8_t	readData[7];
 
-		if(useAltSPI)
+		// Writing the seconds resets the chip's countdown chain so the read back can not see a roll over
+		WriteRegisters(eDS3234_Seconds, timeData, sizeof(timeData));
+		ReadRegisters(eDS3234_Seconds, readData, sizeof(readData));
+
+		for(int i = 0; i < (int)sizeof(timeData); ++i)
 		{
-			SPI.setMISO(8);
-			SPI.setMOSI(7);
-			SPI.setSCK(14);
+			if(timeData[i] != readData[i])
+			{
+				SystemMsg("Date written incorrectly, i=%d wr=%x rd=%x", i, timeData[i], readData[i]);
+				return false;
+			}
 		}
-		SPI.begin();
-		for(int i = 0; i < 7; ++i)
+
+		return true;
+	}
+
+	virtual bool
+	RequestSync(
+		void)
+	{
+		uint8_t	timeData[7];	// second, minute, hour, day, date, month, year
+
+		ReadRegisters(eDS3234_Seconds, timeData, sizeof(timeData));
+
+		int	year = FromBCD(timeData[6]);
+		int	month = FromBCD(timeData[5] & ~eDS3234_MonthCentury);	// No actual need to do anything with the century bit since the year number dictates 1900 or 2000
+		int	dayOfMonth = FromBCD(timeData[4]);
+		int	hour = FromBCD(timeData[2]);
+		int	min = FromBCD(timeData[1]);
+		int	sec = FromBCD(timeData[0]);
+
+		year += (year >= 70 && year <= 99) ? 1900 : 2000;
+
+		if(month < 1 || month > 12 || dayOfMonth < 1 || dayOfMonth > 31 || hour > 23 || min > 59 || sec > 59)
 		{
-			if(i == 3)
-				continue;
+			SystemMsg("RequestSync: Invalid date from hardware %d %d %d %d %d %d\n", year, month, dayOfMonth, hour, min, sec);
+			return false;
+		}
 
-			int b = TimeDate[i] / 10;
-			int a = TimeDate[i] % 10;
+		gRealTime->SetDateAndTime(year, month, dayOfMonth, hour, min, sec, true, this);
 
-			TimeDate[i] = a + (b << 4);
+		return true;
+	}
 
-			if(i == 5 && centuryBit == 1)
-			{
-				TimeDate[i] |= 0x80;
-			}
-			
-			SPI.beginTransaction(spiSettings);
-			digitalWrite(chipselect, LOW);
-			delayMicroseconds(1);
-			SPI.transfer(i + 0x80); 
-			SPI.transfer(TimeDate[i]);        
-			digitalWrite(chipselect, HIGH);
-			SPI.endTransaction();
-
-			SPI.beginTransaction(spiSettings);
-			digitalWrite(chipselect, LOW);
-			delayMicroseconds(1);
-			SPI.transfer(i + 0x00);
-			int n = SPI.transfer(0x00);
-			digitalWrite(chipselect, HIGH);
-			SPI.endTransaction();
-
-			if(TimeDate[i] != n)
-			{
-				SystemMsg("Date written incorrectly, i=%d wr=%x rd=%x", i, TimeDate[i], n);
-				result = false;
-				break;
-			}
+	virtual bool
+	SetAlarmUTC(
+		TEpochTime	inAlarmTimeUTC)
+	{
+		if(alarmPin == 0xFF)
+		{
+			return false;
+		}
 
+		if(inAlarmTimeUTC == 0)
+		{
+			control &= ~eDS3234_ControlA1IE;
 		}
-		SPI.end();
-		if(useAltSPI)
+		else
 		{
-			SPI.setMISO(12);
-			SPI.setMOSI(11);
-			SPI.setSCK(13);
+			int	year, month, dayOfMonth, dayOfWeek, hour, min, sec;
+
+			gRealTime->GetComponentsFromEpochTime(inAlarmTimeUTC, year, month, dayOfMonth, dayOfWeek, hour, min, sec);
+
+			// The mask bits are clear so alarm 1 matches the date, hours, minutes and seconds
+			uint8_t	alarmData[4] = {ToBCD(sec), ToBCD(min), ToBCD(hour), ToBCD(dayOfMonth)};
+
+			WriteRegisters(eDS3234_Alarm1Seconds, alarmData, sizeof(alarmData));
+			control |= eDS3234_ControlA1IE;
 		}
 
-		return result;
+		// Clearing the alarm flag releases the interrupt output so the next alarm gives a new falling edge
+		uint8_t	controlAndStatus[2];
+
+		ReadRegisters(eDS3234_Control, controlAndStatus, sizeof(controlAndStatus));
+		controlAndStatus[0] = control;
+		controlAndStatus[1] &= ~eDS3234_StatusA1F;
+		WriteRegisters(eDS3234_Control, controlAndStatus, sizeof(controlAndStatus));
+
+		return true;
 	}
 
-	virtual bool
-	RequestSync(
+private:
+
+	static void
+	AlarmInterrupt(
 		void)
 	{
-		int TimeDate [7]; //second,minute,hour,null,day,month,year
+		gRealTime->Signal();
+	}
 
-		if(useAltSPI)
+#if defined(WIN32)
+	// A register level stand in for the chip, the time registers run from the local clock so they keep pace with simulated time
+	void
+	ReadRegisters(
+		uint8_t		inAddress,
+		uint8_t*	outData,
+		int			inCount)
+	{
+		int	year, month, dayOfMonth, dayOfWeek, hour, min, sec;
+
+		gRealTime->GetComponentsFromEpochTime((TEpochTime)(timeOffset + gCurLocalUS / 1000000), year, month, dayOfMonth, dayOfWeek, hour, min, sec);
+		registerFile[0] = ToBCD(sec);
+		registerFile[1] = ToBCD(min);
+		registerFile[2] = ToBCD(hour);
+		registerFile[3] = (uint8_t)dayOfWeek;
+		registerFile[4] = ToBCD(dayOfMonth);
+		registerFile[5] = (uint8_t)(ToBCD(month) | (year >= 2000 ? eDS3234_MonthCentury : 0));
+		registerFile[6] = ToBCD(year % 100);
+
+		if((registerFile[eDS3234_Control] & eDS3234_ControlA1IE) && memcmp(registerFile + eDS3234_Alarm1Seconds, registerFile + eDS3234_Seconds, 3) == 0 && registerFile[eDS3234_Alarm1Seconds + 3] == registerFile[4])
 		{
-			SPI.setMISO(8);
-			SPI.setMOSI(7);
-			SPI.setSCK(14);
+			registerFile[eDS3234_Status] |= eDS3234_StatusA1F;
 		}
 
-		SPI.begin();
-		for(int i = 0; i < 7; ++i)
+		for(int i = 0; i < inCount; ++i)
 		{
-			if(i == 3)
-				continue;
+			outData[i] = registerFile[(inAddress + i) % eDS3234_RegisterCount];
+		}
+	}
 
-			SPI.beginTransaction(spiSettings);
-			digitalWrite(chipselect, LOW);
-			delayMicroseconds(1);
-			SPI.transfer(i + 0x00); 
-			int n = SPI.transfer(0x00);
-			//SystemMsg("%x", n);
-			digitalWrite(chipselect, HIGH);
-			SPI.endTransaction();
+	void
+	WriteRegisters(
+		uint8_t			inAddress,
+		uint8_t const*	inData,
+		int				inCount)
+	{
+		for(int i = 0; i < inCount; ++i)
+		{
+			registerFile[(inAddress + i) % eDS3234_RegisterCount] = inData[i];
+		}
 
-			int a = n & 0x0F;
-			int b = (n & 0x70) >> 4;
+		if(inAddress == eDS3234_Seconds && inCount >= 7)
+		{
+			int	year = FromBCD(inData[6]) + ((inData[5] & eDS3234_MonthCentury) ? 2000 : 1900);
 
-			TimeDate[i] = a + b * 10;	
+			timeOffset = (int32_t)(gRealTime->GetEpochTimeFromComponents(year, FromBCD(inData[5] & ~eDS3234_MonthCentury), FromBCD(inData[4]), FromBCD(inData[2]), FromBCD(inData[1]), FromBCD(inData[0])) - gCurLocalUS / 1000000);
+		}
+	}
 
-			if(i == 5 && (TimeDate[i] & 0x80))
-			{
-				// No actual need to do anything with the century bit since the year number dictates 1900 or 2000
-				TimeDate[i] &= 0x1F;
-			}
+	uint8_t	registerFile[eDS3234_RegisterCount];
+	int32_t	timeOffset;	// The chip's time less the local clock in seconds
+#else
+	void
+	BeginSPI(
+		void)
+	{
+		if(useAltSPI)
+		{
+			SPI.setMISO(8);
+			SPI.setMOSI(7);
+			SPI.setSCK(14);
 		}
+
+		SPI.begin();
+		SPI.beginTransaction(spiSettings);
+		digitalWrite(chipselect, LOW);
+		delayMicroseconds(1);
+	}
+
+	void
+	EndSPI(
+		void)
+	{
+		digitalWrite(chipselect, HIGH);
+		SPI.endTransaction();
 		SPI.end();
 
-		if (useAltSPI)
+		if(useAltSPI)
 		{
 			SPI.setMISO(12);
 			SPI.setMOSI(11);
 			SPI.setSCK(13);
 		}
+	}
 
-		TimeDate[6] += (TimeDate[6] >= 70 && TimeDate[6] <= 99) ? 1900 : 2000;
-
-		//SystemMsg("got %d %d %d %d %d %d\n", TimeDate[6], TimeDate[5], TimeDate[4], TimeDate[2], TimeDate[1], TimeDate[0]);
-
-		if (TimeDate[5] < 1 || TimeDate[5] > 12 || TimeDate[4] < 1 || TimeDate[4] > 31 || TimeDate[2] < 0 || TimeDate[2] > 23 || TimeDate[1] < 0 || TimeDate[1] > 59 || TimeDate[0] < 0 || TimeDate[0] > 59)
+	// The chip auto increments the address so consecutive registers are transferred in one transaction
+	void
+	ReadRegisters(
+		uint8_t		inAddress,
+		uint8_t*	outData,
+		int			inCount)
+	{
+		BeginSPI();
+		SPI.transfer(inAddress);
+		for(int i = 0; i < inCount; ++i)
 		{
-			SystemMsg("RequestSync: Invalid date from hardware %d %d %d %d %d %d\n", TimeDate[6], TimeDate[5], TimeDate[4], TimeDate[2], TimeDate[1], TimeDate[0]);
-			return false;
+			outData[i] = SPI.transfer(0x00);
 		}
+		EndSPI();
+	}
 
-		gRealTime->SetDateAndTime(TimeDate[6], TimeDate[5], TimeDate[4], TimeDate[2], TimeDate[1], TimeDate[0], true, this);
-
-		return true;
+	void
+	WriteRegisters(
+		uint8_t			inAddress,
+		uint8_t const*	inData,
+		int				inCount)
+	{
+		BeginSPI();
+		SPI.transfer(inAddress | eDS3234_WriteAddress);
+		for(int i = 0; i < inCount; ++i)
+		{
+			SPI.transfer(inData[i]);
+		}
+		EndSPI();
 	}
+#endif
 
 	int			chipselect;
 	SPISettings	spiSettings;
 	bool		useAltSPI;
+	uint8_t		alarmPin;
+	uint8_t		control;	// The control register as last written
 };
-#endif
 
-class CRealTimeDataProvider_NTP : public IRealTimeDataProvider, public IInternetHandler
+enum
+{
+	eNTP_MaxServers = 4,
+	eNTP_PacketSize = 48,
+	eNTP_ReplyTimeoutSecs = 5,
+	eNTP_MinPollSecs = 64,
+	eNTP_MaxPollSecs = 1024,
+	eNTP_StableOffsetUS = 5000,	// The poll interval backs off while offsets are below this or the delay
+
+	eNTP_ModeServer = 4,
+	eNTP_LeapUnsynchronized = 3,
+};
+
+// The NTP timestamp secs at Jan 1 1970
+#define MNTP_UnixEpoch	2208988800ULL
+
+// Return the epoch time in us from an NTP timestamp, 32 bits of secs since 1900 and 32 bits of fraction
+static uint64_t
+NTPToEpochUS(
+	uint8_t const*	inTimestamp)
+{
+	uint32_t	secs = ((uint32_t)inTimestamp[0] << 24) | ((uint32_t)inTimestamp[1] << 16) | ((uint32_t)inTimestamp[2] << 8) | inTimestamp[3];
+	uint32_t	fraction = ((uint32_t)inTimestamp[4] << 24) | ((uint32_t)inTimestamp[5] << 16) | ((uint32_t)inTimestamp[6] << 8) | inTimestamp[7];
+
+	// NTP era 1 starts in 2036, secs with the high bit clear are assumed to be in it
+	uint64_t	ntpSecs = (secs & 0x80000000) ? secs : secs + 0x100000000ULL;
+
+	return (ntpSecs - MNTP_UnixEpoch) * 1000000 + (((uint64_t)fraction * 1000000) >> 32);
+}
+
+static void
+EpochUSToNTP(
+	uint64_t	inEpochUS,
+	uint8_t*	outTimestamp)
+{
+	uint32_t	secs = (uint32_t)(inEpochUS / 1000000 + MNTP_UnixEpoch);
+	uint32_t	fraction = (uint32_t)(((inEpochUS % 1000000) << 32) / 1000000);
+
+	outTimestamp[0] = (uint8_t)(secs >> 24);
+	outTimestamp[1] = (uint8_t)(secs >> 16);
+	outTimestamp[2] = (uint8_t)(secs >> 8);
+	outTimestamp[3] = (uint8_t)secs;
+	outTimestamp[4] = (uint8_t)(fraction >> 24);
+	outTimestamp[5] = (uint8_t)(fraction >> 16);
+	outTimestamp[6] = (uint8_t)(fraction >> 8);
+	outTimestamp[7] = (uint8_t)fraction;
+}
+
+// An SNTP client, each round queries every server in turn and the reply with the lowest round trip delay sets the time
+class CRealTimeDataProvider_NTP : public IRealTimeDataProvider, public IInternetHandler, public IRealTimeHandler, public ICmdHandler
 {
 public:
 
 	CRealTimeDataProvider_NTP(
+		)
+	{
+		memset(serverList, 0, sizeof(serverList));
+		serverCount = 0;
+		curServer = -1;
+		portRef = -1;
+		requestT1US = 0;
+		memset(requestT1, 0, sizeof(requestT1));
+		pollSecs = eNTP_MinPollSecs;
+		lastRoundLocalUS = 0;
+		roundCount = 0;
+		syncCount = 0;
+		pollEvent = NULL;
+	}
+
+	void
+	AddServer(
 		char const*	inAddress,
 		uint16_t	inPort)
 	{
-		requestInProgress = false;
-		ntpAddress = inAddress;
-		ntpPort = inPort;
+		MReturnOnError(serverCount >= eNTP_MaxServers);
+
+		serverList[serverCount].address = inAddress;
+		serverList[serverCount].port = inPort;
+		++serverCount;
 	}
 
 	virtual bool
@@ -322,18 +478,27 @@ public:
 	RequestSync(
 		void)
 	{
-		if(requestInProgress == false && gInternetModule != NULL && gInternetModule->ConnectedToInternet())
+		SetupIfNeeded();
+
+		if(curServer >= 0)
 		{
-			portRef = gInternetModule->UDPOpenPort(ntpAddress, ntpPort, this, static_cast<TUDPPacketHandlerMethod>(&CRealTimeDataProvider_NTP::InternetTimeHandler));
-			
-			if(portRef >= 0)
-			{
-				requestInProgress = true;
-				return true;
-			}
+			return true;
 		}
 
-		return false;
+		if(serverCount == 0 || gInternetModule == NULL || !gInternetModule->ConnectedToInternet())
+		{
+			return false;
+		}
+
+		// Servers must not be polled more often than the minimum poll interval, the time from the last round is still good
+		if(roundCount > 0 && gCurLocalUS - lastRoundLocalUS < (uint64_t)eNTP_MinPollSecs * 1000000)
+		{
+			return true;
+		}
+
+		StartRound();
+
+		return true;
 	}
 
 	void
@@ -345,89 +510,311 @@ public:
 		size_t				inDataSize,
 		char const*			inData)
 	{
+		MReturnOnError(curServer < 0);
+
+		SNTPServer*	server = serverList + curServer;
+
 		if(inResponse == eConnectionResponse_Opened)
 		{
-			uint8_t	packetBuffer[48];
+			uint8_t	packetBuffer[eNTP_PacketSize];
 			memset(packetBuffer, 0, sizeof(packetBuffer));
-			packetBuffer[0] = 0xE3;
+			packetBuffer[0] = 0xE3;	// Unsynchronized, version 4, client mode
 			packetBuffer[1] = 0;
 			packetBuffer[2] = 6;
 			packetBuffer[3] = 0xEC;
 			packetBuffer[12]  = 49;
 			packetBuffer[13]  = 0x4E;
 			packetBuffer[14]  = 49;
-			packetBuffer[15]  = 52;                 
+			packetBuffer[15]  = 52;
+
+			// The transmit timestamp is T1, the server returns it as the originate timestamp so the reply can be matched to this request
+			requestT1US = gRealTime->GetEpochTimeUS(true);
+			EpochUSToNTP(requestT1US, packetBuffer + 40);
+			memcpy(requestT1, packetBuffer + 40, sizeof(requestT1));
+
+			++server->requestCount;
+			gInternetModule->UDPSend(portRef, sizeof(packetBuffer), packetBuffer, eNTP_ReplyTimeoutSecs);
 
-			gInternetModule->UDPSend(portRef, sizeof(packetBuffer), packetBuffer, 5);
+			return;
 		}
-		else if(inResponse == eConnectionResponse_Data)
+
+		if(inResponse == eConnectionResponse_Data)
 		{
-			uint8_t*	timeData = (uint8_t*)inData;
+			// gCurLocalUS is sampled once per loop pass so T1 and T4 are only as precise as the pass time
+			uint64_t		t4US = gRealTime->GetEpochTimeUS(true);
+			uint8_t const*	timeData = (uint8_t const*)inData;
 
-			TEpochTime epoch;
-			epoch = (timeData[40] << 24UL) | (timeData[41] << 16UL) | (timeData[42] << 8UL) | timeData[43];
-			epoch = epoch - 2208988800;
-			gRealTime->SetEpochTime(epoch, true, this);
-			gInternetModule->UDPClosePort(portRef);
-			requestInProgress = false;
+			if(inDataSize < eNTP_PacketSize || (timeData[0] & 0x07) != eNTP_ModeServer || (timeData[0] >> 6) == eNTP_LeapUnsynchronized
+				|| timeData[1] == 0 || timeData[1] > 15 || memcmp(timeData + 24, requestT1, sizeof(requestT1)) != 0)
+			{
+				++server->rejectCount;
+			}
+			else
+			{
+				uint64_t	t2US = NTPToEpochUS(timeData + 32);
+				uint64_t	t3US = NTPToEpochUS(timeData + 40);
+				int64_t		delayUS = (int64_t)(t4US - requestT1US) - (int64_t)(t3US - t2US);
+
+				server->offsetUS = ((int64_t)(t2US - requestT1US) + (int64_t)(t3US - t4US)) / 2;
+				server->delayUS = (uint32_t)MMax(delayUS, (int64_t)0);
+				server->stratum = timeData[1];
+				server->sampleValid = true;
+				++server->replyCount;
+			}
 		}
 		else
 		{
-			gInternetModule->UDPClosePort(portRef);
-			requestInProgress = false;
+			++server->timeoutCount;
 		}
-	}
 
-	char const*	ntpAddress;
-	int			portRef;
-	uint16_t	ntpPort;
-	bool		requestInProgress;
-};
+		gInternetModule->UDPClosePort(portRef);
+		portRef = -1;
 
-MModuleImplementation_Start(CModule_RealTime)
-MModuleImplementation_FinishGlobal(CModule_RealTime, gRealTime)
+		// The next server is queried from the event instead of from inside the internet module's handler
+		++curServer;
+		gRealTime->ScheduleEvent(pollEvent, 0, true);
+	}
 
-CModule_RealTime::CModule_RealTime(
-	)
-	:
-	CModule(
-		sizeof(STimeZoneRule),	// eeprom size
-		1,						// eeprom version number
-		&timeZoneInfo,
-		1000000)				// Call the update method once a second
-{
-	memset(alarmArray, 0, sizeof(alarmArray));
-	memset(eventArray, 0, sizeof(eventArray));
-	memset(timeChangeHandlerArray, 0, sizeof(timeChangeHandlerArray));
+	void
+	PollEventHandler(
+		TRealTimeEventRef	inEventRef,
+		void*				inRefCon)
+	{
+		if(curServer < 0)
+		{
+			StartRound();
+		}
+		else
+		{
+			QueryServer();
+		}
+	}
 
-	localProvider = NULL;
-	networkProvider = NULL;
-	providerSyncPeriod = 0;
-	epocUTCTimeAtLastSet = 0;
-	localMSAtLastSet = 0;
-	memset(&timeZoneInfo, 0, sizeof(timeZoneInfo));
-	dstStartUTCEpocTime = 0;
-	dstEndUTCEpocTime = 0;
-	dstStartUTC = 0;
-	stdStartUTC = 0;
-	dstStartLocal = 0;
-	stdStartLocal = 0;
-	timeMultiplier = 0;
-	gotNetworkSync = false;
+	uint8_t
+	SerialStats(
+		IOutputDirector*	inOutput,
+		int					inArgC,
+		char const*			inArgV[])
+	{
+		if(inArgC == 2 && strcmp(inArgV[1], "reset") == 0)
+		{
+			for(int i = 0; i < serverCount; ++i)
+			{
+				serverList[i].requestCount = 0;
+				serverList[i].replyCount = 0;
+				serverList[i].rejectCount = 0;
+				serverList[i].timeoutCount = 0;
+			}
+			roundCount = 0;
+			syncCount = 0;
 
-	CModule_Command::Include();
-}
+			return eCmd_Succeeded;
+		}
 
-void
-CModule_RealTime::Configure(
-	IRealTimeDataProvider*	inLocalProvider,
-	IRealTimeDataProvider*	inNetworkProvider,
-	uint32_t				inProviderSyncPeriod)
-{
-	localProvider = inLocalProvider;
-	networkProvider = inNetworkProvider;
-	providerSyncPeriod = inProviderSyncPeriod;
-}
+		inOutput->printf("rounds=%lu syncs=%lu poll=%lu s %s\n", roundCount, syncCount, pollSecs, curServer >= 0 ? "polling" : "idle");
+
+		for(int i = 0; i < serverCount; ++i)
+		{
+			SNTPServer*	server = serverList + i;
+
+			inOutput->printf("%s:%u requests=%u replies=%u rejects=%u timeouts=%u", server->address, server->port, server->requestCount, server->replyCount, server->rejectCount, server->timeoutCount);
+			if(server->replyCount > 0)
+			{
+				inOutput->printf(" stratum=%u offset=%ld us delay=%lu us", server->stratum, (long)server->offsetUS, (unsigned long)server->delayUS);
+			}
+			inOutput->printf("\n");
+		}
+
+		return eCmd_Succeeded;
+	}
+
+private:
+
+	struct SNTPServer
+	{
+		char const*	address;
+		uint16_t	port;
+		uint16_t	requestCount;
+		uint16_t	replyCount;
+		uint16_t	rejectCount;
+		uint16_t	timeoutCount;
+		uint8_t		stratum;
+		bool		sampleValid;	// A reply was received this round
+		int64_t		offsetUS;		// The server's time minus ours
+		uint32_t	delayUS;		// The round trip less the server's processing time
+	};
+
+	// The provider is usually created before CModule::SetupAll() so its event and command are created when the RealTime module first asks for a sync
+	void
+	SetupIfNeeded(
+		void)
+	{
+		if(pollEvent != NULL)
+		{
+			return;
+		}
+
+		MAssert(gRealTime != NULL && gCommandModule != NULL);
+
+		pollEvent = MRealTimeCreateEvent("ntp_poll", CRealTimeDataProvider_NTP::PollEventHandler, NULL);
+
+		MCommandRegister("ntp_stats", CRealTimeDataProvider_NTP::SerialStats, "[reset] : Show the ntp servers and last samples");
+	}
+
+	void
+	StartRound(
+		void)
+	{
+		for(int i = 0; i < serverCount; ++i)
+		{
+			serverList[i].sampleValid = false;
+		}
+
+		curServer = 0;
+		++roundCount;
+		QueryServer();
+	}
+
+	void
+	QueryServer(
+		void)
+	{
+		if(gInternetModule != NULL && gInternetModule->ConnectedToInternet())
+		{
+			for(; curServer < serverCount; ++curServer)
+			{
+				portRef = gInternetModule->UDPOpenPort(serverList[curServer].address, serverList[curServer].port, this, static_cast<TUDPPacketHandlerMethod>(&CRealTimeDataProvider_NTP::InternetTimeHandler));
+				if(portRef >= 0)
+				{
+					// The request is sent once the port is opened
+					return;
+				}
+
+				++serverList[curServer].timeoutCount;
+			}
+		}
+
+		FinishRound();
+	}
+
+	void
+	FinishRound(
+		void)
+	{
+		SNTPServer*	best = NULL;
+
+		for(int i = 0; i < serverCount; ++i)
+		{
+			if(serverList[i].sampleValid && (best == NULL || serverList[i].delayUS < best->delayUS))
+			{
+				best = serverList + i;
+			}
+		}
+
+		curServer = -1;
+		lastRoundLocalUS = gCurLocalUS;
+
+		if(best != NULL)
+		{
+			// The offset is only known to within half the round trip
+			gRealTime->SetEpochTimeUS(gRealTime->GetEpochTimeUS(true) + best->offsetUS, true, this, MMax(best->delayUS, (uint32_t)1));
+			++syncCount;
+
+			// Poll less often while the clock is holding time and more often when it is not
+			if(best->offsetUS < MMax((int64_t)eNTP_StableOffsetUS, (int64_t)best->delayUS) && best->offsetUS > -MMax((int64_t)eNTP_StableOffsetUS, (int64_t)best->delayUS))
+			{
+				pollSecs = MMin(pollSecs * 2, (uint32_t)eNTP_MaxPollSecs);
+			}
+			else
+			{
+				pollSecs = MMax(pollSecs / 2, (uint32_t)eNTP_MinPollSecs);
+			}
+		}
+		else
+		{
+			pollSecs = eNTP_MinPollSecs;
+		}
+
+		gRealTime->ScheduleEvent(pollEvent, (uint64_t)pollSecs * 1000000, true);
+	}
+
+	SNTPServer			serverList[eNTP_MaxServers];
+	int					serverCount;
+	int					curServer;	// The server being queried or -1 between rounds
+	int					portRef;
+	uint64_t			requestT1US;
+	uint8_t				requestT1[8];
+	uint32_t			pollSecs;
+	uint64_t			lastRoundLocalUS;
+	uint32_t			roundCount;
+	uint32_t			syncCount;
+	TRealTimeEventRef	pollEvent;
+};
+
+MModuleImplementation_Start(CModule_RealTime)
+MModuleImplementation_FinishGlobal(CModule_RealTime, gRealTime)
+
+CModule_RealTime::CModule_RealTime(
+	)
+	:
+	CModule(
+		sizeof(STimeZoneRule),	// eeprom size
+		1,						// eeprom version number
+		&timeZoneInfo,
+		1000000)				// Call the update method once a second
+{
+	memset(&alarmHeap, 0, sizeof(alarmHeap));
+	memset(&eventHeap, 0, sizeof(eventHeap));
+	alarmFreeList = NULL;
+	eventFreeList = NULL;
+	timeChangeHandlerList = NULL;
+	memset(isrTimerList, 0, sizeof(isrTimerList));
+	isrTimerCount = 0;
+	isrHardwareWakeUS = 0;
+	isrHardwareRunning = false;
+
+	localProvider = NULL;
+	networkProvider = NULL;
+	providerSyncPeriod = 0;
+	baseLocalUS = 0;
+	baseEpochUS = 0;
+	freqOffsetPPB = 0;
+	freqSampleCount = 0;
+	slewRemainingUS = 0;
+	freqAnchorLocalUS = 0;
+	freqAnchorEpochUS = 0;
+	freqAnchorPrecisionUS = 0;
+	lastSyncLocalUS = 0;
+	clockSet = false;
+	hardwareAlarmUTC = 0;
+	memset(&timeZoneInfo, 0, sizeof(timeZoneInfo));
+	dstStartUTCEpocTime = 0;
+	dstEndUTCEpocTime = 0;
+	dstStartUTC = 0;
+	stdStartUTC = 0;
+	dstStartLocal = 0;
+	stdStartLocal = 0;
+	InvalidateDSTIntervals();
+	cachedDays = MAXUINT32;
+	cachedYear = 1970;
+	cachedMonth = 1;
+	cachedDayOfMonth = 1;
+	timeMultiplier = 0;
+	gotNetworkSync = false;
+
+	CModule_Command::Include();
+}
+
+void
+CModule_RealTime::Configure(
+	IRealTimeDataProvider*	inLocalProvider,
+	IRealTimeDataProvider*	inNetworkProvider,
+	uint32_t				inProviderSyncPeriod)
+{
+	localProvider = inLocalProvider;
+	networkProvider = inNetworkProvider;
+	providerSyncPeriod = inProviderSyncPeriod;
+}
 
 void
 CModule_RealTime::Setup(
@@ -439,6 +826,9 @@ CModule_RealTime::Setup(
 		memset(&timeZoneInfo, 0, sizeof(timeZoneInfo));
 	}
 
+	// The time zone may have just been loaded from eeprom
+	InvalidateDSTIntervals();
+
 	#if defined(WIN32)
 		// For testing
 		SetTimeZone(gTimeZone, false);
@@ -452,6 +842,8 @@ CModule_RealTime::Setup(
 	MCommandRegister("rt_dump", CModule_RealTime::SerialDumpTable, ": Dump the alarm table");
 	MCommandRegister("rt_set_mult", CModule_RealTime::SerialSetMultiplier, "[integer] : multiply the passage of time by the given value");
 
+	// Time does not pass until now
+	RebaseClock();
 	timeMultiplier = 1;
 
 	if(localProvider != NULL)
@@ -488,58 +880,68 @@ CModule_RealTime::Update(
 		networkProvider->RequestSync();
 	}
 
-	if(timeMultiplier == 1 && (millis() - localMSAtLastSet) / 1000 >= providerSyncPeriod)
+	ServiceISRTimers();
+
+	if(timeMultiplier == 1 && (gCurLocalUS - lastSyncLocalUS) / 1000000 >= providerSyncPeriod)
 	{
 		SyncTimeWithProviders();
 	}
 
+	// Rebasing truncates the frequency correction so only do it often enough that the corrections can not overflow
+	if(gCurLocalUS - baseLocalUS >= eClock_RebasePeriodUS)
+	{
+		RebaseClock();
+	}
+
 	TEpochTime	curEpochTimeUTC = GetEpochTime(true);
 
-	SAlarm* curAlarm = alarmArray;
-	for(int alarmItr = 0; alarmItr < eAlarm_MaxActive; ++alarmItr, ++curAlarm)
+	// Only the alarms and events that are due are touched, a rescheduled alarm is always in the future so this terminates
+	while(alarmHeap.count > 0 && alarmHeap.list[0]->deadline <= curEpochTimeUTC)
 	{
-		if(curAlarm->object == NULL)
-		{
-			continue;
-		}
+		SAlarm*	curAlarm = (SAlarm*)alarmHeap.list[0];
 
-		if(curAlarm->nextTriggerTimeUTC <= curEpochTimeUTC)
-		{
-			// this alarm is triggered
-			//SystemMsg("Triggering alarm %s\n", curAlarm->name);
+		// this alarm is triggered
+		//SystemMsg("Triggering alarm %s\n", curAlarm->name);
 			
-			// Set to unscheduled first since it may get rescheduled in the method below
-			curAlarm->nextTriggerTimeUTC = MAXUINT32;
+		// Set to unscheduled first since it may get rescheduled in the method below
+		TimerHeapRemove(alarmHeap, curAlarm);
 
-			// Invoke method and reschedule if requested
-			if((curAlarm->object->*curAlarm->method)(curAlarm, curAlarm->reference))
-			{
-				ScheduleAlarm(curAlarm);
-			}
+		// Invoke method and reschedule if requested
+		LoopMonitorHandlerStart(curAlarm->name);
+		bool	reschedule = (curAlarm->object->*curAlarm->method)(curAlarm, curAlarm->reference);
+		LoopMonitorHandlerEnd();
+
+		if(reschedule && curAlarm->object != NULL)
+		{
+			ScheduleAlarm(curAlarm);
 		}
 	}
 
-	// Now look for events to fire
-	SEvent*	curEvent = eventArray;
-	for(int itr = 0; itr < eEvent_MaxActive; ++itr, ++curEvent)
+	// Now fire the due events, an event rescheduled during this pass is not due until the next one
+	uint64_t	passUS = gCurLocalUS;
+	while(eventHeap.count > 0 && eventHeap.list[0]->deadline <= passUS)
 	{
-		if(curEvent->object == NULL || curEvent->lastFireTime == 0)
+		SEvent*	curEvent = (SEvent*)eventHeap.list[0];
+
+		// Update the schedule before calling the handler so it can reschedule or unschedule itself
+		if(curEvent->onceOnly)
 		{
-			continue;
+			TimerHeapRemove(eventHeap, curEvent);
 		}
-
-		if(gCurLocalUS - curEvent->lastFireTime >= curEvent->periodUS)
+		else
 		{
-			curEvent->lastFireTime = gCurLocalUS;
-			//SystemMsg("Triggering event %s\n", curEvent->name);
-			(curEvent->object->*curEvent->method)(curEvent, curEvent->reference);
-			//SystemMsg("Done");
-			if(curEvent->onceOnly)
-			{
-				curEvent->lastFireTime = 0;
-			}
+			curEvent->deadline = passUS + MMax(curEvent->periodUS, (uint64_t)1);
+			TimerHeapSchedule(eventHeap, curEvent);
 		}
+
+		//SystemMsg("Triggering event %s\n", curEvent->name);
+		LoopMonitorHandlerStart(curEvent->name);
+		(curEvent->object->*curEvent->method)(curEvent, curEvent->reference);
+		LoopMonitorHandlerEnd();
+		//SystemMsg("Done");
 	}
+
+	UpdateHardwareAlarm();
 }
 
 void
@@ -564,20 +966,14 @@ CModule_RealTime::SetTimeZone(
 	bool			inWriteToEEPROM)
 {
 	timeZoneInfo = inTimeZone;
+	InvalidateDSTIntervals();
 
 	if(inWriteToEEPROM)
 	{
 		EEPROMSave();
 	}
 
-	STimeChangeHandler*	curHandler = timeChangeHandlerArray;
-	for(int i = 0; i < eTimeChangeHandler_MaxCount; ++i, ++curHandler)
-	{
-		if(curHandler->name != NULL && curHandler->object != NULL)
-		{
-			(curHandler->object->*curHandler->method)(curHandler->name, true);
-		}
-	}
+	NotifyTimeChange(true);
 }
 
 void
@@ -601,20 +997,42 @@ CModule_RealTime::SetEpochTime(
 	TEpochTime	inEpochTime,
 	bool		inUTC,
 	IRealTimeDataProvider*	inSourceProvider)
+{
+	if(inSourceProvider == NULL)
+	{
+		// A time set by hand means the start of the second and is applied exactly
+		SetEpochTimeUS((uint64_t)inEpochTime * 1000000, inUTC, NULL, 0);
+		return;
+	}
+
+	// Whole second sources such as the DS3234 truncate the time so the true time is most likely the middle of the second
+	SetEpochTimeUS((uint64_t)inEpochTime * 1000000 + 500000, inUTC, inSourceProvider, 1000000);
+}
+
+void 
+CModule_RealTime::SetEpochTimeUS(
+	uint64_t	inEpochTimeUS,
+	bool		inUTC,
+	IRealTimeDataProvider*	inSourceProvider,
+	uint32_t	inPrecisionUS)
 {
 	TEpochTime	oldEpochTime = GetEpochTime(true);
 
 	if(!inUTC)
 	{
-		inEpochTime = LocalToUTC(inEpochTime);
+		TEpochTime	localTime = (TEpochTime)(inEpochTimeUS / 1000000);
+
+		inEpochTimeUS += ((int64_t)LocalToUTC(localTime) - localTime) * 1000000;
 	}
 
-	// This must be set otherwise the periodic sync will always fire because localMSAtLastSet was not updated
-	localMSAtLastSet = millis();
-	epocUTCTimeAtLastSet = inEpochTime;
+	// This must be set otherwise the periodic sync will always fire
+	lastSyncLocalUS = gCurLocalUS;
+	bool	stepped = DisciplineClock(inEpochTimeUS, inPrecisionUS, inSourceProvider != NULL);
+
+	TEpochTime	epochTime = (TEpochTime)(inEpochTimeUS / 1000000);
 
 	int	year, month, dayOfMonth, dayOfWeek, hour, min, sec;
-	GetComponentsFromEpochTime(inEpochTime, year, month, dayOfMonth, dayOfWeek, hour, min, sec);
+	GetComponentsFromEpochTime(epochTime, year, month, dayOfMonth, dayOfWeek, hour, min, sec);
 
 	if(inSourceProvider == networkProvider)
 	{
@@ -626,19 +1044,12 @@ CModule_RealTime::SetEpochTime(
 		}
 	}
 
-	// Since precision of RTC is 1 sec only notify of time change if it's greater then 1 sec
-	if(oldEpochTime > 0 && abs((int32_t)(inEpochTime - oldEpochTime)) > 1)
+	// A slewed offset moves the time too gradually to be a change, and since precision of RTC is 1 sec only notify of a step if it's greater then 1 sec
+	if(stepped && oldEpochTime > 0 && abs((int32_t)(epochTime - oldEpochTime)) > 1)
 	{
-		SystemMsg("Time has been changed, old=%lu new=%lu diff=%ld", oldEpochTime, inEpochTime, oldEpochTime - inEpochTime);
+		SystemMsg("Time has been changed, old=%lu new=%lu diff=%ld", oldEpochTime, epochTime, oldEpochTime - epochTime);
 
-		STimeChangeHandler*	curHandler = timeChangeHandlerArray;
-		for(int i = 0; i < eTimeChangeHandler_MaxCount; ++i, ++curHandler)
-		{
-			if(curHandler->name != NULL && curHandler->object != NULL)
-			{
-				(curHandler->object->*curHandler->method)(curHandler->name, false);
-			}
-		}
+		NotifyTimeChange(false);
 	}
 
 	SystemMsg("Setting time to %02d/%02d/%04d %02d:%02d:%02d", month, dayOfMonth, year, hour, min, sec);
@@ -677,8 +1088,7 @@ TEpochTime
 CModule_RealTime::GetEpochTime(
 	bool	inUTC)
 {
-	uint32_t	deltaMS = millis() - localMSAtLastSet;
-	TEpochTime	result = epocUTCTimeAtLastSet + (deltaMS / 1000) * timeMultiplier;
+	TEpochTime	result = (TEpochTime)(GetEpochTimeUS(true) / 1000000);
 
 	if(!inUTC)
 	{
@@ -693,9 +1103,9 @@ CModule_RealTime::GetEpochTimeWithMS(
 	int&	outMilliseconds,
 	bool	inUTC)
 {
-	uint32_t	deltaMS = millis() - localMSAtLastSet;
-	TEpochTime	result = epocUTCTimeAtLastSet + (deltaMS / 1000) * timeMultiplier;
-	outMilliseconds = deltaMS % 1000;
+	uint64_t	epochTimeUS = GetEpochTimeUS(true);
+	TEpochTime	result = (TEpochTime)(epochTimeUS / 1000000);
+	outMilliseconds = (epochTimeUS / 1000) % 1000;
 
 	if(!inUTC)
 	{
@@ -705,6 +1115,23 @@ CModule_RealTime::GetEpochTimeWithMS(
 	return result;
 }
 
+uint64_t
+CModule_RealTime::GetEpochTimeUS(
+	bool	inUTC)
+{
+	int64_t		slewUS;
+	uint64_t	result = GetDisciplinedUS(gCurLocalUS, slewUS);
+
+	if(!inUTC)
+	{
+		TEpochTime	utcTime = (TEpochTime)(result / 1000000);
+
+		result += ((int64_t)UTCToLocal(utcTime) - utcTime) * 1000000;
+	}
+
+	return result;
+}
+
 int
 CModule_RealTime::GetYearNow(
 	bool	inUTC)
@@ -758,20 +1185,9 @@ int
 CModule_RealTime::GetYearFromEpoch(
 	TEpochTime	inEpochTime)
 {
-	TEpochTime	daysEpochTime = inEpochTime / (60 * 60 * 24);
-	int			year = 1970;
-	TEpochTime	days = 0;
-
-	for(;;)
-	{
-		days += MIsLeapYear(year) ? 366 : 365;
-		if(days > daysEpochTime)
-		{
-			break;
-		}
+	int	year, month, day;
 
-		year++;
-	}
+	GetDateFromEpoch(inEpochTime, year, month, day);
 
 	return year;
 }
@@ -780,92 +1196,22 @@ int
 CModule_RealTime::GetMonthFromEpoch(
 	TEpochTime	inEpochTime)
 {
-	TEpochTime	daysEpochTime = inEpochTime / (60 * 60 * 24);
-	int			year = 1970;
-	TEpochTime	days = 0;
-	int			month;
-	TEpochTime	monthLength;
+	int	year, month, day;
 
-	for(;;)
-	{
-		days += MIsLeapYear(year) ? 366 : 365;
-		if(days > daysEpochTime)
-		{
-			break;
-		}
-
-		year++;
-	}
-
-	days -= MIsLeapYear(year) ? 366 : 365;
-	daysEpochTime -= days;
+	GetDateFromEpoch(inEpochTime, year, month, day);
 
-	for(month = 0; month < 12; ++month)
-	{
-		monthLength = gDaysInMonth[month];
-
-		if(month == 1 && MIsLeapYear(year))
-		{
-			++monthLength;
-		}
-    
-		if(daysEpochTime >= monthLength)
-		{
-			daysEpochTime -= monthLength;
-		}
-		else
-		{
-			break;
-		}
-	}
-
-	return month + 1;
+	return month;
 }
 
 int
 CModule_RealTime::GetDayOfMonthFromEpoch(
 	TEpochTime	inEpochTime)
 {
-	TEpochTime	daysEpochTime = inEpochTime / (60 * 60 * 24);
-	int			year = 1970;
-	TEpochTime	days = 0;
-	int			month;
-	TEpochTime	monthLength;
-
-	for(;;)
-	{
-		days += MIsLeapYear(year) ? 366 : 365;
-		if(days > daysEpochTime)
-		{
-			break;
-		}
+	int	year, month, day;
 
-		year++;
-	}
-
-	days -= MIsLeapYear(year) ? 366 : 365;
-	daysEpochTime -= days;
-
-	for(month = 0; month < 12; ++month)
-	{
-		monthLength = gDaysInMonth[month];
+	GetDateFromEpoch(inEpochTime, year, month, day);
 
-		if(month == 1 && MIsLeapYear(year))
-		{
-			++monthLength;
-		}
-    
-		if(daysEpochTime >= monthLength)
-		{
-			daysEpochTime -= monthLength;
-		}
-		else
-		{
-			break;
-		}
-	}
-
-	return daysEpochTime + 1;
+	return day;
 }
 
 int
@@ -907,31 +1253,9 @@ CModule_RealTime::GetEpochTimeFromComponents(
 	int inMinute, 
 	int inSecond)
 {
-	TEpochTime result;
-
-	// Add in years
-	result = (inYear - 1970) * 60 * 60 * 24 * 365;
-
-	// Add in leap days
-	for(int year = 1970; year < inYear; year++)
-	{
-		if(MIsLeapYear(year))
-		{
-			result += 60 * 60 * 24;
-		}
-	}
-  
-	// add in month
-	for(int i = 1; i < inMonth; ++i)
-	{
-		result += 60 * 60 * 24 * gDaysInMonth[i - 1];
-		if((i == 2) && MIsLeapYear(inYear))
-		{ 
-			result += 60 * 60 * 24;
-		}
-	}
+	// Out of range days, hours, minutes and seconds carry into the next unit
+	TEpochTime	result = DaysFromCivil(inYear, inMonth, 1) * (60 * 60 * 24);
 
-	// Add in days, hours, minutes, seconds
 	result += (inDayOfMonth - 1) * 60 * 60 * 24;
 	result += inHour * 60 * 60;
 	result += inMinute * 60;
@@ -951,99 +1275,87 @@ CModule_RealTime::GetComponentsFromEpochTime(
 	int&		outMinute,		// 00 to 59
 	int&		outSecond)		// 00 to 59
 {
-	int				year;
-	int				month;
-	TEpochTime	monthLength;
-	TEpochTime	remainingTime;
-	TEpochTime	days;
+	TEpochTime	secondOfDay = GetDateFromEpoch(inEpocTime, outYear, outMonth, outDayOfMonth);
 
-	remainingTime = inEpocTime;
+	outDayOfWeek = ((inEpocTime / (60 * 60 * 24) + 4) % 7) + 1;  // Jan 1, 1970 was a Thursday (ie day 4 starting from 0 of the week)
 
-	outSecond = remainingTime % 60;
-	remainingTime /= 60;
+	outSecond = secondOfDay % 60;
+	secondOfDay /= 60;
 
-	outMinute = remainingTime % 60;
-	remainingTime /= 60;
+	outMinute = secondOfDay % 60;
+	outHour = secondOfDay / 60;
+}
 
-	outHour = remainingTime % 24;
-	remainingTime /= 24;
+TEpochTime
+CModule_RealTime::GetDateFromEpoch(
+	TEpochTime	inEpochTime,
+	int&		outYear,
+	int&		outMonth,
+	int&		outDayOfMonth)
+{
+	uint32_t	days = inEpochTime / (60 * 60 * 24);
 
-	outDayOfWeek = ((remainingTime + 4) % 7) + 1;  // Jan 1, 1970 was a Thursday (ie day 4 starting from 0 of the week)
-  
-	year = 1970;  
-	days = 0;
-	for(;;)
+	// Most conversions are for today so remember the last day converted
+	if(days != cachedDays)
 	{
-		days += MIsLeapYear(year) ? 366 : 365;
-		if(days > remainingTime)
-		{
-			break;
-		}
-
-		year++;
+		CivilFromDays(days, cachedYear, cachedMonth, cachedDayOfMonth);
+		cachedDays = days;
 	}
-	outYear = year;
-  
-	days -= MIsLeapYear(year) ? 366 : 365;
-	remainingTime -= days;
-  
-	days = 0;
-	monthLength = 0;
-	for(month = 0; month < 12; ++month)
-	{
-		monthLength = gDaysInMonth[month];
 
-		if(month == 1 && MIsLeapYear(year))
-		{
-			++monthLength;
-		}
-    
-		if(remainingTime >= monthLength)
-		{
-			remainingTime -= monthLength;
-		}
-		else
-		{
-			break;
-		}
-	}
+	outYear = cachedYear;
+	outMonth = cachedMonth;
+	outDayOfMonth = cachedDayOfMonth;
 
-	outMonth = month + 1;
-	outDayOfMonth = remainingTime + 1;
+	return inEpochTime - days * (60 * 60 * 24);
+}
+
+// These count days in 400 year eras starting on Mar 1 so the leap day is the last day of the year, see http://howardhinnant.github.io/date_algorithms.html
+void
+CModule_RealTime::CivilFromDays(
+	uint32_t	inDays,
+	int&		outYear,
+	int&		outMonth,
+	int&		outDayOfMonth)
+{
+	uint32_t	dayOfEpoch = inDays + 719468;	// The days from Mar 1 0000
+	uint32_t	era = dayOfEpoch / 146097;
+	uint32_t	dayOfEra = dayOfEpoch - era * 146097;
+	uint32_t	yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	uint32_t	dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	uint32_t	marchMonth = (5 * dayOfYear + 2) / 153;	// 0 is March
+
+	outDayOfMonth = dayOfYear - (153 * marchMonth + 2) / 5 + 1;
+	outMonth = marchMonth < 10 ? marchMonth + 3 : marchMonth - 9;
+	outYear = yearOfEra + era * 400 + (outMonth <= 2 ? 1 : 0);
+}
+
+uint32_t
+CModule_RealTime::DaysFromCivil(
+	int	inYear,
+	int	inMonth,
+	int	inDayOfMonth)
+{
+	uint32_t	marchYear = inYear - (inMonth <= 2 ? 1 : 0);
+	uint32_t	era = marchYear / 400;
+	uint32_t	yearOfEra = marchYear - era * 400;
+	uint32_t	dayOfYear = (153 * (inMonth > 2 ? inMonth - 3 : inMonth + 9) + 2) / 5 + inDayOfMonth - 1;
+	uint32_t	dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+
+	return era * 146097 + dayOfEra - 719468;
 }
 
 TEpochTime
 CModule_RealTime::LocalToUTC(
 	TEpochTime	inLocalEpochTime)
 {
-	if(GetYearFromEpoch(inLocalEpochTime) != GetYearFromEpoch(dstStartLocal))
-	{
-		ComputeDSTStartAndEnd(GetYearFromEpoch(inLocalEpochTime));
-	}
-
-	if(InDST(inLocalEpochTime, false))
-	{
-		return inLocalEpochTime - timeZoneInfo.dstStart.offsetMins * 60;
-	}
-
-	return inLocalEpochTime - timeZoneInfo.stdStart.offsetMins * 60;
+	return inLocalEpochTime - GetDSTInterval(inLocalEpochTime, false).offsetSecs;
 }
 
 TEpochTime
 CModule_RealTime::UTCToLocal(
 	TEpochTime	inUTCEpochTime)
 {
-	if(GetYearFromEpoch(inUTCEpochTime) != GetYearFromEpoch(dstStartUTC))
-	{
-		ComputeDSTStartAndEnd(GetYearFromEpoch(inUTCEpochTime));
-	}
-
-	if(InDST(inUTCEpochTime, true))
-	{
-		return inUTCEpochTime + timeZoneInfo.dstStart.offsetMins * 60;
-	}
-
-	return inUTCEpochTime + timeZoneInfo.stdStart.offsetMins * 60;
+	return inUTCEpochTime + GetDSTInterval(inUTCEpochTime, true).offsetSecs;
 }
 	
 void
@@ -1079,36 +1391,7 @@ CModule_RealTime::InDST(
 	TEpochTime	inEpochTime,
 	bool			inUTC)
 {
-	if(inUTC)
-	{
-		if (GetYearFromEpoch(inEpochTime) != GetYearFromEpoch(dstStartUTC))
-		{
-			ComputeDSTStartAndEnd(GetYearFromEpoch(inEpochTime));
-		}
-
-		if (stdStartUTC > dstStartUTC)
-		{
-			return inEpochTime >= dstStartUTC && inEpochTime < stdStartUTC;
-		}
-
-		return !(inEpochTime >= stdStartUTC && inEpochTime < dstStartUTC);
-	}
-	else
-	{
-		if (GetYearFromEpoch(inEpochTime) != GetYearFromEpoch(dstStartLocal))
-		{
-			ComputeDSTStartAndEnd(GetYearFromEpoch(inEpochTime));
-		}
-
-		if (stdStartLocal > dstStartLocal)
-		{
-			return inEpochTime >= dstStartLocal && inEpochTime < stdStartLocal;
-		}
-
-		return !(inEpochTime >= stdStartLocal && inEpochTime < dstStartLocal);
-	}
-
-	return false;
+	return GetDSTInterval(inEpochTime, inUTC).inDST;
 }
 
 // Create a new alarm object
@@ -1119,24 +1402,29 @@ CModule_RealTime::CreateAlarm(
 	TRealTimeAlarmMethod	inMethod,		// The method on the above object
 	void*					inReference)	// The reference value passed into the above method
 {
-	SAlarm*	targetAlarm = NULL;
-
-	for(int i = 0; i < eAlarm_MaxActive; ++i)
+	if(alarmFreeList == NULL)
 	{
-		if(alarmArray[i].object == NULL)
+		SAlarm*	newBlock = new SAlarm[eRealTime_PoolBlockCount];
+		MReturnOnError(newBlock == NULL, NULL);
+
+		for(int i = 0; i < eRealTime_PoolBlockCount; ++i)
 		{
-			targetAlarm = alarmArray + i;
-			break;
+			newBlock[i].object = NULL;
+			newBlock[i].heapIndex = eRealTime_NotScheduled;
+			newBlock[i].nextFree = alarmFreeList;
+			alarmFreeList = newBlock + i;
 		}
 	}
 
-	MReturnOnError(targetAlarm == NULL, NULL);
+	SAlarm*	targetAlarm = alarmFreeList;
+	alarmFreeList = targetAlarm->nextFree;
 
 	targetAlarm->name = inAlarmName;
 	targetAlarm->object = inObject;
 	targetAlarm->method = inMethod;
 	targetAlarm->reference = inReference;
-	targetAlarm->nextTriggerTimeUTC = MAXUINT32;
+	targetAlarm->heapIndex = eRealTime_NotScheduled;
+	targetAlarm->nextFree = NULL;
 
 	return targetAlarm;
 }
@@ -1150,7 +1438,12 @@ CModule_RealTime::DestroyAlarm(
 
 	SAlarm*	targetAlarm = (SAlarm*)inAlarmRef;
 
+	MReturnOnError(targetAlarm->object == NULL);	// Already destroyed
+
+	TimerHeapRemove(alarmHeap, targetAlarm);
 	targetAlarm->object = NULL;
+	targetAlarm->nextFree = alarmFreeList;
+	alarmFreeList = targetAlarm;
 }
 
 // Register a alarm handler to be called at the specified time or interval
@@ -1177,6 +1470,24 @@ CModule_RealTime::ScheduleAlarm(
 	targetAlarm->second = inSecond;
 	targetAlarm->utc = inUTC;      
 
+	MReturnOnError(inYear != eAlarm_Any && (inYear < 1970 || inYear > eAlarm_MaxYear));
+	MReturnOnError(inMonth != eAlarm_Any && (inMonth < 1 || inMonth > 12));
+	MReturnOnError(inDayOfMonth != eAlarm_Any && (inDayOfMonth < 1 || inDayOfMonth > 31));
+	MReturnOnError(inDayOfWeek != eAlarm_Any && (inDayOfWeek < 1 || inDayOfWeek > 7));
+	MReturnOnError(inHour != eAlarm_Any && (inHour < 0 || inHour > 23));
+	MReturnOnError(inMinute != eAlarm_Any && (inMinute < 0 || inMinute > 59));
+	MReturnOnError(inSecond != eAlarm_Any && (inSecond < 0 || inSecond > 59));
+
+	// Compile the components once here so each reschedule is a direct search of the masks
+	SAlarmRule&	rule = targetAlarm->rule;
+	rule.secondMask = inSecond == eAlarm_Any ? (1ULL << 60) - 1 : 1ULL << inSecond;
+	rule.minuteMask = inMinute == eAlarm_Any ? (1ULL << 60) - 1 : 1ULL << inMinute;
+	rule.hourMask = inHour == eAlarm_Any ? (1UL << 24) - 1 : 1UL << inHour;
+	rule.dayMask = inDayOfMonth == eAlarm_Any ? 0xFFFFFFFE : 1UL << inDayOfMonth;
+	rule.monthMask = inMonth == eAlarm_Any ? 0x1FFE : 1 << inMonth;
+	rule.dayOfWeekMask = inDayOfWeek == eAlarm_Any ? 0xFE : 1 << inDayOfWeek;
+	rule.year = inYear;
+
 	ScheduleAlarm(targetAlarm);
 }
 
@@ -1185,7 +1496,7 @@ CModule_RealTime::UnscheduleAlarm(
 	TRealTimeAlarmRef	inAlarmRef)
 {
 	SAlarm*	targetAlarm = (SAlarm*)inAlarmRef;
-	targetAlarm->nextTriggerTimeUTC = MAXUINT32;
+	TimerHeapRemove(alarmHeap, targetAlarm);
 }
 
 // Create a new event object
@@ -1196,137 +1507,578 @@ CModule_RealTime::CreateEvent(
 	TRealTimeEventMethod	inMethod,		// The method on the above object
 	void*					inReference)	// The reference value passed into the above method
 {
-	SEvent*	targetEvent = NULL;
+	if(eventFreeList == NULL)
+	{
+		SEvent*	newBlock = new SEvent[eRealTime_PoolBlockCount];
+		MReturnOnError(newBlock == NULL, NULL);
+
+		for(int i = 0; i < eRealTime_PoolBlockCount; ++i)
+		{
+			newBlock[i].object = NULL;
+			newBlock[i].heapIndex = eRealTime_NotScheduled;
+			newBlock[i].nextFree = eventFreeList;
+			eventFreeList = newBlock + i;
+		}
+	}
+
+	SEvent*	targetEvent = eventFreeList;
+	eventFreeList = targetEvent->nextFree;
+
+	targetEvent->name = inEventName;
+	targetEvent->object = inObject;
+	targetEvent->method = inMethod;
+	targetEvent->reference = inReference;
+	targetEvent->heapIndex = eRealTime_NotScheduled;
+	targetEvent->nextFree = NULL;
+
+	return targetEvent;
+}
+
+// destroy the given alarm object
+void
+CModule_RealTime::DestroyEvent(
+	TRealTimeEventRef	inEventRef)
+{
+	MReturnOnError(inEventRef == NULL);
+
+	SEvent*	targetEvent = (SEvent*)inEventRef;
+
+	MReturnOnError(targetEvent->object == NULL);	// Already destroyed
+
+	TimerHeapRemove(eventHeap, targetEvent);
+	targetEvent->object = NULL;
+	targetEvent->nextFree = eventFreeList;
+	eventFreeList = targetEvent;
+}
+
+// Register an event to be called in the given time or for the given periodic interval
+void
+CModule_RealTime::ScheduleEvent(
+	TRealTimeEventRef	inEventRef,
+	uint64_t			inPeriodUS,		// The period for which to call
+	bool				inOnlyOnce)	// True if the event is only called once
+{
+	MReturnOnError(inEventRef == NULL);
+	SEvent*	targetEvent = (SEvent*)inEventRef;
+
+	targetEvent->periodUS = inPeriodUS;
+	targetEvent->onceOnly = inOnlyOnce;
+	targetEvent->deadline = gCurLocalUS + inPeriodUS;
+	MReturnOnError(!TimerHeapSchedule(eventHeap, targetEvent));
+}
+
+void
+CModule_RealTime::UnscheduleEvent(
+	TRealTimeEventRef	inEventRef)
+{
+	MReturnOnError(inEventRef == NULL);
+
+	SEvent*	targetEvent = (SEvent*)inEventRef;
+
+	TimerHeapRemove(eventHeap, targetEvent);
+}
+
+TRealTimeISRTimerRef
+CModule_RealTime::CreateISRTimer(
+	TRealTimeISRTimerFunc	inFunc,
+	void*					inRefCon)
+{
+	MReturnOnError(inFunc == NULL || isrTimerCount >= eRealTime_MaxISRTimers, NULL);
+
+	SISRTimer*	newTimer = isrTimerList + isrTimerCount++;
+
+	newTimer->func = inFunc;
+	newTimer->refCon = inRefCon;
+
+	return newTimer;
+}
+
+bool
+CModule_RealTime::ArmISRTimer(
+	TRealTimeISRTimerRef	inTimerRef,
+	uint32_t				inDelayUS)
+{
+	// No SystemMsg here since this may be in an interrupt
+	if(inTimerRef == NULL || inDelayUS >= eRealTime_MaxISRTimerDelayUS)
+	{
+		return false;
+	}
+
+	SISRTimer*	targetTimer = (SISRTimer*)inTimerRef;
+
+	// The deadline is taken now so the time until the main loop applies the request is not added to the delay
+	uint32_t	nowUS = GetISRTimerUS();
+	uint32_t	deadlineUS = nowUS + inDelayUS;
+
+	// This can be called from an interrupt handler so the interrupt state is restored rather than turned back on
+	uint32_t	interruptState = SaveAndDisableInterrupts();
+	if(!isrHardwareRunning || (int32_t)(deadlineUS - isrHardwareWakeUS) < 0 || (int32_t)(isrHardwareWakeUS - nowUS) <= 0)
+	{
+		// The hardware timer would wake too late for this deadline, or it is waking now and a timer function is arming again, so apply it now instead of waiting for the main loop
+		targetTimer->deadlineUS = deadlineUS;
+		targetTimer->armed = true;
+		targetTimer->request = eISRTimerRequest_None;
+		ProgramISRTimer();
+	}
+	else
+	{
+		// Like a cancel the old deadline must not fire while the new one waits for the main loop
+		targetTimer->armed = false;
+		targetTimer->requestDeadlineUS = deadlineUS;
+		targetTimer->request = eISRTimerRequest_Arm;
+	}
+	RestoreInterrupts(interruptState);
+
+	Signal();
+
+	return true;
+}
+
+void
+CModule_RealTime::CancelISRTimer(
+	TRealTimeISRTimerRef	inTimerRef)
+{
+	if(inTimerRef == NULL)
+	{
+		return;
+	}
+
+	SISRTimer*	targetTimer = (SISRTimer*)inTimerRef;
+
+	// Disarming right away keeps the timer from firing before the request is applied, the request keeps an earlier arm from being applied after this
+	targetTimer->armed = false;
+	targetTimer->request = eISRTimerRequest_Cancel;
+	Signal();
+}
+
+void
+CModule_RealTime::RegisterTimeChangeHandler(
+	STimeChangeHandler*		inNode,
+	char const*				inName,
+	IRealTimeHandler*		inObject,
+	TRealTimeChangeMethod	inMethod)
+{
+	MReturnOnError(inNode == NULL || inName == NULL || strlen(inName) == 0);
+
+	// Registering a name again replaces the old handler
+	CancelTimeChangeHandler(inName);
+
+	inNode->name = inName;
+	inNode->object = inObject;
+	inNode->method = inMethod;
+	inNode->next = timeChangeHandlerList;
+	timeChangeHandlerList = inNode;
+}
+
+void
+CModule_RealTime::CancelTimeChangeHandler(
+	char const*	inName)
+{
+	STimeChangeHandler**	link = FindTimeChangeHandlerLink(inName);
+	if(link != NULL)
+	{
+		*link = (*link)->next;
+	}
+}
+
+STimeChangeHandler**
+CModule_RealTime::FindTimeChangeHandlerLink(
+	char const*	inName)
+{
+	for(STimeChangeHandler** link = &timeChangeHandlerList; *link != NULL; link = &(*link)->next)
+	{
+		if(strcmp(inName, (*link)->name) == 0)
+		{
+			return link;
+		}
+	}
+
+	return NULL;
+}
+
+void
+CModule_RealTime::NotifyTimeChange(
+	bool	inTimeZone)
+{
+	RescheduleAllAlarms();
+
+	// A handler may cancel itself so get the next one first
+	STimeChangeHandler*	curHandler = timeChangeHandlerList;
+	while(curHandler != NULL)
+	{
+		STimeChangeHandler*	nextHandler = curHandler->next;
+
+		if(curHandler->object != NULL)
+		{
+			(curHandler->object->*curHandler->method)(curHandler->name, inTimeZone);
+		}
+
+		curHandler = nextHandler;
+	}
+}
+
+void
+CModule_RealTime::RescheduleAllAlarms(
+	void)
+{
+	TEpochTime	nowUTC = GetEpochTime(true);
+	TEpochTime	nowLocal = UTCToLocal(nowUTC);
+
+	// Alarms that are already due are left to fire, the rest get the first match after the new time which is earlier if time went back or the time zone changed
+	for(uint16_t itr = 0; itr < alarmHeap.count; ++itr)
+	{
+		SAlarm*		curAlarm = (SAlarm*)alarmHeap.list[itr];
+		TEpochTime	nextTriggerTime;
+
+		if(curAlarm->deadline > nowUTC && GetNextAlarmTime(curAlarm->rule, (curAlarm->utc ? nowUTC : nowLocal) + 1, nextTriggerTime))
+		{
+			curAlarm->deadline = curAlarm->utc ? nextTriggerTime : LocalToUTC(nextTriggerTime);
+		}
+	}
+
+	// Heapify from the last parent down
+	for(uint16_t itr = alarmHeap.count / 2; itr > 0; --itr)
+	{
+		TimerHeapSiftDown(alarmHeap, itr - 1);
+	}
+}
+
+void
+CModule_RealTime::ComputeDSTStartAndEnd(
+	int	inYear)
+{
+	dstStartLocal = ComputeEpochTimeForOffsetSpecifier(timeZoneInfo.dstStart, inYear);
+	stdStartLocal = ComputeEpochTimeForOffsetSpecifier(timeZoneInfo.stdStart, inYear);
+	dstStartUTC = dstStartLocal - timeZoneInfo.stdStart.offsetMins * 60;
+	stdStartUTC = stdStartLocal - timeZoneInfo.dstStart.offsetMins * 60;
+}
+
+void
+CModule_RealTime::ServiceISRTimers(
+	void)
+{
+	noInterrupts();
+	for(uint8_t itr = 0; itr < isrTimerCount; ++itr)
+	{
+		SISRTimer*	curTimer = isrTimerList + itr;
+		uint8_t		request = curTimer->request;
+
+		if(request == eISRTimerRequest_None)
+		{
+			continue;
+		}
+
+		curTimer->request = eISRTimerRequest_None;
+		if(request == eISRTimerRequest_Arm)
+		{
+			curTimer->deadlineUS = curTimer->requestDeadlineUS;
+			curTimer->armed = true;
+		}
+		else
+		{
+			curTimer->armed = false;
+		}
+	}
+
+	ProgramISRTimer();
+	interrupts();
+
+	#if !defined(WIN32)
+	if(isrHardwareRunning)
+	{
+		return;
+	}
+	#endif
+
+	// Without a timer interrupt due timers fire from the main loop at the loop latency, this is always the case on the host
+	FireISRTimers();
+
+	// The timer functions may have armed again and on hardware this retries starting the timer
+	noInterrupts();
+	ProgramISRTimer();
+	interrupts();
+
+	#if !defined(WIN32)
+	if(isrHardwareRunning)
+	{
+		return;
+	}
+
+	// Keep the loop coming back while a timer is armed since there is no interrupt to fire it
+	for(uint8_t itr = 0; itr < isrTimerCount; ++itr)
+	{
+		if(isrTimerList[itr].armed)
+		{
+			Signal();
+			break;
+		}
+	}
+	#endif
+}
+
+void
+CModule_RealTime::FireISRTimers(
+	void)
+{
+	uint32_t	nowUS = GetISRTimerUS();
+
+	for(uint8_t itr = 0; itr < isrTimerCount; ++itr)
+	{
+		SISRTimer*	curTimer = isrTimerList + itr;
+
+		if(curTimer->armed && (int32_t)(nowUS - curTimer->deadlineUS) >= 0)
+		{
+			// Disarm first so the function can arm it again
+			curTimer->armed = false;
+			curTimer->func(curTimer->refCon);
+		}
+	}
+}
+
+void
+CModule_RealTime::ProgramISRTimer(
+	void)
+{
+	uint32_t	nowUS = GetISRTimerUS();
+	int32_t		earliestUS = eRealTime_MaxISRHardwarePeriodUS;
+	bool		anyArmed = false;
+
+	for(uint8_t itr = 0; itr < isrTimerCount; ++itr)
+	{
+		SISRTimer*	curTimer = isrTimerList + itr;
+
+		if(curTimer->armed)
+		{
+			earliestUS = MMin(earliestUS, (int32_t)(curTimer->deadlineUS - nowUS));
+			anyArmed = true;
+		}
+	}
+
+	if(!anyArmed)
+	{
+		isrHardwareTimer.end();
+		isrHardwareRunning = false;
+		return;
+	}
+
+	// A deadline already passed fires as soon as the timer can
+	uint32_t	periodUS = (uint32_t)MMax(earliestUS, (int32_t)1);
+
+	isrHardwareWakeUS = nowUS + periodUS;
+	isrHardwareRunning = isrHardwareTimer.begin(CModule_RealTime::ISRTimerInterrupt, periodUS);
+	if(!isrHardwareRunning)
+	{
+		// A failed begin() leaves any earlier period running, stop it so the main loop can take over
+		isrHardwareTimer.end();
+	}
+}
+
+void
+CModule_RealTime::ISRTimerInterrupt(
+	void)
+{
+	// Waking before any deadline is due only happens for a deadline beyond the longest hardware period, programming again takes the next step
+	gRealTime->FireISRTimers();
+
+	uint32_t	interruptState = SaveAndDisableInterrupts();
+	gRealTime->ProgramISRTimer();
+	RestoreInterrupts(interruptState);
 
-	for(int i = 0; i < eEvent_MaxActive; ++i)
+	if(!gRealTime->isrHardwareRunning)
 	{
-		if(eventArray[i].object == NULL)
-		{
-			targetEvent = eventArray + i;
-			break;
-		}
+		gRealTime->Signal();
 	}
+}
 
-	MReturnOnError(targetEvent == NULL, NULL);
-
-	targetEvent->name = inEventName;
-	targetEvent->object = inObject;
-	targetEvent->method = inMethod;
-	targetEvent->reference = inReference;
-	targetEvent->lastFireTime = 0;
-
-	return targetEvent;
+uint32_t
+CModule_RealTime::GetISRTimerUS(
+	void)
+{
+	#if defined(WIN32)
+		// The host follows the local clock so the timers keep pace with simulated time
+		return (uint32_t)gCurLocalUS;
+	#else
+		return micros();
+	#endif
 }
 
-// destroy the given alarm object
 void
-CModule_RealTime::DestroyEvent(
-	TRealTimeEventRef	inEventRef)
+CModule_RealTime::UpdateHardwareAlarm(
+	void)
 {
-	MReturnOnError(inEventRef == NULL);
+	if(localProvider == NULL)
+	{
+		return;
+	}
 
-	SEvent*	targetEvent = (SEvent*)inEventRef;
+	TEpochTime	alarmUTC = 0;
 
-	targetEvent->object = NULL;
+	if(alarmHeap.count > 0 && alarmHeap.list[0]->deadline <= (uint64_t)GetEpochTime(true) + eRealTime_HardwareAlarmHorizonSecs)
+	{
+		alarmUTC = (TEpochTime)alarmHeap.list[0]->deadline;
+	}
+
+	if(alarmUTC != hardwareAlarmUTC)
+	{
+		hardwareAlarmUTC = alarmUTC;
+		localProvider->SetAlarmUTC(alarmUTC);
+	}
 }
 
-// Register an event to be called in the given time or for the given periodic interval
-void
-CModule_RealTime::ScheduleEvent(
-	TRealTimeEventRef	inEventRef,
-	uint64_t			inPeriodUS,		// The period for which to call
-	bool				inOnlyOnce)	// True if the event is only called once
+uint64_t
+CModule_RealTime::GetDisciplinedUS(
+	uint64_t	inLocalUS,
+	int64_t&	outSlewAppliedUS)
 {
-	MReturnOnError(inEventRef == NULL);
-	SEvent*	targetEvent = (SEvent*)inEventRef;
+	uint64_t	elapsedUS = inLocalUS - baseLocalUS;
+	int64_t		maxSlewUS = (int64_t)(elapsedUS * eClock_MaxSlewPPM / 1000000);
 
-	targetEvent->periodUS = inPeriodUS;
-	targetEvent->onceOnly = inOnlyOnce;
-	targetEvent->lastFireTime = gCurLocalUS;
+	outSlewAppliedUS = MMax(-maxSlewUS, MMin(slewRemainingUS, maxSlewUS));
+
+	return baseEpochUS + elapsedUS * timeMultiplier + (int64_t)elapsedUS * freqOffsetPPB / 1000000000 + outSlewAppliedUS;
 }
 
 void
-CModule_RealTime::UnscheduleEvent(
-	TRealTimeEventRef	inEventRef)
+CModule_RealTime::RebaseClock(
+	void)
 {
-	MReturnOnError(inEventRef == NULL);
+	int64_t	slewUS;
 
-	SEvent*	targetEvent = (SEvent*)inEventRef;
-
-	targetEvent->lastFireTime = 0;
+	baseEpochUS = GetDisciplinedUS(gCurLocalUS, slewUS);
+	baseLocalUS = gCurLocalUS;
+	slewRemainingUS -= slewUS;
 }
 
-void
-CModule_RealTime::RegisterTimeChangeHandler(
-	char const*				inName,
-	IRealTimeHandler*		inObject,
-	TRealTimeChangeMethod	inMethod)
+bool
+CModule_RealTime::DisciplineClock(
+	uint64_t	inEpochTimeUS,
+	uint32_t	inPrecisionUS,
+	bool		inFromProvider)
 {
-	MReturnOnError(inName == NULL || strlen(inName) == 0);
+	RebaseClock();
 
-	STimeChangeHandler*	targetHandler = FindTimeChangeHandlerByName(inName);
+	int64_t	offsetUS = (int64_t)(inEpochTimeUS - baseEpochUS);
+	int64_t	stepThresholdUS = MMax((int64_t)eClock_StepThresholdUS, 2 * (int64_t)inPrecisionUS);
 
-	if(targetHandler == NULL)
+	// An offset within the source's precision is not an error
+	if(offsetUS < (int64_t)inPrecisionUS / 2 && offsetUS > -(int64_t)inPrecisionUS / 2)
 	{
-		targetHandler = FindTimeChangeHandlerFirstEmpty();
+		offsetUS = 0;
+	}
+
+	// Only a provider is trusted to be close, a manually set time is always stepped
+	bool	stepped = !clockSet || !inFromProvider || timeMultiplier != 1 || offsetUS >= stepThresholdUS || offsetUS <= -stepThresholdUS;
 
-		MReturnOnError(targetHandler == NULL);
+	if(stepped)
+	{
+		baseEpochUS += offsetUS;
+		slewRemainingUS = 0;
+	}
+	else
+	{
+		// This replaces the remaining slew since the offset was measured from the partially slewed time
+		slewRemainingUS = offsetUS;
 	}
 
-	targetHandler->name = inName;
-	targetHandler->object = inObject;
-	targetHandler->method = inMethod;
-}
+	clockSet = true;
 
-void
-CModule_RealTime::CancelTimeChangeHandler(
-	char const*	inName)
-{
-	STimeChangeHandler*	targetHandler = FindTimeChangeHandlerByName(inName);
-	if(targetHandler != NULL)
+	if(!inFromProvider || timeMultiplier != 1)
 	{
-		targetHandler->name = NULL;
+		return stepped;
 	}
-}
 
-CModule_RealTime::STimeChangeHandler*
-CModule_RealTime::FindTimeChangeHandlerByName(
-	char const*	inName)
-{
-	for(int i = 0; i < eTimeChangeHandler_MaxCount; ++i)
+	// The frequency is measured between provider times so it does not depend on our own corrections
+	if(freqAnchorPrecisionUS > 0)
 	{
-		if(timeChangeHandlerArray[i].name != NULL && strcmp(inName, timeChangeHandlerArray[i].name) == 0)
+		uint64_t	localElapsedUS = gCurLocalUS - freqAnchorLocalUS;
+
+		if(localElapsedUS < (uint64_t)MMax(inPrecisionUS, freqAnchorPrecisionUS) * eClock_FreqIntervalRatio)
+		{
+			return stepped;
+		}
+
+		int64_t	errorUS = (int64_t)(inEpochTimeUS - freqAnchorEpochUS) - (int64_t)localElapsedUS;
+		int64_t	maxErrorUS = (int64_t)(localElapsedUS / 1000000 * eClock_MaxFreqPPB / 1000);
+
+		if(errorUS <= maxErrorUS && errorUS >= -maxErrorUS)
+		{
+			int32_t	measuredPPB = (int32_t)(errorUS * 1000 / (int64_t)(localElapsedUS / 1000000));
+
+			freqOffsetPPB += freqSampleCount == 0 ? measuredPPB : (measuredPPB - freqOffsetPPB) / eClock_FreqGain;
+			++freqSampleCount;
+		}
+		else
 		{
-			return timeChangeHandlerArray + i;
+			SystemMsg("Clock frequency sample of %ld us over %lu s discarded", (int32_t)errorUS, (uint32_t)(localElapsedUS / 1000000));
 		}
 	}
 
-	return NULL;
+	freqAnchorLocalUS = gCurLocalUS;
+	freqAnchorEpochUS = inEpochTimeUS;
+	freqAnchorPrecisionUS = MMax(inPrecisionUS, (uint32_t)1);
+
+	return stepped;
 }
 
-CModule_RealTime::STimeChangeHandler*
-CModule_RealTime::FindTimeChangeHandlerFirstEmpty(
-	void)
+CModule_RealTime::SDSTInterval const&
+CModule_RealTime::GetDSTInterval(
+	TEpochTime	inEpochTime,
+	bool		inUTC)
 {
-	for(int i = 0; i < eTimeChangeHandler_MaxCount; ++i)
+	SDSTInterval&	interval = inUTC ? utcDSTInterval : localDSTInterval;
+
+	if(inEpochTime >= interval.validFrom && inEpochTime < interval.validTo)
 	{
-		if(timeChangeHandlerArray[i].name == NULL)
+		return interval;
+	}
+
+	int	year = GetYearFromEpoch(inEpochTime);
+
+	ComputeDSTStartAndEnd(year);
+
+	TEpochTime	dstStart = inUTC ? dstStartUTC : dstStartLocal;
+	TEpochTime	stdStart = inUTC ? stdStartUTC : stdStartLocal;
+
+	if(stdStart > dstStart)
+	{
+		interval.inDST = inEpochTime >= dstStart && inEpochTime < stdStart;
+	}
+	else
+	{
+		interval.inDST = !(inEpochTime >= stdStart && inEpochTime < dstStart);
+	}
+
+	interval.offsetSecs = (interval.inDST ? timeZoneInfo.dstStart.offsetMins : timeZoneInfo.stdStart.offsetMins) * 60;
+
+	// The transitions are computed per year so the interval is also bounded by the year
+	uint64_t	yearEnd = (uint64_t)DaysFromCivil(year + 1, 1, 1) * 60 * 60 * 24;
+
+	interval.validFrom = DaysFromCivil(year, 1, 1) * 60 * 60 * 24;
+	interval.validTo = yearEnd > MAXUINT32 ? MAXUINT32 : (TEpochTime)yearEnd;
+
+	TEpochTime	transitionList[2] = {dstStart, stdStart};
+	for(int i = 0; i < 2; ++i)
+	{
+		if(transitionList[i] <= inEpochTime && transitionList[i] > interval.validFrom)
+		{
+			interval.validFrom = transitionList[i];
+		}
+		else if(transitionList[i] > inEpochTime && transitionList[i] < interval.validTo)
 		{
-			return timeChangeHandlerArray + i;
+			interval.validTo = transitionList[i];
 		}
 	}
 
-	return NULL;
+	return interval;
 }
 
 void
-CModule_RealTime::ComputeDSTStartAndEnd(
-	int	inYear)
+CModule_RealTime::InvalidateDSTIntervals(
+	void)
 {
-	dstStartLocal = ComputeEpochTimeForOffsetSpecifier(timeZoneInfo.dstStart, inYear);
-	stdStartLocal = ComputeEpochTimeForOffsetSpecifier(timeZoneInfo.stdStart, inYear);
-	dstStartUTC = dstStartLocal - timeZoneInfo.stdStart.offsetMins * 60;
-	stdStartUTC = stdStartLocal - timeZoneInfo.dstStart.offsetMins * 60;
+	// An empty interval so the next lookup recomputes it
+	utcDSTInterval.validFrom = utcDSTInterval.validTo = 0;
+	localDSTInterval.validFrom = localDSTInterval.validTo = 0;
 }
 
 TEpochTime
@@ -1368,21 +2120,18 @@ CModule_RealTime::ScheduleAlarm(
 	SAlarm*	inAlarm)
 {
 	// Reschedule it if possible
-	int	year = inAlarm->year;
-	int	month = inAlarm->month;
-	int	day = inAlarm->dayOfMonth;
-	int	dow = inAlarm->dayOfWeek;
-	int	hour = inAlarm->hour;
-	int	min = inAlarm->minute;
-	int	sec = inAlarm->second;
+	int			year, month, day, dow, hour, min, sec;
+	TEpochTime	nextTriggerTime;
 
-	if(GetNextDateTime(year, month, day, dow, hour, min, sec, inAlarm->utc))
+	if(GetNextAlarmTime(inAlarm->rule, GetEpochTime(inAlarm->utc) + 1, nextTriggerTime))
 	{
-		inAlarm->nextTriggerTimeUTC = GetEpochTimeFromComponents(year, month, day, hour, min, sec);
+		GetComponentsFromEpochTime(nextTriggerTime, year, month, day, dow, hour, min, sec);
 		if(!inAlarm->utc)
 		{
-			inAlarm->nextTriggerTimeUTC = LocalToUTC(inAlarm->nextTriggerTimeUTC);
+			nextTriggerTime = LocalToUTC(nextTriggerTime);
 		}
+		inAlarm->deadline = nextTriggerTime;
+		MReturnOnError(!TimerHeapSchedule(alarmHeap, inAlarm));
 		SystemMsg("%s scheduled for %02d/%02d/%04d %02d:%02d:%02d", inAlarm->name, month, day, year, hour, min, sec);
 	}
 	else
@@ -1391,10 +2140,293 @@ CModule_RealTime::ScheduleAlarm(
 		SystemMsg("  target was %02d/%02d/%04d %02d:%02d:%02d", inAlarm->month, inAlarm->dayOfMonth, inAlarm->year, inAlarm->hour, inAlarm->minute, inAlarm->second);
 		GetComponentsFromEpochTime(GetEpochTime(inAlarm->utc), year, month, day, dow, hour, min, sec);
 		SystemMsg("  now is %02d/%02d/%04d %02d:%02d:%02d", month, day, year, hour, min, sec);
+		TimerHeapRemove(alarmHeap, inAlarm);
 		inAlarm->name = NULL;
 	}
 }
 
+// Return the lowest allowed value at or above inFrom or -1 if there is none
+static int
+FindNextAllowed(
+	uint64_t	inMask,
+	int			inFrom)
+{
+	if(inFrom >= 64)
+	{
+		return -1;
+	}
+
+	uint64_t	mask = inMask >> inFrom;
+
+	if(mask == 0)
+	{
+		return -1;
+	}
+
+	// The bit scan builtin is a gcc one, the simulator may be built with another compiler
+	#if defined(__GNUC__)
+	return inFrom + __builtin_ctzll(mask);
+	#else
+	while((mask & 1) == 0)
+	{
+		mask >>= 1;
+		++inFrom;
+	}
+	return inFrom;
+	#endif
+}
+
+bool
+CModule_RealTime::GetNextAlarmTime(
+	SAlarmRule const&	inRule,
+	TEpochTime			inTime,
+	TEpochTime&			outTime)
+{
+	int	year, month, day, dow, hour, min, sec;
+
+	int	firstDOW = 0;				// The day of week of the first of the month firstDOWMonthKey
+	int	firstDOWMonthKey = -1;		// year * 12 + month
+	int	firstDOWMonthDays = 0;
+
+	GetComponentsFromEpochTime(inTime, year, month, day, dow, hour, min, sec);
+
+	// Each pass either finds the time or moves forward to the start of the next allowed unit, so this is bounded by the number of candidate months
+	for(;;)
+	{
+		if(year > eAlarm_MaxYear || (inRule.year != eAlarm_Any && year > inRule.year))
+		{
+			return false;
+		}
+
+		if(inRule.year != eAlarm_Any && year < inRule.year)
+		{
+			year = inRule.year;
+			month = 1;
+			day = 1;
+			hour = min = sec = 0;
+		}
+
+		int	nextMonth = FindNextAllowed(inRule.monthMask, month);
+		if(nextMonth < 0)
+		{
+			++year;
+			month = 1;
+			day = 1;
+			hour = min = sec = 0;
+			continue;
+		}
+
+		if(nextMonth != month)
+		{
+			month = nextMonth;
+			day = 1;
+			hour = min = sec = 0;
+		}
+
+		// Build the mask of days this month that are on an allowed day of the week, most rules allow any day so skip the work for those
+		int			daysThisMonth = gDaysInMonth[month - 1] + ((month == 2 && MIsLeapYear(year)) ? 1 : 0);
+		uint32_t	dowDayMask = 0xFFFFFFFE;
+		if(inRule.dayOfWeekMask != 0xFE)
+		{
+			// Stepping to the following month carries the day of week forward instead of converting the date again
+			if(year * 12 + month == firstDOWMonthKey + 1)
+			{
+				firstDOW = (firstDOW - 1 + firstDOWMonthDays) % 7 + 1;
+			}
+			else if(year * 12 + month != firstDOWMonthKey)
+			{
+				firstDOW = GetDayOfWeekFromEpoch(GetEpochTimeFromComponents(year, month, 1, 0, 0, 0));
+			}
+			firstDOWMonthKey = year * 12 + month;
+			firstDOWMonthDays = daysThisMonth;
+
+			// Rotate the allowed days of the week so bit 1 is the first of the month
+			uint32_t	weekBits = inRule.dayOfWeekMask >> 1;
+			uint32_t	weekMask = (((weekBits >> (firstDOW - 1)) | (weekBits << (8 - firstDOW))) & 0x7F) << 1;
+
+			dowDayMask = weekMask | (weekMask << 7) | (weekMask << 14) | (weekMask << 21) | (weekMask << 28);
+		}
+		uint32_t	monthDayMask = (uint32_t)((1ULL << (daysThisMonth + 1)) - 2);
+		int			nextDay = FindNextAllowed(inRule.dayMask & dowDayMask & monthDayMask, day);
+		if(nextDay < 0)
+		{
+			if(++month > 12)
+			{
+				++year;
+				month = 1;
+			}
+			day = 1;
+			hour = min = sec = 0;
+			continue;
+		}
+
+		if(nextDay != day)
+		{
+			day = nextDay;
+			hour = min = sec = 0;
+		}
+
+		int	nextHour = FindNextAllowed(inRule.hourMask, hour);
+		if(nextHour < 0)
+		{
+			++day;
+			hour = min = sec = 0;
+			continue;
+		}
+
+		if(nextHour != hour)
+		{
+			hour = nextHour;
+			min = sec = 0;
+		}
+
+		int	nextMin = FindNextAllowed(inRule.minuteMask, min);
+		if(nextMin < 0)
+		{
+			++hour;
+			min = sec = 0;
+			continue;
+		}
+
+		if(nextMin != min)
+		{
+			min = nextMin;
+			sec = 0;
+		}
+
+		int	nextSec = FindNextAllowed(inRule.secondMask, sec);
+		if(nextSec < 0)
+		{
+			++min;
+			sec = 0;
+			continue;
+		}
+
+		outTime = GetEpochTimeFromComponents(year, month, day, hour, min, nextSec);
+
+		return true;
+	}
+}
+
+bool
+CModule_RealTime::TimerHeapSchedule(
+	STimerHeap&	ioHeap,
+	STimer*		inTimer)
+{
+	if(inTimer->heapIndex == eRealTime_NotScheduled)
+	{
+		if(ioHeap.count >= ioHeap.capacity)
+		{
+			uint16_t	newCapacity = ioHeap.capacity + eRealTime_PoolBlockCount;
+			STimer**	newList = new STimer*[newCapacity];
+			MReturnOnError(newList == NULL, false);
+
+			if(ioHeap.list != NULL)
+			{
+				memcpy(newList, ioHeap.list, ioHeap.count * sizeof(STimer*));
+				delete[] ioHeap.list;
+			}
+
+			ioHeap.list = newList;
+			ioHeap.capacity = newCapacity;
+		}
+
+		inTimer->heapIndex = ioHeap.count++;
+		ioHeap.list[inTimer->heapIndex] = inTimer;
+	}
+
+	// The deadline may have moved either way
+	TimerHeapSiftUp(ioHeap, inTimer->heapIndex);
+	TimerHeapSiftDown(ioHeap, inTimer->heapIndex);
+
+	return true;
+}
+
+void
+CModule_RealTime::TimerHeapRemove(
+	STimerHeap&	ioHeap,
+	STimer*		inTimer)
+{
+	uint16_t	index = inTimer->heapIndex;
+
+	if(index == eRealTime_NotScheduled)
+	{
+		return;
+	}
+
+	inTimer->heapIndex = eRealTime_NotScheduled;
+
+	// Move the last timer into the hole and restore the heap order around it
+	if(--ioHeap.count != index)
+	{
+		ioHeap.list[index] = ioHeap.list[ioHeap.count];
+		ioHeap.list[index]->heapIndex = index;
+		TimerHeapSiftUp(ioHeap, index);
+		TimerHeapSiftDown(ioHeap, ioHeap.list[index]->heapIndex);
+	}
+}
+
+void
+CModule_RealTime::TimerHeapSiftUp(
+	STimerHeap&	ioHeap,
+	uint16_t	inIndex)
+{
+	STimer*	curTimer = ioHeap.list[inIndex];
+
+	while(inIndex > 0)
+	{
+		uint16_t	parentIndex = (inIndex - 1) / 2;
+		STimer*		parentTimer = ioHeap.list[parentIndex];
+
+		if(parentTimer->deadline <= curTimer->deadline)
+		{
+			break;
+		}
+
+		ioHeap.list[inIndex] = parentTimer;
+		parentTimer->heapIndex = inIndex;
+		inIndex = parentIndex;
+	}
+
+	ioHeap.list[inIndex] = curTimer;
+	curTimer->heapIndex = inIndex;
+}
+
+void
+CModule_RealTime::TimerHeapSiftDown(
+	STimerHeap&	ioHeap,
+	uint16_t	inIndex)
+{
+	STimer*	curTimer = ioHeap.list[inIndex];
+
+	for(;;)
+	{
+		uint32_t	childIndex = inIndex * 2 + 1;
+
+		if(childIndex >= ioHeap.count)
+		{
+			break;
+		}
+
+		if(childIndex + 1 < ioHeap.count && ioHeap.list[childIndex + 1]->deadline < ioHeap.list[childIndex]->deadline)
+		{
+			++childIndex;
+		}
+
+		if(curTimer->deadline <= ioHeap.list[childIndex]->deadline)
+		{
+			break;
+		}
+
+		ioHeap.list[inIndex] = ioHeap.list[childIndex];
+		ioHeap.list[inIndex]->heapIndex = inIndex;
+		inIndex = childIndex;
+	}
+
+	ioHeap.list[inIndex] = curTimer;
+	curTimer->heapIndex = inIndex;
+}
+
 uint8_t
 CModule_RealTime::SerialSetTime(
 	IOutputDirector*	inOutput,
@@ -1659,19 +2691,34 @@ CModule_RealTime::SerialDumpTable(
 	int					inArgC,
 	char const*			inArgV[])
 {
-	SAlarm* curAlarm = alarmArray;
-	for(int alarmItr = 0; alarmItr < eAlarm_MaxActive; ++alarmItr, ++curAlarm)
+	inOutput->printf("clock: %s freq %ld ppb from %u samples slew %ld us remaining\n", clockSet ? "set" : "not set", freqOffsetPPB, freqSampleCount, (int32_t)slewRemainingUS);
+
+	// Only scheduled alarms and events are in the heaps, they are listed in heap order not time order
+	for(uint16_t itr = 0; itr < alarmHeap.count; ++itr)
 	{
-		if(curAlarm->name == NULL)
-		{
-			continue;
-		}
+		SAlarm*	curAlarm = (SAlarm*)alarmHeap.list[itr];
+		int		year, month, day, dow, hour, min, sec;
+
+		GetComponentsFromEpochTime((TEpochTime)curAlarm->deadline, year, month, day, dow, hour, min, sec);
+
+		inOutput->printf("%s will alarm at %02d/%02d/%02d %02d:%02d:%02d UTC\n", curAlarm->name, month, day, year, hour, min, sec);
+	}
+
+	for(uint16_t itr = 0; itr < eventHeap.count; ++itr)
+	{
+		SEvent*	curEvent = (SEvent*)eventHeap.list[itr];
 
-		int	 year, month, day, dow, hour, min, sec;
+		inOutput->printf("%s will fire in %lu ms\n", curEvent->name, (uint32_t)((curEvent->deadline - MMin(curEvent->deadline, gCurLocalUS)) / 1000));
+	}
 
-		GetComponentsFromEpochTime(curAlarm->nextTriggerTimeUTC, year, month, day, dow, hour, min, sec);
+	for(uint8_t itr = 0; itr < isrTimerCount; ++itr)
+	{
+		SISRTimer*	curTimer = isrTimerList + itr;
 
-		inOutput->printf("%s will alarm at %02d/%02d/%02d %02d:%02d:%02d UTC", curAlarm->name, month, day, year, hour, min, sec);
+		if(curTimer->armed)
+		{
+			inOutput->printf("isr timer %d will fire in %ld us\n", itr, (int32_t)(curTimer->deadlineUS - GetISRTimerUS()));
+		}
 	}
 
 	return eCmd_Succeeded;
@@ -1688,8 +2735,8 @@ CModule_RealTime::SerialSetMultiplier(
 		return false;
 	}
 
-	// Reset the internal state variables
-	SetEpochTime(GetEpochTime(true), true);
+	// The new multiplier only applies from now
+	RebaseClock();
 
 	timeMultiplier = atoi(inArgV[1]);
 
@@ -1906,13 +2953,14 @@ CModule_RealTime::CompareDateTimeWithNow(
 IRealTimeDataProvider*
 CreateDS3234Provider(
 	uint8_t	inChipSelectPin,
-	bool	inUseAltSPI)
+	bool	inUseAltSPI,
+	uint8_t	inAlarmPin)
 {
 	static CRealTimeDataProvider_DS3234*	ds3234Provider = NULL;
 
 	if(ds3234Provider == NULL)
 	{
-		ds3234Provider = new CRealTimeDataProvider_DS3234(inChipSelectPin, inUseAltSPI);
+		ds3234Provider = new CRealTimeDataProvider_DS3234(inChipSelectPin, inUseAltSPI, inAlarmPin);
 	}
 
 	return ds3234Provider;
@@ -1927,9 +2975,11 @@ CreateNTPProvider(
 
 	if(ntpProvider == NULL)
 	{
-		ntpProvider = new CRealTimeDataProvider_NTP(inAddress, inPort);
+		ntpProvider = new CRealTimeDataProvider_NTP();
 	}
 
+	ntpProvider->AddServer(inAddress, inPort);
+
 	return ntpProvider;
 }
 
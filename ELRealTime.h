@@ -63,18 +63,29 @@ class CHTTPConnection;
 enum
 {
 	eAlarm_Any = -1,
+	eAlarm_MaxYear = 2105,	// The last full year TEpochTime can hold
 
-	eAlarm_MaxActive = 8,
-	eEvent_MaxActive = 16,
-	eTimeChangeHandler_MaxCount = 2,
+	eRealTime_PoolBlockCount = 8,	// Alarms and events are allocated from the heap this many at a time and never freed, destroyed ones are reused
+	eRealTime_NotScheduled = 0xFFFF,
 
 	eRealTime_MaxNameLength = 15,
+	eRealTime_HardwareAlarmHorizonSecs = 27 * 24 * 60 * 60,	// Alarms are only given to the provider when they are this close since an RTC alarm may match on the day of the month
+	eRealTime_MaxISRTimers = 8,
+	eRealTime_MaxISRTimerDelayUS = 0x7FFFFFFF,	// Interrupt timer deadlines are kept in micros() which wraps
+	eRealTime_MaxISRHardwarePeriodUS = 60000000,	// IntervalTimer rejects periods over 70 to 90 s depending on the bus clock so longer deadlines are reached in steps
+
+	eClock_StepThresholdUS = 128000,	// Offsets at least this large and twice the source precision are stepped, smaller ones are slewed
+	eClock_MaxSlewPPM = 500,			// The fastest a slew may speed up or slow down the clock
+	eClock_MaxFreqPPB = 500000,			// Frequency errors beyond this are treated as a time change instead of drift
+	eClock_FreqIntervalRatio = 100000,	// A frequency sample needs an interval this many times the source precision, 1 s precision needs ~28 hours
+	eClock_FreqGain = 4,				// Each frequency sample moves the estimate this fraction of the way
+	eClock_RebasePeriodUS = 0x7FFFFFFF,	// About 36 minutes
 };
 
 #define MIsLeapYear(inYear) (((inYear) & 3) == 0 && (((inYear) % 25) != 0 || ((inYear) & 15) == 0))
 #define MRealTimeCreateAlarm(inAlarmName, inMethod, inRefCon) gRealTime->CreateAlarm(inAlarmName, this, static_cast<TRealTimeAlarmMethod>(&inMethod), inRefCon)
 #define MRealTimeCreateEvent(inEventName, inMethod, inRefCon) gRealTime->CreateEvent(inEventName, this, static_cast<TRealTimeEventMethod>(&inMethod), inRefCon)
-#define MRealTimeRegisterTimeChange(inEventName, inMethod) gRealTime->RegisterTimeChangeHandler(inEventName, this, static_cast<TRealTimeChangeMethod>(&inMethod))
+#define MRealTimeRegisterTimeChange(inNode, inEventName, inMethod) gRealTime->RegisterTimeChangeHandler(&inNode, inEventName, this, static_cast<TRealTimeChangeMethod>(&inMethod))
 
 // This specifies a timezone change
 struct STimeZoneOffsetSpecifier
@@ -97,6 +108,7 @@ struct STimeZoneRule
 typedef uint32_t	TEpochTime;	// Secs since Jan 1 00:00 1970 - compatible with standard time definitions but redefined here to eliminate dependencies and conflicts
 typedef void*	TRealTimeEventRef;
 typedef void*	TRealTimeAlarmRef;
+typedef void*	TRealTimeISRTimerRef;
 
 // A provider of a time source implements this interface
 class IRealTimeDataProvider
@@ -116,6 +128,14 @@ public:
 	virtual bool
 	RequestSync(
 		void) = 0;
+
+	// Program a hardware alarm that signals the RealTime module at the given utc time so the cpu can sleep until then, 0 cancels it, return false if there is no hardware alarm
+	virtual bool
+	SetAlarmUTC(
+		TEpochTime	inAlarmTimeUTC)
+	{
+		return false;
+	}
 };
 
 // This is a dummy class for defining a alarm or event handler object
@@ -143,6 +163,20 @@ typedef void
 	char const*	inName,
 	bool		inTimeZone);
 
+// A typedef for a interrupt timer function, it is called from the timer interrupt so it must be interrupt safe
+typedef void
+(*TRealTimeISRTimerFunc)(
+	void*	inRefCon);
+
+// A time change handler is a node owned by the registering object so any number can be registered without allocation, it must stay valid until it is cancelled
+struct STimeChangeHandler
+{
+	char const*				name;
+	IRealTimeHandler*		object;
+	TRealTimeChangeMethod	method;
+	STimeChangeHandler*		next;
+};
+
 class CModule_RealTime : public CModule, public ICmdHandler, public IRealTimeHandler
 {
 public:
@@ -174,12 +208,20 @@ public:
 		bool	inUTC = false,
 		IRealTimeDataProvider*	inSourceProvider = NULL);
 	
-	// Set the current date and time as a TEpochTime
+	// Set the current date and time as a TEpochTime, a time from a source provider is taken as the middle of its second and one set by hand as the start
 	void
 	SetEpochTime(
 		TEpochTime	inEpochTime,
 		bool		inUTC = false,
 		IRealTimeDataProvider*	inSourceProvider = NULL);
+
+	// Set the current date and time in us since the epoch, a source provider's offsets are slewed out when small and used to estimate the local clock's frequency error
+	void
+	SetEpochTimeUS(
+		uint64_t	inEpochTimeUS,
+		bool		inUTC = false,
+		IRealTimeDataProvider*	inSourceProvider = NULL,
+		uint32_t	inPrecisionUS = 1);	// The source time is within half of this of the true time
 	
 	// Get the current date and time components
 	void
@@ -214,6 +256,11 @@ public:
 	GetEpochTimeWithMS(
 		int&	outMilliseconds,
 		bool	inUTC = false);
+
+	// Get the current time in us since the epoch, it is as precise as the last sync and only moves backwards when a large offset is stepped
+	uint64_t
+	GetEpochTimeUS(
+		bool	inUTC = false);
 	
 	int
 	GetYearNow(
@@ -382,10 +429,30 @@ public:
 		TRealTimeEventRef	inEventRef,
 		uint64_t			inPeriodUS,		// The period for which to call
 		bool				inOnlyOnce);	// True if the event is only called once
+
+	// Create a one shot timer whose function is called from a hardware timer interrupt at its deadline, this must be called from the main loop
+	TRealTimeISRTimerRef
+	CreateISRTimer(
+		TRealTimeISRTimerFunc	inFunc,
+		void*					inRefCon);
+
+	// Arm the timer to fire the given time from now, arming an armed timer moves its deadline, this is safe to call from an interrupt handler
+	// A deadline the running hardware timer would reach too late is applied right away and is exact to the microsecond
+	// A deadline later than the one the hardware timer is running for disarms the timer until the next pass of this module applies it, so it is only exact if the delay is longer than the loop latency
+	bool
+	ArmISRTimer(
+		TRealTimeISRTimerRef	inTimerRef,
+		uint32_t				inDelayUS);	// Less than eRealTime_MaxISRTimerDelayUS
+
+	// Disarm the timer, this is safe to call from an interrupt handler
+	void
+	CancelISRTimer(
+		TRealTimeISRTimerRef	inTimerRef);
 	
-	// Register a handler for when time has changed
+	// Register a handler for when time has changed, all alarms have been rescheduled for the new time before it is called
 	void
 	RegisterTimeChangeHandler(
+		STimeChangeHandler*		inNode,	// The caller's storage for the handler
 		char const*				inName,	// All handlers have a unique name, this must be a static string
 		IRealTimeHandler*		inObject,
 		TRealTimeChangeMethod	inMethod);
@@ -447,7 +514,34 @@ private:
 	EEPROMInitialize(
 		void);
 
-	struct SAlarm
+	// The part of an alarm or event kept in a timer heap
+	struct STimer
+	{
+		uint64_t	deadline;	// UTC epoch secs for an alarm, gCurLocalUS for an event
+		uint16_t	heapIndex;	// The index in its timer heap or eRealTime_NotScheduled
+	};
+
+	// A binary min heap of timers keyed on deadline, it grows as needed
+	struct STimerHeap
+	{
+		STimer**	list;
+		uint16_t	count;
+		uint16_t	capacity;
+	};
+
+	// An alarm schedule compiled to a bit per allowed value of each component, bit n set means the value n is allowed
+	struct SAlarmRule
+	{
+		uint64_t	secondMask;
+		uint64_t	minuteMask;
+		uint32_t	hourMask;
+		uint32_t	dayMask;	// Bits 1 to 31
+		uint16_t	monthMask;	// Bits 1 to 12
+		uint8_t		dayOfWeekMask;	// Bits 1 to 7
+		int			year;		// A single year or eAlarm_Any
+	};
+
+	struct SAlarm : public STimer
 	{
 		char const*				name;
 		int						year;
@@ -461,37 +555,70 @@ private:
 		TRealTimeAlarmMethod	method;
 		void*					reference;
 		bool					utc;
-		TEpochTime				nextTriggerTimeUTC;
+		SAlarmRule				rule;
+		SAlarm*					nextFree;
 	};
 	
-	struct SEvent
+	struct SEvent : public STimer
 	{
 		char const*				name;
 		uint64_t				periodUS;
 		bool					onceOnly;
-		uint64_t				lastFireTime;
 		IRealTimeHandler*		object;
 		TRealTimeEventMethod	method;
 		void*					reference;
+		SEvent*					nextFree;
 	};
 
-	struct STimeChangeHandler
+	// Interrupt handlers only write the request fields, the main loop applies them to the armed state with interrupts disabled
+	struct SISRTimer
 	{
-		char const*				name;
-		IRealTimeHandler*		object;
-		TRealTimeChangeMethod	method;
+		TRealTimeISRTimerFunc	func;
+		void*					refCon;
+		uint32_t				deadlineUS;	// In micros(), valid while armed
+		volatile uint32_t		requestDeadlineUS;
+		volatile uint8_t		request;	// The latest arm or cancel request not yet applied
+		volatile bool			armed;
+	};
+
+	// A span of time with a single utc offset
+	struct SDSTInterval
+	{
+		TEpochTime	validFrom;
+		TEpochTime	validTo;	// Exclusive
+		int32_t		offsetSecs;	// Added to utc to get local time
+		bool		inDST;
 	};
 
-	SAlarm	alarmArray[eAlarm_MaxActive];
-	SEvent	eventArray[eEvent_MaxActive];
-	STimeChangeHandler	timeChangeHandlerArray[eTimeChangeHandler_MaxCount];
+	STimerHeap	alarmHeap;
+	STimerHeap	eventHeap;
+	SAlarm*		alarmFreeList;
+	SEvent*		eventFreeList;
+	STimeChangeHandler*	timeChangeHandlerList;
+
+	SISRTimer	isrTimerList[eRealTime_MaxISRTimers];
+	uint8_t		isrTimerCount;
+	IntervalTimer	isrHardwareTimer;	// Runs for the earliest armed interrupt timer
+	uint32_t		isrHardwareWakeUS;	// When the hardware timer fires next, valid while it is running
+	bool			isrHardwareRunning;	// False when nothing is armed or the timer could not be started
 
 	IRealTimeDataProvider*	localProvider;
 	IRealTimeDataProvider*	networkProvider;
 	uint32_t				providerSyncPeriod;
 
-	TEpochTime	epocUTCTimeAtLastSet;
-	uint32_t	localMSAtLastSet;
+	// The disciplined clock, the utc time is baseEpochUS plus the local us since baseLocalUS corrected by freqOffsetPPB and slewRemainingUS
+	uint64_t	baseLocalUS;
+	uint64_t	baseEpochUS;
+	int32_t		freqOffsetPPB;		// How much faster true time runs than local time
+	uint16_t	freqSampleCount;
+	int64_t		slewRemainingUS;	// The part of the last offset not yet applied
+	uint64_t	freqAnchorLocalUS;	// The sync that frequency samples are measured from
+	uint64_t	freqAnchorEpochUS;
+	uint32_t	freqAnchorPrecisionUS;
+	uint64_t	lastSyncLocalUS;
+	bool		clockSet;
+
+	TEpochTime	hardwareAlarmUTC;	// The alarm last given to the local provider or 0
 
 	STimeZoneRule	timeZoneInfo;
 	TEpochTime	dstStartUTCEpocTime;
@@ -502,21 +629,116 @@ private:
 	TEpochTime	dstStartLocal;
 	TEpochTime	stdStartLocal;
 
+	SDSTInterval	utcDSTInterval;
+	SDSTInterval	localDSTInterval;
+
+	uint32_t	cachedDays;	// The days since the epoch of the last date converted by GetDateFromEpoch()
+	int			cachedYear;
+	int			cachedMonth;
+	int			cachedDayOfMonth;
+
 	int	timeMultiplier;
 	bool	gotNetworkSync;
 
-	STimeChangeHandler*
-	FindTimeChangeHandlerByName(
+	// Return the link that points to the named handler or NULL if it is not registered
+	STimeChangeHandler**
+	FindTimeChangeHandlerLink(
 		char const*	inName);
 
-	STimeChangeHandler*
-	FindTimeChangeHandlerFirstEmpty(
+	// Reschedule all alarms for a changed time or time zone and then call the time change handlers
+	void
+	NotifyTimeChange(
+		bool	inTimeZone);
+
+	// Recompute the deadline of every alarm that is not yet due in one pass and rebuild the alarm heap once
+	void
+	RescheduleAllAlarms(
 		void);
 
 	void
 	ComputeDSTStartAndEnd(
 		int	inYear);
 
+	// Return the interval containing the given time, recomputing it only if the time is outside the cached one
+	SDSTInterval const&
+	GetDSTInterval(
+		TEpochTime	inEpochTime,
+		bool		inUTC);
+
+	void
+	InvalidateDSTIntervals(
+		void);
+
+	// Apply the interrupt timer requests made since the last pass and reprogram the hardware timer
+	void
+	ServiceISRTimers(
+		void);
+
+	// Call the functions of the due interrupt timers, on hardware this runs in the timer interrupt
+	void
+	FireISRTimers(
+		void);
+
+	// Start the hardware timer for the earliest armed deadline or stop it if none is armed, interrupts must be disabled
+	// A deadline beyond eRealTime_MaxISRHardwarePeriodUS is reached by waking early and programming the timer again
+	void
+	ProgramISRTimer(
+		void);
+
+	static void
+	ISRTimerInterrupt(
+		void);
+
+	// The time base of the interrupt timers
+	static uint32_t
+	GetISRTimerUS(
+		void);
+
+	// Give the next alarm to the local provider if it has changed
+	void
+	UpdateHardwareAlarm(
+		void);
+
+	// Return the disciplined utc time at the given local time which must not be before baseLocalUS
+	uint64_t
+	GetDisciplinedUS(
+		uint64_t	inLocalUS,
+		int64_t&	outSlewAppliedUS);
+
+	// Move the base of the clock to now so the corrections since the last base are folded in
+	void
+	RebaseClock(
+		void);
+
+	// Returns true if the offset was stepped, false if it is being slewed out
+	bool
+	DisciplineClock(
+		uint64_t	inEpochTimeUS,
+		uint32_t	inPrecisionUS,
+		bool		inFromProvider);
+
+	// Return the seconds into the day
+	TEpochTime
+	GetDateFromEpoch(
+		TEpochTime	inEpochTime,
+		int&		outYear,
+		int&		outMonth,
+		int&		outDayOfMonth);
+
+	static void
+	CivilFromDays(
+		uint32_t	inDays,		// Days since Jan 1 1970
+		int&		outYear,
+		int&		outMonth,
+		int&		outDayOfMonth);
+
+	// Return the days since Jan 1 1970
+	static uint32_t
+	DaysFromCivil(
+		int	inYear,
+		int	inMonth,
+		int	inDayOfMonth);
+
 	TEpochTime
 	ComputeEpochTimeForOffsetSpecifier(
 		STimeZoneOffsetSpecifier const&	inSpecifier,
@@ -525,6 +747,34 @@ private:
 	void
 	ScheduleAlarm(
 		SAlarm*	inAlarm);
+
+	// Compute the first time at or after inTime that matches the rule, return false if there is none before the end of TEpochTime
+	bool
+	GetNextAlarmTime(
+		SAlarmRule const&	inRule,
+		TEpochTime			inTime,
+		TEpochTime&			outTime);
+
+	// Insert the timer into the heap or move it to match a changed deadline, return false if the heap could not grow
+	static bool
+	TimerHeapSchedule(
+		STimerHeap&	ioHeap,
+		STimer*		inTimer);
+
+	static void
+	TimerHeapRemove(
+		STimerHeap&	ioHeap,
+		STimer*		inTimer);
+
+	static void
+	TimerHeapSiftUp(
+		STimerHeap&	ioHeap,
+		uint16_t	inIndex);
+
+	static void
+	TimerHeapSiftDown(
+		STimerHeap&	ioHeap,
+		uint16_t	inIndex);
 	
 	void
 	SyncTimeWithProviders(
@@ -578,9 +828,11 @@ private:
 IRealTimeDataProvider*
 CreateDS3234Provider(
 	uint8_t	inChipSelectPin,
-	bool	inUseAltSPI = false);
+	bool	inUseAltSPI = false,
+	uint8_t	inAlarmPin = 0xFF);	// The pin wired to the INT/SQW output to be woken by alarms
 
-// Create a provider for the DS3234 dead-on RTC clock on main SPI bus with the given chipselect pin
+// Create the NTP provider and add the given server to it, call again to add more servers and the one with the lowest delay is used
+// This can be called before CModule::SetupAll(), the provider does nothing until the RealTime module asks it for a sync
 IRealTimeDataProvider*
 CreateNTPProvider(
 	char const*	inAddress,
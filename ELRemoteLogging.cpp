@@ -42,7 +42,7 @@ MModuleImplementation_Finish(CModule_Loggly, inGlobalTags)
 CModule_Loggly::CModule_Loggly(
 	char const*	inGlobalTags)
 	:
-	CModule(sizeof(SSettings), 1, &settings, 50000)
+	CModule(sizeof(SSettings), 1, &settings, 50000, true, eModulePriority_Background)
 {
 	head = tail = 0;
 	globalTags = inGlobalTags;
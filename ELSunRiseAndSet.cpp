@@ -84,7 +84,7 @@ MModuleImplementation_FinishGlobal(CModule_SunRiseAndSet, gSunRiseAndSet)
 CModule_SunRiseAndSet::CModule_SunRiseAndSet(
 	)
 	:
-	CModule(sizeof(SSettings), 1, &settings, 0)
+	CModule(sizeof(SSettings), 1, &settings, eUpdateTime_SignalOnly)
 {
 	memset(eventList, 0, sizeof(eventList));
 
@@ -100,7 +100,7 @@ CModule_SunRiseAndSet::Setup(
 
 	MCommandRegister("lonlat_set", CModule_SunRiseAndSet::SerialSetLonLat, "[lon] [lat] : Set longitude and latitude");
 	MCommandRegister("lonlat_get", CModule_SunRiseAndSet::SerialGetLonLat, ": Get longitude and latutude");
-	MRealTimeRegisterTimeChange("ssar", CModule_SunRiseAndSet::RealTimeChangeHandler);
+	MRealTimeRegisterTimeChange(timeChangeHandler, "ssar", CModule_SunRiseAndSet::RealTimeChangeHandler);
 }
 
 void
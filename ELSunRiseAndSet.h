@@ -268,6 +268,7 @@ private:
 
 	SEvent		eventList[eMaxSunRiseSetEvents];
 	SSettings	settings;
+	STimeChangeHandler	timeChangeHandler;
 };
 
 extern CModule_SunRiseAndSet*	gSunRiseAndSet;
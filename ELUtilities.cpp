@@ -93,26 +93,59 @@ LoadDataFromEEPROM(
 	uint16_t	inStartAddress,
 	uint16_t	inSize)
 {
+	#if defined(WIN32)
 	uint8_t*	cp = (uint8_t*)inDst;
 
 	for(uint16_t idx = inStartAddress; idx < inStartAddress + inSize; ++idx)
 	{
 		*cp++ = EEPROM.read(idx);
 	}
+	#else
+	// Read the whole block in one call, this avoids the per byte setup of EEPROM.read()
+	eeprom_read_block(inDst, (void const*)(uint32_t)inStartAddress, inSize);
+	#endif
 }
 
-void
+uint16_t
 WriteDataToEEPROM(
-	void*		inSrc,
+	void const*	inSrc,
 	uint16_t	inStartAddress,
 	uint16_t	inSize)
 {
-	uint8_t*	cp = (uint8_t*)inSrc;
+	uint8_t const*	cp = (uint8_t const*)inSrc;
+	uint16_t		bytesWritten = 0;
 
-	for(uint16_t idx = inStartAddress; idx < inStartAddress + inSize; ++idx)
+	for(uint16_t idx = inStartAddress; idx < inStartAddress + inSize; ++idx, ++cp)
+	{
+		// Reads are cheap and don't wear the cell so only write the bytes that changed
+		if(EEPROM.read(idx) != *cp)
+		{
+			EEPROM.write(idx, *cp);
+			++bytesWritten;
+		}
+	}
+
+	return bytesWritten;
+}
+
+uint16_t
+ComputeCRC16(
+	void const*	inData,
+	uint32_t	inSize,
+	uint16_t	inCRC)
+{
+	uint8_t const*	cp = (uint8_t const*)inData;
+
+	while(inSize-- > 0)
 	{
-		EEPROM.write(idx, *cp++);
+		inCRC ^= (uint16_t)*cp++ << 8;
+		for(int i = 0; i < 8; ++i)
+		{
+			inCRC = (inCRC & 0x8000) ? (inCRC << 1) ^ 0x1021 : inCRC << 1;
+		}
 	}
+
+	return inCRC;
 }
 
 char const*
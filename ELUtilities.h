@@ -50,12 +50,20 @@ LoadDataFromEEPROM(
 	uint16_t	inStartAddress,
 	uint16_t	inSize);
 
-void
+// Only the bytes that differ from the current eeprom contents are written, returns the number of bytes written
+uint16_t
 WriteDataToEEPROM(
-	void*		inSrc,
+	void const*	inSrc,
 	uint16_t	inStartAddress,
 	uint16_t	inSize);
 
+// CRC-16/CCITT, pass the result of a previous call as inCRC to continue a crc across several blocks
+uint16_t
+ComputeCRC16(
+	void const*	inData,
+	uint32_t	inSize,
+	uint16_t	inCRC = 0xFFFF);
+
 char const*
 StringizeUInt32(
 	uint32_t	inValue);
@@ -107,6 +115,38 @@ ReMapValue(
 	return inNewRangeMin + (inValue - inValueMin) / (inValueMax - inValueMin) * (inNewRangeMax - inNewRangeMin);
 }
 
+// Disable interrupts and return the state they replace, code that can also run in an interrupt handler must restore that state with RestoreInterrupts() instead of calling interrupts()
+inline uint32_t
+SaveAndDisableInterrupts(
+	void)
+{
+	#if defined(WIN32)
+		noInterrupts();
+		return 0;
+	#else
+		uint32_t	primask;
+
+		asm volatile("mrs %0, primask" : "=r" (primask) :: "memory");
+		asm volatile("cpsid i" ::: "memory");
+
+		return primask;
+	#endif
+}
+
+inline void
+RestoreInterrupts(
+	uint32_t	inState)
+{
+	#if defined(WIN32)
+		if(inState == 0)
+		{
+			interrupts();
+		}
+	#else
+		asm volatile("msr primask, %0" :: "r" (inState) : "memory");
+	#endif
+}
+
 bool
 BufferEndsWithStr(
 	char const*	inBuffer,
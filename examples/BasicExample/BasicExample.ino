@@ -120,7 +120,7 @@ private:
 };
 
 MModuleImplementation_Start(CExampleModule)
-MModuleImplementation_Finish(CExampleModule)
+MModuleImplementation_FinishStatic(CExampleModule, 1)	// The module lives in static storage with room for one instance, use MModuleImplementation_Finish to allocate it from the heap instead
 
 void
 setup(
@@ -0,0 +1,319 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "ArduinoSimulator.h"
+
+enum
+{
+	eEEPROM_SimulatorSize = 2048,
+};
+
+usb_serial_class	Serial;
+HardwareSerial		Serial1;
+HardwareSerial		Serial2;
+HardwareSerial		Serial3;
+EEPROMClass			EEPROM;
+SPIClass			SPI;
+
+uint64_t	gSimulatorUS;
+bool		gSimulatorIntervalTimerFull;
+
+static uint8_t	gEEPROMImage[eEEPROM_SimulatorSize];
+static uint32_t	gEEPROMCellWriteCount[eEEPROM_SimulatorSize];
+static uint32_t	gEEPROMWriteCount;
+
+void
+HardwareSerial::printf(
+	char const*	inFormat,
+	...)
+{
+	char	buffer[1024];
+	va_list	varArgs;
+
+	va_start(varArgs, inFormat);
+	vsnprintf(buffer, sizeof(buffer), inFormat, varArgs);
+	va_end(varArgs);
+
+	write(buffer);
+
+	// AssertFailed() repeats its message forever on the device, end the test instead
+	if(this == &Serial && strncmp(buffer, "ASSERT:", 7) == 0)
+	{
+		abort();
+	}
+}
+
+int
+usb_serial_class::available(
+	void)
+{
+	return (int)(inputTail - inputHead);
+}
+
+int
+usb_serial_class::read(
+	void)
+{
+	if(inputHead == inputTail)
+	{
+		return -1;
+	}
+
+	return (uint8_t)inputBuffer[inputHead++];
+}
+
+void
+usb_serial_class::QueueInput(
+	char const*	inString)
+{
+	if(inputHead == inputTail)
+	{
+		inputHead = inputTail = 0;
+	}
+
+	while(*inString != 0 && inputTail < sizeof(inputBuffer))
+	{
+		inputBuffer[inputTail++] = *inString++;
+	}
+}
+
+size_t
+usb_serial_class::write(
+	uint8_t const*	inBuffer,
+	size_t			inLength)
+{
+	fwrite(inBuffer, 1, inLength, stdout);
+
+	return inLength;
+}
+
+uint8_t
+EEPROMClass::read(
+	int	inAddress)
+{
+	return inAddress >= 0 && inAddress < eEEPROM_SimulatorSize ? gEEPROMImage[inAddress] : 0xFF;
+}
+
+void
+EEPROMClass::write(
+	int		inAddress,
+	uint8_t	inValue)
+{
+	if(inAddress >= 0 && inAddress < eEEPROM_SimulatorSize)
+	{
+		gEEPROMImage[inAddress] = inValue;
+		++gEEPROMCellWriteCount[inAddress];
+		++gEEPROMWriteCount;
+	}
+}
+
+void
+EEPROMClass::update(
+	int		inAddress,
+	uint8_t	inValue)
+{
+	if(read(inAddress) != inValue)
+	{
+		write(inAddress, inValue);
+	}
+}
+
+int
+EEPROMClass::length(
+	void)
+{
+	return eEEPROM_SimulatorSize;
+}
+
+void
+EEPROMClass::ResetWriteCounts(
+	void)
+{
+	memset(gEEPROMCellWriteCount, 0, sizeof(gEEPROMCellWriteCount));
+	gEEPROMWriteCount = 0;
+}
+
+uint32_t
+EEPROMClass::GetWriteCount(
+	void)
+{
+	return gEEPROMWriteCount;
+}
+
+uint32_t
+EEPROMClass::GetMaxCellWriteCount(
+	void)
+{
+	uint32_t	result = 0;
+
+	for(int i = 0; i < eEEPROM_SimulatorSize; ++i)
+	{
+		if(gEEPROMCellWriteCount[i] > result)
+		{
+			result = gEEPROMCellWriteCount[i];
+		}
+	}
+
+	return result;
+}
+
+uint8_t*
+EEPROMClass::GetImage(
+	void)
+{
+	return gEEPROMImage;
+}
+
+bool
+IntervalTimer::begin(
+	void		(*inFunc)(void),
+	uint32_t	inPeriodUS)
+{
+	++beginCount;
+
+	if(inPeriodUS == 0 || inPeriodUS > eIntervalTimer_MaxPeriodUS || (!running && gSimulatorIntervalTimerFull))
+	{
+		return false;
+	}
+
+	running = true;
+	periodUS = inPeriodUS;
+
+	return true;
+}
+
+uint32_t
+millis(
+	void)
+{
+	return (uint32_t)(gSimulatorUS / 1000);
+}
+
+uint32_t
+micros(
+	void)
+{
+	return (uint32_t)gSimulatorUS;
+}
+
+void
+delay(
+	uint32_t	inMS)
+{
+	gSimulatorUS += (uint64_t)inMS * 1000;
+}
+
+void
+delayMicroseconds(
+	uint32_t	inUS)
+{
+	gSimulatorUS += inUS;
+}
+
+void
+pinMode(
+	int	inPin,
+	int	inMode)
+{
+}
+
+void
+digitalWrite(
+	int	inPin,
+	int	inValue)
+{
+}
+
+void
+digitalWriteFast(
+	int	inPin,
+	int	inValue)
+{
+}
+
+int
+digitalRead(
+	int	inPin)
+{
+	return 0;
+}
+
+int
+digitalReadFast(
+	int	inPin)
+{
+	return 0;
+}
+
+int
+analogRead(
+	int	inPin)
+{
+	return 0;
+}
+
+void
+analogWrite(
+	int	inPin,
+	int	inValue)
+{
+}
+
+int
+touchRead(
+	int	inPin)
+{
+	return 0;
+}
+
+void
+noInterrupts(
+	void)
+{
+}
+
+void
+interrupts(
+	void)
+{
+}
+
+void
+yield(
+	void)
+{
+}
+
+char*
+_itoa(
+	int		inValue,
+	char*	outBuffer,
+	int		inRadix)
+{
+	sprintf(outBuffer, inRadix == 16 ? "%x" : "%d", inValue);
+
+	return outBuffer;
+}
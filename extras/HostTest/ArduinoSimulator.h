@@ -0,0 +1,511 @@
+#ifndef _ARDUINOSIMULATOR_H_
+#define _ARDUINOSIMULATOR_H_
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	ABOUT
+
+	This is the host side stand in for the Arduino and Teensy core that EL.h includes when WIN32 is defined. It is enough
+	of the core to build the library on Linux for the tests in this directory.
+
+	The clock does not move on its own, millis() and micros() are derived from gSimulatorUS which the tests advance
+	explicitly (delay() advances it too) so every run is repeatable.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <ctype.h>
+
+#define HIGH			1
+#define LOW				0
+#define INPUT			0
+#define OUTPUT			1
+#define INPUT_PULLUP	2
+#define MSBFIRST		1
+#define SPI_MODE3		3
+#define FALLING			2
+
+#define MAXUINT32	0xFFFFFFFF
+#define MAXUINT8	255
+#define MAXINT8		127
+#define MININT8		-128
+
+#ifndef PI
+#define PI			3.1415926535897932384626433832795
+#endif
+
+#define _stricmp	strcasecmp
+#define _strnicmp	strncasecmp
+
+typedef uint8_t byte;
+
+extern uint64_t	gSimulatorUS;	// The simulated time since boot in us
+
+uint32_t
+millis(
+	void);
+
+uint32_t
+micros(
+	void);
+
+void
+delay(
+	uint32_t	inMS);
+
+void
+delayMicroseconds(
+	uint32_t	inUS);
+
+void
+pinMode(
+	int	inPin,
+	int	inMode);
+
+void
+digitalWrite(
+	int	inPin,
+	int	inValue);
+
+void
+digitalWriteFast(
+	int	inPin,
+	int	inValue);
+
+int
+digitalRead(
+	int	inPin);
+
+int
+digitalReadFast(
+	int	inPin);
+
+int
+analogRead(
+	int	inPin);
+
+void
+analogWrite(
+	int	inPin,
+	int	inValue);
+
+int
+touchRead(
+	int	inPin);
+
+void
+noInterrupts(
+	void);
+
+void
+interrupts(
+	void);
+
+void
+yield(
+	void);
+
+char*
+_itoa(
+	int		inValue,
+	char*	outBuffer,
+	int		inRadix);
+
+class Stream
+{
+public:
+
+	virtual
+	~Stream(
+		)
+	{
+	}
+
+	virtual int
+	available(
+		void) = 0;
+};
+
+// A serial port that goes nowhere, tests subclass this to script a device on the other end
+class HardwareSerial : public Stream
+{
+public:
+
+	virtual void
+	begin(
+		uint32_t	inBaud,
+		uint32_t	inFormat = 0)
+	{
+	}
+
+	virtual void
+	end(
+		void)
+	{
+	}
+
+	virtual int
+	available(
+		void)
+	{
+		return 0;
+	}
+
+	virtual int
+	read(
+		void)
+	{
+		return -1;
+	}
+
+	virtual int
+	peek(
+		void)
+	{
+		return -1;
+	}
+
+	virtual size_t
+	readBytes(
+		char*	outBuffer,
+		size_t	inLength)
+	{
+		size_t	result = 0;
+
+		while(result < inLength)
+		{
+			int	curChar = read();
+			if(curChar < 0)
+			{
+				break;
+			}
+			outBuffer[result++] = (char)curChar;
+		}
+
+		return result;
+	}
+
+	size_t
+	readBytes(
+		uint8_t*	outBuffer,
+		size_t		inLength)
+	{
+		return readBytes((char*)outBuffer, inLength);
+	}
+
+	virtual size_t
+	write(
+		uint8_t	inByte)
+	{
+		return 1;
+	}
+
+	virtual size_t
+	write(
+		uint8_t const*	inBuffer,
+		size_t			inLength)
+	{
+		for(size_t i = 0; i < inLength; ++i)
+		{
+			write(inBuffer[i]);
+		}
+
+		return inLength;
+	}
+
+	size_t
+	write(
+		char const*	inString)
+	{
+		return write((uint8_t const*)inString, strlen(inString));
+	}
+
+	size_t
+	write(
+		char const*	inBuffer,
+		int			inLength)
+	{
+		return write((uint8_t const*)inBuffer, (size_t)inLength);
+	}
+
+	virtual int
+	availableForWrite(
+		void)
+	{
+		return 1024;
+	}
+
+	virtual void
+	flush(
+		void)
+	{
+	}
+
+	void
+	printf(
+		char const*	inFormat,
+		...);
+
+	void
+	print(
+		char const*	inString)
+	{
+		write(inString);
+	}
+
+	void
+	println(
+		char const*	inString)
+	{
+		write(inString);
+		write("\n");
+	}
+
+	virtual void
+	attachRts(
+		uint8_t	inPin)
+	{
+	}
+
+	virtual void
+	attachCts(
+		uint8_t	inPin)
+	{
+	}
+
+	virtual void
+	clear(
+		void)
+	{
+	}
+
+	operator bool(
+		)
+	{
+		return true;
+	}
+};
+
+// The usb serial port is the console, its output goes to stdout and tests can queue input to it with QueueInput()
+class usb_serial_class : public HardwareSerial
+{
+public:
+
+	virtual int
+	available(
+		void);
+
+	virtual int
+	read(
+		void);
+
+	virtual size_t
+	write(
+		uint8_t const*	inBuffer,
+		size_t			inLength);
+
+	using HardwareSerial::write;
+
+	void
+	QueueInput(
+		char const*	inString);
+
+private:
+
+	char	inputBuffer[256];
+	size_t	inputHead;
+	size_t	inputTail;
+};
+
+extern usb_serial_class	Serial;
+extern HardwareSerial	Serial1;
+extern HardwareSerial	Serial2;
+extern HardwareSerial	Serial3;
+
+class EEPROMClass
+{
+public:
+
+	uint8_t
+	read(
+		int	inAddress);
+
+	void
+	write(
+		int		inAddress,
+		uint8_t	inValue);
+
+	void
+	update(
+		int		inAddress,
+		uint8_t	inValue);
+
+	int
+	length(
+		void);
+
+	// The simulated part counts every byte written so tests can measure the wear a change causes
+	void
+	ResetWriteCounts(
+		void);
+
+	// The bytes written since ResetWriteCounts()
+	uint32_t
+	GetWriteCount(
+		void);
+
+	// The most times any one byte was written since ResetWriteCounts()
+	uint32_t
+	GetMaxCellWriteCount(
+		void);
+
+	// The raw contents so tests can save, restore or corrupt them
+	uint8_t*
+	GetImage(
+		void);
+};
+
+extern EEPROMClass	EEPROM;
+
+struct SPISettings
+{
+	SPISettings(
+		)
+	{
+	}
+
+	SPISettings(
+		uint32_t	inClock,
+		int			inBitOrder,
+		int			inDataMode)
+	{
+	}
+};
+
+class SPIClass
+{
+public:
+
+	void
+	begin(
+		void)
+	{
+	}
+
+	void
+	end(
+		void)
+	{
+	}
+
+	void
+	beginTransaction(
+		SPISettings	inSettings)
+	{
+	}
+
+	void
+	endTransaction(
+		void)
+	{
+	}
+
+	uint8_t
+	transfer(
+		uint8_t	inData)
+	{
+		return 0;
+	}
+
+	void
+	setMISO(
+		int	inPin)
+	{
+	}
+
+	void
+	setMOSI(
+		int	inPin)
+	{
+	}
+
+	void
+	setSCK(
+		int	inPin)
+	{
+	}
+};
+
+extern SPIClass	SPI;
+
+enum
+{
+	eIntervalTimer_MaxPeriodUS = 89478485,	// The longest period the Teensy PIT takes at a 48 MHz bus clock
+};
+
+// The host has no timer interrupt so this only records what the library asked of the timer for tests to check
+class IntervalTimer
+{
+public:
+
+	IntervalTimer(
+		)
+		:
+		running(false),
+		periodUS(0),
+		beginCount(0)
+	{
+	}
+
+	// Like the Teensy core an invalid period is refused without touching a timer that is already running
+	bool
+	begin(
+		void		(*inFunc)(void),
+		uint32_t	inPeriodUS);
+
+	void
+	end(
+		void)
+	{
+		running = false;
+	}
+
+	bool		running;
+	uint32_t	periodUS;
+	uint32_t	beginCount;
+};
+
+extern bool	gSimulatorIntervalTimerFull;	// Set to make begin() fail as if every PIT channel was taken
+
+#endif /* _ARDUINOSIMULATOR_H_ */
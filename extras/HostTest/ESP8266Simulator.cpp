@@ -0,0 +1,265 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "ESP8266Simulator.h"
+
+void
+CESP8266Simulator::begin(
+	uint32_t	inBaud,
+	uint32_t	inFormat)
+{
+	baudRate = inBaud;
+	byteNS = inBaud > 0 ? (uint64_t)eESP8266Simulator_BitsPerByte * 1000000000 / inBaud : 0;
+}
+
+void
+CESP8266Simulator::flush(
+	void)
+{
+	if(IsPaced())
+	{
+		Block(GetTxPendingNS());
+	}
+}
+
+int
+CESP8266Simulator::available(
+	void)
+{
+	ReleaseReply();
+
+	return (int)(replyReleased - replyHead);
+}
+
+int
+CESP8266Simulator::read(
+	void)
+{
+	ReleaseReply();
+
+	if(replyHead == replyReleased)
+	{
+		return -1;
+	}
+
+	return (uint8_t)replyBuffer[replyHead++ % eESP8266Simulator_ReplyBufferSize];
+}
+
+size_t
+CESP8266Simulator::write(
+	uint8_t	inByte)
+{
+	if(IsPaced())
+	{
+		uint64_t	bufferNS = (uint64_t)eESP8266Simulator_TxBufferSize * byteNS;
+		uint64_t	pendingNS = GetTxPendingNS();
+
+		if(pendingNS + byteNS > bufferNS)
+		{
+			Block(pendingNS + byteNS - bufferNS);
+		}
+
+		txDoneNS = gSimulatorUS * 1000 + GetTxPendingNS() + byteNS;
+	}
+
+	if(sendRemaining > 0)
+	{
+		if(receivedBytes[sendLink] < eESP8266Simulator_MaxReceivedBytes)
+		{
+			received[sendLink][receivedBytes[sendLink]] = (char)inByte;
+		}
+		++receivedBytes[sendLink];
+
+		if(--sendRemaining == 0)
+		{
+			Reply("\r\nRecv %d bytes\r\n\r\nSEND OK\r\n", sendCount);
+		}
+	}
+	else if(inByte == '\n')
+	{
+		line[lineLength] = 0;
+		ProcessLine();
+		lineLength = 0;
+	}
+	else if(inByte != '\r' && lineLength < eESP8266Simulator_MaxLineLength - 1)
+	{
+		line[lineLength++] = (char)inByte;
+	}
+
+	return 1;
+}
+
+int
+CESP8266Simulator::availableForWrite(
+	void)
+{
+	if(!IsPaced())
+	{
+		return HardwareSerial::availableForWrite();
+	}
+
+	return eESP8266Simulator_TxBufferSize - (int)((GetTxPendingNS() + byteNS - 1) / byteNS);
+}
+
+void
+CESP8266Simulator::Reply(
+	char const*	inFormat,
+	...)
+{
+	char	buffer[256];
+	va_list	varArgs;
+
+	va_start(varArgs, inFormat);
+	vsnprintf(buffer, sizeof(buffer), inFormat, varArgs);
+	va_end(varArgs);
+
+	// Output on an idle line starts once the command it answers is across
+	ReleaseReply();
+	if(IsPaced() && replyReleased == replyTail)
+	{
+		uint64_t	nowNS = gSimulatorUS * 1000;
+		replyNextNS = (txDoneNS > nowNS ? txDoneNS : nowNS) + byteNS;
+	}
+
+	for(char* cp = buffer; *cp != 0; ++cp)
+	{
+		replyBuffer[replyTail++ % eESP8266Simulator_ReplyBufferSize] = *cp;
+	}
+}
+
+bool
+CESP8266Simulator::IsReplyPending(
+	void)
+{
+	return replyHead != replyTail;
+}
+
+bool
+CESP8266Simulator::SawCommand(
+	char const*	inCommand)
+{
+	return strstr(commandLog, inCommand) != NULL;
+}
+
+void
+CESP8266Simulator::ClearReceived(
+	int	inLink)
+{
+	receivedBytes[inLink] = 0;
+	closeCount[inLink] = 0;
+	closedAtBytes[inLink] = 0;
+}
+
+void
+CESP8266Simulator::ProcessLine(
+	void)
+{
+	int	link;
+	int	count;
+
+	if(lineLength == 0)
+	{
+		return;
+	}
+
+	++commandCount;
+	if(strlen(commandLog) + lineLength + 2 < sizeof(commandLog))
+	{
+		strcat(commandLog, line);
+		strcat(commandLog, "\n");
+	}
+
+	if(sscanf(line, "AT+CIPSENDEX=%d,%d", &link, &count) == 2 && link >= 0 && link < eESP8266Simulator_LinkCount)
+	{
+		++sendCommandCount;
+		sendLink = link;
+		sendCount = sendRemaining = count;
+		Reply("\r\nOK\r\n> ");
+	}
+	else if(sscanf(line, "AT+CIPCLOSE=%d", &link) == 1 && link >= 0 && link < eESP8266Simulator_LinkCount)
+	{
+		++closeCount[link];
+		closedAtBytes[link] = receivedBytes[link];
+		Reply("%d,CLOSED\r\n\r\nOK\r\n", link);
+	}
+	else
+	{
+		Reply("\r\nOK\r\n");
+	}
+}
+
+void
+CESP8266Simulator::ReleaseReply(
+	void)
+{
+	uint64_t	nowNS = gSimulatorUS * 1000;
+
+	if(!IsPaced())
+	{
+		replyReleased = replyTail;
+		return;
+	}
+
+	if(replyReleased == replyTail || replyNextNS > nowNS)
+	{
+		return;
+	}
+
+	uint64_t	byteCount = (nowNS - replyNextNS) / byteNS + 1;
+	if(byteCount > replyTail - replyReleased)
+	{
+		byteCount = replyTail - replyReleased;
+	}
+
+	replyReleased += (uint32_t)byteCount;
+	replyNextNS += byteCount * byteNS;
+}
+
+uint64_t
+CESP8266Simulator::GetTxPendingNS(
+	void)
+{
+	uint64_t	nowNS = gSimulatorUS * 1000;
+
+	return txDoneNS > nowNS ? txDoneNS - nowNS : 0;
+}
+
+void
+CESP8266Simulator::Block(
+	uint64_t	inNS)
+{
+	uint64_t	blockUS = (inNS + 999) / 1000;
+
+	gSimulatorUS += blockUS;
+	writeBlockedUS += blockUS;
+}
+
+bool
+CESP8266Simulator::IsPaced(
+	void)
+{
+	return pacing && byteNS > 0;
+}
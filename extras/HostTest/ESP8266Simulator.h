@@ -0,0 +1,155 @@
+#ifndef _ESP8266SIMULATOR_H_
+#define _ESP8266SIMULATOR_H_
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	ABOUT
+
+	A scripted ESP8266 on the other end of a serial port for the driver tests. It answers every AT command with OK,
+	takes the data of each AT+CIPSENDEX and acknowledges it with Recv and SEND OK, and reports a link as closed when it
+	gets AT+CIPCLOSE. Unsolicited output such as connects and ipds is queued with Reply().
+
+	With pacing set the serial line runs at the baud rate the driver passed to begin(): output from the device becomes
+	available one byte time apart, it can not start before the command it answers has gone out, and like the Teensy
+	core write() holds the caller by moving the clock while the transmit buffer is full.
+*/
+
+#include "ArduinoSimulator.h"
+
+enum
+{
+	eESP8266Simulator_LinkCount = 5,
+	eESP8266Simulator_MaxReceivedBytes = 16384,
+	eESP8266Simulator_MaxLineLength = 128,
+	eESP8266Simulator_ReplyBufferSize = 4096,
+	eESP8266Simulator_TxBufferSize = 1024,	// The transmit buffer the driver gives the core
+	eESP8266Simulator_BitsPerByte = 10,		// 8N1 framing
+};
+
+class CESP8266Simulator : public HardwareSerial
+{
+public:
+
+	virtual void
+	begin(
+		uint32_t	inBaud,
+		uint32_t	inFormat = 0);
+
+	virtual void
+	flush(
+		void);
+
+	virtual int
+	available(
+		void);
+
+	virtual int
+	read(
+		void);
+
+	virtual size_t
+	write(
+		uint8_t	inByte);
+
+	using HardwareSerial::write;
+
+	virtual int
+	availableForWrite(
+		void);
+
+	// Queue output from the device for the driver to read
+	void
+	Reply(
+		char const*	inFormat,
+		...);
+
+	// True while some output from the device has not been read yet, paced output may not be available yet
+	bool
+	IsReplyPending(
+		void);
+
+	// True if the driver has sent a line containing inCommand, the lines in the log end with "\n"
+	bool
+	SawCommand(
+		char const*	inCommand);
+
+	// Forget what was received on inLink
+	void
+	ClearReceived(
+		int	inLink);
+
+	char		received[eESP8266Simulator_LinkCount][eESP8266Simulator_MaxReceivedBytes];
+	uint32_t	receivedBytes[eESP8266Simulator_LinkCount];
+	uint32_t	closeCount[eESP8266Simulator_LinkCount];
+	uint32_t	closedAtBytes[eESP8266Simulator_LinkCount];	// How much had been received on the link when it was closed
+	uint32_t	commandCount;
+	uint32_t	sendCommandCount;	// The AT+CIPSENDEX round trips
+	uint32_t	baudRate;			// As last set by begin()
+	bool		pacing;				// Set to hold the line to baudRate, off the clock never moves
+	uint64_t	writeBlockedUS;		// How long write() and flush() held the caller
+
+private:
+
+	void
+	ProcessLine(
+		void);
+
+	// Make the output that has had time to cross the line available to read
+	void
+	ReleaseReply(
+		void);
+
+	// The time the transmit side is busy sending what has been written so far
+	uint64_t
+	GetTxPendingNS(
+		void);
+
+	// Move the clock as the core would while it spins waiting on the transmitter
+	void
+	Block(
+		uint64_t	inNS);
+
+	bool
+	IsPaced(
+		void);
+
+	char		replyBuffer[eESP8266Simulator_ReplyBufferSize];
+	uint32_t	replyHead;
+	uint32_t	replyTail;
+	uint32_t	replyReleased;
+	uint64_t	replyNextNS;	// When the next byte of output is across the line
+	uint64_t	txDoneNS;		// When the last byte written is across the line
+	uint64_t	byteNS;
+	char		line[eESP8266Simulator_MaxLineLength];
+	size_t		lineLength;
+	int			sendLink;
+	int			sendCount;
+	int			sendRemaining;
+	char		commandLog[8192];
+};
+
+#endif /* _ESP8266SIMULATOR_H_ */
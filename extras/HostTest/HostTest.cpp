@@ -0,0 +1,122 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "HostTest.h"
+
+uint32_t	gTestFailCount;
+
+CTestOutput::CTestOutput(
+	)
+	:
+	length(0)
+{
+	buffer[0] = 0;
+}
+
+void
+CTestOutput::write(
+	char const*	inMsg,
+	size_t		inBytes)
+{
+	// Keep the most recent output when the buffer fills
+	if(length + inBytes >= sizeof(buffer))
+	{
+		Clear();
+	}
+
+	inBytes = MMin(inBytes, sizeof(buffer) - 1);
+	memcpy(buffer + length, inMsg, inBytes);
+	length += inBytes;
+	buffer[length] = 0;
+}
+
+bool
+CTestOutput::Contains(
+	char const*	inString)
+{
+	return strstr(buffer, inString) != NULL;
+}
+
+void
+CTestOutput::Clear(
+	void)
+{
+	length = 0;
+	buffer[0] = 0;
+}
+
+uint8_t
+TestCommand(
+	CTestOutput*	outOutput,
+	char const*		inCommand)
+{
+	char	commandStr[256];
+
+	strncpy(commandStr, inCommand, sizeof(commandStr) - 1);
+	commandStr[sizeof(commandStr) - 1] = 0;
+	outOutput->Clear();
+
+	return gCommandModule->ProcessCommand(outOutput, commandStr);
+}
+
+void
+loop(
+	void)
+{
+	CModule::LoopAll();
+}
+
+void
+TestRunLoop(
+	uint32_t	inPassCount,
+	uint32_t	inStepUS)
+{
+	for(uint32_t i = 0; i < inPassCount; ++i)
+	{
+		gSimulatorUS += inStepUS;
+		loop();
+	}
+}
+
+uint64_t
+TestGetCPUTimeUS(
+	void)
+{
+	struct timespec	curTime;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &curTime);
+
+	return (uint64_t)curTime.tv_sec * 1000000 + curTime.tv_nsec / 1000;
+}
+
+int
+TestFinish(
+	char const*	inTestName)
+{
+	printf("%s: %s (%u failed checks)\n", inTestName, gTestFailCount == 0 ? "PASS" : "FAIL", gTestFailCount);
+
+	return gTestFailCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#ifndef _HOSTTEST_H_
+#define _HOSTTEST_H_
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	ABOUT
+
+	Shared support for the host tests. Each Test*.cpp file is its own program since the library keeps its modules in
+	globals, the program defines setup() to include the modules it needs and then calls TestFinish() as its exit status.
+
+	Benchmarks print their results with a "BENCH:" prefix, they measure the host cpu so the numbers are only good for
+	comparing one build against another.
+*/
+
+#include <EL.h>
+#include <ELModule.h>
+#include <ELAssert.h>
+#include <ELCommand.h>
+
+#define MTestCheck(x) do {if(!(x)) {printf("FAIL: %s %s %d\n", #x, __FILE__, __LINE__); ++gTestFailCount;}} while(0)
+
+// Collects the output of a command or the system messages so a test can look for a given string
+class CTestOutput : public IOutputDirector
+{
+public:
+
+	CTestOutput(
+		);
+
+	virtual void
+	write(
+		char const*	inMsg,
+		size_t		inBytes);
+
+	bool
+	Contains(
+		char const*	inString);
+
+	void
+	Clear(
+		void);
+
+	char	buffer[8192];
+	size_t	length;
+};
+
+extern uint32_t	gTestFailCount;
+
+// Each test defines setup() to include its modules and call CModule::SetupAll(), loop() is defined by HostTest.cpp
+void
+setup(
+	void);
+
+void
+loop(
+	void);
+
+// Run the given command and capture its output
+uint8_t
+TestCommand(
+	CTestOutput*	outOutput,
+	char const*		inCommand);
+
+// Call loop() inPassCount times advancing the simulated clock by inStepUS before each pass
+void
+TestRunLoop(
+	uint32_t	inPassCount,
+	uint32_t	inStepUS);
+
+// Return the host cpu time in us for benchmarks
+uint64_t
+TestGetCPUTimeUS(
+	void);
+
+// Report the result of the test, return this from main()
+int
+TestFinish(
+	char const*	inTestName);
+
+#endif /* _HOSTTEST_H_ */
@@ -0,0 +1,270 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Compares the compiled alarm rules of GetNextAlarmTime() against the older component search in
+	GetNextDateTimeFromTime() over random rules and times from 1970 to 2058
+
+	The two differ on purpose in two cases where the old search was wrong, those are excluded from the random comparison
+	and checked directly: a day 29 to 31 that a month does not have, and a day of week rule with any hour, minute, or second
+*/
+
+#include "HostTest.h"
+
+// The rule and its search are internal to the RealTime module
+#define private public
+#include <ELRealTime.h>
+#undef private
+
+enum
+{
+	eRandomRuleCount = 200000,
+	eFridayCount = 20000,
+};
+
+static uint32_t	gRandomState = 1;
+
+// xorshift32 so the sequence is the same on every host
+static uint32_t
+Random(
+	void)
+{
+	gRandomState ^= gRandomState << 13;
+	gRandomState ^= gRandomState >> 17;
+	gRandomState ^= gRandomState << 5;
+
+	return gRandomState;
+}
+
+// Half the time any, otherwise a value in the range
+static int
+RandomComponent(
+	int	inLow,
+	int	inHigh)
+{
+	return (Random() & 1) ? (int)eAlarm_Any : inLow + (int)(Random() % (inHigh - inLow + 1));
+}
+
+// The same compilation ScheduleAlarm() does
+static void
+CompileRule(
+	CModule_RealTime::SAlarmRule&	outRule,
+	int								inYear,
+	int								inMonth,
+	int								inDayOfMonth,
+	int								inDayOfWeek,
+	int								inHour,
+	int								inMinute,
+	int								inSecond)
+{
+	outRule.secondMask = inSecond == eAlarm_Any ? (1ULL << 60) - 1 : 1ULL << inSecond;
+	outRule.minuteMask = inMinute == eAlarm_Any ? (1ULL << 60) - 1 : 1ULL << inMinute;
+	outRule.hourMask = inHour == eAlarm_Any ? (1UL << 24) - 1 : 1UL << inHour;
+	outRule.dayMask = inDayOfMonth == eAlarm_Any ? 0xFFFFFFFE : 1UL << inDayOfMonth;
+	outRule.monthMask = inMonth == eAlarm_Any ? 0x1FFE : 1 << inMonth;
+	outRule.dayOfWeekMask = inDayOfWeek == eAlarm_Any ? 0xFE : 1 << inDayOfWeek;
+	outRule.year = inYear;
+}
+
+static TEpochTime
+NextAlarmTime(
+	int			inYear,
+	int			inMonth,
+	int			inDayOfMonth,
+	int			inDayOfWeek,
+	int			inHour,
+	int			inMinute,
+	int			inSecond,
+	TEpochTime	inTime)
+{
+	CModule_RealTime::SAlarmRule	rule;
+	TEpochTime						result = 0;
+
+	CompileRule(rule, inYear, inMonth, inDayOfMonth, inDayOfWeek, inHour, inMinute, inSecond);
+	MTestCheck(gRealTime->GetNextAlarmTime(rule, inTime, result));
+
+	return result;
+}
+
+void
+setup(
+	void)
+{
+	CModule_RealTime::Include();
+	CModule::SetupAll("test", false);
+}
+
+// A random rule and the time to search from
+struct SRandomRule
+{
+	int			year;
+	int			month;
+	int			day;
+	int			dayOfWeek;
+	int			hour;
+	int			minute;
+	int			second;
+	TEpochTime	startTime;
+	TEpochTime	oldTime;
+	TEpochTime	newTime;
+	bool		oldFound;
+	bool		newFound;
+};
+
+static SRandomRule	gRuleList[eRandomRuleCount];
+
+int
+main(
+	void)
+{
+	setup();
+
+	for(int ruleItr = 0; ruleItr < eRandomRuleCount; ++ruleItr)
+	{
+		SRandomRule*	curRule = gRuleList + ruleItr;
+
+		curRule->year = (Random() % 4) ? (int)eAlarm_Any : 1975 + (int)(Random() % 80);
+		curRule->month = RandomComponent(1, 12);
+		curRule->day = RandomComponent(1, 31);
+		curRule->dayOfWeek = (Random() % 3) ? (int)eAlarm_Any : 1 + (int)(Random() % 7);
+		curRule->hour = RandomComponent(0, 23);
+		curRule->minute = RandomComponent(0, 59);
+		curRule->second = RandomComponent(0, 59);
+		curRule->startTime = (TEpochTime)(Random() % 2800000000u);
+	}
+
+	// Each search runs over the whole list on its own so the timing is not swamped by reading the clock
+	uint64_t	startUS = TestGetCPUTimeUS();
+	for(int ruleItr = 0; ruleItr < eRandomRuleCount; ++ruleItr)
+	{
+		SRandomRule*					curRule = gRuleList + ruleItr;
+		CModule_RealTime::SAlarmRule	rule;
+
+		CompileRule(rule, curRule->year, curRule->month, curRule->day, curRule->dayOfWeek, curRule->hour, curRule->minute, curRule->second);
+		curRule->newFound = gRealTime->GetNextAlarmTime(rule, curRule->startTime, curRule->newTime);
+	}
+	uint64_t	newSearchUS = TestGetCPUTimeUS() - startUS;
+
+	startUS = TestGetCPUTimeUS();
+	for(int ruleItr = 0; ruleItr < eRandomRuleCount; ++ruleItr)
+	{
+		SRandomRule*	curRule = gRuleList + ruleItr;
+		int				year = curRule->year, month = curRule->month, day = curRule->day, dayOfWeek = curRule->dayOfWeek, hour = curRule->hour, minute = curRule->minute, second = curRule->second;
+
+		curRule->oldFound = gRealTime->GetNextDateTimeFromTime(curRule->startTime, year, month, day, dayOfWeek, hour, minute, second);
+		curRule->oldTime = curRule->oldFound ? gRealTime->GetEpochTimeFromComponents(year, month, day, hour, minute, second) : 0;
+	}
+	uint64_t	oldSearchUS = TestGetCPUTimeUS() - startUS;
+
+	uint32_t	bothCount = 0;
+	uint32_t	mismatchCount = 0;
+	uint32_t	newOnlyFailCount = 0;
+
+	for(int ruleItr = 0; ruleItr < eRandomRuleCount; ++ruleItr)
+	{
+		SRandomRule*	curRule = gRuleList + ruleItr;
+
+		// Days past 28 and day of week rules with any time of day are where the old search was wrong
+		if((curRule->day != eAlarm_Any && curRule->day > 28) || (curRule->dayOfWeek != eAlarm_Any && (curRule->hour == eAlarm_Any || curRule->minute == eAlarm_Any || curRule->second == eAlarm_Any)))
+		{
+			continue;
+		}
+
+		if(curRule->oldFound && curRule->newFound)
+		{
+			++bothCount;
+			if(curRule->oldTime != curRule->newTime && mismatchCount++ < 8)
+			{
+				printf("mismatch t=%u y=%d m=%d d=%d w=%d %d:%d:%d old=%u new=%u\n", curRule->startTime, curRule->year, curRule->month, curRule->day, curRule->dayOfWeek, curRule->hour, curRule->minute, curRule->second, curRule->oldTime, curRule->newTime);
+			}
+		}
+		else if(curRule->oldFound)
+		{
+			++newOnlyFailCount;
+		}
+	}
+
+	MTestCheck(bothCount > eRandomRuleCount / 2);
+	MTestCheck(mismatchCount == 0);
+	MTestCheck(newOnlyFailCount == 0);
+	printf("BENCH: alarm next time %.0f ns, component search %.0f ns\n", newSearchUS * 1000.0 / eRandomRuleCount, oldSearchUS * 1000.0 / eRandomRuleCount);
+
+	// A day of week together with a day of month is the slow case for a search that steps a day at a time, Friday the 13th at noon
+	CModule_RealTime::SAlarmRule	fridayRule;
+	CompileRule(fridayRule, eAlarm_Any, eAlarm_Any, 13, 6, 12, 0, 0);
+	startUS = TestGetCPUTimeUS();
+	for(int ruleItr = 0; ruleItr < eFridayCount; ++ruleItr)
+	{
+		SRandomRule*	curRule = gRuleList + ruleItr;
+		curRule->newFound = gRealTime->GetNextAlarmTime(fridayRule, curRule->startTime, curRule->newTime);
+	}
+	newSearchUS = TestGetCPUTimeUS() - startUS;
+
+	startUS = TestGetCPUTimeUS();
+	for(int ruleItr = 0; ruleItr < eFridayCount; ++ruleItr)
+	{
+		SRandomRule*	curRule = gRuleList + ruleItr;
+		int				year = eAlarm_Any, month = eAlarm_Any, day = 13, dayOfWeek = 6, hour = 12, minute = 0, second = 0;
+
+		curRule->oldFound = gRealTime->GetNextDateTimeFromTime(curRule->startTime, year, month, day, dayOfWeek, hour, minute, second);
+		curRule->oldTime = curRule->oldFound ? gRealTime->GetEpochTimeFromComponents(year, month, day, hour, minute, second) : 0;
+	}
+	oldSearchUS = TestGetCPUTimeUS() - startUS;
+
+	mismatchCount = 0;
+	for(int ruleItr = 0; ruleItr < eFridayCount; ++ruleItr)
+	{
+		SRandomRule*	curRule = gRuleList + ruleItr;
+		if(!curRule->newFound || (curRule->oldFound && curRule->oldTime != curRule->newTime))
+		{
+			++mismatchCount;
+		}
+	}
+	MTestCheck(mismatchCount == 0);
+	printf("BENCH: alarm next friday the 13th %.0f ns, component search %.0f ns\n", newSearchUS * 1000.0 / eFridayCount, oldSearchUS * 1000.0 / eFridayCount);
+
+	// Nov 1 2020 with a rule for day 31 of any month is Dec 31, the old search rolled Nov 31 over to Dec 1
+	TEpochTime	nov1 = gRealTime->GetEpochTimeFromComponents(2020, 11, 1, 0, 0, 0);
+	MTestCheck(NextAlarmTime(eAlarm_Any, eAlarm_Any, 31, eAlarm_Any, 12, 0, 0, nov1) == gRealTime->GetEpochTimeFromComponents(2020, 12, 31, 12, 0, 0));
+
+	// Feb 29 only comes in leap years
+	MTestCheck(NextAlarmTime(eAlarm_Any, 2, 29, eAlarm_Any, 0, 0, 0, nov1) == gRealTime->GetEpochTimeFromComponents(2024, 2, 29, 0, 0, 0));
+
+	// Nov 1 2020 was a Sunday, every second of Monday starts at midnight rather than at the current time of day
+	TEpochTime	nov1Noon = gRealTime->GetEpochTimeFromComponents(2020, 11, 1, 12, 30, 0);
+	MTestCheck(NextAlarmTime(eAlarm_Any, eAlarm_Any, eAlarm_Any, 2, eAlarm_Any, eAlarm_Any, eAlarm_Any, nov1Noon) == gRealTime->GetEpochTimeFromComponents(2020, 11, 2, 0, 0, 0));
+
+	// A time that matches the rule is its own next time
+	MTestCheck(NextAlarmTime(eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, 12, 30, 0, nov1Noon) == nov1Noon);
+
+	// A rule for a year that is over has no next time
+	CModule_RealTime::SAlarmRule	pastRule;
+	TEpochTime						pastTime;
+	CompileRule(pastRule, 2019, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any);
+	MTestCheck(!gRealTime->GetNextAlarmTime(pastRule, nov1, pastTime));
+
+	return TestFinish("TestAlarmRule");
+}
@@ -0,0 +1,232 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the closed form epoch and calendar conversions against the year and month walking loops they replaced, for
+	every day TEpochTime can hold, and times both
+*/
+
+#include "HostTest.h"
+#include <ELRealTime.h>
+
+enum
+{
+	eSecsPerDay = 24 * 60 * 60,
+	eBenchStride = 3607,		// About an hour so most conversions land on a day that was just converted
+	eRandomTimeCount = 1000000,
+};
+
+// The year and month walking conversion the RealTime module used before, it is the reference for the checks below
+static void
+LoopComponentsFromEpochTime(
+	TEpochTime	inEpochTime,
+	int&		outYear,
+	int&		outMonth,
+	int&		outDayOfMonth,
+	int&		outDayOfWeek,
+	int&		outHour,
+	int&		outMinute,
+	int&		outSecond)
+{
+	TEpochTime	remainingTime = inEpochTime;
+
+	outSecond = remainingTime % 60;
+	remainingTime /= 60;
+	outMinute = remainingTime % 60;
+	remainingTime /= 60;
+	outHour = remainingTime % 24;
+	remainingTime /= 24;
+	outDayOfWeek = ((remainingTime + 4) % 7) + 1;
+
+	int	year = 1970;
+	for(;;)
+	{
+		TEpochTime	yearLength = MIsLeapYear(year) ? 366 : 365;
+		if(remainingTime < yearLength)
+		{
+			break;
+		}
+		remainingTime -= yearLength;
+		++year;
+	}
+	outYear = year;
+
+	int	month;
+	for(month = 0; month < 11; ++month)
+	{
+		TEpochTime	monthLength = gDaysInMonth[month] + ((month == 1 && MIsLeapYear(year)) ? 1 : 0);
+		if(remainingTime < monthLength)
+		{
+			break;
+		}
+		remainingTime -= monthLength;
+	}
+	outMonth = month + 1;
+	outDayOfMonth = remainingTime + 1;
+}
+
+// Components out of their range carry into the next unit, the same as the old loop version
+static TEpochTime
+LoopEpochTimeFromComponents(
+	int	inYear,
+	int	inMonth,
+	int	inDayOfMonth,
+	int	inHour,
+	int	inMinute,
+	int	inSecond)
+{
+	TEpochTime	result = 0;
+
+	for(int year = 1970; year < inYear; ++year)
+	{
+		result += (MIsLeapYear(year) ? 366 : 365) * eSecsPerDay;
+	}
+
+	for(int month = 1; month < inMonth; ++month)
+	{
+		result += (gDaysInMonth[month - 1] + ((month == 2 && MIsLeapYear(inYear)) ? 1 : 0)) * eSecsPerDay;
+	}
+
+	return result + (inDayOfMonth - 1) * eSecsPerDay + inHour * 3600 + inMinute * 60 + inSecond;
+}
+
+static uint32_t	gRandomState = 1;
+
+static uint32_t
+Random(
+	void)
+{
+	gRandomState ^= gRandomState << 13;
+	gRandomState ^= gRandomState >> 17;
+	gRandomState ^= gRandomState << 5;
+
+	return gRandomState;
+}
+
+static uint32_t	gMismatchCount;
+
+static void
+CheckTime(
+	TEpochTime	inEpochTime)
+{
+	int	year, month, day, dow, hour, min, sec;
+	int	refYear, refMonth, refDay, refDOW, refHour, refMin, refSec;
+
+	gRealTime->GetComponentsFromEpochTime(inEpochTime, year, month, day, dow, hour, min, sec);
+	LoopComponentsFromEpochTime(inEpochTime, refYear, refMonth, refDay, refDOW, refHour, refMin, refSec);
+
+	bool	match = year == refYear && month == refMonth && day == refDay && dow == refDOW && hour == refHour && min == refMin && sec == refSec;
+	match = match && gRealTime->GetYearFromEpoch(inEpochTime) == refYear;
+	match = match && gRealTime->GetMonthFromEpoch(inEpochTime) == refMonth;
+	match = match && gRealTime->GetDayOfMonthFromEpoch(inEpochTime) == refDay;
+	match = match && gRealTime->GetDayOfWeekFromEpoch(inEpochTime) == refDOW;
+	match = match && gRealTime->GetEpochTimeFromComponents(year, month, day, hour, min, sec) == inEpochTime;
+
+	if(!match && gMismatchCount++ < 8)
+	{
+		printf("mismatch %u: %04d-%02d-%02d %d %02d:%02d:%02d ref %04d-%02d-%02d %d %02d:%02d:%02d\n", inEpochTime, year, month, day, dow, hour, min, sec, refYear, refMonth, refDay, refDOW, refHour, refMin, refSec);
+	}
+}
+
+void
+setup(
+	void)
+{
+	CModule_RealTime::Include();
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	// Every day in range at its first and last second and one time in between
+	uint32_t	lastDay = 0xFFFFFFFFUL / eSecsPerDay;
+	for(uint32_t dayItr = 0; dayItr <= lastDay; ++dayItr)
+	{
+		TEpochTime	dayStart = dayItr * eSecsPerDay;
+
+		CheckTime(dayStart);
+		CheckTime(dayStart + Random() % eSecsPerDay);
+		if(dayItr < lastDay)
+		{
+			CheckTime(dayStart + eSecsPerDay - 1);
+		}
+	}
+	CheckTime(0xFFFFFFFFUL);
+
+	// Random times in random order so the day cache is missed and refilled
+	for(int timeItr = 0; timeItr < eRandomTimeCount; ++timeItr)
+	{
+		CheckTime(Random());
+	}
+	MTestCheck(gMismatchCount == 0);
+
+	// Every date through 2105 including days past the end of the month and times that carry
+	uint32_t	componentMismatchCount = 0;
+	for(int year = 1970; year <= 2105; ++year)
+	{
+		for(int month = 1; month <= 12; ++month)
+		{
+			for(int day = 1; day <= 31; ++day)
+			{
+				if(gRealTime->GetEpochTimeFromComponents(year, month, day, 0, 0, 0) != LoopEpochTimeFromComponents(year, month, day, 0, 0, 0)
+					|| gRealTime->GetEpochTimeFromComponents(year, month, day, 25, 61, 70) != LoopEpochTimeFromComponents(year, month, day, 25, 61, 70))
+				{
+					++componentMismatchCount;
+				}
+			}
+		}
+	}
+	MTestCheck(componentMismatchCount == 0);
+
+	// Benchmark over the full range, the checksum keeps the conversions from being optimized away
+	int			year, month, day, dow, hour, min, sec;
+	uint32_t	checksum = 0;
+	uint32_t	benchCount = 0;
+	uint64_t	startUS = TestGetCPUTimeUS();
+	for(uint64_t curTime = 0; curTime <= 0xFFFFFFFFULL; curTime += eBenchStride, ++benchCount)
+	{
+		gRealTime->GetComponentsFromEpochTime((TEpochTime)curTime, year, month, day, dow, hour, min, sec);
+		checksum += year + month + day;
+	}
+	uint64_t	newUS = TestGetCPUTimeUS() - startUS;
+
+	startUS = TestGetCPUTimeUS();
+	for(uint64_t curTime = 0; curTime <= 0xFFFFFFFFULL; curTime += eBenchStride)
+	{
+		LoopComponentsFromEpochTime((TEpochTime)curTime, year, month, day, dow, hour, min, sec);
+		checksum -= year + month + day;
+	}
+	uint64_t	loopUS = TestGetCPUTimeUS() - startUS;
+	MTestCheck(checksum == 0);
+
+	printf("BENCH: epoch to components %.1f ns, year and month loops %.1f ns\n", newUS * 1000.0 / benchCount, loopUS * 1000.0 / benchCount);
+
+	return TestFinish("TestCalendar");
+}
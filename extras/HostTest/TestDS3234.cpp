@@ -0,0 +1,170 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the DS3234 provider against its register level stand in: the time block is written and read back in one
+	burst across a year roll over, the RealTime module syncs from it, and the next alarm is programmed into the chip's
+	alarm 1 registers with the interrupt enabled until the alarm flag is raised and cleared again
+*/
+
+// The provider class is private to ELRealTime.cpp so it is built into this program to reach its registers
+#define private public
+#include "HostTest.h"
+#include "../../ELRealTime.cpp"
+
+static uint32_t	gAlarmFireCount;
+
+class CTestModuleDS3234 : public CModule, public IRealTimeHandler
+{
+public:
+
+	MModule_Declaration(CTestModuleDS3234)
+
+	void
+	ScheduleTestAlarm(
+		int	inSecond)
+	{
+		TRealTimeAlarmRef	alarmRef = MRealTimeCreateAlarm("rtc_alarm", CTestModuleDS3234::TestAlarm, NULL);
+		gRealTime->ScheduleAlarm(alarmRef, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, inSecond, true);
+	}
+
+private:
+
+	CTestModuleDS3234(
+		)
+		:
+		CModule(0, 0, NULL, eUpdateTime_SignalOnly)
+	{
+		CModule_RealTime::Include();
+	}
+
+	bool
+	TestAlarm(
+		TRealTimeAlarmRef	inAlarmRef,
+		void*				inRefCon)
+	{
+		++gAlarmFireCount;
+		return false;
+	}
+};
+
+MModuleImplementation_Start(CTestModuleDS3234)
+MModuleImplementation_Finish(CTestModuleDS3234)
+
+static CTestModuleDS3234*				gModule;
+static CRealTimeDataProvider_DS3234*	gProvider;
+
+void
+setup(
+	void)
+{
+	gModule = CTestModuleDS3234::Include();
+	gRealTime->Configure(gProvider, NULL, 3600);
+	CModule::SetupAll("test", false);
+}
+
+static uint8_t
+ReadRegister(
+	uint8_t	inAddress)
+{
+	uint8_t	result;
+
+	gProvider->ReadRegisters(inAddress, &result, 1);
+
+	return result;
+}
+
+int
+main(
+	void)
+{
+	CModule_RealTime::Include();
+	gProvider = (CRealTimeDataProvider_DS3234*)CreateDS3234Provider(10, false, 5);
+
+	// With an alarm pin the INT/SQW output is the alarm interrupt and no alarm is enabled yet
+	MTestCheck(gProvider->registerFile[eDS3234_Control] == (eDS3234_ControlDefault | eDS3234_ControlINTCN));
+
+	// The time block is written as bcd with the century in the month register
+	uint8_t	timeData[7];
+
+	MTestCheck(gProvider->SetUTCDateAndTime(2031, 12, 31, 23, 59, 58));
+	gProvider->ReadRegisters(eDS3234_Seconds, timeData, sizeof(timeData));
+	MTestCheck(timeData[0] == 0x58 && timeData[1] == 0x59 && timeData[2] == 0x23 && timeData[4] == 0x31);
+	MTestCheck(timeData[5] == (0x12 | eDS3234_MonthCentury) && timeData[6] == 0x31);
+	MTestCheck(timeData[3] == gRealTime->GetDayOfWeekFromEpoch(gRealTime->GetEpochTimeFromComponents(2031, 12, 31, 0, 0, 0)));
+	MTestCheck(!gProvider->SetUTCDateAndTime(2150, 1, 1, 0, 0, 0));
+	MTestCheck(!gProvider->SetUTCDateAndTime(2031, 13, 1, 0, 0, 0));
+
+	// A single burst read sees every field of the new year together
+	gCurLocalUS += 3000000;
+	gProvider->ReadRegisters(eDS3234_Seconds, timeData, sizeof(timeData));
+	MTestCheck(timeData[0] == 0x01 && timeData[1] == 0x00 && timeData[2] == 0x00 && timeData[4] == 0x01);
+	MTestCheck(timeData[5] == (0x01 | eDS3234_MonthCentury) && timeData[6] == 0x32);
+
+	// The RealTime module takes its time from the chip at setup
+	gSimulatorUS = gCurLocalUS;
+	setup();
+	TestRunLoop(10, 100000);
+
+	TEpochTime	nowUTC = gRealTime->GetEpochTime(true);
+
+	MTestCheck(nowUTC >= gRealTime->GetEpochTimeFromComponents(2032, 1, 1, 0, 0, 1) && nowUTC <= gRealTime->GetEpochTimeFromComponents(2032, 1, 1, 0, 0, 5));
+
+	// The next alarm is given to the chip so it could wake a sleeping mcu
+	TEpochTime	alarmUTC = nowUTC + 5;
+	int			year, month, dayOfMonth, dayOfWeek, hour, min, sec;
+
+	gRealTime->GetComponentsFromEpochTime(alarmUTC, year, month, dayOfMonth, dayOfWeek, hour, min, sec);
+	gModule->ScheduleTestAlarm(sec);
+	TestRunLoop(10, 100000);
+	MTestCheck(gRealTime->hardwareAlarmUTC == alarmUTC);
+	MTestCheck(ReadRegister(eDS3234_Alarm1Seconds) == ToBCD(sec));
+	MTestCheck(ReadRegister(eDS3234_Alarm1Seconds + 1) == ToBCD(min));
+	MTestCheck(ReadRegister(eDS3234_Alarm1Seconds + 2) == ToBCD(hour));
+	MTestCheck(ReadRegister(eDS3234_Alarm1Seconds + 3) == ToBCD(dayOfMonth));
+	MTestCheck(ReadRegister(eDS3234_Control) & eDS3234_ControlA1IE);
+	MTestCheck((ReadRegister(eDS3234_Status) & eDS3234_StatusA1F) == 0);
+
+	// Once the alarm fires there is nothing left to program and the chip's alarm is turned off
+	TestRunLoop(60, 100000);
+	MTestCheck(gAlarmFireCount == 1);
+	MTestCheck(gRealTime->hardwareAlarmUTC == 0);
+	MTestCheck((ReadRegister(eDS3234_Control) & eDS3234_ControlA1IE) == 0);
+
+	// The chip raises its alarm flag when the alarm registers match the time and a new alarm clears it
+	TEpochTime	chipUTC = (TEpochTime)(gProvider->timeOffset + gCurLocalUS / 1000000);
+
+	MTestCheck(gProvider->SetAlarmUTC(chipUTC + 2));
+	gCurLocalUS += 1000000;
+	MTestCheck((ReadRegister(eDS3234_Status) & eDS3234_StatusA1F) == 0);
+	gCurLocalUS += 1000000;
+	MTestCheck(ReadRegister(eDS3234_Status) & eDS3234_StatusA1F);
+	MTestCheck(gProvider->SetAlarmUTC(0));
+	MTestCheck((ReadRegister(eDS3234_Status) & eDS3234_StatusA1F) == 0);
+	MTestCheck((ReadRegister(eDS3234_Control) & eDS3234_ControlA1IE) == 0);
+
+	return TestFinish("TestDS3234");
+}
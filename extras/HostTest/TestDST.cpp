@@ -0,0 +1,251 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the local and utc conversions around the daylight savings transitions of a northern and two southern
+	hemisphere time zones, and that the cached DST interval gives the same answer as computing it from scratch
+*/
+
+#include "HostTest.h"
+
+// The cached intervals are internal to the RealTime module
+#define private public
+#include <ELRealTime.h>
+#undef private
+
+enum
+{
+	eRandomTimeCount = 1000000,
+	eBenchCount = 1000000,
+};
+
+static uint32_t	gRandomState = 1;
+
+static uint32_t
+Random(
+	void)
+{
+	gRandomState ^= gRandomState << 13;
+	gRandomState ^= gRandomState >> 17;
+	gRandomState ^= gRandomState << 5;
+
+	return gRandomState;
+}
+
+static void
+SetZone(
+	char const*	inAbbrev,
+	int			inDSTWeek,
+	int			inDSTMonth,
+	int			inDSTHour,
+	int			inDSTOffsetMins,
+	int			inSTDWeek,
+	int			inSTDMonth,
+	int			inSTDHour,
+	int			inSTDOffsetMins)
+{
+	STimeZoneRule	zone;
+
+	memset(&zone, 0, sizeof(zone));
+	strcpy(zone.abbrev, inAbbrev);
+	zone.dstStart.week = inDSTWeek;
+	zone.dstStart.dayOfWeek = 1;
+	zone.dstStart.month = inDSTMonth;
+	zone.dstStart.hour = inDSTHour;
+	zone.dstStart.offsetMins = inDSTOffsetMins;
+	zone.stdStart.week = inSTDWeek;
+	zone.stdStart.dayOfWeek = 1;
+	zone.stdStart.month = inSTDMonth;
+	zone.stdStart.hour = inSTDHour;
+	zone.stdStart.offsetMins = inSTDOffsetMins;
+	gRealTime->SetTimeZone(zone, false);
+}
+
+static TEpochTime
+UTC(
+	int	inYear,
+	int	inMonth,
+	int	inDay,
+	int	inHour,
+	int	inMinute)
+{
+	return gRealTime->GetEpochTimeFromComponents(inYear, inMonth, inDay, inHour, inMinute, 0);
+}
+
+// The transition at inUTC moves the offset from inBeforeMins to inAfterMins
+static void
+CheckTransition(
+	TEpochTime	inUTC,
+	int			inBeforeMins,
+	int			inAfterMins,
+	bool		inToDST)
+{
+	MTestCheck(gRealTime->UTCToLocal(inUTC - 1) == inUTC - 1 + inBeforeMins * 60);
+	MTestCheck(gRealTime->UTCToLocal(inUTC) == inUTC + inAfterMins * 60);
+	MTestCheck(gRealTime->InDST(inUTC - 1, true) == !inToDST);
+	MTestCheck(gRealTime->InDST(inUTC, true) == inToDST);
+
+	// An hour either side is away from the skipped or repeated local hour so it maps back exactly
+	TEpochTime	localBefore = inUTC - 3600 + inBeforeMins * 60;
+	TEpochTime	localAfter = inUTC + 3600 + inAfterMins * 60;
+	MTestCheck(gRealTime->LocalToUTC(localBefore) == inUTC - 3600);
+	MTestCheck(gRealTime->LocalToUTC(localAfter) == inUTC + 3600);
+	MTestCheck(gRealTime->InDST(localBefore, false) == !inToDST);
+	MTestCheck(gRealTime->InDST(localAfter, false) == inToDST);
+}
+
+static uint32_t	gMismatchCount;
+
+// Convert with the cached intervals and again from scratch, then put the cache back as it was
+static void
+CheckCached(
+	TEpochTime	inTime,
+	int			inKind)
+{
+	TEpochTime	cachedResult;
+	TEpochTime	uncachedResult;
+
+	switch(inKind)
+	{
+		case 0: cachedResult = gRealTime->LocalToUTC(inTime); break;
+		case 1: cachedResult = gRealTime->UTCToLocal(inTime); break;
+		default: cachedResult = gRealTime->InDST(inTime, inKind == 2); break;
+	}
+
+	CModule_RealTime::SDSTInterval	savedUTC = gRealTime->utcDSTInterval;
+	CModule_RealTime::SDSTInterval	savedLocal = gRealTime->localDSTInterval;
+
+	gRealTime->InvalidateDSTIntervals();
+	switch(inKind)
+	{
+		case 0: uncachedResult = gRealTime->LocalToUTC(inTime); break;
+		case 1: uncachedResult = gRealTime->UTCToLocal(inTime); break;
+		default: uncachedResult = gRealTime->InDST(inTime, inKind == 2); break;
+	}
+
+	gRealTime->utcDSTInterval = savedUTC;
+	gRealTime->localDSTInterval = savedLocal;
+
+	if(cachedResult != uncachedResult && gMismatchCount++ < 8)
+	{
+		printf("mismatch t=%u kind=%d cached=%u uncached=%u\n", inTime, inKind, cachedResult, uncachedResult);
+	}
+}
+
+// Sweep 2000 to 2100, then random times, then a random walk that crosses transitions in both directions
+static void
+CheckCachedZone(
+	void)
+{
+	for(uint64_t curTime = 946684800ULL; curTime < 4102444800ULL; curTime += 1201)
+	{
+		for(int kind = 0; kind < 4; ++kind)
+		{
+			CheckCached((TEpochTime)curTime, kind);
+		}
+	}
+
+	for(int i = 0; i < eRandomTimeCount; ++i)
+	{
+		CheckCached(Random(), Random() % 4);
+	}
+
+	TEpochTime	walkTime = 1000000000;
+	for(int i = 0; i < eRandomTimeCount; ++i)
+	{
+		walkTime += (int32_t)(Random() % 200000) - 90000;
+		CheckCached(walkTime, Random() % 4);
+	}
+}
+
+void
+setup(
+	void)
+{
+	CModule_RealTime::Include();
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	// US Pacific, second Sunday of March to first Sunday of November
+	SetZone("PST", 2, 3, 2, -7 * 60, 1, 11, 2, -8 * 60);
+	CheckTransition(UTC(2020, 3, 8, 10, 0), -8 * 60, -7 * 60, true);
+	CheckTransition(UTC(2020, 11, 1, 9, 0), -7 * 60, -8 * 60, false);
+	CheckTransition(UTC(2021, 3, 14, 10, 0), -8 * 60, -7 * 60, true);
+	MTestCheck(!gRealTime->InDST(UTC(2020, 1, 15, 12, 0), true));
+	MTestCheck(gRealTime->InDST(UTC(2020, 7, 15, 12, 0), true));
+	CheckCachedZone();
+
+	// Sydney, first Sunday of October to first Sunday of April so DST spans the new year
+	SetZone("AEST", 1, 10, 2, 11 * 60, 1, 4, 3, 10 * 60);
+	CheckTransition(UTC(2020, 4, 4, 16, 0), 11 * 60, 10 * 60, false);
+	CheckTransition(UTC(2020, 10, 3, 16, 0), 10 * 60, 11 * 60, true);
+	MTestCheck(gRealTime->InDST(UTC(2020, 1, 15, 12, 0), true));
+	MTestCheck(!gRealTime->InDST(UTC(2020, 7, 15, 12, 0), true));
+	MTestCheck(gRealTime->UTCToLocal(UTC(2020, 12, 31, 12, 59)) == UTC(2020, 12, 31, 23, 59));
+	MTestCheck(gRealTime->UTCToLocal(UTC(2020, 12, 31, 13, 0)) == UTC(2021, 1, 1, 0, 0));
+	CheckCachedZone();
+
+	// New Zealand, last Sunday of September to first Sunday of April
+	SetZone("NZST", 0, 9, 2, 13 * 60, 1, 4, 3, 12 * 60);
+	CheckTransition(UTC(2020, 4, 4, 14, 0), 13 * 60, 12 * 60, false);
+	CheckTransition(UTC(2020, 9, 26, 14, 0), 12 * 60, 13 * 60, true);
+	CheckCachedZone();
+	MTestCheck(gMismatchCount == 0);
+
+	// A zone change takes effect on the next conversion even for a time inside the cached interval
+	TEpochTime	julyUTC = UTC(2020, 7, 15, 12, 0);
+	MTestCheck(gRealTime->UTCToLocal(julyUTC) == julyUTC + 12 * 60 * 60);
+	SetZone("PST", 2, 3, 2, -7 * 60, 1, 11, 2, -8 * 60);
+	MTestCheck(gRealTime->UTCToLocal(julyUTC) == julyUTC - 7 * 60 * 60);
+
+	// The cost of a conversion inside the cached interval and of one that has to recompute it
+	TEpochTime	checksum = 0;
+	uint64_t	startUS = TestGetCPUTimeUS();
+	for(int i = 0; i < eBenchCount; ++i)
+	{
+		checksum += gRealTime->LocalToUTC(julyUTC + i);
+	}
+	uint64_t	cachedUS = TestGetCPUTimeUS() - startUS;
+
+	startUS = TestGetCPUTimeUS();
+	for(int i = 0; i < eBenchCount; ++i)
+	{
+		gRealTime->InvalidateDSTIntervals();
+		checksum -= gRealTime->LocalToUTC(julyUTC + i);
+	}
+	uint64_t	uncachedUS = TestGetCPUTimeUS() - startUS;
+	MTestCheck(checksum == 0);
+
+	printf("BENCH: local to utc %.1f ns cached, %.1f ns recomputed\n", cachedUS * 1000.0 / eBenchCount, uncachedUS * 1000.0 / eBenchCount);
+
+	return TestFinish("TestDST");
+}
@@ -0,0 +1,254 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the eeprom commit path against the write counting simulated eeprom: saves made close together are merged
+	into one commit, only the bytes that changed are written, and a module with no directory entry is skipped
+*/
+
+#include "HostTest.h"
+
+enum
+{
+	eSaveCount = 100,
+	eSettingsSize = 64,
+};
+
+struct SSettings
+{
+	uint8_t	values[eSettingsSize];
+};
+
+struct SCounter
+{
+	uint32_t	count;
+};
+
+// Lets the test save the module data and find where it is stored
+class CTestModuleStored : public CModule
+{
+public:
+
+	void
+	Save(
+		void)
+	{
+		EEPROMSave();
+	}
+
+	uint16_t
+	GetEEPROMOffset(
+		void)
+	{
+		return eepromOffset;
+	}
+
+protected:
+
+	CTestModuleStored(
+		uint16_t	inEEPROMSize,
+		void*		inEEPROMData)
+		:
+		CModule(inEEPROMSize, 1, inEEPROMData, 1000000)
+	{
+	}
+};
+
+class CTestModuleSettings : public CTestModuleStored
+{
+public:
+
+	MModule_Declaration(CTestModuleSettings)
+
+	SSettings	settings;
+
+private:
+
+	CTestModuleSettings(
+		)
+		:
+		CTestModuleStored(sizeof(SSettings), &settings)
+	{
+	}
+};
+
+class CTestModuleCounter : public CTestModuleStored
+{
+public:
+
+	MModule_Declaration(CTestModuleCounter)
+
+	SCounter	counter;
+
+private:
+
+	CTestModuleCounter(
+		)
+		:
+		CTestModuleStored(sizeof(SCounter), &counter)
+	{
+	}
+};
+
+// Included after SetupAll() so it never gets a directory entry
+class CTestModuleLate : public CTestModuleStored
+{
+public:
+
+	MModule_Declaration(CTestModuleLate)
+
+	SCounter	counter;
+
+private:
+
+	CTestModuleLate(
+		)
+		:
+		CTestModuleStored(sizeof(SCounter), &counter)
+	{
+	}
+};
+
+MModuleImplementation_Start(CTestModuleSettings)
+MModuleImplementation_Finish(CTestModuleSettings)
+
+MModuleImplementation_Start(CTestModuleCounter)
+MModuleImplementation_Finish(CTestModuleCounter)
+
+MModuleImplementation_Start(CTestModuleLate)
+MModuleImplementation_Finish(CTestModuleLate)
+
+static CTestModuleSettings*	gSettings;
+static CTestModuleCounter*	gCounter;
+static CTestOutput			gSysMsgOutput;
+
+static uint32_t
+GetCommitCount(
+	void)
+{
+	CTestOutput	output;
+	unsigned	result = 0;
+
+	TestCommand(&output, "dbg_dump CModuleManager");
+	char const*	countStr = strstr(output.buffer, "EEPROM commits = ");
+	MTestCheck(countStr != NULL);
+	if(countStr != NULL)
+	{
+		sscanf(countStr, "EEPROM commits = %u", &result);
+	}
+
+	return result;
+}
+
+// Run long enough for any pending commit to be written
+static void
+RunPastCommit(
+	void)
+{
+	TestRunLoop(1200, 1000);
+}
+
+void
+setup(
+	void)
+{
+	gSettings = CTestModuleSettings::Include();
+	gCounter = CTestModuleCounter::Include();
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	AddSysMsgHandler(&gSysMsgOutput);
+	setup();
+	RunPastCommit();
+
+	// The first boot lays out the directory and writes the initial data
+	uint8_t*	image = EEPROM.GetImage();
+	MTestCheck(memcmp(image + gSettings->GetEEPROMOffset(), &gSettings->settings, sizeof(SSettings)) == 0);
+
+	// Saves within the commit delay are held back and then written once, only the changed byte and the crc are written
+	EEPROM.ResetWriteCounts();
+	uint32_t	commitCount = GetCommitCount();
+	for(int i = 0; i < eSaveCount; ++i)
+	{
+		gSettings->settings.values[10] = (uint8_t)(i + 1);
+		gSettings->Save();
+		TestRunLoop(5, 1000);
+	}
+	MTestCheck(EEPROM.GetWriteCount() == 0);
+	RunPastCommit();
+	uint32_t	coalescedWrites = EEPROM.GetWriteCount();
+	MTestCheck(coalescedWrites > 0 && coalescedWrites <= 3);
+	MTestCheck(GetCommitCount() == commitCount + 1);
+	MTestCheck(image[gSettings->GetEEPROMOffset() + 10] == eSaveCount);
+	printf("BENCH: eeprom %d saves of a %d byte module wrote %u bytes, a full rewrite per save writes %d\n", eSaveCount, eSettingsSize, coalescedWrites, eSaveCount * eSettingsSize);
+
+	// Saves from two modules in the same window share one commit
+	commitCount = GetCommitCount();
+	gSettings->settings.values[20] = 1;
+	gSettings->Save();
+	TestRunLoop(100, 1000);
+	gCounter->counter.count = 1;
+	gCounter->Save();
+	RunPastCommit();
+	MTestCheck(GetCommitCount() == commitCount + 1);
+	MTestCheck(image[gSettings->GetEEPROMOffset() + 20] == 1);
+
+	// A save with nothing changed writes nothing
+	EEPROM.ResetWriteCounts();
+	gSettings->Save();
+	gCounter->Save();
+	RunPastCommit();
+	MTestCheck(EEPROM.GetWriteCount() == 0);
+
+	// Repeated one byte changes only wear the cells that hold that byte and the crc
+	EEPROM.ResetWriteCounts();
+	for(int i = 0; i < 10; ++i)
+	{
+		++gCounter->counter.count;
+		gCounter->Save();
+		RunPastCommit();
+	}
+	MTestCheck(EEPROM.GetMaxCellWriteCount() <= 10);
+
+	// A module included after SetupAll() has no directory entry, its saves are skipped and the others still commit
+	CTestOutput	output;
+	TestCommand(&output, "config_set debug_level 1");
+	CTestModuleLate*	lateModule = CTestModuleLate::Include();
+	gSysMsgOutput.Clear();
+	lateModule->counter.count = 5;
+	lateModule->Save();
+	gSettings->settings.values[30] = 7;
+	gSettings->Save();
+	RunPastCommit();
+	MTestCheck(gSysMsgOutput.Contains("CTestModuleLate: no eeprom entry"));
+	MTestCheck(image[gSettings->GetEEPROMOffset() + 30] == 7);
+
+	return TestFinish("TestEEPROM");
+}
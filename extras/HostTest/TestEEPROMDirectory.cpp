@@ -0,0 +1,283 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the eeprom directory across reboots: data saved on one boot is loaded on the next, version 104 and 105
+	images are migrated with their module data intact, and a crc mismatch reinitializes the module
+
+	The library keeps its modules in globals so each boot runs in a forked child that reports back through shared memory
+*/
+
+#include "HostTest.h"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum
+{
+	eImageSize = 2048,
+	eDirectoryEntries = 16,
+	eUIDLength = 32,
+
+	eBoot_Load,		// Boot and report what was loaded
+	eBoot_Store,	// Boot, store the test pattern, and commit it
+};
+
+struct SSettings
+{
+	uint8_t	values[48];
+};
+
+// The old directory entries as ELModule.cpp reads them
+struct SEntryV105
+{
+	char		uid[eUIDLength];
+	uint16_t	offset;
+	uint16_t	size;
+	uint16_t	version;
+	uint16_t	crc;
+	bool		inUse;
+};
+
+struct SEntryV104
+{
+	char		uid[eUIDLength];
+	uint16_t	offset;
+	uint16_t	size;
+	uint16_t	version;
+	bool		inUse;
+};
+
+// Filled in by the child for each boot
+struct SBootResult
+{
+	uint8_t		image[eImageSize];
+	SSettings	settings;
+	uint16_t	settingsOffset;
+	bool		converted;
+	bool		initialized;
+	bool		crcMismatch;
+};
+
+class CTestModuleSettings : public CModule
+{
+public:
+
+	MModule_Declaration(CTestModuleSettings)
+
+	void
+	Save(
+		void)
+	{
+		EEPROMSave();
+	}
+
+	uint16_t
+	GetEEPROMOffset(
+		void)
+	{
+		return eepromOffset;
+	}
+
+	SSettings	settings;
+
+private:
+
+	CTestModuleSettings(
+		)
+		:
+		CModule(sizeof(SSettings), 1, &settings, 1000000)
+	{
+	}
+};
+
+MModuleImplementation_Start(CTestModuleSettings)
+MModuleImplementation_Finish(CTestModuleSettings)
+
+static CTestModuleSettings*	gSettings;
+static SBootResult*			gResult;
+
+static void
+FillPattern(
+	SSettings*	outSettings)
+{
+	for(uint32_t i = 0; i < sizeof(outSettings->values); ++i)
+	{
+		outSettings->values[i] = (uint8_t)(i * 7 + 3);
+	}
+}
+
+void
+setup(
+	void)
+{
+	gSettings = CTestModuleSettings::Include();
+	CModule::SetupAll("test", false);
+}
+
+// Boot the library from the given image in a child process, the image it leaves behind is in gResult->image
+static void
+Boot(
+	uint8_t const*	inImage,
+	int				inAction)
+{
+	memset(gResult, 0, sizeof(*gResult));
+
+	pid_t	childPID = fork();
+	if(childPID == 0)
+	{
+		CTestOutput	sysMsgOutput;
+
+		memcpy(EEPROM.GetImage(), inImage, eImageSize);
+		AddSysMsgHandler(&sysMsgOutput);
+		setup();
+
+		gResult->converted = sysMsgOutput.Contains("EEPROM converting directory");
+		gResult->initialized = sysMsgOutput.Contains("CTestModuleSettings: Initializing eeprom");
+		gResult->crcMismatch = sysMsgOutput.Contains("CTestModuleSettings: eeprom crc mismatch");
+		gResult->settings = gSettings->settings;
+		gResult->settingsOffset = gSettings->GetEEPROMOffset();
+
+		if(inAction == eBoot_Store)
+		{
+			FillPattern(&gSettings->settings);
+			gSettings->Save();
+		}
+		TestRunLoop(1200, 1000);
+
+		memcpy(gResult->image, EEPROM.GetImage(), eImageSize);
+		_exit(0);
+	}
+
+	int	status = -1;
+	waitpid(childPID, &status, 0);
+	MTestCheck(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// Build an image in an old layout holding only the test module with the pattern as its data
+static void
+BuildOldImage(
+	uint8_t*	outImage,
+	uint8_t		inVersion)
+{
+	SSettings	pattern;
+	size_t		entrySize = inVersion == 105 ? sizeof(SEntryV105) : sizeof(SEntryV104);
+	uint16_t	dataOffset = (uint16_t)(2 + eDirectoryEntries * entrySize);
+
+	FillPattern(&pattern);
+	memset(outImage, 0, eImageSize);
+	outImage[0] = inVersion;
+	outImage[1] = eDirectoryEntries;
+	if(inVersion == 105)
+	{
+		SEntryV105	entry;
+		memset(&entry, 0, sizeof(entry));
+		strcpy(entry.uid, "CTestModuleSettings");
+		entry.offset = dataOffset;
+		entry.size = sizeof(SSettings);
+		entry.version = 1;
+		entry.crc = ComputeCRC16(&pattern, sizeof(pattern));
+		entry.inUse = true;
+		memcpy(outImage + 2, &entry, sizeof(entry));
+	}
+	else
+	{
+		SEntryV104	entry;
+		memset(&entry, 0, sizeof(entry));
+		strcpy(entry.uid, "CTestModuleSettings");
+		entry.offset = dataOffset;
+		entry.size = sizeof(SSettings);
+		entry.version = 1;
+		entry.inUse = true;
+		memcpy(outImage + 2, &entry, sizeof(entry));
+	}
+	memcpy(outImage + dataOffset, &pattern, sizeof(pattern));
+}
+
+static void
+CheckMigration(
+	uint8_t	inVersion)
+{
+	uint8_t		image[eImageSize];
+	SSettings	pattern;
+
+	FillPattern(&pattern);
+	BuildOldImage(image, inVersion);
+	size_t	oldDataOffset = 2 + eDirectoryEntries * (inVersion == 105 ? sizeof(SEntryV105) : sizeof(SEntryV104));
+
+	// The directory is converted, the data survives, and it moves down into the space the old directory used
+	Boot(image, eBoot_Load);
+	MTestCheck(gResult->converted);
+	MTestCheck(!gResult->initialized);
+	MTestCheck(memcmp(&gResult->settings, &pattern, sizeof(pattern)) == 0);
+	MTestCheck(gResult->settingsOffset < oldDataOffset);
+	MTestCheck(gResult->image[0] == 106);
+
+	// The converted image boots without another conversion
+	memcpy(image, gResult->image, eImageSize);
+	Boot(image, eBoot_Load);
+	MTestCheck(!gResult->converted);
+	MTestCheck(!gResult->initialized);
+	MTestCheck(memcmp(&gResult->settings, &pattern, sizeof(pattern)) == 0);
+}
+
+int
+main(
+	void)
+{
+	gResult = (SBootResult*)mmap(NULL, sizeof(SBootResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	MAssert(gResult != MAP_FAILED);
+
+	uint8_t		image[eImageSize];
+	SSettings	pattern;
+
+	FillPattern(&pattern);
+
+	// A blank part is laid out and the module starts from its initial data
+	memset(image, 0xFF, sizeof(image));
+	Boot(image, eBoot_Store);
+	MTestCheck(gResult->initialized);
+	MTestCheck(gResult->image[0] == 106);
+
+	// What was stored is loaded on the next boot
+	memcpy(image, gResult->image, eImageSize);
+	Boot(image, eBoot_Load);
+	MTestCheck(!gResult->initialized && !gResult->converted && !gResult->crcMismatch);
+	MTestCheck(memcmp(&gResult->settings, &pattern, sizeof(pattern)) == 0);
+
+	// Data that does not match its crc, as after a reset part way through a commit, is reinitialized
+	uint16_t	dataOffset = gResult->settingsOffset;
+	image[dataOffset + 5] ^= 0x40;
+	Boot(image, eBoot_Load);
+	MTestCheck(gResult->crcMismatch);
+	MTestCheck(gResult->settings.values[5] == 0);
+
+	CheckMigration(105);
+	CheckMigration(104);
+
+	return TestFinish("TestEEPROMDirectory");
+}
@@ -0,0 +1,229 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Runs the ESP8266 driver against a scripted AT responder on its serial port: no call into the driver waits on the
+	device, a stream bigger than the outgoing ring goes out whole through short TCPSendData() counts, a close follows
+	every queued byte, and the closes, server and setup commands that find the command queue full are sent later
+	from Update() while an open that does not fit fails right away
+
+	Nothing in the driver may call delay() so the simulated clock only moves between calls
+*/
+
+#define private public
+#include "HostTest.h"
+#include <ELRealTime.h>
+#include <ELInternet.h>
+#include <ELInternetDevice_ESP8266.h>
+#include "ESP8266Simulator.h"
+
+enum
+{
+	eStreamBytes = 10000,
+	eChunkBytes = 700,
+	eStepUS = 1000,
+	eMaxIdlePasses = 20000,
+};
+
+static CESP8266Simulator	gSerial;
+static CModule_ESP8266*		gESP8266;
+static char					gStream[eStreamBytes];
+
+// Run the loop until the driver has nothing left to send and the device has nothing left to say
+static bool
+RunUntilIdle(
+	void)
+{
+	for(int i = 0; i < eMaxIdlePasses; ++i)
+	{
+		bool	channelBusy = false;
+		for(int j = 0; j < CModule_ESP8266::eChannelCount; ++j)
+		{
+			CModule_ESP8266::SChannel*	curChannel = gESP8266->channelArray + j;
+			channelBusy |= curChannel->outgoingTotalBytes > 0 || curChannel->closeRequested;
+		}
+
+		if(!channelBusy && gESP8266->commandHead == gESP8266->commandTail && gESP8266->serverCommandPort == 0
+			&& gESP8266->setupStep == CModule_ESP8266::eSetupStep_Done && gSerial.available() == 0)
+		{
+			return true;
+		}
+
+		TestRunLoop(1, eStepUS);
+	}
+
+	return false;
+}
+
+// Accept a server connection from a remote client on inLink and return its port
+static int
+ConnectLink(
+	int	inLink)
+{
+	gSerial.Reply("%d,CONNECT\r\n", inLink);
+	MTestCheck(RunUntilIdle());
+
+	CModule_ESP8266::SChannel*	channel = gESP8266->FindChannel(inLink);
+	MTestCheck(channel != NULL && channel->state == CModule_ESP8266::eChannelState_Server);
+
+	return channel != NULL ? channel->channelIndex : 0;
+}
+
+static bool
+FillCommandQueue(
+	void)
+{
+	int	count = 0;
+	while(gESP8266->IssueCommand("AT", NULL, CModule_ESP8266::eSimpleCommandTimeoutMS))
+	{
+		++count;
+	}
+
+	return count > 0 && (uint16_t)(gESP8266->commandHead - gESP8266->commandTail) == CModule_ESP8266::eMaxPendingCommands;
+}
+
+void
+setup(
+	void)
+{
+	CModule_RealTime::Include();
+	gESP8266 = CModule_ESP8266::Include(&gSerial, 0xFF);
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	for(int i = 0; i < eStreamBytes; ++i)
+	{
+		gStream[i] = 'a' + (i * 7) % 26;
+	}
+
+	// Setup goes through once the device says it is ready
+	gSerial.Reply("ready\r\n");
+	MTestCheck(RunUntilIdle());
+	MTestCheck(gSerial.SawCommand("ATE0\n"));
+	MTestCheck(gSerial.SawCommand("AT+CIPMUX=1\n"));
+	MTestCheck(gSerial.SawCommand("AT+CIPDINFO=1\n"));
+
+	MTestCheck(gESP8266->Server_Open(80));
+	MTestCheck(RunUntilIdle());
+	MTestCheck(gSerial.SawCommand("AT+CIPSERVER=1,80\n"));
+
+	// A stream ten times the outgoing ring, the caller resends what a short count left behind and never waits
+	int			port = ConnectLink(0);
+	uint32_t	offset = 0;
+	uint32_t	callCount = 0;
+	uint32_t	shortCount = 0;
+	uint32_t	blockedCount = 0;
+
+	while(offset < eStreamBytes && callCount < eMaxIdlePasses)
+	{
+		size_t		chunkBytes = MMin((size_t)eChunkBytes, (size_t)(eStreamBytes - offset));
+		uint64_t	beforeUS = gSimulatorUS;
+		size_t		bytesSent;
+		bool		success = gESP8266->TCPSendData(port, chunkBytes, gStream + offset, bytesSent, true);
+
+		blockedCount += gSimulatorUS != beforeUS;
+		++callCount;
+		MTestCheck(success);
+		if(!success)
+		{
+			break;
+		}
+
+		shortCount += bytesSent < chunkBytes;
+		offset += bytesSent;
+		TestRunLoop(1, eStepUS);
+	}
+
+	uint64_t	beforeUS = gSimulatorUS;
+	gESP8266->TCPCloseConnection(port);
+	blockedCount += gSimulatorUS != beforeUS;
+
+	MTestCheck(RunUntilIdle());
+	printf("stream: %u calls, %u short, %u blocked\n", callCount, shortCount, blockedCount);
+	MTestCheck(blockedCount == 0);
+	MTestCheck(shortCount > 0);
+	MTestCheck(gSerial.receivedBytes[0] == eStreamBytes && memcmp(gSerial.received[0], gStream, eStreamBytes) == 0);
+	MTestCheck(gSerial.closeCount[0] == 1 && gSerial.closedAtBytes[0] == eStreamBytes);
+	MTestCheck(gESP8266->channelArray[port].state == CModule_ESP8266::eChannelState_Unused);
+
+	// A close right behind a send in flight must not wait on a flush that has nothing to send
+	size_t	bytesQueued;
+	port = ConnectLink(1);
+	MTestCheck(gESP8266->TCPSendData(port, 100, gStream, bytesQueued, true) && bytesQueued == 100);
+	gESP8266->TCPCloseConnection(port);
+	MTestCheck(!gESP8266->channelArray[port].closeRequested);
+	MTestCheck(RunUntilIdle());
+	MTestCheck(gSerial.closeCount[1] == 1 && gSerial.closedAtBytes[1] == 100);
+
+	// A close with bytes queued behind the send in flight follows them once that send is done
+	port = ConnectLink(1);
+	MTestCheck(gESP8266->TCPSendData(port, 100, gStream, bytesQueued, true) && bytesQueued == 100);
+	uint32_t	commandCount = gSerial.commandCount;
+	for(int i = 0; i < eMaxIdlePasses && gSerial.commandCount == commandCount; ++i)
+	{
+		TestRunLoop(1, eStepUS);
+	}
+	MTestCheck(gESP8266->channelArray[port].sendPending);
+	MTestCheck(gESP8266->TCPSendData(port, 50, gStream + 100, bytesQueued, false) && bytesQueued == 50);
+	gESP8266->TCPCloseConnection(port);
+	MTestCheck(gESP8266->channelArray[port].closeRequested);
+	MTestCheck(RunUntilIdle());
+	MTestCheck(gSerial.closeCount[1] == 2 && gSerial.receivedBytes[1] == 250 && gSerial.closedAtBytes[1] == 250);
+
+	// With the command queue full nothing is dropped except an open, which fails right away
+	port = ConnectLink(2);
+	int	idlePort = ConnectLink(3);
+	MTestCheck(gESP8266->TCPSendData(port, 200, gStream, bytesQueued, false) && bytesQueued == 200);
+	MTestCheck(FillCommandQueue());
+	gESP8266->TCPCloseConnection(port);
+	gESP8266->TCPCloseConnection(idlePort);
+	gESP8266->Server_Close(80);
+	gESP8266->SetIPAddr(0xC0A80164, 0xC0A80101, 0xFFFFFF00);
+	MTestCheck(gESP8266->TCPRequestOpen(80, "example.com") < 0);
+	MTestCheck(gESP8266->FindAvailableChannel() != NULL);
+	MTestCheck(gESP8266->channelArray[port].closeRequested);
+	MTestCheck(gESP8266->channelArray[idlePort].closeRequested);
+	MTestCheck(gESP8266->serverCommandPort == 80);
+	MTestCheck(gESP8266->setupStep == CModule_ESP8266::eSetupStep_IPAddr);
+
+	MTestCheck(RunUntilIdle());
+	MTestCheck(gSerial.closeCount[2] == 1 && gSerial.receivedBytes[2] == 200 && gSerial.closedAtBytes[2] == 200);
+	MTestCheck(memcmp(gSerial.received[2], gStream, 200) == 0);
+	MTestCheck(gESP8266->channelArray[port].state == CModule_ESP8266::eChannelState_Unused);
+	MTestCheck(gSerial.closeCount[3] == 1 && gSerial.receivedBytes[3] == 0);
+	MTestCheck(gESP8266->channelArray[idlePort].state == CModule_ESP8266::eChannelState_Unused);
+	MTestCheck(gSerial.SawCommand("AT+CIPSERVER=0,80\n"));
+	MTestCheck(gSerial.SawCommand("AT+CIPSTA_CUR=\"192.168.1.100\",\"192.168.1.1\",\"255.255.255.0\"\n"));
+	MTestCheck(!gSerial.SawCommand("AT+CIPSTART"));
+
+	return TestFinish("TestESP8266");
+}
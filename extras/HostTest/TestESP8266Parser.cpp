@@ -0,0 +1,304 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Feeds ESP8266 output through the driver's serial input path: responses and ipd headers split at any byte still
+	parse, ipd payloads land in pool packets intact with their remote address, a truncated ipd gives way to the
+	response that cut it off, and a connection that holds its share of the packets drops data without losing sync
+
+	The benchmark replays a captured web server session, a request and a two packet post body per connection, and
+	reports the parser throughput
+*/
+
+#define private public
+#include "HostTest.h"
+#include <ELRealTime.h>
+#include <ELInternet.h>
+#include <ELInternetDevice_ESP8266.h>
+
+enum
+{
+	eInputBufferSize = 1024 * 1024,
+	eBodyPacketBytes = 1400,
+	eBodyLineBytes = 50,
+	eBenchConnectionCount = 200,
+	eBenchRepeatCount = 20,
+	eSerialChunkBytes = 1023,	// The most ProcessSerialInput() reads in one pass
+};
+
+static char const	gRequest[] = "POST /cmd_data HTTP/1.1\r\nHost: 192.168.1.50\r\nUser-Agent: test\r\nContent-Type: text/plain\r\nContent-Length: 2800\r\n\r\n";
+
+// Replays queued device output, what the driver writes goes nowhere
+class CTestReplaySerial : public HardwareSerial
+{
+public:
+
+	virtual int
+	available(
+		void)
+	{
+		return (int)(inputTail - inputHead);
+	}
+
+	virtual int
+	read(
+		void)
+	{
+		if(inputHead == inputTail)
+		{
+			return -1;
+		}
+
+		return (uint8_t)input[inputHead++];
+	}
+
+	virtual size_t
+	readBytes(
+		char*	outBuffer,
+		size_t	inLength)
+	{
+		inLength = MMin(inLength, inputTail - inputHead);
+		memcpy(outBuffer, input + inputHead, inLength);
+		inputHead += inLength;
+
+		return inLength;
+	}
+
+	using HardwareSerial::readBytes;
+
+	void
+	Queue(
+		char const*	inData,
+		size_t		inLength)
+	{
+		if(inputHead == inputTail)
+		{
+			inputHead = inputTail = 0;
+		}
+
+		MTestCheck(inputTail + inLength <= sizeof(input));
+		inLength = MMin(inLength, sizeof(input) - inputTail);
+		memcpy(input + inputTail, inData, inLength);
+		inputTail += inLength;
+	}
+
+private:
+
+	char	input[eInputBufferSize];
+	size_t	inputHead;
+	size_t	inputTail;
+};
+
+static CTestReplaySerial	gSerial;
+static CModule_ESP8266*		gESP8266;
+static char					gBody[2][eBodyPacketBytes];
+static char					gTranscript[eInputBufferSize];
+
+// Pass inData to the driver inChunkBytes at a time the way its serial port would hand it over
+static void
+FeedInput(
+	char const*	inData,
+	size_t		inLength,
+	size_t		inChunkBytes)
+{
+	while(inLength > 0)
+	{
+		size_t	chunkBytes = MMin(inLength, inChunkBytes);
+
+		gSerial.Queue(inData, chunkBytes);
+		while(gSerial.available() > 0)
+		{
+			gESP8266->ProcessSerialInput();
+		}
+
+		inData += chunkBytes;
+		inLength -= chunkBytes;
+	}
+}
+
+static void
+FeedString(
+	char const*	inString,
+	size_t		inChunkBytes = eSerialChunkBytes)
+{
+	FeedInput(inString, strlen(inString), inChunkBytes);
+}
+
+// Append one connection's output up to the close: the connect, the request and the post body with ip info
+static size_t
+AppendConnection(
+	char*	outTranscript,
+	int		inLink)
+{
+	size_t	length = sprintf(outTranscript, "%d,CONNECT\r\n\r\n+IPD,%d,%d,192.168.1.20,52144:%s", inLink, inLink, (int)sizeof(gRequest) - 1, gRequest);
+
+	for(int i = 0; i < 2; ++i)
+	{
+		length += sprintf(outTranscript + length, "\r\n+IPD,%d,%d,192.168.1.20,52144:", inLink, eBodyPacketBytes);
+		memcpy(outTranscript + length, gBody[i], eBodyPacketBytes);
+		length += eBodyPacketBytes;
+	}
+
+	length += sprintf(outTranscript + length, "\r\n");
+
+	return length;
+}
+
+static bool
+CheckPacket(
+	SInternetPacket*	inPacket,
+	char const*			inData,
+	size_t				inSize,
+	uint32_t			inRemoteAddress,
+	uint16_t			inRemotePort)
+{
+	return inPacket != NULL && inPacket->size == inSize && memcmp(inPacket->data, inData, inSize) == 0 && inPacket->data[inSize] == 0
+		&& inPacket->remoteAddress == inRemoteAddress && inPacket->remotePort == inRemotePort;
+}
+
+void
+setup(
+	void)
+{
+	CModule_RealTime::Include();
+	gESP8266 = CModule_ESP8266::Include(&gSerial, 0xFF);
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	// The body lines look like responses to the truncation check but none of them is one
+	for(int i = 0; i < 2; ++i)
+	{
+		for(int j = 0; j < eBodyPacketBytes; ++j)
+		{
+			gBody[i][j] = j % eBodyLineBytes == eBodyLineBytes - 2 ? '\r' : j % eBodyLineBytes == eBodyLineBytes - 1 ? '\n' : 'A' + (i * 7 + j) % 26;
+		}
+		memcpy(gBody[i] + eBodyLineBytes, "OK", 2);
+		memcpy(gBody[i] + 2 * eBodyLineBytes, "SEND OK?", 8);
+	}
+
+	FeedString("ready\r\n", 1);
+	MTestCheck(gESP8266->gotReady);
+	FeedString("WIFI CONNECTED\r\nWIFI GOT IP\r\n", 3);
+	MTestCheck(gESP8266->wifiConnected && gESP8266->gotIP);
+
+	// The same connection split every way a serial port could split it
+	static size_t const	chunkSizeList[] = {1, 2, 3, 7, 64, 1023};
+	size_t				connectionBytes = AppendConnection(gTranscript, 0);
+	int					freeCount = gInternetPacketPool.GetFreeCount();
+
+	for(size_t i = 0; i < MStaticArrayLength(chunkSizeList); ++i)
+	{
+		FeedInput(gTranscript, connectionBytes, chunkSizeList[i]);
+
+		CModule_ESP8266::SChannel*	channel = gESP8266->FindChannel(0);
+		MTestCheck(channel != NULL && channel->state == CModule_ESP8266::eChannelState_Server);
+		MTestCheck(!gESP8266->ipdInProcess);
+		if(channel == NULL)
+		{
+			break;
+		}
+
+		MTestCheck(channel->CountIncoming() == 3);
+		SInternetPacket*	packet = channel->incomingHead;
+		MTestCheck(CheckPacket(packet, gRequest, sizeof(gRequest) - 1, 0xC0A80114, 52144));
+		for(int j = 0; j < 2 && packet != NULL; ++j)
+		{
+			packet = packet->next;
+			MTestCheck(CheckPacket(packet, gBody[j], eBodyPacketBytes, 0xC0A80114, 52144));
+		}
+
+		FeedString("0,CLOSED\r\n", chunkSizeList[i]);
+		MTestCheck(gESP8266->FindChannel(0) == NULL);
+		MTestCheck(gInternetPacketPool.GetFreeCount() == freeCount);
+	}
+
+	// An ipd without the ip info
+	FeedString("1,CONNECT\r\n+IPD,1,4:abcd\r\n", 2);
+	CModule_ESP8266::SChannel*	channel = gESP8266->FindChannel(1);
+	MTestCheck(channel != NULL && CheckPacket(channel->incomingHead, "abcd", 4, 0, 0));
+
+	// A close that cuts off an ipd ends it and frees its packet
+	FeedString("+IPD,1,200,10.1.2.3,8080:partial\r\nline\r\n1,CLOS", 5);
+	MTestCheck(gESP8266->ipdInProcess);
+	FeedString("ED\r\n");
+	MTestCheck(!gESP8266->ipdInProcess);
+	MTestCheck(gESP8266->FindChannel(1) == NULL);
+	MTestCheck(gInternetPacketPool.GetFreeCount() == freeCount);
+
+	// A connection that does not collect its packets only holds eInternetMaxChannelPackets of them, the extra data is
+	// dropped, the next response still parses and another connection still gets a packet
+	FeedString("2,CONNECT\r\n3,CONNECT\r\n");
+	channel = gESP8266->FindChannel(2);
+	MTestCheck(channel != NULL);
+	gESP8266->wifiConnected = false;
+	for(int i = 0; i < freeCount + 2; ++i)
+	{
+		FeedString("+IPD,2,6:packet\r\n", 4);
+	}
+	FeedString("WIFI CONNECTED\r\n");
+	MTestCheck(gESP8266->wifiConnected && !gESP8266->ipdInProcess);
+	MTestCheck(channel != NULL && channel->CountIncoming() == eInternetMaxChannelPackets);
+	FeedString("+IPD,3,5:other\r\n");
+	MTestCheck(gESP8266->FindChannel(3) != NULL && CheckPacket(gESP8266->FindChannel(3)->incomingHead, "other", 5, 0, 0));
+	FeedString("2,CLOSED\r\n3,CLOSED\r\n");
+	MTestCheck(gInternetPacketPool.GetFreeCount() == freeCount);
+
+	// Replay a session of many connections, each one is closed so its packets go back to the pool
+	size_t	transcriptBytes = 0;
+	for(int i = 0; i < eBenchConnectionCount; ++i)
+	{
+		int	link = i % CModule_ESP8266::eChannelCount;
+
+		transcriptBytes += AppendConnection(gTranscript + transcriptBytes, link);
+		transcriptBytes += sprintf(gTranscript + transcriptBytes, "%d,CLOSED\r\n", link);
+		MTestCheck(transcriptBytes + 2 * connectionBytes < sizeof(gTranscript));
+	}
+
+	uint64_t	startCPUUS = TestGetCPUTimeUS();
+	for(int i = 0; i < eBenchRepeatCount; ++i)
+	{
+		FeedInput(gTranscript, transcriptBytes, eSerialChunkBytes);
+	}
+	uint64_t	cpuUS = MMax(TestGetCPUTimeUS() - startCPUUS, (uint64_t)1);
+
+	MTestCheck(!gESP8266->ipdInProcess);
+	MTestCheck(gInternetPacketPool.GetFreeCount() == freeCount);
+	for(int i = 0; i < CModule_ESP8266::eChannelCount; ++i)
+	{
+		MTestCheck(gESP8266->channelArray[i].state == CModule_ESP8266::eChannelState_Unused);
+	}
+
+	double	totalBytes = (double)transcriptBytes * eBenchRepeatCount;
+	printf("BENCH: ESP8266 parser %.1f MB/s, %.2f ns per byte\n", totalBytes / cpuUS, cpuUS * 1000.0 / totalBytes);
+
+	return TestFinish("TestESP8266Parser");
+}
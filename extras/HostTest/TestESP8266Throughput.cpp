@@ -0,0 +1,178 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	ABOUT
+
+	Measures how fast the ESP8266 driver streams to a server link when the simulated serial line runs at its baud
+	rate. The driver is included at 921600 baud so setup switches the device with AT+UART_CUR, then the same stream
+	is sent again after dropping the link back to the 115200 baud the device starts at.
+
+	The rate is in simulated time so it reflects the driver's round trips and pauses on top of the line rate, the cpu
+	cost per byte is host time and only good for comparing one build against another
+*/
+
+#define private public
+#include "HostTest.h"
+#include <ELRealTime.h>
+#include <ELInternet.h>
+#include <ELInternetDevice_ESP8266.h>
+#include "ESP8266Simulator.h"
+
+enum
+{
+	eFastBaudRate = 921600,
+	eStreamBytes = 64 * 1024,
+	eChunkBytes = 700,
+	eStepUS = 1000,
+	eMaxPasses = 100000,
+};
+
+static CESP8266Simulator	gSerial;
+static CModule_ESP8266*		gESP8266;
+static char					gStream[eChunkBytes];
+
+// Run the loop until the driver has nothing left to send or wait on
+static bool
+RunUntilIdle(
+	void)
+{
+	for(int i = 0; i < eMaxPasses; ++i)
+	{
+		if(gESP8266->commandHead == gESP8266->commandTail && gESP8266->serverCommandPort == 0
+			&& gESP8266->setupStep == CModule_ESP8266::eSetupStep_Done && !gSerial.IsReplyPending())
+		{
+			return true;
+		}
+
+		TestRunLoop(1, eStepUS);
+	}
+
+	return false;
+}
+
+// Stream eStreamBytes to a client on inLink, return the simulated bytes per second
+static double
+StreamToLink(
+	int	inLink)
+{
+	gSerial.ClearReceived(inLink);
+	gSerial.Reply("%d,CONNECT\r\n", inLink);
+	MTestCheck(RunUntilIdle());
+
+	CModule_ESP8266::SChannel*	channel = gESP8266->FindChannel(inLink);
+	MTestCheck(channel != NULL);
+	if(channel == NULL)
+	{
+		return 0;
+	}
+
+	int			port = channel->channelIndex;
+	uint32_t	offset = 0;
+	uint64_t	startUS = gSimulatorUS;
+	uint64_t	startBlockedUS = gSerial.writeBlockedUS;
+	uint64_t	startCPUUS = TestGetCPUTimeUS();
+
+	for(int i = 0; i < eMaxPasses && gSerial.receivedBytes[inLink] < eStreamBytes; ++i)
+	{
+		if(offset < eStreamBytes)
+		{
+			size_t	bytesSent;
+			bool	success = gESP8266->TCPSendData(port, MMin((size_t)eChunkBytes, (size_t)(eStreamBytes - offset)), gStream, bytesSent, true);
+			MTestCheck(success);
+			if(!success)
+			{
+				break;
+			}
+			offset += bytesSent;
+		}
+
+		TestRunLoop(1, eStepUS);
+	}
+
+	uint64_t	cpuUS = TestGetCPUTimeUS() - startCPUUS;
+	uint64_t	elapsedUS = gSimulatorUS - startUS;
+	double		lineBytesPerSec = gSerial.baudRate / (double)eESP8266Simulator_BitsPerByte;
+	double		bytesPerSec = eStreamBytes * 1000000.0 / elapsedUS;
+
+	MTestCheck(gSerial.receivedBytes[inLink] == eStreamBytes);
+	MTestCheck(bytesPerSec < lineBytesPerSec);
+
+	printf("BENCH: ESP8266 stream at %u baud %.1f KB/s, %.0f%% of the line, %.1f ms blocked in write, %.1f ns cpu per byte\n",
+		gSerial.baudRate, bytesPerSec / 1024, bytesPerSec * 100 / lineBytesPerSec, (gSerial.writeBlockedUS - startBlockedUS) / 1000.0,
+		cpuUS * 1000.0 / eStreamBytes);
+
+	gESP8266->TCPCloseConnection(port);
+	MTestCheck(RunUntilIdle());
+
+	return bytesPerSec;
+}
+
+void
+setup(
+	void)
+{
+	CModule_RealTime::Include();
+	gESP8266 = CModule_ESP8266::Include(&gSerial, 0xFF, 0xFF, 0xFF, 0xFF, eFastBaudRate);
+	gSerial.pacing = true;
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	for(int i = 0; i < eChunkBytes; ++i)
+	{
+		gStream[i] = 'a' + (i * 7) % 26;
+	}
+
+	// Setup starts at the default rate and switches once the device has echo off
+	MTestCheck(gSerial.baudRate == CModule_ESP8266::eDefaultBaudRate);
+	gSerial.Reply("ready\r\n");
+	MTestCheck(RunUntilIdle());
+	MTestCheck(gSerial.SawCommand("AT+UART_CUR=921600,8,1,0,0\n"));
+	MTestCheck(gSerial.baudRate == eFastBaudRate);
+	MTestCheck(!gESP8266->uartSwitchPending);
+
+	MTestCheck(gESP8266->Server_Open(80));
+	MTestCheck(RunUntilIdle());
+
+	double	fastBytesPerSec = StreamToLink(0);
+
+	// Drop back to the rate the device starts at, the next OK confirms it like the one after AT+UART_CUR
+	gESP8266->baudRate = CModule_ESP8266::eDefaultBaudRate;
+	gESP8266->SwitchUART();
+	MTestCheck(gSerial.baudRate == CModule_ESP8266::eDefaultBaudRate);
+
+	double	slowBytesPerSec = StreamToLink(1);
+	MTestCheck(!gESP8266->uartSwitchPending);
+	MTestCheck(fastBytesPerSec > slowBytesPerSec);
+
+	return TestFinish("TestESP8266Throughput");
+}
@@ -0,0 +1,160 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the interrupt timers: arming, cancelling and arming again from a timer function, an old deadline never fires
+	once the timer is armed again, an earlier deadline reprograms the hardware timer without waiting for the main loop,
+	long deadlines are reached in steps the hardware timer accepts, and a timer that can not be started is noticed
+
+	The host has no timer interrupt, ISRTimerInterrupt() is called directly where the hardware would take it
+*/
+
+#define private public
+#include "HostTest.h"
+#include <ELRealTime.h>
+
+enum
+{
+	eTestTimerCount = 6,
+	eTestRearmCount = 3,
+};
+
+static uint32_t	gFireCount[eTestTimerCount];
+static uint64_t	gFireUS[eTestTimerCount];
+
+static TRealTimeISRTimerRef	gTimer[eTestTimerCount];
+
+static void
+TestTimerFunc(
+	void*	inRefCon)
+{
+	int	timerIndex = (int)(intptr_t)inRefCon;
+
+	++gFireCount[timerIndex];
+	gFireUS[timerIndex] = gCurLocalUS;
+
+	// Timer 1 arms itself again from its own function
+	if(timerIndex == 1 && gFireCount[timerIndex] < eTestRearmCount)
+	{
+		gRealTime->ArmISRTimer(gTimer[timerIndex], 500);
+	}
+}
+
+void
+setup(
+	void)
+{
+	CModule_RealTime::Include();
+	CModule::SetupAll("test", false);
+	gRealTime->SetDateAndTime(2020, 1, 1, 0, 0, 0, true);
+}
+
+// Move the timer clock without running the loop, as happens between main loop passes on hardware
+static void
+AdvanceUS(
+	uint32_t	inUS)
+{
+	gCurLocalUS += inUS;
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	for(int i = 0; i < eTestTimerCount; ++i)
+	{
+		gTimer[i] = gRealTime->CreateISRTimer(TestTimerFunc, (void*)(intptr_t)i);
+	}
+
+	MTestCheck(!gRealTime->ArmISRTimer(gTimer[0], eRealTime_MaxISRTimerDelayUS));
+	MTestCheck(!gRealTime->ArmISRTimer(NULL, 100));
+
+	// Timers fire once at or after their deadline, a cancelled one never does and one can arm itself again
+	uint64_t	startUS = gCurLocalUS;
+
+	MTestCheck(gRealTime->ArmISRTimer(gTimer[0], 2500000));
+	MTestCheck(gRealTime->isrHardwareRunning && gRealTime->isrHardwareTimer.periodUS == 2500000);
+	gRealTime->ArmISRTimer(gTimer[1], 1000);
+	gRealTime->ArmISRTimer(gTimer[2], 100);
+	gRealTime->CancelISRTimer(gTimer[2]);
+	TestRunLoop(4000, 1000);
+	MTestCheck(gFireCount[0] == 1 && gFireUS[0] - startUS >= 2500000);
+	MTestCheck(gFireCount[1] == eTestRearmCount && gFireUS[1] - startUS >= 2000);
+	MTestCheck(gFireCount[2] == 0);
+	MTestCheck(!gRealTime->isrHardwareRunning && !gRealTime->isrHardwareTimer.running);
+
+	// Arming an armed timer for later must keep its old deadline from firing before the main loop applies the new one
+	gRealTime->ArmISRTimer(gTimer[3], 100000);
+	MTestCheck(gRealTime->isrHardwareTimer.periodUS == 100000);
+	AdvanceUS(50000);
+	gRealTime->ArmISRTimer(gTimer[3], 2000000);
+	AdvanceUS(50000);
+	gRealTime->ISRTimerInterrupt();
+	MTestCheck(gFireCount[3] == 0);
+	loop();
+	MTestCheck(gRealTime->isrHardwareRunning && gRealTime->isrHardwareTimer.periodUS == 1950000);
+
+	// An earlier deadline programs the hardware timer straight away
+	uint32_t	beginCount = gRealTime->isrHardwareTimer.beginCount;
+
+	gRealTime->ArmISRTimer(gTimer[4], 10000);
+	MTestCheck(gRealTime->isrHardwareTimer.beginCount == beginCount + 1);
+	MTestCheck(gRealTime->isrHardwareTimer.periodUS == 10000);
+	AdvanceUS(10000);
+	gRealTime->ISRTimerInterrupt();
+	MTestCheck(gFireCount[4] == 1);
+	MTestCheck(gRealTime->isrHardwareTimer.periodUS == 1940000);
+	AdvanceUS(1940000);
+	gRealTime->ISRTimerInterrupt();
+	MTestCheck(gFireCount[3] == 1);
+	MTestCheck(!gRealTime->isrHardwareRunning);
+
+	// A deadline beyond the longest hardware period is reached by waking early and programming the next step
+	gRealTime->ArmISRTimer(gTimer[5], 300000000);
+	MTestCheck(gRealTime->isrHardwareRunning && gRealTime->isrHardwareTimer.periodUS == eRealTime_MaxISRHardwarePeriodUS);
+	for(int i = 0; i < 4; ++i)
+	{
+		AdvanceUS(eRealTime_MaxISRHardwarePeriodUS);
+		gRealTime->ISRTimerInterrupt();
+		MTestCheck(gFireCount[5] == 0);
+		MTestCheck(gRealTime->isrHardwareRunning && gRealTime->isrHardwareTimer.periodUS <= eRealTime_MaxISRHardwarePeriodUS);
+	}
+	AdvanceUS(eRealTime_MaxISRHardwarePeriodUS);
+	gRealTime->ISRTimerInterrupt();
+	MTestCheck(gFireCount[5] == 1);
+
+	// When begin() fails the timer is stopped and the main loop fires the due timers
+	gSimulatorIntervalTimerFull = true;
+	gRealTime->ArmISRTimer(gTimer[0], 5000);
+	MTestCheck(!gRealTime->isrHardwareRunning && !gRealTime->isrHardwareTimer.running);
+	TestRunLoop(1100, 1000);
+	MTestCheck(gFireCount[0] == 2);
+	gSimulatorIntervalTimerFull = false;
+
+	return TestFinish("TestISRTimer");
+}
@@ -0,0 +1,170 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the loop budget monitor: a pass that goes over the budget is recorded with the module that took the longest
+	and, when the time went to a realtime event or a command, the name of that handler
+*/
+
+#include "HostTest.h"
+#include <ELRealTime.h>
+
+enum
+{
+	eLoopBudgetUS = 2000,
+};
+
+static uint32_t	gSlowUpdateUS;
+static bool		gRunSlowCommand;
+
+class CTestModuleSlow : public CModule, public IRealTimeHandler, public ICmdHandler
+{
+public:
+
+	MModule_Declaration(CTestModuleSlow)
+
+private:
+
+	CTestModuleSlow(
+		)
+		:
+		CModule(0, 0, NULL, 1000)
+	{
+		CModule_RealTime::Include();
+	}
+
+	virtual void
+	Setup(
+		void)
+	{
+		slowEvent = MRealTimeCreateEvent("slow_event", CTestModuleSlow::SlowEvent, NULL);
+		MCommandRegister("slow_cmd", CTestModuleSlow::SlowCommand, "");
+	}
+
+	virtual void
+	Update(
+		uint32_t	inDeltaTimeUS)
+	{
+		gSimulatorUS += gSlowUpdateUS;
+
+		if(gRunSlowCommand)
+		{
+			CTestOutput	output;
+
+			gRunSlowCommand = false;
+			TestCommand(&output, "slow_cmd");
+		}
+	}
+
+	void
+	SlowEvent(
+		TRealTimeEventRef	inEventRef,
+		void*				inRefCon)
+	{
+		gSimulatorUS += 9000;
+	}
+
+	uint8_t
+	SlowCommand(
+		IOutputDirector*	inOutput,
+		int					inArgC,
+		char const*			inArgV[])
+	{
+		gSimulatorUS += 5000;
+		return eCmd_Succeeded;
+	}
+
+public:
+
+	TRealTimeEventRef	slowEvent;
+};
+
+MModuleImplementation_Start(CTestModuleSlow)
+MModuleImplementation_Finish(CTestModuleSlow)
+
+static CTestModuleSlow*	gSlowModule;
+
+void
+setup(
+	void)
+{
+	gSlowModule = CTestModuleSlow::Include();
+	CModule::SetupAll("test", false);
+	CModule::SetLoopBudget(eLoopBudgetUS);
+}
+
+int
+main(
+	void)
+{
+	CTestOutput	output;
+
+	setup();
+
+	// Passes within the budget are not recorded
+	TestRunLoop(100, 100);
+	MTestCheck(TestCommand(&output, "loop_overruns") == eCmd_Succeeded);
+	MTestCheck(output.Contains("overruns=0"));
+
+	// A slow Update() names the module and no handler
+	gSlowUpdateUS = 3000;
+	TestRunLoop(20, 100);
+	gSlowUpdateUS = 0;
+	TestCommand(&output, "loop_overruns");
+	MTestCheck(output.Contains("module=CTestModuleSlow (3000 us) handler=(none)"));
+
+	// A slow event names the realtime module and the event
+	TestCommand(&output, "loop_overruns reset");
+	gRealTime->ScheduleEvent(gSlowModule->slowEvent, 5000, true);
+	TestRunLoop(1100, 1000);	// The realtime module updates once a second
+	TestCommand(&output, "loop_overruns");
+	MTestCheck(output.Contains("overruns=1"));
+	MTestCheck(output.Contains("module=CModule_RealTime"));
+	MTestCheck(output.Contains("handler=slow_event"));
+
+	// A slow command names the command and the module that processed it
+	TestCommand(&output, "loop_overruns reset");
+	gRunSlowCommand = true;
+	TestRunLoop(20, 100);
+	TestCommand(&output, "loop_overruns");
+	MTestCheck(output.Contains("overruns=1"));
+	MTestCheck(output.Contains("module=CTestModuleSlow (5000 us) handler=slow_cmd"));
+
+	// The ring keeps only the most recent incidents
+	TestCommand(&output, "loop_overruns reset");
+	gSlowUpdateUS = 3000;
+	TestRunLoop(4 * eLoopMonitor_MaxOverruns, 1000);
+	gSlowUpdateUS = 0;
+	TestCommand(&output, "loop_overruns");
+	uint32_t	listedCount = 0;
+	for(char const* cp = strstr(output.buffer, "pass="); cp != NULL; cp = strstr(cp + 1, "pass="))
+	{
+		++listedCount;
+	}
+	MTestCheck(listedCount == eLoopMonitor_MaxOverruns);
+
+	return TestFinish("TestLoopMonitor");
+}
@@ -0,0 +1,390 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Runs the NTP provider against simulated servers on a fake internet device: the provider may be created before
+	CModule::SetupAll(), the reply with the lowest delay sets the clock, and servers that time out or reply with a bad
+	packet are skipped
+
+	The simulated true time runs at the same rate as gSimulatorUS, the device clock starts out a few seconds wrong
+*/
+
+#include "HostTest.h"
+#include <ELRealTime.h>
+#include <ELInternet.h>
+
+enum
+{
+	eServerCount = 4,
+	eChannelCount = 4,
+	eServerPortBase = 1231,
+	eServerProcessingUS = 300,
+	eStepUS = 250,
+};
+
+#define MNTP_UnixEpoch	2208988800ULL
+
+static uint64_t const	cTrueEpochStartUS = 1600000000000000ULL;	// The true utc time when gSimulatorUS is 0
+static int64_t const	cInitialErrorUS = 3250000;					// The device clock starts this far ahead
+
+// How each simulated server behaves
+struct SServerModel
+{
+	uint32_t	outboundDelayUS;
+	uint32_t	returnDelayUS;
+	bool		replies;
+	uint8_t		stratum;
+};
+
+static SServerModel const	gServerModelList[eServerCount] =
+{
+	{40000, 40000, true, 2},	// Far away
+	{4000, 6000, true, 1},		// Close by with a slightly asymmetric route, this one should be used
+	{5000, 5000, false, 2},		// Never replies
+	{3000, 3000, true, 0},		// A kiss of death reply with stratum 0 must be rejected even though it is the fastest
+};
+
+static uint64_t
+GetTrueEpochUS(
+	void)
+{
+	return cTrueEpochStartUS + gSimulatorUS;
+}
+
+static void
+WriteNTPTimestamp(
+	uint8_t*	outTimestamp,
+	uint64_t	inEpochUS)
+{
+	uint32_t	secs = (uint32_t)(inEpochUS / 1000000 + MNTP_UnixEpoch);
+	uint32_t	fraction = (uint32_t)(((inEpochUS % 1000000) << 32) / 1000000);
+
+	for(int i = 0; i < 4; ++i)
+	{
+		outTimestamp[i] = (uint8_t)(secs >> (24 - i * 8));
+		outTimestamp[4 + i] = (uint8_t)(fraction >> (24 - i * 8));
+	}
+}
+
+// An internet device with only the udp side, it answers NTP requests from the server models after their delays
+class CTestNTPDevice : public IInternetDevice
+{
+public:
+
+	CTestNTPDevice(
+		)
+	{
+		memset(channelList, 0, sizeof(channelList));
+	}
+
+	virtual void
+	ConnectToAP(
+		char const*		inSSID,
+		char const*		inPassword,
+		EWirelessPWEnc	inPasswordEncryption)
+	{
+	}
+
+	virtual void
+	SetIPAddr(
+		uint32_t	inIPAddr,
+		uint32_t	inGatewayAddr,
+		uint32_t	inSubnetAddr)
+	{
+	}
+
+	virtual bool
+	Server_Open(
+		uint16_t	inServerPort)
+	{
+		return false;
+	}
+
+	virtual void
+	Server_Close(
+		uint16_t	inServerPort)
+	{
+	}
+
+	virtual int
+	TCPRequestOpen(
+		uint16_t	inRemoteServerPort,
+		char const*	inRemoteServerAddress)
+	{
+		return -1;
+	}
+
+	virtual bool
+	TCPCheckOpenCompleted(
+		int			inOpenRef,
+		bool&		outSuccess,
+		uint16_t&	outPort)
+	{
+		outSuccess = false;
+		return true;
+	}
+
+	virtual void
+	TCPGetData(
+		uint16_t&			outPort,
+		uint16_t&			outReplyPort,
+		SInternetPacket*&	outPacket)
+	{
+		outPacket = NULL;
+	}
+
+	virtual bool
+	TCPSendData(
+		uint16_t	inPort,
+		size_t		inBufferSize,
+		char const*	inBuffer,
+		size_t&		outBytesQueued,
+		bool		inFlush)
+	{
+		outBytesQueued = 0;
+		return false;
+	}
+
+	virtual uint32_t
+	TCPGetPortState(
+		uint16_t	inPort)
+	{
+		return 0;
+	}
+
+	virtual void
+	TCPCloseConnection(
+		uint16_t	inPort)
+	{
+	}
+
+	virtual int
+	UDPOpenChannel(
+		uint16_t	inLocalPort,
+		uint16_t	inRemoteServerPort,
+		char const*	inRemoteServerAddress)
+	{
+		for(int i = 0; i < eChannelCount; ++i)
+		{
+			if(!channelList[i].open)
+			{
+				channelList[i].open = true;
+				channelList[i].remotePort = inRemoteServerPort;
+				channelList[i].replyPending = false;
+				return i;
+			}
+		}
+
+		return -1;
+	}
+
+	virtual bool
+	UDPChannelReady(
+		int	inChannel)
+	{
+		return true;
+	}
+
+	virtual bool
+	UDPGetData(
+		int					inChannel,
+		SInternetPacket*&	outPacket)
+	{
+		SChannel*	channel = channelList + inChannel;
+
+		if(!channel->replyPending || gSimulatorUS < channel->replyDueUS)
+		{
+			return false;
+		}
+
+		outPacket = gInternetPacketPool.Allocate();
+		MTestCheck(outPacket != NULL);
+		if(outPacket == NULL)
+		{
+			return false;
+		}
+
+		channel->replyPending = false;
+		memcpy(outPacket->data, channel->reply, sizeof(channel->reply));
+		outPacket->size = sizeof(channel->reply);
+		outPacket->remoteAddress = 0x7F000001;
+		outPacket->remotePort = channel->remotePort;
+
+		return true;
+	}
+
+	virtual bool
+	UDPSendData(
+		int			inChannel,
+		size_t		inBufferSize,
+		void*		inBuffer,
+		char const*	inRemoteAddress,
+		uint16_t	inRemotePort)
+	{
+		int	serverIndex = inRemotePort - eServerPortBase;
+		MTestCheck(serverIndex >= 0 && serverIndex < eServerCount && inBufferSize == 48);
+
+		SChannel*			channel = channelList + inChannel;
+		SServerModel const*	server = gServerModelList + serverIndex;
+		uint8_t const*		request = (uint8_t const*)inBuffer;
+
+		++requestCount[serverIndex];
+		if(!server->replies)
+		{
+			return true;
+		}
+
+		// The server stamps T2 when the request arrives and T3 when the reply leaves, both on the true clock
+		uint64_t	receiveUS = GetTrueEpochUS() + server->outboundDelayUS;
+
+		memset(channel->reply, 0, sizeof(channel->reply));
+		channel->reply[0] = (4 << 3) | 4;	// No leap warning, version 4, server mode
+		channel->reply[1] = server->stratum;
+		memcpy(channel->reply + 24, request + 40, 8);
+		WriteNTPTimestamp(channel->reply + 32, receiveUS);
+		WriteNTPTimestamp(channel->reply + 40, receiveUS + eServerProcessingUS);
+		channel->replyPending = true;
+		channel->replyDueUS = gSimulatorUS + server->outboundDelayUS + eServerProcessingUS + server->returnDelayUS;
+
+		return true;
+	}
+
+	virtual void
+	UDPCloseChannel(
+		int	inChannel)
+	{
+		channelList[inChannel].open = false;
+		channelList[inChannel].replyPending = false;
+	}
+
+	virtual bool
+	ConnectedToInternet(
+		void)
+	{
+		return true;
+	}
+
+	virtual bool
+	IsDeviceTotallyFd(
+		void)
+	{
+		return false;
+	}
+
+	virtual void
+	ResetDevice(
+		void)
+	{
+	}
+
+	uint32_t	requestCount[eServerCount];
+
+private:
+
+	struct SChannel
+	{
+		bool		open;
+		bool		replyPending;
+		uint16_t	remotePort;
+		uint64_t	replyDueUS;
+		uint8_t		reply[48];
+	};
+
+	SChannel	channelList[eChannelCount];
+};
+
+static CTestNTPDevice	gDevice;
+
+static int64_t
+GetClockErrorUS(
+	void)
+{
+	return (int64_t)(gRealTime->GetEpochTimeUS(true) - GetTrueEpochUS());
+}
+
+void
+setup(
+	void)
+{
+	// The provider is created before the RealTime module exists
+	IRealTimeDataProvider*	provider = NULL;
+	for(int i = 0; i < eServerCount; ++i)
+	{
+		provider = CreateNTPProvider("127.0.0.1", eServerPortBase + i);
+	}
+
+	CModule_Internet::Include();
+	CModule_RealTime::Include();
+	gRealTime->Configure(NULL, provider, 3600);
+	gInternetModule->Configure(&gDevice);
+	CModule::SetupAll("test", false);
+
+	uint64_t	wrongUS = GetTrueEpochUS() + cInitialErrorUS;
+	gRealTime->SetEpochTimeUS(wrongUS, true, NULL, 1000);
+}
+
+int
+main(
+	void)
+{
+	setup();
+	MTestCheck(GetClockErrorUS() > cInitialErrorUS - 10000);
+
+	// The first round covers every server, the one that never replies takes the reply timeout
+	TestRunLoop(20 * 1000000 / eStepUS, eStepUS);
+
+	CTestOutput	output;
+	TestCommand(&output, "ntp_stats");
+	MTestCheck(output.Contains("rounds=1 syncs=1"));
+	for(int i = 0; i < eServerCount; ++i)
+	{
+		MTestCheck(gDevice.requestCount[i] == 1);
+	}
+	MTestCheck(output.Contains("127.0.0.1:1233 requests=1 replies=0 rejects=0 timeouts=1"));
+	MTestCheck(output.Contains("127.0.0.1:1234 requests=1 replies=0 rejects=1 timeouts=0"));
+
+	// The close server wins, its route is 2ms asymmetric so at best the clock is 1ms behind, the internet module picks up
+	// replies on its 10ms poll so T4 can be late by that much too, which is within the half round trip NTP promises
+	int64_t	errorUS = GetClockErrorUS();
+	printf("clock error after the first round %ld us\n", (long)errorUS);
+	MTestCheck(output.Contains("127.0.0.1:1232 requests=1 replies=1"));
+	MTestCheck(errorUS > -10000 && errorUS < 1000);
+
+	// Later rounds keep the clock there and back off the poll interval while it holds, run for an hour
+	TestRunLoop(1800000, 2000);
+	TestCommand(&output, "ntp_stats");
+	printf("%s", output.buffer);
+	unsigned	roundCount = 0;
+	unsigned	pollSecs = 0;
+	MTestCheck(sscanf(output.buffer, "rounds=%u syncs=%*u poll=%u", &roundCount, &pollSecs) == 2);
+	MTestCheck(roundCount > 3 && roundCount < 60);
+	MTestCheck(pollSecs > 64);
+	errorUS = GetClockErrorUS();
+	printf("clock error after an hour %ld us\n", (long)errorUS);
+	MTestCheck(errorUS > -10000 && errorUS < 1000);
+
+	return TestFinish("TestNTP");
+}
@@ -0,0 +1,190 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the RealTime alarm and event heaps: periodic and once only events fire on time, handlers can destroy or
+	reschedule their own event, alarms fire on their rule, and the cost of an update stays flat as timers are added
+*/
+
+#include "HostTest.h"
+#include <ELRealTime.h>
+
+enum
+{
+	eTestEventCount = 200,
+	eBenchPassCount = 100000,
+};
+
+static uint64_t const	cIdlePeriodUS = 1000000000000ULL;	// Long enough to never come due during the benchmark
+
+static uint32_t	gEventFireCount[eTestEventCount];
+static uint32_t	gOnceFireCount;
+static uint32_t	gAlarmFireCount;
+
+class CTestModuleTimers : public CModule, public IRealTimeHandler
+{
+public:
+
+	MModule_Declaration(CTestModuleTimers)
+
+	void
+	CreateTestTimers(
+		void)
+	{
+		for(int i = 0; i < eTestEventCount; ++i)
+		{
+			TRealTimeEventRef	eventRef = MRealTimeCreateEvent("periodic", CTestModuleTimers::PeriodicEvent, (void*)(intptr_t)i);
+			gRealTime->ScheduleEvent(eventRef, (uint64_t)(i + 1) * 1000000, false);
+		}
+
+		TRealTimeEventRef	onceRef = MRealTimeCreateEvent("once", CTestModuleTimers::OnceEvent, NULL);
+		gRealTime->ScheduleEvent(onceRef, 3000000, true);
+
+		TRealTimeAlarmRef	alarmRef = MRealTimeCreateAlarm("every_minute", CTestModuleTimers::MinuteAlarm, NULL);
+		gRealTime->ScheduleAlarm(alarmRef, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, 0);
+	}
+
+	void
+	CreateIdleEvents(
+		uint32_t	inCount)
+	{
+		for(uint32_t i = 0; i < inCount; ++i)
+		{
+			TRealTimeEventRef	eventRef = MRealTimeCreateEvent("idle", CTestModuleTimers::IdleEvent, NULL);
+			gRealTime->ScheduleEvent(eventRef, cIdlePeriodUS + i, false);
+		}
+	}
+
+private:
+
+	CTestModuleTimers(
+		)
+		:
+		CModule(0, 0, NULL, eUpdateTime_SignalOnly)
+	{
+		CModule_RealTime::Include();
+	}
+
+	void
+	PeriodicEvent(
+		TRealTimeEventRef	inEventRef,
+		void*				inRefCon)
+	{
+		int	eventIndex = (int)(intptr_t)inRefCon;
+
+		// Destroying the event from its own handler must be safe
+		if(++gEventFireCount[eventIndex] == 3 && eventIndex == 10)
+		{
+			gRealTime->DestroyEvent(inEventRef);
+		}
+	}
+
+	void
+	OnceEvent(
+		TRealTimeEventRef	inEventRef,
+		void*				inRefCon)
+	{
+		// A once only event can schedule itself again from its handler
+		if(++gOnceFireCount < 3)
+		{
+			gRealTime->ScheduleEvent(inEventRef, 2000000, true);
+		}
+	}
+
+	void
+	IdleEvent(
+		TRealTimeEventRef	inEventRef,
+		void*				inRefCon)
+	{
+		MTestCheck(false);
+	}
+
+	bool
+	MinuteAlarm(
+		TRealTimeAlarmRef	inAlarmRef,
+		void*				inRefCon)
+	{
+		++gAlarmFireCount;
+		return true;
+	}
+};
+
+MModuleImplementation_Start(CTestModuleTimers)
+MModuleImplementation_Finish(CTestModuleTimers)
+
+static CTestModuleTimers*	gModule;
+
+void
+setup(
+	void)
+{
+	gModule = CTestModuleTimers::Include();
+	CModule::SetupAll("test", false);
+	gRealTime->SetDateAndTime(2020, 1, 1, 0, 0, 30, true);
+}
+
+// Time a pass with the given number of idle timers registered, the test events from the first check keep firing as usual
+static void
+BenchUpdate(
+	uint32_t	inTimerCount,
+	uint32_t&	ioCurTimerCount)
+{
+	gModule->CreateIdleEvents(inTimerCount - ioCurTimerCount);
+	ioCurTimerCount = inTimerCount;
+
+	uint64_t	startUS = TestGetCPUTimeUS();
+	TestRunLoop(eBenchPassCount, 1000000);
+	uint64_t	benchUS = TestGetCPUTimeUS() - startUS;
+
+	printf("BENCH: realtime pass with %u timers %.1f ns\n", inTimerCount, benchUS * 1000.0 / eBenchPassCount);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	// Ten minutes in 10ms steps
+	gModule->CreateTestTimers();
+	TestRunLoop(60000, 10000);
+	MTestCheck(gEventFireCount[0] == 600);
+	MTestCheck(gEventFireCount[1] == 300);
+	MTestCheck(gEventFireCount[9] == 60);
+	MTestCheck(gEventFireCount[10] == 3);
+	MTestCheck(gEventFireCount[99] == 6);
+	MTestCheck(gEventFireCount[eTestEventCount - 1] == 3);
+	MTestCheck(gOnceFireCount == 3);
+	MTestCheck(gAlarmFireCount == 10);
+
+	// The dispatch cost should not grow with the number of registered timers
+	uint32_t	curTimerCount = 0;
+	BenchUpdate(10, curTimerCount);
+	BenchUpdate(100, curTimerCount);
+	BenchUpdate(1000, curTimerCount);
+
+	return TestFinish("TestRealTimeTimers");
+}
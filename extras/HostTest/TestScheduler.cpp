@@ -0,0 +1,231 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the deadline ordered schedule in CModule::LoopAll(): modules run in deadline order with ties broken by
+	include order, a pass with nothing due runs nothing, and a stalled loop does not cause a burst of catch up updates
+*/
+
+#include "HostTest.h"
+
+enum
+{
+	eIdleModuleCount = 24,
+	eBenchPassCount = 200000,
+};
+
+static char		gUpdateLog[1024];
+static uint64_t	gLogStartUS;
+static uint32_t	gUpdateCount;
+static uint32_t	gSlowUpdateUS;
+
+static void
+LogUpdate(
+	char const*	inName)
+{
+	size_t	curLength = strlen(gUpdateLog);
+
+	snprintf(gUpdateLog + curLength, sizeof(gUpdateLog) - curLength, "%s@%lu ", inName, (unsigned long)(gCurLocalUS - gLogStartUS));
+	++gUpdateCount;
+}
+
+static void
+ClearLog(
+	void)
+{
+	gUpdateLog[0] = 0;
+	gUpdateCount = 0;
+}
+
+class CTestModuleA : public CModule
+{
+public:
+
+	MModule_Declaration(CTestModuleA)
+
+private:
+
+	CTestModuleA(
+		)
+		:
+		CModule(0, 0, NULL, 1000)
+	{
+	}
+
+	virtual void
+	Update(
+		uint32_t	inDeltaTimeUS)
+	{
+		LogUpdate("A");
+		gSimulatorUS += gSlowUpdateUS;
+	}
+};
+
+class CTestModuleB : public CModule
+{
+public:
+
+	MModule_Declaration(CTestModuleB)
+
+private:
+
+	CTestModuleB(
+		)
+		:
+		CModule(0, 0, NULL, 2500)
+	{
+	}
+
+	virtual void
+	Update(
+		uint32_t	inDeltaTimeUS)
+	{
+		LogUpdate("B");
+	}
+};
+
+class CTestModuleC : public CModule
+{
+public:
+
+	MModule_Declaration(CTestModuleC)
+
+private:
+
+	CTestModuleC(
+		)
+		:
+		CModule(0, 0, NULL, 1000)
+	{
+	}
+
+	virtual void
+	Update(
+		uint32_t	inDeltaTimeUS)
+	{
+		LogUpdate("C");
+	}
+};
+
+// Fills the module list for the benchmark, it is never due during the benchmark
+class CTestModuleIdle : public CModule
+{
+public:
+
+	MModule_Declaration(CTestModuleIdle)
+
+private:
+
+	CTestModuleIdle(
+		)
+		:
+		CModule(0, 0, NULL, 10000000)
+	{
+	}
+};
+
+MModuleImplementation_Start(CTestModuleA)
+MModuleImplementation_Finish(CTestModuleA)
+
+MModuleImplementation_Start(CTestModuleB)
+MModuleImplementation_Finish(CTestModuleB)
+
+MModuleImplementation_Start(CTestModuleC)
+MModuleImplementation_Finish(CTestModuleC)
+
+MModuleImplementation_Start(CTestModuleIdle)
+MModuleImplementation_Finish(CTestModuleIdle)
+
+static CTestModuleB*	gModuleB;
+
+void
+setup(
+	void)
+{
+	CTestModuleA::Include();
+	gModuleB = CTestModuleB::Include();
+	CTestModuleC::Include();
+	for(int i = 0; i < eIdleModuleCount; ++i)
+	{
+		CTestModuleIdle::Include();
+	}
+
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	// Dispatch order, equal deadlines run in include order
+	gLogStartUS = gCurLocalUS;
+	ClearLog();
+	TestRunLoop(50, 100);
+	MTestCheck(strcmp(gUpdateLog, "A@1000 C@1000 A@2000 C@2000 B@2500 A@3000 C@3000 A@4000 C@4000 A@5000 B@5000 C@5000 ") == 0);
+
+	// Nothing is due before 6000 so these passes must not update anything
+	ClearLog();
+	TestRunLoop(9, 100);
+	MTestCheck(gUpdateCount == 0);
+
+	// The clock is sampled once per pass so C sees the same time as A even though A took 300 us
+	ClearLog();
+	gSlowUpdateUS = 300;
+	TestRunLoop(1, 100);
+	gSlowUpdateUS = 0;
+	MTestCheck(strcmp(gUpdateLog, "A@6000 C@6000 ") == 0);
+
+	// A stalled loop runs each overdue module once rather than once per missed period
+	ClearLog();
+	TestRunLoop(1, 10000);
+	MTestCheck(gUpdateCount == 3);
+
+	// A disabled module is never updated until it is enabled again
+	ClearLog();
+	gModuleB->SetEnabledState(false);
+	TestRunLoop(100, 100);
+	MTestCheck(strchr(gUpdateLog, 'B') == NULL);
+	gModuleB->SetEnabledState(true);
+	ClearLog();
+	TestRunLoop(25, 100);
+	MTestCheck(strchr(gUpdateLog, 'B') != NULL);
+
+	// The cost of a pass with nothing due
+	TestRunLoop(1, 100);
+	ClearLog();
+	uint64_t	startUS = TestGetCPUTimeUS();
+	for(uint32_t i = 0; i < eBenchPassCount; ++i)
+	{
+		loop();
+	}
+	uint64_t	benchUS = TestGetCPUTimeUS() - startUS;
+	MTestCheck(gUpdateCount == 0);
+	printf("BENCH: scheduler idle pass %.1f ns with %d modules\n", benchUS * 1000.0 / eBenchPassCount, eIdleModuleCount + 7);
+
+	return TestFinish("TestScheduler");
+}
@@ -0,0 +1,125 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks module wakeups: a signal only module is updated once per Signal() and never otherwise, and a module watching
+	a serial port with SignalOnInput() is updated on the first pass after input arrives
+*/
+
+#include "HostTest.h"
+
+static uint32_t	gUpdateCount;
+static uint32_t	gCommandCount;
+
+class CTestModuleSignaled : public CModule, public ICmdHandler
+{
+public:
+
+	MModule_Declaration(CTestModuleSignaled)
+
+private:
+
+	CTestModuleSignaled(
+		)
+		:
+		CModule(0, 0, NULL, eUpdateTime_SignalOnly)
+	{
+		CModule_SerialCmdHandler::Include();
+	}
+
+	virtual void
+	Setup(
+		void)
+	{
+		MCommandRegister("test_cmd", CTestModuleSignaled::TestCommandHandler, "");
+	}
+
+	virtual void
+	Update(
+		uint32_t	inDeltaTimeUS)
+	{
+		++gUpdateCount;
+	}
+
+	uint8_t
+	TestCommandHandler(
+		IOutputDirector*	inOutput,
+		int					inArgC,
+		char const*			inArgV[])
+	{
+		++gCommandCount;
+		return eCmd_Succeeded;
+	}
+};
+
+MModuleImplementation_Start(CTestModuleSignaled)
+MModuleImplementation_Finish(CTestModuleSignaled)
+
+static CTestModuleSignaled*	gModule;
+
+void
+setup(
+	void)
+{
+	gModule = CTestModuleSignaled::Include();
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	// A signal only module is left alone until it is signaled
+	TestRunLoop(1000, 1000);
+	MTestCheck(gUpdateCount == 0);
+
+	// Signals before a pass are merged into one update on that pass
+	gModule->Signal();
+	gModule->Signal();
+	TestRunLoop(1, 10);
+	MTestCheck(gUpdateCount == 1);
+	TestRunLoop(100, 1000);
+	MTestCheck(gUpdateCount == 1);
+
+	// The serial command handler is signal only and watches the console, a command is processed on the next pass
+	Serial.QueueInput("test_cmd\n");
+	TestRunLoop(1, 10);
+	MTestCheck(gCommandCount == 1);
+	TestRunLoop(1000, 1000);
+	MTestCheck(gCommandCount == 1);
+
+	// Input longer than one read is drained over the following passes
+	for(int i = 0; i < 20; ++i)
+	{
+		Serial.QueueInput("test_cmd\n");
+	}
+	TestRunLoop(3, 10);
+	MTestCheck(gCommandCount == 21);
+
+	return TestFinish("TestSignal");
+}
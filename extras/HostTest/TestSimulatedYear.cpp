@@ -0,0 +1,174 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Runs a year of outdoor lighting in simulated time: the local clock jumps from one module deadline to the next so
+	RealTime, SunRiseAndSet and OutdoorLightingControl see the whole year while the host only spends seconds on it
+*/
+
+#include "HostTest.h"
+#include <ELRealTime.h>
+#include <ELSunRiseAndSet.h>
+#include <ELOutdoorLightingControl.h>
+#include <ELDigitalIO.h>
+#include <ELInternet.h>
+
+enum
+{
+	eTestYear = 2021,
+	eTestDayCount = 365,
+	eTestSunriseToleranceSecs = 60,
+};
+
+static double const	cTestLongitude = -122.3;
+static double const	cTestLatitude = 47.6;
+
+class CTestLightingInterface : public IOutdoorLightingInterface
+{
+public:
+
+	virtual void
+	LEDStateChange(
+		bool	inLEDsOn)
+	{
+		++ledChangeCount;
+		ledsOn = inLEDsOn;
+	}
+
+	virtual void
+	MotionSensorStateChange(
+		bool	inMotionSensorTriggered)
+	{
+	}
+
+	virtual void
+	LuxSensorStateChange(
+		bool	inTriggered)
+	{
+	}
+
+	virtual void
+	PushButtonStateChange(
+		int	inToggleCount)
+	{
+	}
+
+	virtual void
+	TimeOfDayChange(
+		int	inTimeOfDay)
+	{
+		TEpochTime	curTime = gRealTime->GetEpochTime(false);
+
+		++timeOfDayCount[inTimeOfDay];
+
+		if(inTimeOfDay == eTimeOfDay_Day || inTimeOfDay == eTimeOfDay_Night)
+		{
+			// Each sunrise and sunset must come when SunRiseAndSet says it should on that day
+			int			year, month, day, dayOfWeek, hour, minute, second;
+			TEpochTime	sunriseTime, sunsetTime;
+
+			gRealTime->GetComponentsFromEpochTime(curTime, year, month, day, dayOfWeek, hour, minute, second);
+			gSunRiseAndSet->GetSunRiseAndSetEpochTime(sunriseTime, sunsetTime, year, month, day, false);
+
+			TEpochTime	expectedTime = inTimeOfDay == eTimeOfDay_Day ? sunriseTime : sunsetTime;
+
+			if(curTime < expectedTime || curTime > expectedTime + eTestSunriseToleranceSecs)
+			{
+				++lateCount;
+			}
+		}
+	}
+
+	void
+	Reset(
+		void)
+	{
+		memset(timeOfDayCount, 0, sizeof(timeOfDayCount));
+		ledChangeCount = 0;
+		lateCount = 0;
+	}
+
+	uint32_t	timeOfDayCount[3];
+	uint32_t	ledChangeCount;
+	uint32_t	lateCount;
+	bool		ledsOn;
+};
+
+static CTestLightingInterface	gInterface;
+
+void
+setup(
+	void)
+{
+	CModule_OutdoorLightingControl::Include(&gInterface, false, 0xFF, 5, 0xFF, NULL);
+	CModule::SetupAll("test", false);
+	gSunRiseAndSet->SetLongitudeAndLatitude(cTestLongitude, cTestLatitude);
+	gRealTime->SetDateAndTime(eTestYear - 1, 12, 31, 12, 0, 0);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	// Nothing here uses pins or the network, left enabled their 10ms polls would set the pace of the simulated clock
+	gDigitalIOModule->SetEnabledState(false);
+	gInternetModule->SetEnabledState(false);
+	CModule::SetSimulatedTime(true);
+	gRealTime->SetDateAndTime(eTestYear, 1, 1, 0, 0, 0);
+	gInterface.Reset();
+
+	TEpochTime	endTime = gRealTime->GetEpochTimeFromComponents(eTestYear + 1, 1, 1, 0, 0, 30);
+	uint64_t	startLocalUS = gCurLocalUS;
+	uint64_t	startCPUUS = TestGetCPUTimeUS();
+	uint32_t	passCount = 0;
+
+	while(gRealTime->GetEpochTime(false) < endTime)
+	{
+		loop();
+		++passCount;
+	}
+
+	uint64_t	cpuUS = TestGetCPUTimeUS() - startCPUUS;
+	uint64_t	simulatedUS = gCurLocalUS - startLocalUS;
+
+	// Every day has one sunrise, one sunset and one late night alarm, the leds go on at sunset and off at late night
+	MTestCheck(gInterface.timeOfDayCount[eTimeOfDay_Day] == eTestDayCount);
+	MTestCheck(gInterface.timeOfDayCount[eTimeOfDay_Night] == eTestDayCount);
+	MTestCheck(gInterface.timeOfDayCount[eTimeOfDay_LateNight] == eTestDayCount);
+	MTestCheck(gInterface.ledChangeCount == 2 * eTestDayCount);
+	MTestCheck(gInterface.lateCount == 0);
+	MTestCheck(!gInterface.ledsOn);
+
+	// The clock only moves through module deadlines so the simulated year is the real year
+	MTestCheck(simulatedUS / 1000000 >= (uint64_t)eTestDayCount * 24 * 3600 - 2);
+	MTestCheck(simulatedUS / 1000000 <= (uint64_t)eTestDayCount * 24 * 3600 + 32);
+
+	printf("BENCH: simulated year of outdoor lighting in %.2f s, %u passes\n", cpuUS / 1000000.0, passCount);
+
+	return TestFinish("TestSimulatedYear");
+}
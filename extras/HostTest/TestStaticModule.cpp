@@ -0,0 +1,87 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks that a module in static storage keeps the Include() semantics of a heap module, each call constructs and
+	schedules a new instance
+*/
+
+#include "HostTest.h"
+
+static uint32_t	gUpdateCount;
+
+class CTestModuleStatic : public CModule
+{
+public:
+
+	MModule_Declaration(CTestModuleStatic)
+
+private:
+
+	CTestModuleStatic(
+		)
+		:
+		CModule(0, 0, NULL, 1000)
+	{
+	}
+
+	virtual void
+	Update(
+		uint32_t	inDeltaTimeUS)
+	{
+		++gUpdateCount;
+	}
+};
+
+MModuleImplementation_Start(CTestModuleStatic)
+MModuleImplementation_FinishStatic(CTestModuleStatic, 2)
+
+static CTestModuleStatic*	gFirstModule;
+static CTestModuleStatic*	gSecondModule;
+
+void
+setup(
+	void)
+{
+	gFirstModule = CTestModuleStatic::Include();
+	gSecondModule = CTestModuleStatic::Include();
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	MTestCheck(gFirstModule != gSecondModule);
+	MTestCheck(strcmp(gFirstModule->uid, "CTestModuleStatic") == 0);
+
+	TestRunLoop(10, 100);
+	MTestCheck(gUpdateCount == 2);
+
+	return TestFinish("TestStaticModule");
+}
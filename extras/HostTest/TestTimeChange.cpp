@@ -0,0 +1,267 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	Checks the time change fan out with far more handlers than the old fixed table held: every handler hears every
+	change once, registering a name again replaces it, a handler can cancel itself from its callback, alarms are
+	moved to the new time before the handlers run, and a provider offset that is slewed out is not a change
+*/
+
+#define private public
+#include "HostTest.h"
+#include <ELRealTime.h>
+
+enum
+{
+	eTestHandlerCount = 48,
+	eTestSelfCancelIndex = 5,
+};
+
+static uint32_t	gChangeCount[eTestHandlerCount];
+static uint32_t	gTimeZoneChangeCount;
+static uint32_t	gAlarmFireCount;
+static int		gAlarmHour;
+
+class CTestModuleTimeChange : public CModule, public IRealTimeHandler
+{
+public:
+
+	MModule_Declaration(CTestModuleTimeChange)
+
+	void
+	RegisterHandlers(
+		void)
+	{
+		for(int i = 0; i < eTestHandlerCount; ++i)
+		{
+			snprintf(handlerName[i], sizeof(handlerName[i]), "tc%02d", i);
+			MRealTimeRegisterTimeChange(handlerNode[i], handlerName[i], CTestModuleTimeChange::TimeChange);
+		}
+	}
+
+	void
+	RegisterAgain(
+		int	inIndex)
+	{
+		MRealTimeRegisterTimeChange(handlerNode[inIndex], handlerName[inIndex], CTestModuleTimeChange::TimeChange);
+	}
+
+	void
+	ScheduleNoonAlarm(
+		void)
+	{
+		TRealTimeAlarmRef	alarmRef = MRealTimeCreateAlarm("noon", CTestModuleTimeChange::NoonAlarm, NULL);
+		gRealTime->ScheduleAlarm(alarmRef, eAlarm_Any, eAlarm_Any, eAlarm_Any, eAlarm_Any, 12, 0, 0);
+	}
+
+private:
+
+	CTestModuleTimeChange(
+		)
+		:
+		CModule(0, 0, NULL, eUpdateTime_SignalOnly)
+	{
+		CModule_RealTime::Include();
+	}
+
+	void
+	TimeChange(
+		char const*	inName,
+		bool		inTimeZone)
+	{
+		int	handlerIndex = atoi(inName + 2);
+
+		++gChangeCount[handlerIndex];
+		if(inTimeZone && handlerIndex == 0)
+		{
+			++gTimeZoneChangeCount;
+		}
+
+		if(handlerIndex == eTestSelfCancelIndex)
+		{
+			gRealTime->CancelTimeChangeHandler(inName);
+		}
+	}
+
+	bool
+	NoonAlarm(
+		TRealTimeAlarmRef	inAlarmRef,
+		void*				inRefCon)
+	{
+		int	year, month, dayOfMonth, dayOfWeek, minute, second;
+
+		gRealTime->GetComponentsFromEpochTime(gRealTime->GetEpochTime(false), year, month, dayOfMonth, dayOfWeek, gAlarmHour, minute, second);
+		++gAlarmFireCount;
+
+		return true;
+	}
+
+	STimeChangeHandler	handlerNode[eTestHandlerCount];
+	char				handlerName[eTestHandlerCount][8];
+};
+
+MModuleImplementation_Start(CTestModuleTimeChange)
+MModuleImplementation_Finish(CTestModuleTimeChange)
+
+// Stands in for a whole second source so its times are disciplined instead of always stepped
+class CTestProvider : public IRealTimeDataProvider
+{
+public:
+
+	virtual bool
+	SetUTCDateAndTime(
+		int	inYear,
+		int	inMonth,
+		int	inDayOfMonth,
+		int	inHour,
+		int	inMinute,
+		int	inSecond)
+	{
+		return true;
+	}
+
+	virtual bool
+	RequestSync(
+		void)
+	{
+		return false;
+	}
+};
+
+static CTestModuleTimeChange*	gModule;
+static CTestProvider			gProvider;
+
+void
+setup(
+	void)
+{
+	gModule = CTestModuleTimeChange::Include();
+	CModule::SetupAll("test", false);
+	gRealTime->SetDateAndTime(2020, 5, 1, 0, 0, 0);
+}
+
+// Every handler except the one that cancelled itself has heard inCount changes
+static bool
+AllHandlersCalled(
+	uint32_t	inCount)
+{
+	for(int i = 0; i < eTestHandlerCount; ++i)
+	{
+		if(gChangeCount[i] != (i == eTestSelfCancelIndex ? MMin(inCount, 1U) : inCount))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	// A time set by hand is the start of its second, only a provider's whole second time is moved to the middle
+	MTestCheck(gRealTime->GetEpochTimeUS(true) % 1000000 < 1000);
+
+	// Only a change of more than a second is passed on
+	gModule->RegisterHandlers();
+	gRealTime->SetDateAndTime(2020, 5, 1, 0, 0, 1);
+	MTestCheck(AllHandlersCalled(0));
+	gRealTime->SetDateAndTime(2020, 6, 1, 8, 0, 0);
+	MTestCheck(AllHandlersCalled(1));
+	MTestCheck(gTimeZoneChangeCount == 0);
+
+	// Registering a node again must not link it twice
+	gModule->RegisterAgain(3);
+	gModule->RegisterAgain(eTestHandlerCount - 1);
+	gRealTime->SetDateAndTime(2020, 6, 1, 10, 0, 0);
+	MTestCheck(AllHandlersCalled(2));
+
+	// A time zone change reaches every handler too
+	STimeZoneRule	zone;
+
+	memset(&zone, 0, sizeof(zone));
+	strcpy(zone.abbrev, "CET");
+	zone.dstStart.week = 0;
+	zone.dstStart.dayOfWeek = 1;
+	zone.dstStart.month = 3;
+	zone.dstStart.hour = 2;
+	zone.dstStart.offsetMins = 120;
+	zone.stdStart.week = 0;
+	zone.stdStart.dayOfWeek = 1;
+	zone.stdStart.month = 10;
+	zone.stdStart.hour = 3;
+	zone.stdStart.offsetMins = 60;
+	gRealTime->SetTimeZone(zone, false);
+	MTestCheck(AllHandlersCalled(3));
+	MTestCheck(gTimeZoneChangeCount == 1);
+
+	// Noon comes an hour after 11:00 local
+	gRealTime->SetDateAndTime(2020, 6, 1, 11, 0, 0, false);
+	MTestCheck(AllHandlersCalled(4));
+	gModule->ScheduleNoonAlarm();
+	TestRunLoop(3610, 1000000);
+	MTestCheck(gAlarmFireCount == 1 && gAlarmHour == 12);
+
+	// Setting the clock back to the morning brings today's noon back instead of waiting for tomorrow
+	gRealTime->SetDateAndTime(2020, 6, 1, 9, 0, 0, false);
+	MTestCheck(AllHandlersCalled(5));
+	TestRunLoop(3 * 3600 + 10, 1000000);
+	MTestCheck(gAlarmFireCount == 2 && gAlarmHour == 12);
+
+	// Moving the clock ahead past noon fires the missed alarm once straight away and the next one is tomorrow
+	gRealTime->SetDateAndTime(2020, 6, 2, 13, 0, 0, false);
+	TestRunLoop(10, 1000000);
+	MTestCheck(gAlarmFireCount == 3 && gAlarmHour == 13);
+	TestRunLoop(23 * 3600, 1000000);
+	MTestCheck(gAlarmFireCount == 4 && gAlarmHour == 12);
+
+	// Noon in the new zone is two hours after noon in CET summer time
+	zone.dstStart.offsetMins = 0;
+	zone.stdStart.offsetMins = 0;
+	strcpy(zone.abbrev, "UTC");
+	gRealTime->SetTimeZone(zone, false);
+	MTestCheck(gTimeZoneChangeCount == 2);
+	TestRunLoop(2 * 3600 - 20, 1000000);
+	MTestCheck(gAlarmFireCount == 4);
+	TestRunLoop(20, 1000000);
+	MTestCheck(gAlarmFireCount == 5 && gAlarmHour == 12);
+
+	// A provider offset that is slewed out is not a change even when the seconds move by more than one, one that is stepped is
+	uint32_t	changeCount = gChangeCount[0];
+	gRealTime->SetDateAndTime(2020, 6, 3, 0, 0, 0, true);
+	MTestCheck(gChangeCount[0] == changeCount + 1);
+	TestRunLoop(1, 600000);
+	gRealTime->SetEpochTimeUS(gRealTime->GetEpochTimeUS(true) + 1900000, true, &gProvider, 1000000);
+	MTestCheck(gRealTime->slewRemainingUS != 0);
+	MTestCheck(gChangeCount[0] == changeCount + 1);
+	gRealTime->SetEpochTimeUS(gRealTime->GetEpochTimeUS(true) + 60000000, true, &gProvider, 1000000);
+	MTestCheck(gChangeCount[0] == changeCount + 2);
+
+	return TestFinish("TestTimeChange");
+}
@@ -0,0 +1,192 @@
+/*
+	Author: Brent Pease (embeddedlibraryfeedback@gmail.com)
+
+	The MIT License (MIT)
+
+	Copyright (c) 2015-FOREVER Brent Pease
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+/*
+	ABOUT
+
+	Serves pages from the internet module's web server through the ESP8266 driver to a scripted device: a request
+	that comes in as an ipd goes back out as the whole page followed by a close, and a page too long for the packet
+	pool is cut short without taking the last packet so a request on another link is still served
+*/
+
+#define private public
+#include "HostTest.h"
+#include <ELRealTime.h>
+#include <ELInternet.h>
+#include <ELInternetDevice_ESP8266.h>
+#include "ESP8266Simulator.h"
+
+enum
+{
+	eStepUS = 1000,
+	eServePasses = 3000,
+	eSmallPageLines = 20,
+	eLargePageLines = 400,
+};
+
+class CTestPage : public IInternetHandler
+{
+public:
+
+	void
+	Page(
+		IOutputDirector*	inOutput,
+		int					inParamCount,
+		char const**		inParamList)
+	{
+		for(int i = 0; i < lineCount; ++i)
+		{
+			inOutput->printf("line %03d of the status page\n", i);
+		}
+
+		++pageCount;
+		minFreePackets = MMin(minFreePackets, gInternetPacketPool.GetFreeCount());
+	}
+
+	int			lineCount;
+	int			pageCount;
+	int			minFreePackets;
+};
+
+static CESP8266Simulator	gSerial;
+static CModule_ESP8266*		gESP8266;
+static CTestPage			gPage;
+static char const*			gRequest = "GET /status HTTP/1.1\r\nHost: 192.168.1.50\r\n\r\n";
+
+// Queue a request for the status page from a new client on inLink
+static void
+RequestPage(
+	int	inLink)
+{
+	gSerial.ClearReceived(inLink);
+	gSerial.closeCount[inLink] = 0;
+	gSerial.Reply("%d,CONNECT\r\n\r\n+IPD,%d,%d,192.168.1.20,50000:%s", inLink, inLink, (int)strlen(gRequest), gRequest);
+}
+
+// Return what inLink received as a string
+static char const*
+GetPage(
+	int	inLink)
+{
+	static char	page[eESP8266Simulator_MaxReceivedBytes + 1];
+
+	memcpy(page, gSerial.received[inLink], gSerial.receivedBytes[inLink]);
+	page[gSerial.receivedBytes[inLink]] = 0;
+
+	return page;
+}
+
+// True if inLink got the whole page of inLineCount lines and was closed after the last byte
+static bool
+GotWholePage(
+	int	inLink,
+	int	inLineCount)
+{
+	char const*	page = GetPage(inLink);
+	char const*	postOutput = "</code></body></html>";
+	size_t		pageBytes = strlen(page);
+	char		line[64];
+
+	if(strncmp(page, "HTTP/1.1 200 OK\r\n", 17) != 0)
+	{
+		return false;
+	}
+
+	for(int i = 0; i < inLineCount; ++i)
+	{
+		snprintf(line, sizeof(line), "line %03d of the status page</br>", i);
+		if(strstr(page, line) == NULL)
+		{
+			return false;
+		}
+	}
+
+	return pageBytes > strlen(postOutput) && strcmp(page + pageBytes - strlen(postOutput), postOutput) == 0
+		&& gSerial.closeCount[inLink] == 1 && gSerial.closedAtBytes[inLink] == gSerial.receivedBytes[inLink];
+}
+
+void
+setup(
+	void)
+{
+	CModule_RealTime::Include();
+	CModule_Internet::Include();
+	gESP8266 = CModule_ESP8266::Include(&gSerial, 0xFF);
+	gInternetModule->Configure(gESP8266);
+	gInternetModule->WebServer_Start(80);
+	gInternetModule->WebServer_RegisterPageHandler("/status", &gPage, static_cast<TInternetServerPageMethod>(&CTestPage::Page));
+	CModule::SetupAll("test", false);
+}
+
+int
+main(
+	void)
+{
+	setup();
+
+	gSerial.Reply("ready\r\n");
+	TestRunLoop(eServePasses, eStepUS);
+	MTestCheck(gSerial.SawCommand("AT+CIPSERVER=1,80\n"));
+
+	// A short page goes back whole and the link is closed behind it
+	uint32_t	sendCount = gSerial.sendCommandCount;
+	gPage.lineCount = eSmallPageLines;
+	gPage.minFreePackets = eInternetPacketPoolCount;
+	RequestPage(0);
+	TestRunLoop(eServePasses, eStepUS);
+	MTestCheck(gPage.pageCount == 1);
+	MTestCheck(GotWholePage(0, eSmallPageLines));
+	MTestCheck(gInternetPacketPool.GetFreeCount() == eInternetPacketPoolCount);
+
+	uint32_t	pageBytes = gSerial.receivedBytes[0];
+	uint32_t	pageSends = gSerial.sendCommandCount - sendCount;
+	MTestCheck(pageSends <= pageBytes / eMaxOutgoingPacketSize + 2);
+	printf("BENCH: web page of %u bytes in %u sends\n", pageBytes, pageSends);
+
+	// A page longer than the pool can hold is cut short but still closed, and the reply leaves a packet for
+	// incoming data so a request on another link while it drains is still served
+	gPage.lineCount = eLargePageLines;
+	gPage.minFreePackets = eInternetPacketPoolCount;
+	RequestPage(1);
+	for(int i = 0; i < eServePasses && gPage.pageCount < 2; ++i)
+	{
+		TestRunLoop(1, eStepUS);
+	}
+	MTestCheck(gPage.pageCount == 2);
+	MTestCheck(gPage.minFreePackets >= eInternetReceiveReservePackets);
+
+	gPage.lineCount = eSmallPageLines;
+	RequestPage(2);
+	TestRunLoop(eServePasses, eStepUS);
+	MTestCheck(gPage.pageCount == 3);
+	MTestCheck(GotWholePage(2, eSmallPageLines));
+	MTestCheck(!GotWholePage(1, eLargePageLines));
+	MTestCheck(strncmp(GetPage(1), "HTTP/1.1 200 OK\r\n", 17) == 0);
+	MTestCheck(gSerial.closeCount[1] == 1 && gSerial.closedAtBytes[1] == gSerial.receivedBytes[1]);
+	MTestCheck(gInternetPacketPool.GetFreeCount() == eInternetPacketPoolCount);
+
+	return TestFinish("TestWebServer");
+}